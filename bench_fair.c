@@ -0,0 +1,252 @@
+// Mixed load: interactive sessions typing next to bulk sessions pasting
+// as fast as the server takes it, against a running server.
+//
+// Bulk connections keep the server's receive path full with 100-byte
+// lines and read the echo back without looking at it. Interactive
+// connections send one short line (a unique token) at a time, at a steady
+// rate, and time it until its echo shows up. The report gives the echo
+// latency of the interactive lines and the bulk throughput, so the effect
+// of TELNET_FAIR_BYTES / TELNET_FAIR_LINES / TELNET_FAIR_MODE on the tail
+// of the interactive sessions can be compared.
+//
+// Usage: bench_fair [-a address] [-p port] [-b bulk] [-i interactive]
+//                   [-r lines per second] [-d seconds]
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define FAIR_BULK_CHUNK (64 * 1024)
+#define FAIR_LINE_LEN 100
+#define FAIR_WARMUP 0.5            // Seconds before the first interactive line
+#define FAIR_MAX_SAMPLES (1 << 20)
+
+typedef struct {
+    int fd;
+    int bulk;
+    double next_send;              // Interactive: when to type the next line
+    double sent_at;                // Interactive: 0 while no line is out
+    char token[24];                // Interactive: the line waiting for its echo
+    char tail[24];                 // Interactive: end of the previous receive
+    size_t tail_len;
+    size_t offset;                 // Bulk: position in the chunk
+    unsigned long long received;
+} fair_conn_t;
+
+static unsigned char bulk_chunk[FAIR_BULK_CHUNK];
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *label, double *times, int count) {
+    if (count == 0) {
+        printf("%-12s %8s\n", label, "-");
+        return;
+    }
+    qsort(times, count, sizeof(double), compare_double);
+    printf("%-12s %8d %10.2f %10.2f %10.2f %10.2f %10.2f\n", label, count,
+           times[count / 2] * 1e3, times[(int)(count * 0.9)] * 1e3, times[(int)(count * 0.99)] * 1e3,
+           times[(int)(count * 0.999)] * 1e3, times[count - 1] * 1e3);
+}
+
+// Whether the token shows up in what arrived, counting a token split
+// between two receives
+static int token_arrived(fair_conn_t *conn, const char *data, size_t len) {
+    size_t token_len = strlen(conn->token);
+    char joined[sizeof(conn->tail) * 2];
+    size_t head = len < token_len ? len : token_len;
+    memcpy(joined, conn->tail, conn->tail_len);
+    memcpy(joined + conn->tail_len, data, head);
+    int found = memmem(joined, conn->tail_len + head, conn->token, token_len) != NULL ||
+                memmem(data, len, conn->token, token_len) != NULL;
+
+    // Keep the end for the next receive
+    if (len >= token_len) {
+        memcpy(conn->tail, data + len - (token_len - 1), token_len - 1);
+        conn->tail_len = token_len - 1;
+    } else {
+        size_t total = conn->tail_len + len;
+        size_t keep = total < token_len - 1 ? total : token_len - 1;
+        memmove(joined, joined + total - keep, keep);
+        memcpy(conn->tail, joined, keep);
+        conn->tail_len = keep;
+    }
+    return found;
+}
+
+int main(int argc, char **argv) {
+    const char *address = "127.0.0.1";
+    int port = 9091;
+    int bulk_count = 8;
+    int interactive_count = 32;
+    double rate = 20.0;
+    double duration = 10.0;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:p:b:i:r:d:")) != -1) {
+        switch (opt) {
+        case 'a': address = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'b': bulk_count = atoi(optarg); break;
+        case 'i': interactive_count = atoi(optarg); break;
+        case 'r': rate = atof(optarg); break;
+        case 'd': duration = atof(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-a address] [-p port] [-b bulk] [-i interactive] "
+                            "[-r lines per second] [-d seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (rate <= 0 || bulk_count < 0 || interactive_count < 1) {
+        fprintf(stderr, "Need at least one interactive connection and a positive rate\n");
+        return 1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address: %s\n", address);
+        return 1;
+    }
+
+    for (size_t i = 0; i < FAIR_BULK_CHUNK; i++) {
+        bulk_chunk[i] = i % FAIR_LINE_LEN == FAIR_LINE_LEN - 2 ? '\r'
+                      : i % FAIR_LINE_LEN == FAIR_LINE_LEN - 1 ? '\n' : 'a' + i % 26;
+    }
+
+    int count = bulk_count + interactive_count;
+    fair_conn_t *conns = calloc(count, sizeof(fair_conn_t));
+    double *times = malloc(sizeof(double) * FAIR_MAX_SAMPLES);
+    int epoll_fd = epoll_create1(0);
+    if (conns == NULL || times == NULL || epoll_fd == -1) {
+        perror("setup");
+        return 1;
+    }
+
+    double start = now_sec();
+    for (int i = 0; i < count; i++) {
+        fair_conn_t *conn = &conns[i];
+        conn->bulk = i < bulk_count;
+        conn->fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (conn->fd == -1 || connect(conn->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+            perror("connect");
+            return 1;
+        }
+        int one = 1;
+        setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+        // Interactive lines start spread over one interval
+        conn->next_send = start + FAIR_WARMUP + (double)(i - bulk_count) / interactive_count / rate;
+        struct epoll_event event = { .events = EPOLLIN | (conn->bulk ? EPOLLOUT : 0), .data.u32 = (uint32_t)i };
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->fd, &event);
+    }
+
+    int samples = 0, lost = 0, closed = 0;
+    unsigned long long sequence = 0;
+    double end = start + FAIR_WARMUP + duration;
+    struct epoll_event events[256];
+    char buf[FAIR_BULK_CHUNK];
+    while (closed == 0) {
+        double now = now_sec();
+        if (now >= end) {
+            break;
+        }
+
+        // Type the lines that are due; a line still out is counted lost
+        double next = end;
+        for (int i = bulk_count; i < count; i++) {
+            fair_conn_t *conn = &conns[i];
+            if (now >= conn->next_send) {
+                if (conn->sent_at != 0) {
+                    lost++;
+                }
+                int len = snprintf(conn->token, sizeof(conn->token), "i%llux", ++sequence);
+                char line[32];
+                memcpy(line, conn->token, len);
+                memcpy(line + len, "\r\n", 2);
+                if (send(conn->fd, line, len + 2, 0) == len + 2) {
+                    conn->sent_at = now;
+                } else {
+                    conn->sent_at = 0;
+                }
+                conn->next_send += 1.0 / rate;
+            }
+            if (conn->next_send < next) {
+                next = conn->next_send;
+            }
+        }
+
+        int timeout = (int)((next - now) * 1e3);
+        int n = epoll_wait(epoll_fd, events, 256, timeout > 0 ? timeout : 0);
+        now = now_sec();
+        for (int e = 0; e < n; e++) {
+            fair_conn_t *conn = &conns[events[e].data.u32];
+            if (events[e].events & (EPOLLERR | EPOLLHUP)) {
+                closed++;
+                continue;
+            }
+            if (events[e].events & EPOLLOUT) {
+                ssize_t sent = send(conn->fd, bulk_chunk + conn->offset, FAIR_BULK_CHUNK - conn->offset, 0);
+                if (sent > 0) {
+                    conn->offset = (conn->offset + (size_t)sent) % FAIR_BULK_CHUNK;
+                }
+            }
+            if (events[e].events & EPOLLIN) {
+                ssize_t got = recv(conn->fd, buf, sizeof(buf), 0);
+                if (got == 0 || (got == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    closed++;
+                    continue;
+                }
+                if (got > 0) {
+                    conn->received += (unsigned long long)got;
+                    if (!conn->bulk && conn->sent_at != 0 && token_arrived(conn, buf, (size_t)got)) {
+                        if (samples < FAIR_MAX_SAMPLES) {
+                            times[samples++] = now - conn->sent_at;
+                        }
+                        conn->sent_at = 0;
+                        conn->tail_len = 0;
+                    }
+                }
+            }
+        }
+    }
+
+    unsigned long long bulk_bytes = 0;
+    for (int i = 0; i < bulk_count; i++) {
+        bulk_bytes += conns[i].received;
+    }
+    printf("%d bulk and %d interactive connections to %s:%d, %.0f lines/s each, %.1f s\n",
+           bulk_count, interactive_count, address, port, rate, duration);
+    printf("bulk echo    %10.1f MB/s\n", bulk_bytes / duration / 1e6);
+    printf("%-12s %8s %10s %10s %10s %10s %10s\n", "echo ms", "count", "p50", "p90", "p99", "p99.9", "max");
+    report("interactive", times, samples);
+    printf("lines without an echo before the next one: %d, connections closed: %d\n", lost, closed);
+
+    for (int i = 0; i < count; i++) {
+        close(conns[i].fd);
+    }
+    close(epoll_fd);
+    free(conns);
+    free(times);
+    return closed > 0 ? 2 : 0;
+}
@@ -0,0 +1,678 @@
+// Microbenchmarks for the protocol helpers in telnet_proto.c
+//
+// Runs utf8_sequence_length, check_incomplete_utf8, find_line_ending,
+// telnet_option_frame, telnet_extract_data, utf8_validate (the selected
+// SIMD or scalar validator), CP949 <-> UTF-8 transcoding, display widths
+// and character-mode line editing over synthetic corpora and
+// reports ns/byte and ops/sec. With -b the results are compared against a
+// stored baseline and the run fails when any benchmark is slower than the
+// baseline by more than the threshold.
+//
+// The baseline holds each benchmark's cost relative to a reference kernel
+// (an FNV-1a hash of the ASCII corpus) timed right after each run, so
+// a faster, slower or busier host moves both alike and the baseline
+// carries over.
+//
+// Usage: bench_proto [-b baseline] [-w baseline] [-t percent] [-f filter]
+//        bench_proto -m baseline run...
+//   -b FILE   compare against FILE (exit 1 on regression)
+//   -w FILE   write the results to FILE as the new baseline
+//   -m FILE   write the median of the runs (files written with -w) to FILE
+//   -t PCT    allowed slowdown in percent (default 25, or $BENCH_THRESHOLD)
+//   -f TEXT   only run benchmarks whose name contains TEXT
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "char_width.h"
+#include "charset.h"
+#include "line_editor.h"
+#include "telnet_proto.h"
+#include "utf8_validate.h"
+
+#define CORPUS_SIZE (64 * 1024)
+#define RECV_SEGMENT 1023          // Matches recv(..., BUFFER_SIZE - 1)
+#define MIN_RUN_NS 10000000.0      // Each timed run lasts at least 10 ms
+#define REFERENCE_RUN_NS 2000000.0 // Reference run after each timed run
+#define REFERENCE_LANES 8
+#define REPETITIONS 21             // Best of N runs filters scheduler noise
+#define MAX_RESULTS 64
+#define DEFAULT_THRESHOLD 25.0
+#define MERGE_MAX 16               // Runs merged into one baseline
+#define CONFIRM_RUNS 5             // Times a regression is measured again before it counts
+#define CONFIRM_PAUSE_US 1000000   // Between those, to get past a busy stretch of the host
+
+typedef struct {
+    const char *name;
+    unsigned char *data;
+    int len;
+    int *segments;                 // Segment lengths, as recv() would deliver them
+    int segment_count;
+} corpus_t;
+
+// Returns the number of operations performed on the corpus
+typedef long (*bench_fn_t)(const corpus_t *corpus);
+
+typedef struct {
+    char name[64];
+    double ns_per_op;
+    double ns_per_byte;
+    double ops_per_sec;
+    double cost;                   // ns_per_op in reference ns/byte
+    bench_fn_t fn;                 // What was timed, to time it again
+    const corpus_t *corpus;
+} result_t;
+
+static volatile long sink;
+static unsigned int rng_state = 12345;
+
+static unsigned int next_random(void) {
+    rng_state = rng_state * 1103515245u + 12345u;
+    return (rng_state >> 16) & 0x7FFF;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// Fill the corpus by repeating a pattern, then split it into segments
+static void build_corpus(corpus_t *corpus, const char *name, const char *pattern,
+                         int pattern_len, int min_segment, int max_segment) {
+    corpus->name = name;
+    corpus->data = malloc(CORPUS_SIZE);
+    corpus->len = CORPUS_SIZE;
+    for (int i = 0; i < CORPUS_SIZE; i++) {
+        corpus->data[i] = (unsigned char)pattern[i % pattern_len];
+    }
+
+    corpus->segments = malloc(sizeof(int) * CORPUS_SIZE);
+    corpus->segment_count = 0;
+    int remaining = CORPUS_SIZE;
+    while (remaining > 0) {
+        int span = max_segment - min_segment + 1;
+        int seg = min_segment + (span > 1 ? (int)(next_random() % span) : 0);
+        if (seg > remaining) {
+            seg = remaining;
+        }
+        corpus->segments[corpus->segment_count++] = seg;
+        remaining -= seg;
+    }
+}
+
+// Random binary data where about one byte in eight is IAC, escaped as
+// IAC IAC, with option commands and subnegotiations mixed in
+static void build_iac_corpus(corpus_t *corpus) {
+    corpus->name = "iac_binary";
+    corpus->data = malloc(CORPUS_SIZE);
+    corpus->len = 0;
+    while (corpus->len < CORPUS_SIZE - 16) {
+        unsigned int r = next_random() % 64;
+        unsigned char *p = corpus->data + corpus->len;
+        if (r < 8) {
+            p[0] = IAC;
+            p[1] = IAC;
+            corpus->len += 2;
+        } else if (r == 8) {
+            p[0] = IAC;
+            p[1] = (unsigned char)(WILL + next_random() % 4);
+            p[2] = (unsigned char)(next_random() % 40);
+            corpus->len += 3;
+        } else if (r == 9) {
+            static const unsigned char sb[] = { IAC, SB, 24, 0, 'V', 'T', '1', '0', '0', IAC, SE };
+            memcpy(p, sb, sizeof(sb));
+            corpus->len += sizeof(sb);
+        } else {
+            unsigned char byte = (unsigned char)(next_random() & 0xFF);
+            p[0] = byte == IAC ? 0 : byte;
+            corpus->len += 1;
+        }
+    }
+
+    corpus->segments = malloc(sizeof(int) * CORPUS_SIZE);
+    corpus->segment_count = 0;
+    for (int pos = 0; pos < corpus->len; pos += RECV_SEGMENT) {
+        int seg = corpus->len - pos < RECV_SEGMENT ? corpus->len - pos : RECV_SEGMENT;
+        corpus->segments[corpus->segment_count++] = seg;
+    }
+}
+
+static long bench_utf8_sequence_length(const corpus_t *corpus) {
+    long total = 0;
+    for (int i = 0; i < corpus->len; i++) {
+        total += utf8_sequence_length(corpus->data[i]);
+    }
+    sink = total;
+    return corpus->len;
+}
+
+static long bench_check_incomplete_utf8(const corpus_t *corpus) {
+    long total = 0;
+    const unsigned char *p = corpus->data;
+    for (int s = 0; s < corpus->segment_count; s++) {
+        total += check_incomplete_utf8(p, corpus->segments[s]);
+        p += corpus->segments[s];
+    }
+    sink = total;
+    return corpus->segment_count;
+}
+
+static long bench_find_line_ending(const corpus_t *corpus) {
+    long ops = 0;
+    const unsigned char *p = corpus->data;
+    for (int s = 0; s < corpus->segment_count; s++) {
+        int len = corpus->segments[s];
+        int pos = 0;
+        int end;
+        while ((end = find_line_ending(p + pos, len - pos)) > 0) {
+            pos += end;
+            ops++;
+        }
+        ops++;
+        p += len;
+    }
+    sink = ops;
+    return ops;
+}
+
+static void count_option(void *ctx, unsigned char command, unsigned char option) {
+    (*(long *)ctx) += command + option;
+}
+
+static long bench_telnet_extract_data(const corpus_t *corpus) {
+    static unsigned char out[CORPUS_SIZE];
+    long options = 0;
+    long total = 0;
+    const unsigned char *p = corpus->data;
+    for (int s = 0; s < corpus->segment_count; s++) {
+        total += telnet_extract_data(p, corpus->segments[s], out, count_option, NULL, &options, NULL);
+        p += corpus->segments[s];
+    }
+    sink = total + options;
+    return corpus->segment_count;
+}
+
+static long bench_utf8_validate(const corpus_t *corpus) {
+    long total = 0;
+    const unsigned char *p = corpus->data;
+    for (int s = 0; s < corpus->segment_count; s++) {
+        total += utf8_validate(p, corpus->segments[s]);
+        p += corpus->segments[s];
+    }
+    sink = total;
+    return corpus->segment_count;
+}
+
+static long bench_telnet_escape_iov(const corpus_t *corpus) {
+    struct iovec iov[64];
+    long total = 0;
+    const unsigned char *p = corpus->data;
+    for (int s = 0; s < corpus->segment_count; s++) {
+        size_t done = 0;
+        while (done < (size_t)corpus->segments[s]) {
+            size_t consumed;
+            total += telnet_escape_iov(p + done, corpus->segments[s] - done, iov, 64, &consumed);
+            done += consumed;
+        }
+        p += corpus->segments[s];
+    }
+    sink = total;
+    return corpus->segment_count;
+}
+
+static const charset_t *bench_charset;
+
+static long bench_charset_decode(const corpus_t *corpus) {
+    static unsigned char out[CHARSET_DECODE_MAX(CORPUS_SIZE)];
+    charset_state_t state;
+    charset_session_init(&state, bench_charset);
+    long total = 0;
+    const unsigned char *p = corpus->data;
+    for (int s = 0; s < corpus->segment_count; s++) {
+        total += charset_decode(&state, p, corpus->segments[s], out);
+        p += corpus->segments[s];
+    }
+    sink = total;
+    return corpus->segment_count;
+}
+
+static long bench_charset_encode(const corpus_t *corpus) {
+    static unsigned char out[CHARSET_ENCODE_MAX(CORPUS_SIZE)];
+    long total = 0;
+    const unsigned char *p = corpus->data;
+    for (int s = 0; s < corpus->segment_count; s++) {
+        total += charset_encode(bench_charset, p, corpus->segments[s], out, sizeof(out));
+        p += corpus->segments[s];
+    }
+    sink = total;
+    return corpus->segment_count;
+}
+
+static long bench_telnet_option_frame(const corpus_t *corpus) {
+    unsigned char frame[3];
+    long total = 0;
+    long ops = corpus->len / 3;
+    for (long i = 0; i < ops; i++) {
+        total += telnet_option_frame(frame, (unsigned char)(WILL + (i & 3)), (unsigned char)i);
+        total += frame[2];
+    }
+    sink = total;
+    return ops;
+}
+
+static long bench_char_width_utf8(const corpus_t *corpus) {
+    size_t total = 0;
+    const unsigned char *p = corpus->data;
+    for (int s = 0; s < corpus->segment_count; s++) {
+        total += char_width_utf8(p, corpus->segments[s]);
+        p += corpus->segments[s];
+    }
+    sink = (long)total;
+    return corpus->segment_count;
+}
+
+// Type the corpus into a line editor, one key per byte and Enter at each
+// CR. With home, the cursor goes back to the start after the first
+// character of a line, so every further character is inserted mid-line.
+static long run_line_editor(const corpus_t *corpus, int home) {
+    static line_buffer_t out = { .limit = LINE_BUFFER_UNLIMITED };
+    line_editor_t editor;
+    line_editor_init(&editor, LINE_BUFFER_DEFAULT_LIMIT);
+    int line_start = 1;
+    long total = 0;
+    for (int i = 0; i < corpus->len; i++) {
+        unsigned char ch = corpus->data[i];
+        if (ch == '\r' || ch == '\n') {
+            if (ch == '\r') {
+                line_editor_commit(&editor);
+            }
+            line_start = 1;
+            continue;
+        }
+        line_editor_key(&editor, ch, &out);
+        if (home && line_start && editor.text.len > 0) {
+            line_editor_key(&editor, 1, &out);
+            line_start = 0;
+        }
+        total += (long)out.len;
+        out.len = 0;
+    }
+    line_editor_free(&editor);
+    sink = total;
+    return corpus->len;
+}
+
+static long bench_line_editor_append(const corpus_t *corpus) {
+    return run_line_editor(corpus, 0);
+}
+
+static long bench_line_editor_insert(const corpus_t *corpus) {
+    return run_line_editor(corpus, 1);
+}
+
+// Reference kernel: FNV-1a over eight interleaved lanes. The lanes are
+// independent, so like the kernels it is compared with it is bound by the
+// core's throughput rather than by one dependency chain, and it slows down
+// with them when the host is busy.
+static long bench_reference(const corpus_t *corpus) {
+    uint32_t lanes[REFERENCE_LANES];
+    for (int l = 0; l < REFERENCE_LANES; l++) {
+        lanes[l] = 2166136261u;
+    }
+    for (int i = 0; i + REFERENCE_LANES <= corpus->len; i += REFERENCE_LANES) {
+        for (int l = 0; l < REFERENCE_LANES; l++) {
+            lanes[l] = (lanes[l] ^ corpus->data[i + l]) * 16777619u;
+        }
+    }
+    uint32_t hash = 0;
+    for (int l = 0; l < REFERENCE_LANES; l++) {
+        hash ^= lanes[l];
+    }
+    sink = (long)hash;
+    return corpus->len;
+}
+
+// Iterations of fn that take about ns
+static int calibrate(bench_fn_t fn, const corpus_t *corpus, double ns) {
+    fn(corpus);
+    double start = now_ns();
+    fn(corpus);
+    double single = now_ns() - start;
+    return single > 0 ? (int)(ns / single) + 1 : 1;
+}
+
+static double time_runs(bench_fn_t fn, const corpus_t *corpus, int iterations) {
+    double start = now_ns();
+    for (int it = 0; it < iterations; it++) {
+        fn(corpus);
+    }
+    return (now_ns() - start) / iterations;
+}
+
+// The reference kernel and its best ns/byte over the whole run
+static const corpus_t *reference_corpus;
+static int reference_iterations;
+static double reference_ns;
+
+// Time fn over the corpus and fill in the rates (result->name is set by the
+// caller). Each run is followed by a shorter run of the reference kernel,
+// so the cost compares the two over the same stretch of time.
+static void run_benchmark(result_t *result, bench_fn_t fn, const corpus_t *corpus) {
+    // Calibrate the iteration count, then keep the best of N runs
+    long ops = fn(corpus);
+    int iterations = calibrate(fn, corpus, MIN_RUN_NS);
+
+    double best = 0;
+    double best_reference = 0;
+    for (int rep = 0; rep < REPETITIONS; rep++) {
+        double elapsed = time_runs(fn, corpus, iterations);
+        if (rep == 0 || elapsed < best) {
+            best = elapsed;
+        }
+        elapsed = time_runs(bench_reference, reference_corpus, reference_iterations);
+        if (rep == 0 || elapsed < best_reference) {
+            best_reference = elapsed;
+        }
+    }
+
+    double reference_per_byte = best_reference / (double)reference_corpus->len;
+    if (reference_ns == 0 || reference_per_byte < reference_ns) {
+        reference_ns = reference_per_byte;
+    }
+    result->ns_per_op = best / (double)ops;
+    result->ns_per_byte = best / (double)corpus->len;
+    result->ops_per_sec = (double)ops / (best / 1e9);
+    result->cost = result->ns_per_op / reference_per_byte;
+    result->fn = fn;
+    result->corpus = corpus;
+}
+
+static int load_baseline(const char *path, result_t *baseline, int max) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror("Failed to open baseline");
+        return -1;
+    }
+    int count = 0;
+    char line[256];
+    while (count < max && fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        if (sscanf(line, "%63s %lf", baseline[count].name, &baseline[count].cost) == 2) {
+            count++;
+        }
+    }
+    fclose(fp);
+    return count;
+}
+
+static int write_baseline(const char *path, const result_t *results, int count, int runs) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        perror("Failed to write baseline");
+        return -1;
+    }
+    fprintf(fp, "# bench_proto baseline: <benchmark> <ns per op / reference ns per byte>\n");
+    if (runs > 1) {
+        fprintf(fp, "# Median of %d runs; regenerate with 'make bench-baseline'.\n", runs);
+    } else {
+        fprintf(fp, "# Regenerate with 'make bench-baseline'.\n");
+    }
+    for (int i = 0; i < count; i++) {
+        fprintf(fp, "%s %.4f\n", results[i].name, results[i].cost);
+    }
+    fclose(fp);
+    return 0;
+}
+
+static int compare_cost(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Write the median cost of each benchmark over the runs in paths to path.
+// Speed changes between processes on a busy host, so a single run may be
+// an outlier either way.
+static int merge_baselines(const char *path, char **paths, int count) {
+    static result_t runs[MERGE_MAX][MAX_RESULTS];
+    int counts[MERGE_MAX];
+    if (count < 1 || count > MERGE_MAX) {
+        fprintf(stderr, "Merge 1 to %d runs\n", MERGE_MAX);
+        return 2;
+    }
+    for (int r = 0; r < count; r++) {
+        counts[r] = load_baseline(paths[r], runs[r], MAX_RESULTS);
+        if (counts[r] < 0) {
+            return 2;
+        }
+    }
+
+    result_t merged[MAX_RESULTS];
+    for (int i = 0; i < counts[0]; i++) {
+        double costs[MERGE_MAX];
+        int n = 0;
+        for (int r = 0; r < count; r++) {
+            for (int j = 0; j < counts[r]; j++) {
+                if (strcmp(runs[r][j].name, runs[0][i].name) == 0) {
+                    costs[n++] = runs[r][j].cost;
+                    break;
+                }
+            }
+        }
+        qsort(costs, n, sizeof(costs[0]), compare_cost);
+        merged[i] = runs[0][i];
+        merged[i].cost = costs[n / 2];
+    }
+    if (write_baseline(path, merged, counts[0], count) == -1) {
+        return 2;
+    }
+    printf("Baseline written to %s (median of %d runs)\n", path, count);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *baseline_path = NULL;
+    const char *write_path = NULL;
+    const char *merge_path = NULL;
+    const char *filter = NULL;
+    const char *env_threshold = getenv("BENCH_THRESHOLD");
+    double threshold = env_threshold != NULL ? atof(env_threshold) : DEFAULT_THRESHOLD;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:w:m:t:f:")) != -1) {
+        switch (opt) {
+        case 'b': baseline_path = optarg; break;
+        case 'w': write_path = optarg; break;
+        case 'm': merge_path = optarg; break;
+        case 't': threshold = atof(optarg); break;
+        case 'f': filter = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-b baseline] [-w baseline] [-t percent] [-f filter]\n"
+                    "       %s -m baseline run...\n", argv[0], argv[0]);
+            return 2;
+        }
+    }
+    if (merge_path != NULL) {
+        return merge_baselines(merge_path, argv + optind, argc - optind);
+    }
+
+    // Synthetic corpora
+    static const char ascii[] = "The quick brown fox jumps over the lazy dog 0123456789\r\n";
+    static const char korean[] = "\xec\x95\x88\xeb\x85\x95\xed\x95\x98\xec\x84\xb8\xec\x9a\x94 "
+                                 "\xed\x85\x94\xeb\x84\xb7 \xec\x97\x90\xec\xbd\x94 "
+                                 "\xec\x84\x9c\xeb\xb2\x84\xec\x9e\x85\xeb\x8b\x88\xeb\x8b\xa4\r\n";
+    static const char crnul[] = "line terminated by carriage return and nul\r\0";
+    static const char mixed[] = "ab\xed\x95\x9c\xea\xb8\x80 cd\r\n";
+
+    corpus_t corpora[5];
+    build_corpus(&corpora[0], "ascii", ascii, sizeof(ascii) - 1, RECV_SEGMENT, RECV_SEGMENT);
+    build_corpus(&corpora[1], "korean", korean, sizeof(korean) - 1, RECV_SEGMENT, RECV_SEGMENT);
+    build_iac_corpus(&corpora[2]);
+    build_corpus(&corpora[3], "crnul", crnul, sizeof(crnul) - 1, RECV_SEGMENT, RECV_SEGMENT);
+    build_corpus(&corpora[4], "fragments", mixed, sizeof(mixed) - 1, 1, 7);
+    int corpus_count = 5;
+
+    static const struct {
+        const char *name;
+        bench_fn_t fn;
+    } per_corpus[] = {
+        { "utf8_sequence_length", bench_utf8_sequence_length },
+        { "check_incomplete_utf8", bench_check_incomplete_utf8 },
+        { "find_line_ending", bench_find_line_ending },
+        { "telnet_extract_data", bench_telnet_extract_data },
+        { "utf8_validate", bench_utf8_validate },
+        { "telnet_escape_iov", bench_telnet_escape_iov },
+        { "char_width_utf8", bench_char_width_utf8 },
+        { "line_editor_append", bench_line_editor_append },
+        { "line_editor_insert", bench_line_editor_insert },
+    };
+
+    result_t results[MAX_RESULTS];
+    int result_count = 0;
+
+    reference_corpus = &corpora[0];
+    reference_iterations = calibrate(bench_reference, reference_corpus, REFERENCE_RUN_NS);
+
+    for (size_t f = 0; f < sizeof(per_corpus) / sizeof(per_corpus[0]); f++) {
+        for (int c = 0; c < corpus_count; c++) {
+            result_t *r = &results[result_count];
+            snprintf(r->name, sizeof(r->name), "%s.%s", per_corpus[f].name, corpora[c].name);
+            if (filter != NULL && strstr(r->name, filter) == NULL) {
+                continue;
+            }
+            run_benchmark(r, per_corpus[f].fn, &corpora[c]);
+            result_count++;
+        }
+    }
+
+    // CP949 transcoding: decoding pure ASCII must stay on the fast path
+    corpus_t cp949;
+    if (charset_init(0) != NULL && (bench_charset = charset_find("CP949")) != NULL) {
+        cp949.name = "cp949";
+        cp949.data = malloc(CORPUS_SIZE);
+        cp949.len = (int)charset_encode(bench_charset, corpora[1].data, corpora[1].len, cp949.data, CORPUS_SIZE);
+        cp949.segments = malloc(sizeof(int) * (CORPUS_SIZE / RECV_SEGMENT + 1));
+        cp949.segment_count = 0;
+        for (int pos = 0; pos < cp949.len; pos += RECV_SEGMENT) {
+            cp949.segments[cp949.segment_count++] =
+                cp949.len - pos < RECV_SEGMENT ? cp949.len - pos : RECV_SEGMENT;
+        }
+
+        const struct {
+            const char *name;
+            bench_fn_t fn;
+            const corpus_t *corpus;
+        } transcode[] = {
+            { "charset_decode.ascii", bench_charset_decode, &corpora[0] },
+            { "charset_decode.cp949", bench_charset_decode, &cp949 },
+            { "charset_encode.ascii", bench_charset_encode, &corpora[0] },
+            { "charset_encode.korean", bench_charset_encode, &corpora[1] },
+        };
+        for (size_t t = 0; t < sizeof(transcode) / sizeof(transcode[0]); t++) {
+            result_t *r = &results[result_count];
+            snprintf(r->name, sizeof(r->name), "%s", transcode[t].name);
+            if (filter != NULL && strstr(r->name, filter) == NULL) {
+                continue;
+            }
+            run_benchmark(r, transcode[t].fn, transcode[t].corpus);
+            result_count++;
+        }
+    }
+    if (filter == NULL || strstr("telnet_option_frame", filter) != NULL) {
+        // Frames 3 bytes per op; sized like the corpora for a comparable ns/byte
+        result_t *r = &results[result_count];
+        snprintf(r->name, sizeof(r->name), "telnet_option_frame");
+        run_benchmark(r, bench_telnet_option_frame, &corpora[0]);
+        result_count++;
+    }
+
+    result_t baseline[MAX_RESULTS];
+    int baseline_count = 0;
+    if (baseline_path != NULL) {
+        baseline_count = load_baseline(baseline_path, baseline, MAX_RESULTS);
+        if (baseline_count < 0) {
+            return 2;
+        }
+    }
+
+    // A slow result is timed again on a copy of its corpus at another
+    // address, in passes a second apart after the whole run, keeping the
+    // best. A stretch of load on the host or an unlucky placement in memory
+    // then does not count as a regression.
+    const result_t *bases[MAX_RESULTS];
+    double deltas[MAX_RESULTS];
+    for (int i = 0; i < result_count; i++) {
+        bases[i] = NULL;
+        for (int b = 0; b < baseline_count; b++) {
+            if (strcmp(baseline[b].name, results[i].name) == 0 && baseline[b].cost > 0) {
+                bases[i] = &baseline[b];
+                break;
+            }
+        }
+        deltas[i] = bases[i] != NULL ? (results[i].cost / bases[i]->cost - 1.0) * 100.0 : 0;
+    }
+    for (int pass = 0; pass < CONFIRM_RUNS; pass++) {
+        int slow = 0;
+        for (int i = 0; i < result_count; i++) {
+            slow += deltas[i] > threshold;
+        }
+        if (slow == 0) {
+            break;
+        }
+        usleep(CONFIRM_PAUSE_US);
+        for (int i = 0; i < result_count; i++) {
+            if (deltas[i] <= threshold) {
+                continue;
+            }
+            result_t *r = &results[i];
+            corpus_t copy = *r->corpus;
+            unsigned char *block = malloc((size_t)copy.len + 4096);
+            copy.data = block + 64 * (pass + 1);
+            memcpy(copy.data, r->corpus->data, (size_t)copy.len);
+            result_t again;
+            run_benchmark(&again, r->fn, &copy);
+            free(block);
+            if (again.cost < r->cost) {
+                memcpy(again.name, r->name, sizeof(again.name));
+                again.corpus = r->corpus;
+                *r = again;
+                deltas[i] = (r->cost / bases[i]->cost - 1.0) * 100.0;
+            }
+        }
+    }
+
+    int regressions = 0;
+    printf("%-36s %12s %14s %12s %10s\n", "benchmark", "ns/byte", "ops/sec", "ns/op", "vs base");
+    printf("%-36s %12.4f %14s %12s %10s\n", "reference (fnv1a.ascii)", reference_ns, "-", "-", "-");
+    for (int i = 0; i < result_count; i++) {
+        const result_t *r = &results[i];
+        printf("%-36s %12.4f %14.0f %12.4f", r->name, r->ns_per_byte, r->ops_per_sec, r->ns_per_op);
+        if (bases[i] == NULL) {
+            printf(" %10s\n", baseline_path != NULL ? "new" : "-");
+        } else if (deltas[i] > threshold) {
+            printf(" %+9.1f%%  REGRESSION\n", deltas[i]);
+            regressions++;
+        } else {
+            printf(" %+9.1f%%\n", deltas[i]);
+        }
+    }
+
+    if (write_path != NULL && write_baseline(write_path, results, result_count, 1) == 0) {
+        printf("\nBaseline written to %s\n", write_path);
+    }
+    if (baseline_path != NULL) {
+        if (regressions > 0) {
+            printf("\n%d benchmark(s) regressed by more than %.0f%%\n", regressions, threshold);
+            return 1;
+        }
+        printf("\nNo regressions beyond %.0f%%\n", threshold);
+    }
+    return 0;
+}
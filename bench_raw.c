@@ -0,0 +1,168 @@
+// Raw echo throughput: splice() versus the recv()/send() copy loop.
+//
+// Runs raw_echo_session() on one end of a loopback TCP connection while a
+// writer thread streams data into the other end and the main thread reads
+// the echo back, and reports GB/s (10^9 bytes per second) for each mode.
+//
+// Usage: bench_raw [-m megabytes] [-r repetitions]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "raw_echo.h"
+
+#define WRITE_CHUNK (64 * 1024)
+
+typedef struct {
+    int fd;
+    size_t total;
+} writer_t;
+
+typedef struct {
+    int fd;
+    raw_echo_config_t config;
+} echoer_t;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *writer_thread(void *arg) {
+    writer_t *writer = arg;
+    unsigned char *chunk = malloc(WRITE_CHUNK);
+    // Printable data without IAC, so the escape scan never stops early
+    for (int i = 0; i < WRITE_CHUNK; i++) {
+        chunk[i] = (unsigned char)('a' + i % 26);
+    }
+    size_t sent = 0;
+    while (sent < writer->total) {
+        size_t len = writer->total - sent < WRITE_CHUNK ? writer->total - sent : WRITE_CHUNK;
+        ssize_t n = send(writer->fd, chunk, len, 0);
+        if (n <= 0) {
+            break;
+        }
+        sent += (size_t)n;
+    }
+    shutdown(writer->fd, SHUT_WR);
+    free(chunk);
+    return NULL;
+}
+
+static void *echoer_thread(void *arg) {
+    echoer_t *echoer = arg;
+    transcript_session_t transcript = { 0 };
+    raw_echo_session(echoer->fd, &echoer->config, &transcript);
+    close(echoer->fd);
+    return NULL;
+}
+
+// Echo total bytes through one connection. Returns GB/s, or 0 on failure.
+static double run_once(int listen_fd, const struct sockaddr_in *addr, const raw_echo_config_t *config,
+                       size_t total) {
+    int client_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(client_fd, (const struct sockaddr *)addr, sizeof(*addr)) == -1) {
+        perror("connect");
+        close(client_fd);
+        return 0;
+    }
+    echoer_t echoer = { .fd = accept(listen_fd, NULL, NULL), .config = *config };
+    writer_t writer = { .fd = client_fd, .total = total };
+
+    double start = now_sec();
+    pthread_t echo_tid, write_tid;
+    pthread_create(&echo_tid, NULL, echoer_thread, &echoer);
+    pthread_create(&write_tid, NULL, writer_thread, &writer);
+
+    unsigned char *buffer = malloc(WRITE_CHUNK);
+    size_t received = 0;
+    ssize_t n;
+    while ((n = recv(client_fd, buffer, WRITE_CHUNK, 0)) > 0) {
+        received += (size_t)n;
+    }
+    double elapsed = now_sec() - start;
+
+    pthread_join(write_tid, NULL);
+    pthread_join(echo_tid, NULL);
+    close(client_fd);
+    free(buffer);
+
+    if (received != total) {
+        fprintf(stderr, "short echo: %zu of %zu bytes\n", received, total);
+        return 0;
+    }
+    return (double)total / elapsed / 1e9;
+}
+
+int main(int argc, char **argv) {
+    size_t megabytes = 1024;
+    int repetitions = 3;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:r:")) != -1) {
+        switch (opt) {
+        case 'm': megabytes = (size_t)atol(optarg); break;
+        case 'r': repetitions = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-m megabytes] [-r repetitions]\n", argv[0]);
+            return 1;
+        }
+    }
+    size_t total = megabytes * 1024 * 1024;
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(listen_fd, 4) == -1 ||
+        getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len) == -1) {
+        perror("listen");
+        return 1;
+    }
+
+    static const struct {
+        const char *name;
+        int splice;
+        int escape;
+    } modes[] = {
+        { "recv/send", 0, 0 },
+        { "splice", 1, 0 },
+        { "recv/send+escape", 0, 1 },
+        { "splice+escape", 1, 1 },
+    };
+
+    printf("%-20s %10s   (%zu MB per run, best of %d)\n", "mode", "GB/s", megabytes, repetitions);
+    double copy_rate = 0;
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        raw_echo_config_t config = { .port = 0, .splice = modes[m].splice, .escape = modes[m].escape };
+        double best = 0;
+        for (int r = 0; r < repetitions; r++) {
+            double rate = run_once(listen_fd, &addr, &config, total);
+            if (rate > best) {
+                best = rate;
+            }
+        }
+        if (m == 0) {
+            copy_rate = best;
+        }
+        if (m == 0 || copy_rate == 0) {
+            printf("%-20s %10.3f\n", modes[m].name, best);
+        } else {
+            printf("%-20s %10.3f   %+.1f%% vs recv/send\n", modes[m].name, best,
+                   (best / copy_rate - 1) * 100);
+        }
+    }
+
+    close(listen_fd);
+    return 0;
+}
@@ -0,0 +1,201 @@
+// Connection surge: open many connections to a running server at once, as
+// clients do when they all reconnect after a network blip.
+//
+// Every connection is started with a non-blocking connect() before any is
+// waited for. The report gives, per connection, the time until the
+// handshake completed and until the server's first byte (its negotiation
+// commands) arrived, which is when the server has really accepted and
+// started the session. Connections refused, reset or without a first byte
+// within the timeout count as failed.
+//
+// Usage: bench_surge [-a address] [-p port] [-n connections] [-t timeout seconds]
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define SURGE_DEFAULT_CONNECTIONS 20000
+#define SURGE_RESERVED_FDS 16
+
+typedef struct {
+    int fd;
+    double connected;              // Seconds after the start, 0 until then
+    double first_byte;
+    int failed;
+} surge_conn_t;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Print percentiles of the count values in times (sorted in place)
+static void report(const char *label, double *times, int count) {
+    if (count == 0) {
+        printf("%-12s %8s\n", label, "-");
+        return;
+    }
+    qsort(times, count, sizeof(double), compare_double);
+    printf("%-12s %8d %10.2f %10.2f %10.2f %10.2f\n", label, count,
+           times[count / 2] * 1e3, times[(int)(count * 0.9)] * 1e3,
+           times[(int)(count * 0.99)] * 1e3, times[count - 1] * 1e3);
+}
+
+int main(int argc, char **argv) {
+    const char *address = "127.0.0.1";
+    int port = 9091;
+    int count = SURGE_DEFAULT_CONNECTIONS;
+    double timeout = 30.0;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:p:n:t:")) != -1) {
+        switch (opt) {
+        case 'a': address = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'n': count = atoi(optarg); break;
+        case 't': timeout = atof(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-a address] [-p port] [-n connections] [-t timeout seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // One descriptor per connection
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if ((rlim_t)count + SURGE_RESERVED_FDS > limit.rlim_cur) {
+        int allowed = (int)limit.rlim_cur - SURGE_RESERVED_FDS;
+        fprintf(stderr, "Descriptor limit %llu: opening %d connections instead of %d\n",
+                (unsigned long long)limit.rlim_cur, allowed, count);
+        count = allowed;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address: %s\n", address);
+        return 1;
+    }
+
+    surge_conn_t *conns = calloc(count, sizeof(surge_conn_t));
+    double *times = malloc(sizeof(double) * count);
+    int epoll_fd = epoll_create1(0);
+    if (conns == NULL || times == NULL || epoll_fd == -1) {
+        perror("setup");
+        return 1;
+    }
+
+    // Start every handshake before waiting for any
+    double start = now_sec();
+    int opened = 0;
+    for (int i = 0; i < count; i++) {
+        conns[i].fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (conns[i].fd == -1) {
+            perror("socket");
+            break;
+        }
+        if (connect(conns[i].fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 && errno != EINPROGRESS) {
+            conns[i].failed = 1;
+        } else {
+            struct epoll_event event = { .events = EPOLLIN | EPOLLOUT, .data.u32 = (uint32_t)i };
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conns[i].fd, &event);
+        }
+        opened++;
+    }
+    double issued = now_sec() - start;
+
+    // Collect handshakes and first bytes until all are in or the timeout
+    int pending = 0;
+    for (int i = 0; i < opened; i++) {
+        pending += !conns[i].failed;
+    }
+    struct epoll_event events[256];
+    while (pending > 0 && now_sec() - start < timeout) {
+        int n = epoll_wait(epoll_fd, events, 256, 100);
+        double now = now_sec() - start;
+        for (int e = 0; e < n; e++) {
+            surge_conn_t *conn = &conns[events[e].data.u32];
+            int error = 0;
+            socklen_t error_len = sizeof(error);
+            getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &error_len);
+            if (error != 0 || (events[e].events & (EPOLLERR | EPOLLHUP))) {
+                conn->failed = 1;
+            } else {
+                if (conn->connected == 0 && (events[e].events & EPOLLOUT)) {
+                    conn->connected = now;
+                    // Only the first byte is still of interest
+                    struct epoll_event event = { .events = EPOLLIN, .data.u32 = events[e].data.u32 };
+                    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+                }
+                if (events[e].events & EPOLLIN) {
+                    char buf[512];
+                    ssize_t got = recv(conn->fd, buf, sizeof(buf), 0);
+                    if (got > 0) {
+                        if (conn->connected == 0) {
+                            conn->connected = now;
+                        }
+                        conn->first_byte = now;
+                    } else if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                        conn->failed = 1;
+                    }
+                }
+            }
+            if (conn->failed || conn->first_byte > 0) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+                pending--;
+            }
+        }
+    }
+
+    int failed = 0, timed_out = 0, samples = 0;
+    for (int i = 0; i < opened; i++) {
+        if (conns[i].failed) {
+            failed++;
+        } else if (conns[i].first_byte == 0) {
+            timed_out++;
+        }
+    }
+
+    printf("%d connections to %s:%d issued in %.1f ms\n", opened, address, port, issued * 1e3);
+    printf("%-12s %8s %10s %10s %10s %10s\n", "ms", "count", "p50", "p90", "p99", "max");
+    for (int i = 0; i < opened; i++) {
+        if (conns[i].connected > 0) {
+            times[samples++] = conns[i].connected;
+        }
+    }
+    report("handshake", times, samples);
+    samples = 0;
+    for (int i = 0; i < opened; i++) {
+        if (conns[i].first_byte > 0) {
+            times[samples++] = conns[i].first_byte;
+        }
+    }
+    report("first byte", times, samples);
+    printf("failed %d, no first byte within %.0f s: %d\n", failed, timeout, timed_out);
+
+    for (int i = 0; i < opened; i++) {
+        close(conns[i].fd);
+    }
+    close(epoll_fd);
+    free(conns);
+    free(times);
+    return failed + timed_out > 0 ? 2 : 0;
+}
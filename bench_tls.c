@@ -0,0 +1,210 @@
+// TLS cost against a running server: handshake rate with and without
+// session resumption, and bulk echo throughput over one connection.
+//
+// Each handshake connects, completes TLS, sends one byte and waits for the
+// server's first byte (the raw port echoes it, the telnet ports send their
+// negotiation commands), so a TLS 1.3 session ticket has arrived by then.
+// Resumed handshakes offer the ticket of the previous connection. The bulk
+// test needs an echoing port (the raw TLS port of line_mode_binary_server)
+// and checks that every byte came back.
+//
+// Run it against a server started with TELNET_TLS_KTLS=0 and =1 to compare
+// user-space encryption with kernel TLS; the server's admin port reports
+// how many sessions got kTLS (telnet_tls_ktls_send_total).
+//
+// Usage: bench_tls [-a address] [-p port] [-n handshakes] [-m bulk megabytes]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#define BENCH_TLS_DEFAULT_HANDSHAKES 1000
+#define BENCH_TLS_CHUNK (64 * 1024)
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_to(const struct sockaddr_in *addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Connect and complete TLS, offering session when it is not NULL.
+// Returns the connection, or NULL after printing the error.
+static SSL *tls_open(SSL_CTX *ctx, const struct sockaddr_in *addr, SSL_SESSION *session) {
+    int fd = connect_to(addr);
+    if (fd == -1) {
+        perror("connect");
+        return NULL;
+    }
+    SSL *ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, fd);
+    if (session != NULL) {
+        SSL_set_session(ssl, session);
+    }
+    if (SSL_connect(ssl) != 1) {
+        ERR_print_errors_fp(stderr);
+        SSL_free(ssl);
+        close(fd);
+        return NULL;
+    }
+    return ssl;
+}
+
+static void tls_close(SSL *ssl) {
+    int fd = SSL_get_fd(ssl);
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+    close(fd);
+}
+
+// One byte out, the server's first bytes back. Returns 0, or -1 on error.
+static int tls_first_byte(SSL *ssl) {
+    unsigned char buf[4096];
+    if (SSL_write(ssl, "\n", 1) != 1 || SSL_read(ssl, buf, sizeof(buf)) <= 0) {
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+    return 0;
+}
+
+// Run count handshakes and print their rate. With resume, each one offers
+// the session of the one before, starting with *session; without, the
+// session of the first one is kept in *session.
+static int bench_handshakes(SSL_CTX *ctx, const struct sockaddr_in *addr, int count,
+                            SSL_SESSION **session, int resume) {
+    int reused = 0;
+    double start = now_sec();
+    for (int i = 0; i < count; i++) {
+        SSL *ssl = tls_open(ctx, addr, resume ? *session : NULL);
+        if (ssl == NULL || tls_first_byte(ssl) == -1) {
+            return -1;
+        }
+        reused += SSL_session_reused(ssl);
+        if (resume || *session == NULL) {
+            // Like a real client, resume with the newest ticket
+            SSL_SESSION_free(*session);
+            *session = SSL_get1_session(ssl);
+        }
+        tls_close(ssl);
+    }
+    double elapsed = now_sec() - start;
+    printf("%-10s %8d %10.1f %10.3f %10d\n", resume ? "resumed" : "full", count,
+           count / elapsed, elapsed / count * 1e3, reused);
+    return 0;
+}
+
+// Echo megabytes through one connection, keeping one chunk in flight
+static int bench_bulk(SSL_CTX *ctx, const struct sockaddr_in *addr, int megabytes) {
+    SSL *ssl = tls_open(ctx, addr, NULL);
+    if (ssl == NULL) {
+        return -1;
+    }
+    static unsigned char out[BENCH_TLS_CHUNK];
+    static unsigned char in[BENCH_TLS_CHUNK];
+    for (size_t i = 0; i < sizeof(out); i++) {
+        out[i] = (unsigned char)(i * 7);
+    }
+
+    size_t total = (size_t)megabytes * 1024 * 1024;
+    size_t done = 0;
+    int result = 0;
+    double start = now_sec();
+    while (done < total && result == 0) {
+        if (SSL_write(ssl, out, sizeof(out)) != (int)sizeof(out)) {
+            result = -1;
+            break;
+        }
+        size_t got = 0;
+        while (got < sizeof(out)) {
+            int n = SSL_read(ssl, in + got, (int)(sizeof(in) - got));
+            if (n <= 0) {
+                result = -1;
+                break;
+            }
+            got += (size_t)n;
+        }
+        if (result == 0 && memcmp(in, out, sizeof(out)) != 0) {
+            fprintf(stderr, "Echo mismatch after %zu bytes\n", done);
+            result = -1;
+        }
+        done += got;
+    }
+    double elapsed = now_sec() - start;
+    if (result == 0) {
+        printf("bulk echo  %8d MB %9.1f MB/s (cipher %s)\n", megabytes,
+               done / elapsed / (1024 * 1024), SSL_get_cipher_name(ssl));
+    } else {
+        ERR_print_errors_fp(stderr);
+    }
+    tls_close(ssl);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    const char *address = "127.0.0.1";
+    int port = 9994;
+    int count = BENCH_TLS_DEFAULT_HANDSHAKES;
+    int megabytes = 256;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:p:n:m:")) != -1) {
+        switch (opt) {
+        case 'a': address = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'n': count = atoi(optarg); break;
+        case 'm': megabytes = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-a address] [-p port] [-n handshakes] [-m bulk megabytes]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Bad address %s\n", address);
+        return 1;
+    }
+
+    // The test certificate is self-signed: no verification
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT);
+
+    printf("TLS against %s:%d\n", address, port);
+    printf("%-10s %8s %10s %10s %10s\n", "handshake", "count", "per sec", "ms each", "resumed");
+    SSL_SESSION *session = NULL;
+    int result = bench_handshakes(ctx, &addr, count, &session, 0);
+    if (result == 0 && session != NULL) {
+        result = bench_handshakes(ctx, &addr, count, &session, 1);
+    }
+    if (result == 0 && megabytes > 0) {
+        result = bench_bulk(ctx, &addr, megabytes);
+    }
+
+    SSL_SESSION_free(session);
+    SSL_CTX_free(ctx);
+    return result == 0 ? 0 : 2;
+}
@@ -0,0 +1,453 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "char_session.h"
+#include "line_buffer.h"
+#include "line_editor.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "telnet_proto.h"
+#include "trace_probes.h"
+
+#ifndef DEBUG
+#define DEBUG 0
+#endif
+
+// Control characters
+#define CTRL_C 3
+#define CTRL_D 4
+
+static char_session_config_t config = {
+    .max_line = LINE_BUFFER_DEFAULT_LIMIT
+};
+
+// Telnet negotiation tracking
+typedef struct {
+    int echo_acked;
+    int sga_acked;
+    int ready_sent;
+} telnet_negotiation_t;
+
+// Everything a session keeps across suspensions
+typedef struct {
+    coro_t co;                 // First member: the state is the coroutine
+    telnet_negotiation_t negotiation;
+    charset_state_t charset;
+    line_editor_t editor;      // Line being typed, in UTF-8
+    line_buffer_t sb;          // Subnegotiation being received
+    int line_full;             // The client was told the line is full
+    unsigned char ch;          // Byte being handled
+    unsigned char cmd;         // Telnet command after IAC
+} char_session_t;
+
+// Line transcoded to a legacy client charset, shared by a worker's sessions
+static __thread line_buffer_t encoded = { .limit = LINE_BUFFER_UNLIMITED };
+
+// Screen update of the key being handled, in UTF-8
+static __thread line_buffer_t edit_output = { .limit = LINE_BUFFER_UNLIMITED };
+
+void char_session_configure(const char_session_config_t *settings) {
+    config = *settings;
+}
+
+static void send_telnet_option(coro_t *co, unsigned char command, unsigned char option) {
+    unsigned char buf[3];
+    int len = telnet_option_frame(buf, command, option);
+    coro_send(co, buf, len);
+}
+
+static void setup_charmode(coro_t *co, telnet_negotiation_t *negotiation) {
+    // Negotiate character mode (disable line mode)
+    send_telnet_option(co, DONT, LINEMODE);
+    send_telnet_option(co, WILL, ECHO);
+    // Many telnet clients don't explicitly respond to WILL, mark as acked
+    negotiation->echo_acked = 1;
+    send_telnet_option(co, WILL, SUPPRESS_GO_AHEAD);
+    send_telnet_option(co, DO, SUPPRESS_GO_AHEAD);
+    // The line editor fits the line to the client's width
+    send_telnet_option(co, DO, NAWS);
+
+    // Offer TTYPE and CHARSET so the client can select its charset
+    unsigned char offer[6];
+    int offer_len = charset_offer(offer, sizeof(offer));
+    if (offer_len > 0) {
+        coro_send(co, offer, offer_len);
+    }
+}
+
+// Answer a DO/DONT/WILL/WONT from the client
+static void handle_telnet_option(char_session_t *state, unsigned char cmd, unsigned char opt) {
+    coro_t *co = &state->co;
+    telnet_negotiation_t *negotiation = &state->negotiation;
+
+    // NAWS: WILL/WONT answer our DO
+    if (opt == NAWS) {
+        if (cmd == DO) {
+            send_telnet_option(co, WONT, opt);
+        }
+        return;
+    }
+
+    // TTYPE and CHARSET are answered by the charset module
+    unsigned char reply[128];
+    int reply_len = charset_handle_option(cmd, opt, reply, sizeof(reply));
+    if (reply_len >= 0) {
+        if (reply_len > 0) {
+            coro_send(co, reply, reply_len);
+        }
+        return;
+    }
+
+    // Respond to telnet negotiations
+    if (cmd == DO) {
+        if (opt == ECHO) {
+            send_telnet_option(co, WILL, opt);
+            negotiation->echo_acked = 1;
+        } else if (opt == SUPPRESS_GO_AHEAD) {
+            send_telnet_option(co, WILL, opt);
+            negotiation->sga_acked = 1;
+        } else {
+            send_telnet_option(co, WONT, opt);
+        }
+    } else if (cmd == DONT) {
+        send_telnet_option(co, WONT, opt);
+    } else if (cmd == WILL) {
+        if (opt == SUPPRESS_GO_AHEAD) {
+            send_telnet_option(co, DO, opt);
+            negotiation->sga_acked = 1;
+        } else {
+            send_telnet_option(co, DONT, opt);
+        }
+    } else if (cmd == WONT) {
+        send_telnet_option(co, DONT, opt);
+    }
+
+    // Check if negotiation is complete and send "ready!" message
+    if (!negotiation->ready_sent &&
+        negotiation->echo_acked &&
+        negotiation->sga_acked) {
+
+        const char *ready_msg = "\r\n*** READY! ***\r\n\r\n";
+        coro_send(co, ready_msg, strlen(ready_msg));
+        negotiation->ready_sent = 1;
+        stats_inc(STAT_NEGOTIATIONS_COMPLETE);
+        TRACE_PROBE1(negotiation_complete, co->session->fd);
+        if (DEBUG) {
+            char ts[32];
+            get_timestamp(ts, sizeof(ts));
+            printf("%s[DEBUG] Negotiation complete for client %s:%d.\n",
+                   ts, co->session->peer_ip, co->session->peer_port);
+        }
+    }
+}
+
+// Send the editor's screen update in the client's charset
+static void send_edit_output(char_session_t *state) {
+    if (edit_output.len == 0) {
+        return;
+    }
+    const unsigned char *text = edit_output.data;
+    size_t text_len = edit_output.len;
+    if (!charset_is_utf8(state->charset.charset)) {
+        if (line_buffer_reserve(&encoded, CHARSET_ENCODE_MAX(text_len)) == 0) {
+            text_len = charset_encode(state->charset.charset, text, text_len, encoded.data, encoded.capacity);
+            text = encoded.data;
+            latency_mark(state->co.clock, LAT_CHARSET);
+        }
+    }
+    coro_send_escaped(&state->co, text, text_len);
+    edit_output.len = 0;
+    line_buffer_trim(&edit_output);
+    line_buffer_trim(&encoded);
+}
+
+// NAWS: width and height as 16-bit numbers, with IAC doubled
+static void handle_naws(char_session_t *state, const unsigned char *data, int len) {
+    unsigned char size[4];
+    int count = 0;
+    for (int i = 1; i < len && count < 4; i++) {
+        size[count++] = data[i];
+        if (data[i] == IAC && i + 1 < len && data[i + 1] == IAC) {
+            i++;
+        }
+    }
+    if (count == 4) {
+        line_editor_resize(&state->editor, size[0] << 8 | size[1], &edit_output);
+        send_edit_output(state);
+    }
+}
+
+// Handle a NAWS, TTYPE or CHARSET subnegotiation
+static void handle_telnet_subnegotiation(char_session_t *state, const unsigned char *data, int len) {
+    session_t *session = state->co.session;
+    if (data[0] == NAWS) {
+        handle_naws(state, data, len);
+        return;
+    }
+    const charset_t *previous = state->charset.charset;
+    unsigned char reply[80];
+    int reply_len = charset_handle_subnegotiation(&state->charset, data, len, reply, sizeof(reply));
+    if (reply_len > 0) {
+        coro_send(&state->co, reply, reply_len);
+    }
+    if (state->charset.charset != previous) {
+        char ts[32];
+        get_timestamp(ts, sizeof(ts));
+        printf("%s[INFO] Session charset for %s:%d: %s.\n",
+               ts, session->peer_ip, session->peer_port, charset_name(state->charset.charset));
+    }
+}
+
+// Tell the client once per line that characters past the limit are
+// ignored, and put the line back below the notice
+static void line_full_notice(char_session_t *state) {
+    if (state->line_full) {
+        return;
+    }
+    char notice[96];
+    int len = snprintf(notice, sizeof(notice),
+                       "\r\nERROR: Line longer than %zu bytes; further characters ignored.\r\n",
+                       state->editor.text.limit);
+    coro_send(&state->co, notice, len);
+    stats_inc(STAT_LINES_DROPPED);
+    state->line_full = 1;
+    line_editor_redraw(&state->editor, &edit_output);
+    send_edit_output(state);
+}
+
+// Enter: echo the line as "ECHO: <line>" and start a new one.
+// Returns 1 when the line was "quit".
+static int end_of_line(char_session_t *state) {
+    coro_t *co = &state->co;
+    size_t line_len;
+    const unsigned char *line = line_editor_line(&state->editor, &line_len);
+    char ts[32];
+    session_charge_lines(co->session, 1);
+
+    // Check for quit command
+    if (line_len == 4 && memcmp(line, "quit", 4) == 0) {
+        coro_send(co, "Goodbye!\r\n", 10);
+        if (DEBUG) {
+            get_timestamp(ts, sizeof(ts));
+            printf("%s[DEBUG] Client quit: %s:%d.\n", ts, co->session->peer_ip, co->session->peer_port);
+        }
+        return 1;
+    }
+
+    // Echo the complete line if not empty
+    if (line_len > 0) {
+        latency_mark(co->clock, LAT_LINE);
+
+        // Transcode back to the client charset (UTF-8 is sent straight
+        // from the editor)
+        const unsigned char *text = line;
+        size_t text_len = line_len;
+        if (!charset_is_utf8(state->charset.charset)) {
+            if (line_buffer_reserve(&encoded, CHARSET_ENCODE_MAX(text_len)) == -1) {
+                stats_inc(STAT_LINES_DROPPED);
+                text = NULL;
+            } else {
+                text_len = charset_encode(state->charset.charset, text, text_len, encoded.data, encoded.capacity);
+                text = encoded.data;
+                latency_mark(co->clock, LAT_CHARSET);
+            }
+        }
+
+        if (text != NULL) {
+            coro_send(co, "ECHO: ", 6);
+            coro_send_escaped(co, text, text_len);
+            coro_send(co, "\r\n", 2);
+            stats_inc(STAT_LINES_ECHOED);
+            TRACE_PROBE2(line_echoed, co->session->fd, (int)line_len);
+            if (DEBUG) {
+                get_timestamp(ts, sizeof(ts));
+                printf("%s[DEBUG] Echoed line to %s:%d: %.*s.\n",
+                       ts, co->session->peer_ip, co->session->peer_port,
+                       (int)line_len, (const char *)line);
+            }
+        }
+        encoded.len = 0;
+        line_buffer_trim(&encoded);
+    }
+
+    // Keep the line in the history and start a new one
+    line_editor_commit(&state->editor);
+    state->line_full = 0;
+    state->charset.pending_len = 0;
+    return 0;
+}
+
+// Handle one data byte typed by the client. Returns 1 to end the session.
+static int handle_key(char_session_t *state, unsigned char ch) {
+    coro_t *co = &state->co;
+    int result = LINE_EDITOR_OK;
+
+    if (ch == CTRL_D) {
+        // Ctrl+D: disconnect
+        coro_send(co, "\r\nGoodbye!\r\n", 12);
+        if (DEBUG) {
+            char ts[32];
+            get_timestamp(ts, sizeof(ts));
+            printf("%s[DEBUG] Client sent Ctrl+D: %s:%d.\n", ts, co->session->peer_ip, co->session->peer_port);
+        }
+        return 1;
+    } else if (ch == CTRL_C) {
+        // Ctrl+C: clear current line
+        coro_send(co, "\r\n", 2);
+        line_editor_clear(&state->editor);
+        state->line_full = 0;
+        return 0;
+    } else if (ch == '\r' || ch == '\n') {
+        // Newline: process the line
+        if (ch == '\r') {
+            coro_send(co, "\r\n", 2);
+        }
+        return end_of_line(state);
+    } else if (!charset_is_utf8(state->charset.charset) && (ch >= 0x80 || state->charset.pending_len > 0)) {
+        // Legacy charset: wait for the whole character and edit it as
+        // UTF-8; the screen update goes back in the client's charset
+        unsigned char utf8[CHARSET_DECODE_MAX(1)];
+        size_t utf8_len = charset_decode(&state->charset, &ch, 1, utf8);
+        latency_mark(co->clock, LAT_CHARSET);
+        for (size_t i = 0; i < utf8_len; i++) {
+            if (line_editor_key(&state->editor, utf8[i], &edit_output) != LINE_EDITOR_OK) {
+                result = LINE_EDITOR_FULL;
+            }
+        }
+    } else {
+        // Printable characters (a 0xFF data byte goes back escaped as
+        // IAC IAC), editing keys and escape sequences
+        result = line_editor_key(&state->editor, ch, &edit_output);
+    }
+
+    if (edit_output.len > 0) {
+        send_edit_output(state);
+        latency_mark(co->clock, LAT_LINE);
+    }
+    if (result == LINE_EDITOR_FULL) {
+        line_full_notice(state);
+    }
+    return 0;
+}
+
+// The session, from greeting to goodbye
+static int char_session_run(coro_t *co) {
+    char_session_t *state = (char_session_t *)co;
+    session_t *session = co->session;
+    char ts[32];
+
+    CORO_BEGIN(co);
+
+    get_timestamp(ts, sizeof(ts));
+    printf("%s[INFO] Client connected: %s:%d.\n", ts, session->peer_ip, session->peer_port);
+
+    // Input is kept in UTF-8; the client's charset is converted at the edges
+    charset_session_init(&state->charset, config.default_charset);
+    line_editor_init(&state->editor, config.max_line);
+    line_buffer_init(&state->sb, CHAR_SESSION_SB_MAX);
+
+    // Setup character mode
+    setup_charmode(co, &state->negotiation);
+
+    // Send welcome message
+    coro_send(co, config.banner, strlen(config.banner));
+
+    // Record the inbound byte stream when capture is enabled
+    co->capture = capture_open(config.port);
+
+    while (1) {
+        CORO_GETC(co, state->ch);
+
+        // Handle telnet protocol commands
+        if (state->ch == IAC) {
+            CORO_GETC(co, state->cmd);
+            if (state->cmd != IAC) {
+                stats_count_iac(state->cmd);
+            }
+            if (state->cmd == DO || state->cmd == DONT || state->cmd == WILL || state->cmd == WONT) {
+                CORO_GETC(co, state->ch);
+                handle_telnet_option(state, state->cmd, state->ch);
+                continue;
+            } else if (state->cmd == SB) {
+                // Subnegotiation: collect everything up to IAC SE
+                do {
+                    CORO_GETC(co, state->ch);
+                    if (state->ch != IAC) {
+                        line_buffer_append(&state->sb, &state->ch, 1);
+                        continue;
+                    }
+                    CORO_GETC(co, state->cmd);
+                    if (state->cmd != SE) {
+                        line_buffer_append(&state->sb, &state->ch, 1);
+                        line_buffer_append(&state->sb, &state->cmd, 1);
+                    }
+                } while (state->ch != IAC || state->cmd != SE);
+                latency_mark(co->clock, LAT_IAC);
+                if (state->sb.len > 0) {
+                    handle_telnet_subnegotiation(state, state->sb.data, (int)state->sb.len);
+                }
+                line_buffer_consume(&state->sb, state->sb.len);
+                line_buffer_trim(&state->sb);
+                continue;
+            } else if (state->cmd != IAC) {
+                continue;
+            }
+            // Escaped IAC (255), treat as regular character
+        }
+
+        if (handle_key(state, state->ch)) {
+            CORO_EXIT(co);
+        }
+    }
+
+    CORO_END(co);
+}
+
+// Push the periodic timestamp
+static void char_session_tick(coro_t *co) {
+    session_t *session = co->session;
+    if (session->failed) {
+        return;
+    }
+    time_t now = time(NULL);
+    struct tm tm_info;
+    char timestamp_msg[128];
+    localtime_r(&now, &tm_info);
+    snprintf(timestamp_msg, sizeof(timestamp_msg),
+             "\r\n[TIMESTAMP] %04d-%02d-%02d %02d:%02d:%02d\r\n",
+             tm_info.tm_year + 1900, tm_info.tm_mon + 1, tm_info.tm_mday,
+             tm_info.tm_hour, tm_info.tm_min, tm_info.tm_sec);
+
+    coro_send(co, timestamp_msg, strlen(timestamp_msg));
+    stats_inc(STAT_TIMESTAMPS_SENT);
+
+    // Put the line being typed back below the timestamp
+    char_session_t *state = (char_session_t *)co;
+    line_editor_redraw(&state->editor, &edit_output);
+    send_edit_output(state);
+    TRACE_PROBE1(timestamp_sent, session->fd);
+
+    char ts[32];
+    get_timestamp(ts, sizeof(ts));
+    printf("%s[INFO] Sent timestamp to client (fd=%d).\n", ts, session->fd);
+}
+
+static void char_session_close(coro_t *co) {
+    char_session_t *state = (char_session_t *)co;
+    if (!co->done) {
+        char ts[32];
+        get_timestamp(ts, sizeof(ts));
+        printf("%s[INFO] Client disconnected: %s:%d.\n", ts, co->session->peer_ip, co->session->peer_port);
+    }
+    line_editor_free(&state->editor);
+    line_buffer_free(&state->sb);
+}
+
+const coro_protocol_t char_session_protocol = {
+    .ops = CORO_SESSION_OPS(CHAR_SESSION_TICK_SECONDS),
+    .state_size = sizeof(char_session_t),
+    .run = char_session_run,
+    .tick = char_session_tick,
+    .close = char_session_close
+};
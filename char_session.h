@@ -0,0 +1,36 @@
+#ifndef CHAR_SESSION_H
+#define CHAR_SESSION_H
+
+#include <stddef.h>
+
+#include "charset.h"
+#include "coro_session.h"
+
+// Character mode echo protocol of char_mode_server, written as a coroutine
+// session (coro_session.h).
+//
+// A session negotiates server-side echo, SGA and NAWS, edits the line as it
+// is typed with the line editor (line_editor.h: cursor movement, insertion,
+// word deletion, history), echoes it as "ECHO: <line>" on Enter, handles
+// Ctrl+C (clear the line) and Ctrl+D (disconnect), pushes a timestamp every
+// 10 seconds and ends on "quit".
+//
+// The session state is the coroutine, the negotiation and charset state and
+// the line editor, whose line is allocated only once something is typed.
+
+#define CHAR_SESSION_TICK_SECONDS 10
+#define CHAR_SESSION_SB_MAX 512        // Longest subnegotiation kept
+
+typedef struct {
+    int port;
+    const char *banner;                // Sent after the negotiation commands
+    const charset_t *default_charset;
+    size_t max_line;
+} char_session_config_t;
+
+// Settings used by every character session in this process (set before serving)
+void char_session_configure(const char_session_config_t *config);
+
+extern const coro_protocol_t char_session_protocol;
+
+#endif
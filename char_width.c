@@ -0,0 +1,81 @@
+#include "char_width.h"
+#include "char_width_table.h"
+
+int char_width(uint32_t cp) {
+    if (cp < 0x7F) {
+        return cp >= 0x20;
+    }
+    if (cp > 0x10FFFF) {
+        return 1;
+    }
+    unsigned char byte = CHAR_WIDTH_STAGE2[CHAR_WIDTH_STAGE1[cp >> CHAR_WIDTH_BLOCK_SHIFT]]
+                                          [(cp & ((1u << CHAR_WIDTH_BLOCK_SHIFT) - 1)) >> 2];
+    return (byte >> ((cp & 3) * 2)) & 3;
+}
+
+size_t char_width_next(const unsigned char *s, size_t len, int *width) {
+    unsigned char lead = s[0];
+    if (lead < 0x80) {
+        *width = lead >= 0x20 && lead != 0x7F;
+        return 1;
+    }
+
+    // Lead byte, then the range of the second byte that keeps the sequence
+    // out of overlongs, surrogates and code points above U+10FFFF
+    size_t need;
+    uint32_t cp;
+    unsigned char low = 0x80, high = 0xBF;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        need = 2;
+        cp = lead & 0x1F;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        need = 3;
+        cp = lead & 0x0F;
+        if (lead == 0xE0) {
+            low = 0xA0;
+        } else if (lead == 0xED) {
+            high = 0x9F;
+        }
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        need = 4;
+        cp = lead & 0x07;
+        if (lead == 0xF0) {
+            low = 0x90;
+        } else if (lead == 0xF4) {
+            high = 0x8F;
+        }
+    } else {
+        *width = 1;
+        return 1;
+    }
+    if (len < need || s[1] < low || s[1] > high) {
+        *width = 1;
+        return 1;
+    }
+    for (size_t i = 1; i < need; i++) {
+        if ((s[i] & 0xC0) != 0x80) {
+            *width = 1;
+            return 1;
+        }
+        cp = (cp << 6) | (s[i] & 0x3F);
+    }
+    *width = char_width(cp);
+    return need;
+}
+
+size_t char_width_utf8(const unsigned char *s, size_t len) {
+    size_t total = 0;
+    size_t pos = 0;
+    while (pos < len) {
+        // Printable ASCII runs are one column per byte
+        if (s[pos] >= 0x20 && s[pos] < 0x7F) {
+            total++;
+            pos++;
+            continue;
+        }
+        int width;
+        pos += char_width_next(s + pos, len - pos, &width);
+        total += (size_t)width;
+    }
+    return total;
+}
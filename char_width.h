@@ -0,0 +1,29 @@
+#ifndef CHAR_WIDTH_H
+#define CHAR_WIDTH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Terminal display width of UTF-8 text, for server-side line editing.
+//
+// A code point takes 0 columns (combining marks, format characters,
+// conjoining Hangul vowels and finals, controls), 2 (East Asian Wide and
+// Fullwidth: Hangul syllables, CJK ideographs, kana, fullwidth forms) or 1.
+// ASCII is decided inline; everything else is two table lookups in
+// char_width_table.h, generated from the Unicode database by
+// gen_char_width.py.
+//
+// Bytes that do not start a well-formed UTF-8 sequence count as one
+// character of width 1 each, which is how terminals show them (U+FFFD).
+
+// Display width of a code point
+int char_width(uint32_t cp);
+
+// Decode the character at s (len > 0 bytes available). Returns its length
+// in bytes (1 for an ill-formed byte) and stores its width in *width.
+size_t char_width_next(const unsigned char *s, size_t len, int *width);
+
+// Display width of UTF-8 text
+size_t char_width_utf8(const unsigned char *s, size_t len);
+
+#endif
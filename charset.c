@@ -0,0 +1,576 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <iconv.h>
+
+#include "charset.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "telnet_proto.h"
+
+#define REPLACEMENT_CHAR 0xFFFD
+#define UNMAPPED_BYTE '?'
+#define SS3 0x8F               // EUC-JP: JIS X 0212 follows as two bytes
+
+struct charset {
+    const char *name;
+    const char *iconv_name;
+    const char *aliases;       // Space separated, matched case-insensitively
+    unsigned char lead_min, lead_max;
+    unsigned char trail_min, trail_max;
+    int has_ss3;
+
+    int loaded;
+    uint16_t single[128];      // Code point of a single byte 0x80..0xFF, 0 if none
+    uint16_t *decode;          // [lead - lead_min][trail - trail_min]
+    uint16_t *decode_ss3;      // EUC-JP 0x8F A1..FE A1..FE
+    uint16_t *encode[256];     // Pages by code point >> 8, encoded form below
+};
+
+// Encoded form stored in the encode pages:
+//   < 0x0100           one byte
+//   0x0100 .. 0x7FFF   EUC-JP SS3: 0x8F, high | 0x80, low | 0x80
+//   >= 0x8000          two bytes, lead then trail
+// UTF-8 must stay first: it is the identity charset and needs no tables
+static charset_t charsets[] = {
+    { .name = "UTF-8", .aliases = "UTF8", .loaded = 1 },
+    { .name = "CP949", .iconv_name = "CP949", .aliases = "UHC MS949 WINDOWS-949",
+      .lead_min = 0x81, .lead_max = 0xFE, .trail_min = 0x41, .trail_max = 0xFE },
+    { .name = "EUC-KR", .iconv_name = "EUC-KR", .aliases = "EUCKR KS_C_5601-1987",
+      .lead_min = 0xA1, .lead_max = 0xFE, .trail_min = 0xA1, .trail_max = 0xFE },
+    { .name = "EUC-JP", .iconv_name = "EUC-JP", .aliases = "EUCJP UJIS",
+      .lead_min = 0x8E, .lead_max = 0xFE, .trail_min = 0xA1, .trail_max = 0xFE, .has_ss3 = 1 },
+    { .name = "SHIFT_JIS", .iconv_name = "SHIFT_JIS", .aliases = "SJIS SHIFT-JIS MS_KANJI",
+      .lead_min = 0x81, .lead_max = 0xFC, .trail_min = 0x40, .trail_max = 0xFC },
+};
+#define CHARSET_COUNT (sizeof(charsets) / sizeof(charsets[0]))
+
+// Terminal types that imply a legacy charset
+static const struct {
+    const char *terminal_type;
+    const char *charset;
+} terminal_charsets[] = {
+    { "KTERM", "EUC-JP" },
+    { "HANTERM", "EUC-KR" },
+    { "HANTERM-XF", "EUC-KR" },
+};
+
+static int negotiate = 1;
+
+static int trail_span(const charset_t *cs) {
+    return cs->trail_max - cs->trail_min + 1;
+}
+
+// Convert one byte sequence with iconv; returns the BMP code point or 0
+static uint16_t iconv_one(iconv_t cd, const unsigned char *bytes, size_t len) {
+    char *in = (char *)bytes;
+    size_t in_left = len;
+    uint32_t out[2];
+    char *outp = (char *)out;
+    size_t out_left = sizeof(out);
+
+    iconv(cd, NULL, NULL, NULL, NULL);
+    if (iconv(cd, &in, &in_left, &outp, &out_left) == (size_t)-1 || in_left != 0 ||
+        out_left != sizeof(out) - sizeof(uint32_t)) {
+        return 0;
+    }
+    return out[0] <= 0xFFFF ? (uint16_t)out[0] : 0;
+}
+
+static void set_encode(charset_t *cs, uint16_t code_point, uint16_t value) {
+    if (code_point < 0x80 || code_point == REPLACEMENT_CHAR) {
+        return;
+    }
+    uint16_t **page = &cs->encode[code_point >> 8];
+    if (*page == NULL) {
+        *page = calloc(256, sizeof(uint16_t));
+        if (*page == NULL) {
+            return;
+        }
+    }
+    // The first (lowest) byte sequence for a code point wins
+    if ((*page)[code_point & 0xFF] == 0) {
+        (*page)[code_point & 0xFF] = value;
+    }
+}
+
+static int load_tables(charset_t *cs) {
+    iconv_t cd = iconv_open("UCS-4LE", cs->iconv_name);
+    if (cd == (iconv_t)-1) {
+        return -1;
+    }
+
+    for (int b = 0x80; b <= 0xFF; b++) {
+        unsigned char byte = (unsigned char)b;
+        cs->single[b - 0x80] = iconv_one(cd, &byte, 1);
+        set_encode(cs, cs->single[b - 0x80], byte);
+    }
+
+    int leads = cs->lead_max - cs->lead_min + 1;
+    cs->decode = calloc((size_t)leads * trail_span(cs), sizeof(uint16_t));
+    for (int lead = cs->lead_min; lead <= cs->lead_max; lead++) {
+        if (cs->single[lead - 0x80] != 0 || (cs->has_ss3 && lead == SS3)) {
+            continue;
+        }
+        for (int trail = cs->trail_min; trail <= cs->trail_max; trail++) {
+            unsigned char bytes[2] = { (unsigned char)lead, (unsigned char)trail };
+            uint16_t cp = iconv_one(cd, bytes, 2);
+            cs->decode[(lead - cs->lead_min) * trail_span(cs) + (trail - cs->trail_min)] = cp;
+            set_encode(cs, cp, (uint16_t)(lead << 8 | trail));
+        }
+    }
+
+    if (cs->has_ss3) {
+        cs->decode_ss3 = calloc(94 * 94, sizeof(uint16_t));
+        for (int hi = 0xA1; hi <= 0xFE; hi++) {
+            for (int lo = 0xA1; lo <= 0xFE; lo++) {
+                unsigned char bytes[3] = { SS3, (unsigned char)hi, (unsigned char)lo };
+                uint16_t cp = iconv_one(cd, bytes, 3);
+                cs->decode_ss3[(hi - 0xA1) * 94 + (lo - 0xA1)] = cp;
+                set_encode(cs, cp, (uint16_t)((hi & 0x7F) << 8 | (lo & 0x7F)));
+            }
+        }
+    }
+
+    iconv_close(cd);
+    cs->loaded = 1;
+    return 0;
+}
+
+static int name_matches(const char *name, const charset_t *cs) {
+    if (strcasecmp(name, cs->name) == 0) {
+        return 1;
+    }
+    size_t len = strlen(name);
+    const char *alias = cs->aliases;
+    while (*alias != '\0') {
+        size_t alias_len = strcspn(alias, " ");
+        if (alias_len == len && strncasecmp(alias, name, len) == 0) {
+            return 1;
+        }
+        alias += alias_len;
+        alias += strspn(alias, " ");
+    }
+    return 0;
+}
+
+const charset_t *charset_init(int port) {
+    for (size_t i = 1; i < CHARSET_COUNT; i++) {
+        if (load_tables(&charsets[i]) == -1) {
+            fprintf(stderr, "Charset %s unavailable (no iconv support)\n", charsets[i].name);
+        }
+    }
+    negotiate = (int)config_get_long("CHARSET_NEGOTIATE", port, 1);
+
+    const char *name = config_get_str("CHARSET", port, "UTF-8");
+    const charset_t *charset = charset_find(name);
+    if (charset == NULL) {
+        fprintf(stderr, "Ignoring invalid value for TELNET_CHARSET: '%s'\n", name);
+        charset = &charsets[0];
+    }
+    return charset;
+}
+
+const charset_t *charset_find(const char *name) {
+    for (size_t i = 0; i < CHARSET_COUNT; i++) {
+        if (name_matches(name, &charsets[i])) {
+            return charsets[i].loaded ? &charsets[i] : NULL;
+        }
+    }
+    return NULL;
+}
+
+const charset_t *charset_for_terminal(const char *terminal_type) {
+    for (size_t i = 0; i < sizeof(terminal_charsets) / sizeof(terminal_charsets[0]); i++) {
+        if (strcasecmp(terminal_type, terminal_charsets[i].terminal_type) == 0) {
+            return charset_find(terminal_charsets[i].charset);
+        }
+    }
+    return NULL;
+}
+
+const char *charset_name(const charset_t *charset) {
+    return charset->name;
+}
+
+int charset_is_utf8(const charset_t *charset) {
+    return charset == &charsets[0];
+}
+
+void charset_session_init(charset_state_t *state, const charset_t *charset) {
+    state->charset = charset;
+    state->pending_len = 0;
+    state->negotiated = 0;
+}
+
+static size_t put_utf8(unsigned char *out, uint32_t cp) {
+    if (cp < 0x80) {
+        out[0] = (unsigned char)cp;
+        return 1;
+    } else if (cp < 0x800) {
+        out[0] = (unsigned char)(0xC0 | (cp >> 6));
+        out[1] = (unsigned char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    out[0] = (unsigned char)(0xE0 | (cp >> 12));
+    out[1] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+    out[2] = (unsigned char)(0x80 | (cp & 0x3F));
+    return 3;
+}
+
+// Length of the run of ASCII bytes at the start of buf
+static size_t ascii_run(const unsigned char *buf, size_t len) {
+    size_t i = 0;
+    while (i + 8 <= len) {
+        uint64_t word;
+        memcpy(&word, buf + i, sizeof(word));
+        if ((word & 0x8080808080808080ull) != 0) {
+            break;
+        }
+        i += 8;
+    }
+    while (i < len && buf[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+// Decode the non-ASCII character at p. Returns the bytes consumed, or 0
+// when more input is needed to decide.
+static int decode_one(const charset_t *cs, const unsigned char *p, size_t avail, uint32_t *cp) {
+    unsigned char b = p[0];
+
+    if (cs->single[b - 0x80] != 0) {
+        *cp = cs->single[b - 0x80];
+        return 1;
+    }
+    if (cs->has_ss3 && b == SS3) {
+        if (avail < 3) {
+            return 0;
+        }
+        if (p[1] >= 0xA1 && p[1] <= 0xFE && p[2] >= 0xA1 && p[2] <= 0xFE) {
+            uint16_t value = cs->decode_ss3[(p[1] - 0xA1) * 94 + (p[2] - 0xA1)];
+            *cp = value != 0 ? value : REPLACEMENT_CHAR;
+            return 3;
+        }
+        *cp = REPLACEMENT_CHAR;
+        return 1;
+    }
+    if (b >= cs->lead_min && b <= cs->lead_max) {
+        if (avail < 2) {
+            return 0;
+        }
+        unsigned char trail = p[1];
+        if (trail >= cs->trail_min && trail <= cs->trail_max) {
+            uint16_t value = cs->decode[(b - cs->lead_min) * trail_span(cs) + (trail - cs->trail_min)];
+            if (value != 0) {
+                *cp = value;
+                return 2;
+            }
+        }
+        // Keep an ASCII trail byte: it is most likely a character of its own
+        *cp = REPLACEMENT_CHAR;
+        return trail < 0x80 ? 1 : 2;
+    }
+    *cp = REPLACEMENT_CHAR;
+    return 1;
+}
+
+size_t charset_decode(charset_state_t *state, const unsigned char *in, size_t len,
+                      unsigned char *out) {
+    const charset_t *cs = state->charset;
+    size_t o = 0;
+    size_t i = 0;
+
+    if (charset_is_utf8(cs)) {
+        memcpy(out, in, len);
+        return len;
+    }
+
+    // Finish a character split across the previous segment
+    while (state->pending_len > 0 && i < len) {
+        unsigned char joined[3];
+        int have = state->pending_len;
+        memcpy(joined, state->pending, have);
+        while (have < 3 && i + (have - state->pending_len) < len) {
+            joined[have] = in[i + (have - state->pending_len)];
+            have++;
+        }
+        uint32_t cp;
+        int used = decode_one(cs, joined, have, &cp);
+        if (used == 0) {
+            // Still incomplete: everything so far becomes pending
+            memcpy(state->pending, joined, have);
+            state->pending_len = have;
+            return o;
+        }
+        o += put_utf8(out + o, cp);
+        if (cp == REPLACEMENT_CHAR) {
+            stats_inc(STAT_CHARSET_UNMAPPED);
+        }
+        if (used >= state->pending_len) {
+            i += used - state->pending_len;
+            state->pending_len = 0;
+        } else {
+            // Only part of the pending bytes were used; keep the rest
+            memmove(state->pending, state->pending + used, state->pending_len - used);
+            state->pending_len -= used;
+        }
+    }
+
+    while (i < len) {
+        size_t run = ascii_run(in + i, len - i);
+        memcpy(out + o, in + i, run);
+        o += run;
+        i += run;
+        if (i == len) {
+            break;
+        }
+
+        uint32_t cp;
+        int used = decode_one(cs, in + i, len - i, &cp);
+        if (used == 0) {
+            state->pending_len = (int)(len - i);
+            memcpy(state->pending, in + i, state->pending_len);
+            break;
+        }
+        o += put_utf8(out + o, cp);
+        if (cp == REPLACEMENT_CHAR) {
+            stats_inc(STAT_CHARSET_UNMAPPED);
+        }
+        i += used;
+    }
+    return o;
+}
+
+// Decode the UTF-8 character at p (input is trusted to be mostly valid;
+// malformed bytes are consumed one at a time)
+static int utf8_next(const unsigned char *p, size_t avail, uint32_t *cp) {
+    unsigned char b = p[0];
+    int n = utf8_sequence_length(b);
+    if (n < 2 || (size_t)n > avail) {
+        *cp = REPLACEMENT_CHAR;
+        return 1;
+    }
+    uint32_t value = b & (0x7F >> n);
+    for (int k = 1; k < n; k++) {
+        if ((p[k] & 0xC0) != 0x80) {
+            *cp = REPLACEMENT_CHAR;
+            return 1;
+        }
+        value = (value << 6) | (p[k] & 0x3F);
+    }
+    *cp = value;
+    return n;
+}
+
+size_t charset_encode(const charset_t *charset, const unsigned char *in, size_t len,
+                      unsigned char *out, size_t size) {
+    size_t o = 0;
+    size_t i = 0;
+
+    if (charset_is_utf8(charset)) {
+        len = len < size ? len : size;
+        memcpy(out, in, len);
+        return len;
+    }
+
+    while (i < len) {
+        size_t run = ascii_run(in + i, len - i);
+        if (run > size - o) {
+            run = size - o;
+        }
+        memcpy(out + o, in + i, run);
+        o += run;
+        i += run;
+        if (i == len || o == size) {
+            break;
+        }
+
+        uint32_t cp;
+        size_t step = utf8_next(in + i, len - i, &cp);
+        uint16_t value = 0;
+        if (cp <= 0xFFFF && charset->encode[cp >> 8] != NULL) {
+            value = charset->encode[cp >> 8][cp & 0xFF];
+        }
+        size_t need = value >= 0x100 ? (value < 0x8000 ? 3 : 2) : 1;
+        if (need > size - o) {
+            break;
+        }
+        i += step;
+        if (value == 0) {
+            out[o++] = UNMAPPED_BYTE;
+            stats_inc(STAT_CHARSET_UNMAPPED);
+        } else if (value < 0x100) {
+            out[o++] = (unsigned char)value;
+        } else if (value < 0x8000) {
+            out[o++] = SS3;
+            out[o++] = (unsigned char)((value >> 8) | 0x80);
+            out[o++] = (unsigned char)((value & 0xFF) | 0x80);
+        } else {
+            out[o++] = (unsigned char)(value >> 8);
+            out[o++] = (unsigned char)(value & 0xFF);
+        }
+    }
+    return o;
+}
+
+int charset_offer(unsigned char *reply, size_t size) {
+    if (!negotiate || size < 6) {
+        return 0;
+    }
+    int len = telnet_option_frame(reply, DO, TTYPE);
+    len += telnet_option_frame(reply + len, WILL, CHARSET);
+    return len;
+}
+
+int charset_handle_option(unsigned char command, unsigned char option,
+                          unsigned char *reply, size_t size) {
+    if (option != TTYPE && option != CHARSET) {
+        return -1;
+    }
+    if (!negotiate) {
+        // Refuse as the servers do for any other unsupported option
+        if (command == DO || command == WILL) {
+            return telnet_option_frame(reply, command == DO ? WONT : DONT, option);
+        }
+        return 0;
+    }
+
+    if (command == WILL && option == TTYPE) {
+        // Answer to our DO TTYPE: ask for the terminal type
+        unsigned char send_cmd = TTYPE_SEND;
+        return telnet_subneg_frame(reply, TTYPE, &send_cmd, 1);
+    }
+    if (command == DO && option == CHARSET) {
+        // Answer to our WILL CHARSET: offer the charsets we can transcode
+        unsigned char list[128];
+        int len = 0;
+        list[len++] = CHARSET_REQUEST;
+        for (size_t i = 0; i < CHARSET_COUNT; i++) {
+            if (i > 0 && !charsets[i].loaded) {
+                continue;
+            }
+            int n = snprintf((char *)list + len, sizeof(list) - len, ";%s", charsets[i].name);
+            len += n;
+        }
+        if ((size_t)len + 5 > size) {
+            return 0;
+        }
+        return telnet_subneg_frame(reply, CHARSET, list, len);
+    }
+    if (command == WILL && option == CHARSET) {
+        // The client wants to send its own REQUEST
+        return telnet_option_frame(reply, DO, CHARSET);
+    }
+    // DONT/WONT: nothing to negotiate
+    return 0;
+}
+
+// Pick the first charset of a REQUEST list we support. Returns its length
+// within list and stores the charset, or returns 0.
+static const charset_t *choose_requested(const unsigned char *list, int len,
+                                         const unsigned char **chosen, int *chosen_len) {
+    if (len > 0 && list[0] == '[') {
+        // Skip the optional "[TTABLE <version>]" prefix
+        const unsigned char *end = memchr(list, ']', len);
+        if (end == NULL) {
+            return NULL;
+        }
+        len -= (int)(end + 1 - list);
+        list = end + 1;
+    }
+    if (len < 2) {
+        return NULL;
+    }
+    unsigned char sep = list[0];
+    int start = 1;
+    for (int i = 1; i <= len; i++) {
+        if (i == len || list[i] == sep) {
+            char name[64];
+            int n = i - start;
+            if (n > 0 && n < (int)sizeof(name)) {
+                memcpy(name, list + start, n);
+                name[n] = '\0';
+                const charset_t *charset = charset_find(name);
+                if (charset != NULL) {
+                    *chosen = list + start;
+                    *chosen_len = n;
+                    return charset;
+                }
+            }
+            start = i + 1;
+        }
+    }
+    return NULL;
+}
+
+static void switch_charset(charset_state_t *state, const charset_t *charset) {
+    if (charset != state->charset) {
+        state->charset = charset;
+        state->pending_len = 0;
+        if (!charset_is_utf8(charset)) {
+            stats_inc(STAT_CHARSET_SWITCHES);
+        }
+    }
+}
+
+int charset_handle_subnegotiation(charset_state_t *state, const unsigned char *data, int len,
+                                  unsigned char *reply, size_t size) {
+    if (len < 2) {
+        return 0;
+    }
+    unsigned char option = data[0];
+    unsigned char command = data[1];
+    const unsigned char *args = data + 2;
+    int args_len = len - 2;
+
+    if (option == TTYPE && command == TTYPE_IS) {
+        // An explicitly negotiated charset takes precedence over TTYPE
+        char terminal_type[64];
+        int n = args_len < (int)sizeof(terminal_type) - 1 ? args_len : (int)sizeof(terminal_type) - 1;
+        memcpy(terminal_type, args, n);
+        terminal_type[n] = '\0';
+        const charset_t *charset = charset_for_terminal(terminal_type);
+        if (charset != NULL && !state->negotiated) {
+            switch_charset(state, charset);
+        }
+        return 0;
+    }
+
+    if (option != CHARSET) {
+        return 0;
+    }
+    if (command == CHARSET_ACCEPTED) {
+        // The client accepted one of the charsets we offered
+        char name[64];
+        int n = args_len < (int)sizeof(name) - 1 ? args_len : (int)sizeof(name) - 1;
+        memcpy(name, args, n);
+        name[n] = '\0';
+        const charset_t *charset = charset_find(name);
+        if (charset != NULL) {
+            switch_charset(state, charset);
+            state->negotiated = 1;
+        }
+        return 0;
+    }
+    if (command == CHARSET_REQUEST) {
+        const unsigned char *chosen = NULL;
+        int chosen_len = 0;
+        const charset_t *charset = choose_requested(args, args_len, &chosen, &chosen_len);
+        unsigned char answer[66];
+        if (charset == NULL || (size_t)chosen_len + 6 > size) {
+            answer[0] = CHARSET_REJECTED;
+            return telnet_subneg_frame(reply, CHARSET, answer, 1);
+        }
+        switch_charset(state, charset);
+        state->negotiated = 1;
+        answer[0] = CHARSET_ACCEPTED;
+        memcpy(answer + 1, chosen, chosen_len);
+        return telnet_subneg_frame(reply, CHARSET, answer, chosen_len + 1);
+    }
+    // REJECTED or TTABLE-*: keep the current charset
+    return 0;
+}
@@ -0,0 +1,84 @@
+#ifndef CHARSET_H
+#define CHARSET_H
+
+#include <stddef.h>
+
+// Per-session charset transcoding between legacy double-byte terminals
+// (EUC-KR, CP949, Shift-JIS, EUC-JP) and the UTF-8 used inside the servers.
+//
+// Every charset is described by compact lookup tables: a dense
+// lead x trail array of BMP code points for decoding, and 256-entry pages
+// indexed by the high byte of the code point for encoding. The tables are
+// generated from the system iconv once in the listener (charset_init), so
+// forked workers share them copy-on-write and never call iconv themselves.
+// Runs of ASCII are copied eight bytes at a time without a table lookup.
+//
+// The session charset comes from TELNET_CHARSET[_<port>] and can be changed
+// by the client through CHARSET (RFC 2066) or, when the client does not
+// negotiate CHARSET, by a known terminal type reported via TTYPE.
+
+typedef struct charset charset_t;
+
+// Decoder state carried between receive segments, so a character split
+// across two recv() calls is decoded once both halves have arrived
+typedef struct {
+    const charset_t *charset;
+    unsigned char pending[3];
+    int pending_len;
+    int negotiated;            // Set once CHARSET picked the charset
+} charset_state_t;
+
+// Output buffer sizes: decoding yields at most 3 UTF-8 bytes per input byte
+// (plus the pending bytes of a split character); encoding grows by half at
+// most, when EUC-JP writes a 2-byte UTF-8 character of JIS X 0212 as a
+// 3-byte SS3 sequence
+#define CHARSET_DECODE_MAX(len) ((len) * 3 + 9)
+#define CHARSET_ENCODE_MAX(len) (((len) * 3 + 1) / 2 + 3)
+
+// Build the tables (call once in the listener, before fork).
+// Returns the configured default charset.
+const charset_t *charset_init(int port);
+
+// Look up a charset by name (case-insensitive, common aliases accepted).
+// Returns NULL for unknown names or charsets whose tables are unavailable.
+const charset_t *charset_find(const char *name);
+
+// Charset conventionally used by a terminal type (e.g. KTERM -> EUC-JP),
+// or NULL when the terminal type says nothing about the charset
+const charset_t *charset_for_terminal(const char *terminal_type);
+
+const char *charset_name(const charset_t *charset);
+int charset_is_utf8(const charset_t *charset);
+
+// Start a session with the configured default charset
+void charset_session_init(charset_state_t *state, const charset_t *charset);
+
+// Decode client bytes to UTF-8 into out (CHARSET_DECODE_MAX(len) bytes).
+// Undecodable bytes become U+FFFD. Returns the number of bytes written.
+size_t charset_decode(charset_state_t *state, const unsigned char *in, size_t len,
+                      unsigned char *out);
+
+// Encode UTF-8 into the client charset into out, which holds size bytes
+// (CHARSET_ENCODE_MAX(len) takes all of it). Characters the charset cannot
+// represent become '?'. Stops before a character that does not fit.
+// Returns the number of bytes written.
+size_t charset_encode(const charset_t *charset, const unsigned char *in, size_t len,
+                      unsigned char *out, size_t size);
+
+// Telnet negotiation. Both return the number of reply bytes written to
+// reply (at most size), 0 when nothing needs to be sent.
+//
+// charset_offer() writes the opening DO TTYPE / WILL CHARSET.
+int charset_offer(unsigned char *reply, size_t size);
+
+// Answer a DO/WILL for TTYPE or CHARSET. Returns -1 when the option is not
+// one of ours so the caller falls back to its usual answer.
+int charset_handle_option(unsigned char command, unsigned char option,
+                          unsigned char *reply, size_t size);
+
+// Process a TTYPE or CHARSET subnegotiation (the bytes between IAC SB and
+// IAC SE, option byte first). May switch state->charset.
+int charset_handle_subnegotiation(charset_state_t *state, const unsigned char *data, int len,
+                                  unsigned char *reply, size_t size);
+
+#endif
@@ -0,0 +1,117 @@
+// Checks for the charset transcoder (charset.c)
+//
+// Encodes known UTF-8 text into each legacy charset and compares the bytes
+// with what iconv produces, into an output buffer of exactly
+// CHARSET_ENCODE_MAX(len) bytes followed by guard bytes, so an encoder
+// that writes past the size its callers reserve is caught. The text is then
+// decoded again and must come back unchanged. Encoding into a smaller
+// buffer must stop at a character boundary without touching the guard.
+//
+// Usage: check_charset
+
+#include <stdio.h>
+#include <string.h>
+
+#include "charset.h"
+
+#define GUARD_SIZE 16
+#define GUARD_BYTE 0xA5
+#define CHECK_TEXT_MAX 64
+
+typedef struct {
+    const char *label;
+    const char *charset;
+    const char *utf8;              // Input text
+    const char *encoded;           // Expected bytes in the charset
+} check_case_t;
+
+static const check_case_t cases[] = {
+    { "ascii", "EUC-KR", "telnet 9091\r\n", "telnet 9091\r\n" },
+    { "hangul", "CP949", "\xed\x95\x9c\xea\xb8\x80", "\xc7\xd1\xb1\xdb" },
+    { "kana", "SHIFT_JIS", "\xe3\x81\x82" "a", "\x82\xa0" "a" },
+    { "jis0208", "EUC-JP", "\xe3\x81\x82", "\xa4\xa2" },
+    // JIS X 0212: a 2-byte UTF-8 character becomes a 3-byte SS3 sequence,
+    // the one case where encoding grows
+    { "jis0212", "EUC-JP",
+      "\xc2\xa1\xc2\xa1\xc2\xa1\xc2\xa1\xc2\xa1\xc2\xa1\xc2\xa1\xc2\xa1\xc2\xa1\xc2\xa1",
+      "\x8f\xa2\xc2\x8f\xa2\xc2\x8f\xa2\xc2\x8f\xa2\xc2\x8f\xa2\xc2"
+      "\x8f\xa2\xc2\x8f\xa2\xc2\x8f\xa2\xc2\x8f\xa2\xc2\x8f\xa2\xc2" },
+};
+
+static int guard_intact(const unsigned char *guard) {
+    for (int i = 0; i < GUARD_SIZE; i++) {
+        if (guard[i] != GUARD_BYTE) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Returns the number of failed checks
+static int check_case(const check_case_t *c) {
+    const charset_t *charset = charset_find(c->charset);
+    if (charset == NULL) {
+        printf("skip  %-8s %-10s (no iconv support)\n", c->label, c->charset);
+        return 0;
+    }
+    const unsigned char *in = (const unsigned char *)c->utf8;
+    size_t len = strlen(c->utf8);
+    size_t expected_len = strlen(c->encoded);
+    size_t max = CHARSET_ENCODE_MAX(len);
+    unsigned char out[CHARSET_ENCODE_MAX(CHECK_TEXT_MAX) + GUARD_SIZE];
+    int failed = 0;
+
+    memset(out, GUARD_BYTE, sizeof(out));
+    size_t out_len = charset_encode(charset, in, len, out, max);
+    if (out_len != expected_len || memcmp(out, c->encoded, expected_len) != 0) {
+        printf("FAIL  %-8s %-10s encoded to %zu bytes, expected %zu\n", c->label, c->charset,
+               out_len, expected_len);
+        failed++;
+    }
+    if (!guard_intact(out + max)) {
+        printf("FAIL  %-8s %-10s wrote past CHARSET_ENCODE_MAX(%zu) = %zu\n", c->label, c->charset,
+               len, max);
+        failed++;
+    }
+
+    // Round trip
+    charset_state_t state;
+    charset_session_init(&state, charset);
+    unsigned char decoded[CHARSET_DECODE_MAX(CHARSET_ENCODE_MAX(CHECK_TEXT_MAX))];
+    size_t decoded_len = charset_decode(&state, out, out_len, decoded);
+    if (decoded_len != len || memcmp(decoded, in, len) != 0) {
+        printf("FAIL  %-8s %-10s did not decode back to the input\n", c->label, c->charset);
+        failed++;
+    }
+
+    // One byte short of the whole text: the last character is left out
+    if (expected_len > 1) {
+        memset(out, GUARD_BYTE, sizeof(out));
+        size_t short_len = charset_encode(charset, in, len, out, expected_len - 1);
+        if (short_len >= expected_len || memcmp(out, c->encoded, short_len) != 0 ||
+            !guard_intact(out + expected_len - 1)) {
+            printf("FAIL  %-8s %-10s overran a buffer of %zu bytes\n", c->label, c->charset,
+                   expected_len - 1);
+            failed++;
+        }
+    }
+
+    if (failed == 0) {
+        printf("ok    %-8s %-10s %zu -> %zu bytes\n", c->label, c->charset, len, out_len);
+    }
+    return failed;
+}
+
+int main(void) {
+    charset_init(0);
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        failed += check_case(&cases[i]);
+    }
+    if (failed > 0) {
+        printf("%d check(s) failed\n", failed);
+        return 1;
+    }
+    printf("All charset checks passed\n");
+    return 0;
+}
@@ -0,0 +1,168 @@
+// Room check against a running line mode server with TELNET_ROOMS=1
+//
+// Connects several members, which all land in the default room, and has
+// the first one post a line holding a 0xFF data byte (sent as IAC IAC, as
+// a telnet client does). Every member, the sender included, must receive
+// the room message, and no 0xFF in it may reach a member unescaped: a lone
+// IAC would be taken as a telnet command injected by another member.
+//
+// Rooms connect the sessions of one process, so run the server in the
+// reactor model (or prefork with one worker) for the members to meet.
+//
+// Under TELNET_UTF8_POLICY=reject the line is dropped instead, which
+// passes as long as nobody receives it.
+//
+// Usage: check_room [-a address] [-p port] [-m members]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define ROOM_CHECK_MAX_MEMBERS 16
+#define ROOM_CHECK_TIMEOUT 3.0         // Seconds for the message to arrive
+#define ROOM_CHECK_SETTLE_US 300000    // Negotiation and room join after connecting
+#define ROOM_CHECK_BUF 65536
+#define ROOM_CHECK_REJECTED "Invalid UTF-8 input, line dropped"
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Read whatever arrives within timeout seconds, or until the buffer holds
+// the token followed by CRLF. Returns the bytes held.
+static size_t receive(int fd, unsigned char *buf, size_t len, const char *token, double timeout) {
+    double end = now_sec() + timeout;
+    while (len < ROOM_CHECK_BUF && now_sec() < end) {
+        ssize_t n = recv(fd, buf + len, ROOM_CHECK_BUF - len, 0);
+        if (n <= 0) {
+            if (n == 0) {
+                break;
+            }
+            continue;              // Receive timeout: look at the clock again
+        }
+        len += (size_t)n;
+        unsigned char *at = token != NULL ? memmem(buf, len, token, strlen(token)) : NULL;
+        if (at != NULL && memmem(at, len - (size_t)(at - buf), "\r\n", 2) != NULL) {
+            break;
+        }
+    }
+    return len;
+}
+
+// Check the room message in what a member received. Returns 0 when it is
+// there with every 0xFF doubled.
+static int check_message(int member, const unsigned char *buf, size_t len, const char *token) {
+    const unsigned char *at = memmem(buf, len, token, strlen(token));
+    const unsigned char *end = at != NULL ? memmem(at, len - (size_t)(at - buf), "\r\n", 2) : NULL;
+    if (end == NULL) {
+        printf("FAIL  member %d did not receive the room message\n", member);
+        return 1;
+    }
+    for (const unsigned char *p = at; p < end; p++) {
+        if (*p == 0xFF) {
+            if (p + 1 == end || p[1] != 0xFF) {
+                printf("FAIL  member %d received a lone IAC (0xFF %02X) in the room message\n",
+                       member, p + 1 < end ? p[1] : 0);
+                return 1;
+            }
+            p++;
+        }
+    }
+    printf("ok    member %d received the room message (%zu bytes)\n", member, (size_t)(end - at));
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *address = "127.0.0.1";
+    int port = 9091;
+    int members = 2;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:p:m:")) != -1) {
+        switch (opt) {
+        case 'a': address = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'm': members = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-a address] [-p port] [-m members]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (members < 1 || members > ROOM_CHECK_MAX_MEMBERS) {
+        fprintf(stderr, "Members must be 1 to %d\n", ROOM_CHECK_MAX_MEMBERS);
+        return 1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address: %s\n", address);
+        return 1;
+    }
+
+    int fds[ROOM_CHECK_MAX_MEMBERS];
+    static unsigned char bufs[ROOM_CHECK_MAX_MEMBERS][ROOM_CHECK_BUF];
+    size_t lens[ROOM_CHECK_MAX_MEMBERS];
+    for (int i = 0; i < members; i++) {
+        fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+        if (fds[i] == -1 || connect(fds[i], (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+            perror("connect");
+            return 1;
+        }
+        struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+        setsockopt(fds[i], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+    usleep(ROOM_CHECK_SETTLE_US);
+    for (int i = 0; i < members; i++) {
+        receive(fds[i], bufs[i], 0, NULL, 0.2);    // Greeting and negotiation
+    }
+
+    // The token ends before the data byte, so a message repaired to U+FFFD
+    // is found as well as one that keeps the byte
+    char token[64];
+    snprintf(token, sizeof(token), "room-check-%d:", (int)getpid());
+    unsigned char line[128];
+    size_t line_len = (size_t)snprintf((char *)line, sizeof(line), "%s", token);
+    line[line_len++] = 0xFF;                       // Data byte 0xFF, escaped
+    line[line_len++] = 0xFF;
+    memcpy(line + line_len, "after\r\n", 7);
+    line_len += 7;
+    if (send(fds[0], line, line_len, 0) != (ssize_t)line_len) {
+        perror("send");
+        return 1;
+    }
+
+    int failed = 0;
+    lens[0] = receive(fds[0], bufs[0], 0, token, ROOM_CHECK_TIMEOUT);
+    int rejected = memmem(bufs[0], lens[0], ROOM_CHECK_REJECTED, strlen(ROOM_CHECK_REJECTED)) != NULL;
+    for (int i = 0; i < members; i++) {
+        if (i > 0) {
+            lens[i] = receive(fds[i], bufs[i], 0, token, rejected ? 0.5 : ROOM_CHECK_TIMEOUT);
+        }
+        if (!rejected) {
+            failed += check_message(i, bufs[i], lens[i], token);
+        } else if (memmem(bufs[i], lens[i], token, strlen(token)) != NULL) {
+            printf("FAIL  member %d received a line the server rejected\n", i);
+            failed++;
+        } else {
+            printf("ok    member %d: line rejected by the UTF-8 policy\n", i);
+        }
+        close(fds[i]);
+    }
+    if (failed > 0) {
+        printf("%d member(s) failed\n", failed);
+        return 1;
+    }
+    printf("All room checks passed\n");
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "coro_session.h"
+#include "line_buffer.h"
+#include "telnet_proto.h"
+
+// Output of the coroutine running on this worker thread
+static __thread line_buffer_t coro_out = { .limit = LINE_BUFFER_UNLIMITED };
+
+static const coro_protocol_t *coro_protocol(session_t *session) {
+    return (const coro_protocol_t *)session->ops;
+}
+
+void coro_send(coro_t *co, const void *data, size_t len) {
+    size_t taken = line_buffer_append(&coro_out, data, len);
+    if (taken < len) {
+        // Out of memory: send what is gathered so far, then the rest directly
+        session_send(co->session, coro_out.data, coro_out.len);
+        coro_out.len = 0;
+        session_send(co->session, (const unsigned char *)data + taken, len - taken);
+    }
+}
+
+void coro_send_escaped(coro_t *co, const unsigned char *data, size_t len) {
+    static const unsigned char iac_iac[2] = { IAC, IAC };
+    while (len > 0) {
+        const unsigned char *iac = memchr(data, IAC, len);
+        size_t run = iac != NULL ? (size_t)(iac - data) : len;
+        coro_send(co, data, run);
+        if (iac == NULL) {
+            break;
+        }
+        coro_send(co, iac_iac, sizeof(iac_iac));
+        data += run + 1;
+        len -= run + 1;
+    }
+}
+
+// Send the gathered output and give the scratch memory back
+static void coro_flush(session_t *session) {
+    if (coro_out.len > 0) {
+        session_send(session, coro_out.data, coro_out.len);
+        coro_out.len = 0;
+    }
+    line_buffer_trim(&coro_out);
+}
+
+// Resume the coroutine with the given input until it suspends or finishes
+static void coro_resume(session_t *session, coro_t *co, const unsigned char *data, size_t len) {
+    co->data = data;
+    co->len = len;
+    co->clock = session_clock(session);
+    if (len > 0) {
+        capture_record(co->capture, data, len);
+    }
+    if (coro_protocol(session)->run(co) == CORO_DONE) {
+        co->done = 1;
+    }
+    co->data = NULL;
+    co->len = 0;
+    coro_flush(session);
+    latency_mark(co->clock, LAT_SEND);
+    if (co->done) {
+        session_close(session);
+    }
+}
+
+void coro_session_open(session_t *session) {
+    const coro_protocol_t *protocol = coro_protocol(session);
+    coro_t *co = session_alloc(protocol->state_size);
+    if (co == NULL) {
+        perror("Failed to allocate session");
+        session_close(session);
+        return;
+    }
+    session->state = co;
+    co->session = session;
+
+    // Run up to the first wait for input
+    coro_resume(session, co, NULL, 0);
+}
+
+void coro_session_input(session_t *session, const unsigned char *data, size_t len) {
+    coro_t *co = session->state;
+    if (co == NULL || co->done) {
+        return;
+    }
+    coro_resume(session, co, data, len);
+}
+
+void coro_session_tick(session_t *session) {
+    coro_t *co = session->state;
+    const coro_protocol_t *protocol = coro_protocol(session);
+    if (co == NULL || co->done || protocol->tick == NULL) {
+        return;
+    }
+    protocol->tick(co);
+    coro_flush(session);
+}
+
+void coro_session_writable(session_t *session) {
+    coro_t *co = session->state;
+    const coro_protocol_t *protocol = coro_protocol(session);
+    if (co == NULL || co->done || protocol->writable == NULL) {
+        return;
+    }
+    protocol->writable(co);
+    coro_flush(session);
+}
+
+void coro_session_close(session_t *session) {
+    coro_t *co = session->state;
+    if (co == NULL) {
+        return;
+    }
+    const coro_protocol_t *protocol = coro_protocol(session);
+    if (protocol->close != NULL) {
+        protocol->close(co);
+    }
+    capture_close(co->capture);
+    session_free(co, protocol->state_size);
+    session->state = NULL;
+}
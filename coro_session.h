@@ -0,0 +1,98 @@
+#ifndef CORO_SESSION_H
+#define CORO_SESSION_H
+
+#include <stddef.h>
+
+#include "latency_hist.h"
+#include "reactor.h"
+#include "session_capture.h"
+
+// Stackless coroutine sessions on the reactor core.
+//
+// A protocol written against session_ops_t is a set of callbacks fed one
+// receive segment at a time. A coroutine session is instead one function
+// that reads like the old blocking handle_client() loop: it takes input
+// with CORO_GETC()/CORO_RECV(), which suspend the session until the
+// client sends more, and answers with coro_send(). The coroutine has no
+// stack of its own. Suspending records the source line to resume at and
+// returns to the worker, so the session costs its coro_t (a few dozen
+// bytes) plus the protocol state the function keeps between suspensions.
+//
+// The rules that come with that:
+//   - Locals do not survive a suspension; keep anything needed afterwards
+//     in the protocol state, which embeds coro_t as its first member.
+//   - Only one CORO_* suspension per source line, and none inside a
+//     switch statement of the function itself.
+//   - Output from coro_send() is gathered while the coroutine runs and
+//     leaves in one send when it suspends.
+//
+// Periodic work (a timestamp) runs in the protocol's tick callback, next to
+// the coroutine rather than inside it, and so does output produced while
+// the client reads (the writable callback); both send with coro_send() too.
+
+#define CORO_WAITING 0
+#define CORO_DONE 1
+
+typedef struct coro {
+    session_t *session;
+    int resume;                    // Line to resume at, 0 before the first run
+    int done;                      // The function returned CORO_DONE
+    const unsigned char *data;     // Unread part of the current receive segment
+    size_t len;
+    latency_clock_t *clock;        // Timing of that segment
+    session_capture_t *capture;    // Set by the protocol to record the input
+} coro_t;
+
+typedef struct coro_protocol {
+    session_ops_t ops;             // Handed to the reactor (first member)
+    size_t state_size;             // Protocol state, starting with its coro_t
+    int (*run)(coro_t *co);        // The coroutine: CORO_WAITING or CORO_DONE
+    void (*tick)(coro_t *co);      // Every ops.tick_seconds (may be NULL)
+    void (*close)(coro_t *co);     // Release what the state holds (may be NULL)
+    void (*writable)(coro_t *co);  // After session_notify_writable() (may be NULL)
+} coro_protocol_t;
+
+// session_ops_t for a coroutine protocol ticking every tick_seconds
+#define CORO_SESSION_OPS(tick_seconds_) {    \
+        .open = coro_session_open,           \
+        .input = coro_session_input,         \
+        .tick = coro_session_tick,           \
+        .close = coro_session_close,         \
+        .writable = coro_session_writable,   \
+        .tick_seconds = (tick_seconds_)      \
+    }
+
+#define CORO_BEGIN(co) switch ((co)->resume) { case 0:
+
+#define CORO_END(co) } return CORO_DONE
+
+// Return to the worker and continue here on the next receive segment
+#define CORO_SUSPEND(co) \
+    do { (co)->resume = __LINE__; return CORO_WAITING; case __LINE__:; } while (0)
+
+// Wait for the next receive segment; co->data and co->len hold all of it
+// afterwards, and whatever is left unread at the next suspension is dropped
+#define CORO_RECV(co) \
+    do { (co)->len = 0; CORO_SUSPEND(co); } while (0)
+
+// Take the next input byte into out, waiting for input when there is none
+#define CORO_GETC(co, out) \
+    do { while ((co)->len == 0) CORO_SUSPEND(co); (out) = *(co)->data++; (co)->len--; } while (0)
+
+// End the session once the output has been sent
+#define CORO_EXIT(co) return CORO_DONE
+
+// Queue output; the batch goes to the client when the coroutine suspends
+void coro_send(coro_t *co, const void *data, size_t len);
+
+// Queue data bytes, doubling 0xFF to IAC IAC
+void coro_send_escaped(coro_t *co, const unsigned char *data, size_t len);
+
+// session_ops_t callbacks behind CORO_SESSION_OPS()
+void coro_session_open(session_t *session);
+void coro_session_input(session_t *session, const unsigned char *data, size_t len);
+void coro_session_tick(session_t *session);
+void coro_session_close(session_t *session);
+void coro_session_writable(session_t *session);
+
+#endif
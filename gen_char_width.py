@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+# Generate char_width_table.h, the display width table used by char_width.c.
+#
+# Widths follow the usual wcwidth() rules on top of the Unicode database of
+# this Python:
+#   0  nonspacing and enclosing marks (Mn, Me), format characters (Cf)
+#      except SOFT HYPHEN, ZERO WIDTH SPACE and the conjoining Hangul Jamo
+#      vowels and final consonants, controls (Cc)
+#   2  East Asian Wide and Fullwidth characters, and the unassigned code
+#      points of the CJK ideograph planes
+#   1  everything else
+#
+# The table has two stages: CHAR_WIDTH_STAGE1[cp >> 8] selects a 256 code
+# point block in CHAR_WIDTH_STAGE2, which packs four 2-bit widths per byte.
+# Identical blocks are stored once.
+#
+# Usage: python3 gen_char_width.py > char_width_table.h
+
+import sys
+import unicodedata
+
+BLOCK_SHIFT = 8
+BLOCK = 1 << BLOCK_SHIFT
+LAST = 0x10FFFF
+
+
+def width(cp):
+    if cp < 0x20 or 0x7F <= cp < 0xA0:
+        return 0
+    if cp == 0x00AD:
+        return 1
+    if cp == 0x200B or 0x1160 <= cp <= 0x11FF or 0xD7B0 <= cp <= 0xD7FF:
+        return 0
+    ch = chr(cp)
+    if unicodedata.category(ch) in ('Mn', 'Me', 'Cf'):
+        return 0
+    if unicodedata.east_asian_width(ch) in ('W', 'F'):
+        return 2
+    if 0x3400 <= cp <= 0x4DBF or 0x4E00 <= cp <= 0x9FFF or 0xF900 <= cp <= 0xFAFF:
+        return 2
+    if 0x20000 <= cp <= 0x2FFFD or 0x30000 <= cp <= 0x3FFFD:
+        return 2
+    return 1
+
+
+def main():
+    blocks = []
+    index = {}
+    stage1 = []
+    for start in range(0, LAST + 1, BLOCK):
+        packed = bytearray(BLOCK // 4)
+        for i in range(BLOCK):
+            packed[i >> 2] |= width(start + i) << ((i & 3) * 2)
+        packed = bytes(packed)
+        if packed not in index:
+            index[packed] = len(blocks)
+            blocks.append(packed)
+        stage1.append(index[packed])
+    if len(blocks) > 256:
+        sys.exit('too many distinct blocks for an 8-bit stage 1')
+
+    out = sys.stdout
+    out.write('// Generated by gen_char_width.py from Unicode %s; do not edit.\n\n'
+              % unicodedata.unidata_version)
+    out.write('#define CHAR_WIDTH_BLOCK_SHIFT %d\n\n' % BLOCK_SHIFT)
+    out.write('static const unsigned char CHAR_WIDTH_STAGE1[%d] = {\n' % len(stage1))
+    for i in range(0, len(stage1), 16):
+        out.write('    ' + ', '.join('%d' % b for b in stage1[i:i + 16]) + ',\n')
+    out.write('};\n\n')
+    out.write('static const unsigned char CHAR_WIDTH_STAGE2[%d][%d] = {\n' % (len(blocks), BLOCK // 4))
+    for block in blocks:
+        out.write('    {\n')
+        for i in range(0, len(block), 16):
+            out.write('        ' + ', '.join('0x%02x' % b for b in block[i:i + 16]) + ',\n')
+        out.write('    },\n')
+    out.write('};\n')
+
+
+if __name__ == '__main__':
+    main()
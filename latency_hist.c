@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/mman.h>
+
+#include "latency_hist.h"
+#include "server_config.h"
+#include "server_stats.h"
+
+#define LATENCY_DEFAULT_SAMPLE_EVERY 16
+
+typedef struct {
+    volatile uint32_t sample_every;
+    double ns_per_cycle;
+} latency_control_t;
+
+typedef struct {
+    latency_histogram_t stages[LAT_STAGE_COUNT];
+} latency_worker_t;
+
+static uint32_t latency_disabled = 0;
+volatile uint32_t *latency_sample_every = &latency_disabled;
+__thread uint32_t latency_countdown = 1;
+
+static latency_control_t *latency_control = NULL;
+static latency_worker_t *latency_workers = NULL;
+
+#define LATENCY_LABEL_ENTRY(id, label) label,
+static const char *stage_labels[LAT_STAGE_COUNT] = {
+    LATENCY_STAGES(LATENCY_LABEL_ENTRY)
+};
+#undef LATENCY_LABEL_ENTRY
+
+static const double report_quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+#define REPORT_QUANTILE_COUNT (sizeof(report_quantiles) / sizeof(report_quantiles[0]))
+
+static int bucket_index(uint64_t value) {
+    if (value < LATENCY_SUB_BUCKETS) {
+        return (int)value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent > LATENCY_MAX_EXPONENT) {
+        return LATENCY_BUCKETS - 1;
+    }
+    int sub = (int)(value >> (exponent - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1);
+    return (exponent - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS + sub;
+}
+
+// Upper bound (exclusive) of the values that land in a bucket
+static uint64_t bucket_limit(int index) {
+    if (index < LATENCY_SUB_BUCKETS) {
+        return (uint64_t)index + 1;
+    }
+    int exponent = index / LATENCY_SUB_BUCKETS + LATENCY_SUB_BITS - 1;
+    uint64_t sub = (uint64_t)(index % LATENCY_SUB_BUCKETS);
+    return (LATENCY_SUB_BUCKETS + sub + 1) << (exponent - LATENCY_SUB_BITS);
+}
+
+// Single writer per slot: relaxed load/store keeps readers tear-free
+// without paying for a locked instruction.
+static inline void slot_add(uint64_t *field, uint64_t value) {
+    __atomic_store_n(field, __atomic_load_n(field, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+void latency_wait_readable(int fd) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    poll(&pfd, 1, -1);
+}
+
+void latency_end(latency_clock_t *clock) {
+    if (!clock->active || latency_workers == NULL) {
+        return;
+    }
+    int worker = stats_worker_index();
+    if (worker < 0) {
+        return;
+    }
+
+    clock->stage_cycles[LAT_SEGMENT] = clock->last - clock->start;
+    clock->touched |= 1u << LAT_SEGMENT;
+
+    latency_worker_t *slot = &latency_workers[worker];
+    for (int stage = 0; stage < LAT_STAGE_COUNT; stage++) {
+        if (!(clock->touched & (1u << stage))) {
+            continue;
+        }
+        uint64_t cycles = clock->stage_cycles[stage];
+        latency_histogram_t *hist = &slot->stages[stage];
+        slot_add(&hist->buckets[bucket_index(cycles)], 1);
+        slot_add(&hist->count, 1);
+        slot_add(&hist->sum, cycles);
+        if (cycles > hist->max) {
+            __atomic_store_n(&hist->max, cycles, __ATOMIC_RELAXED);
+        }
+    }
+    clock->active = 0;
+}
+
+// Measure TSC ticks against CLOCK_MONOTONIC over a short interval
+static double calibrate_ns_per_cycle(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec start, end, pause = { .tv_sec = 0, .tv_nsec = 20000000 };
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t tsc_start = latency_now();
+    nanosleep(&pause, NULL);
+    uint64_t tsc_end = latency_now();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ns = (double)(end.tv_sec - start.tv_sec) * 1e9 + (double)(end.tv_nsec - start.tv_nsec);
+    if (tsc_end <= tsc_start || ns <= 0) {
+        return 1.0;
+    }
+    return ns / (double)(tsc_end - tsc_start);
+#else
+    return 1.0;  // latency_now() already returns nanoseconds
+#endif
+}
+
+// Merge every worker's histogram for one stage
+static void merge_stage(int stage, latency_histogram_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (int w = 0; w < STATS_MAX_WORKERS; w++) {
+        const latency_histogram_t *hist = &latency_workers[w].stages[stage];
+        uint64_t count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+        if (count == 0) {
+            continue;
+        }
+        out->count += count;
+        out->sum += __atomic_load_n(&hist->sum, __ATOMIC_RELAXED);
+        uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+        if (max > out->max) {
+            out->max = max;
+        }
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            out->buckets[b] += __atomic_load_n(&hist->buckets[b], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Value (in ns) below which the given fraction of samples fall
+static double histogram_quantile(const latency_histogram_t *hist, double quantile) {
+    if (hist->count == 0) {
+        return 0.0;
+    }
+    uint64_t rank = (uint64_t)(quantile * (double)hist->count);
+    if (rank >= hist->count) {
+        rank = hist->count - 1;
+    }
+    uint64_t seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += hist->buckets[b];
+        if (seen > rank) {
+            uint64_t limit = bucket_limit(b);
+            if (limit > hist->max) {
+                limit = hist->max;
+            }
+            return (double)limit * latency_control->ns_per_cycle;
+        }
+    }
+    return (double)hist->max * latency_control->ns_per_cycle;
+}
+
+static size_t latency_table(char *buf, size_t size) {
+    static latency_histogram_t merged;
+    size_t len = 0;
+
+    len = stats_appendf(buf, size, len, "sampling: 1 in %u segments%s\n",
+                        *latency_sample_every, *latency_sample_every == 0 ? " (disabled)" : "");
+    len = stats_appendf(buf, size, len, "%-8s %10s %10s %10s %10s %10s %10s %10s\n",
+                        "stage", "count", "mean_ns", "p50_ns", "p90_ns", "p99_ns", "p999_ns", "max_ns");
+    for (int stage = 0; stage < LAT_STAGE_COUNT; stage++) {
+        merge_stage(stage, &merged);
+        double mean = merged.count ? (double)merged.sum / (double)merged.count *
+                                     latency_control->ns_per_cycle : 0.0;
+        len = stats_appendf(buf, size, len, "%-8s %10llu %10.0f", stage_labels[stage],
+                            (unsigned long long)merged.count, mean);
+        for (size_t q = 0; q < REPORT_QUANTILE_COUNT; q++) {
+            len = stats_appendf(buf, size, len, " %10.0f",
+                                histogram_quantile(&merged, report_quantiles[q]));
+        }
+        len = stats_appendf(buf, size, len, " %10.0f\n",
+                            (double)merged.max * latency_control->ns_per_cycle);
+    }
+    return len;
+}
+
+// "/latency" shows the table; "/latency?every=N" changes the sampling rate
+static size_t latency_admin_handler(const char *args, char *buf, size_t size) {
+    size_t len = 0;
+    if (strncmp(args, "every=", 6) == 0) {
+        char *end;
+        long every = strtol(args + 6, &end, 10);
+        if (end != args + 6 && every >= 0) {
+            __atomic_store_n(&latency_control->sample_every, (uint32_t)every, __ATOMIC_RELAXED);
+            len = stats_appendf(buf, size, len, "sampling set to 1 in %ld segments\n", every);
+        }
+    }
+    return len + latency_table(buf + len, size - len);
+}
+
+// Prometheus summary per stage, appended to "/metrics"
+static size_t latency_metrics_handler(const char *args, char *buf, size_t size) {
+    static latency_histogram_t merged;
+    size_t len = 0;
+    (void)args;
+
+    len = stats_appendf(buf, size, len,
+                        "# HELP telnet_stage_latency_seconds Sampled time per receive segment spent in each stage.\n"
+                        "# TYPE telnet_stage_latency_seconds summary\n");
+    for (int stage = 0; stage < LAT_STAGE_COUNT; stage++) {
+        merge_stage(stage, &merged);
+        for (size_t q = 0; q < REPORT_QUANTILE_COUNT; q++) {
+            len = stats_appendf(buf, size, len,
+                                "telnet_stage_latency_seconds{stage=\"%s\",quantile=\"%g\"} %.9f\n",
+                                stage_labels[stage], report_quantiles[q],
+                                histogram_quantile(&merged, report_quantiles[q]) / 1e9);
+        }
+        len = stats_appendf(buf, size, len,
+                            "telnet_stage_latency_seconds_sum{stage=\"%s\"} %.9f\n"
+                            "telnet_stage_latency_seconds_count{stage=\"%s\"} %llu\n",
+                            stage_labels[stage],
+                            (double)merged.sum * latency_control->ns_per_cycle / 1e9,
+                            stage_labels[stage], (unsigned long long)merged.count);
+    }
+    return len;
+}
+
+int latency_init(int port) {
+    size_t size = sizeof(latency_control_t) + sizeof(latency_worker_t) * STATS_MAX_WORKERS;
+    void *region = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        perror("latency mmap failed");
+        return -1;
+    }
+
+    latency_control = (latency_control_t *)region;
+    latency_workers = (latency_worker_t *)((char *)region + sizeof(latency_control_t));
+    latency_control->ns_per_cycle = calibrate_ns_per_cycle();
+
+    long every = config_get_long("LATENCY_SAMPLE", port, LATENCY_DEFAULT_SAMPLE_EVERY);
+    latency_control->sample_every = every < 0 ? 0 : (uint32_t)every;
+    latency_sample_every = &latency_control->sample_every;
+
+    stats_admin_register("/latency", latency_admin_handler);
+    stats_admin_register_metrics(latency_metrics_handler);
+    return 0;
+}
+
+void latency_dump(FILE *out) {
+    static char table[8192];
+    if (latency_control == NULL) {
+        return;
+    }
+    latency_table(table, sizeof(table));
+    fputs(table, out);
+    fflush(out);
+}
@@ -0,0 +1,119 @@
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Per-stage latency histograms for the client receive path.
+//
+// A sampled receive segment is timed with the TSC at each stage boundary
+// by the session's input path. Time between two marks is charged to the stage named
+// by the later mark and accumulated for the segment; when the segment is
+// done each touched stage records one value into a log-linear histogram
+// (8 linear sub-buckets per power of two, <= 12.5% relative error).
+//
+// Histograms live in a MAP_SHARED region next to the live counters, one
+// set per worker slot, and are only written by the thread owning the slot,
+// so recording needs no atomics. The sampling rate is kept in the shared
+// region as well and can be changed at runtime through the admin port.
+
+#define LATENCY_SUB_BITS 3
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_EXPONENT 47   // 2^48 cycles is about a day at 3 GHz
+#define LATENCY_BUCKETS ((LATENCY_MAX_EXPONENT - LATENCY_SUB_BITS + 2) * LATENCY_SUB_BUCKETS)
+
+// X(enum suffix, label)
+#define LATENCY_STAGES(X) \
+    X(RECV, "recv") \
+    X(IAC, "iac") \
+    X(CHARSET, "charset") \
+    X(UTF8, "utf8") \
+    X(LINE, "line") \
+    X(SEND, "send") \
+    X(SEGMENT, "segment")
+
+#define LATENCY_ENUM_ENTRY(id, label) LAT_##id,
+typedef enum {
+    LATENCY_STAGES(LATENCY_ENUM_ENTRY)
+    LAT_STAGE_COUNT
+} latency_stage_t;
+#undef LATENCY_ENUM_ENTRY
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[LATENCY_BUCKETS];
+} latency_histogram_t;
+
+// Timing state for one receive segment (one per worker)
+typedef struct {
+    int active;
+    uint64_t start;
+    uint64_t last;
+    uint64_t stage_cycles[LAT_STAGE_COUNT];
+    unsigned int touched;
+} latency_clock_t;
+
+static inline uint64_t latency_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// 1 in *latency_sample_every segments is timed (0 disables sampling)
+extern volatile uint32_t *latency_sample_every;
+extern __thread uint32_t latency_countdown;
+
+static inline int latency_should_sample(void) {
+    uint32_t every = *latency_sample_every;
+    if (every == 0 || --latency_countdown > 0) {
+        return 0;
+    }
+    latency_countdown = every;
+    return 1;
+}
+
+static inline void latency_begin(latency_clock_t *clock, int sampled) {
+    clock->active = sampled;
+    if (sampled) {
+        clock->start = clock->last = latency_now();
+        clock->touched = 0;
+    }
+}
+
+// Charge the time since the previous mark to stage
+static inline void latency_mark(latency_clock_t *clock, latency_stage_t stage) {
+    if (clock->active) {
+        uint64_t now = latency_now();
+        if (clock->touched & (1u << stage)) {
+            clock->stage_cycles[stage] += now - clock->last;
+        } else {
+            clock->stage_cycles[stage] = now - clock->last;
+            clock->touched |= 1u << stage;
+        }
+        clock->last = now;
+    }
+}
+
+// Block until fd is readable, so that a sampled recv stage measures the
+// copy out of the socket rather than the client's think time
+void latency_wait_readable(int fd);
+
+// Record the segment's per-stage totals into the worker's histograms
+void latency_end(latency_clock_t *clock);
+
+// Create the shared histogram region and calibrate the TSC. Call in the
+// listener after stats_init() and before the first fork(). Registers the
+// "/latency" admin path and the latency summaries on "/metrics".
+int latency_init(int port);
+
+// Print per-stage percentiles of all workers combined (used for SIGUSR1)
+void latency_dump(FILE *out);
+
+#endif
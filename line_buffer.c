@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "line_buffer.h"
+#include "server_config.h"
+#include "server_stats.h"
+
+// Per-thread cache of LINE_BUFFER_SMALL blocks. The first word of a cached
+// block links to the next one.
+#define SMALL_POOL_MAX 256
+
+static __thread void *small_pool;
+static __thread int small_pool_count;
+
+static unsigned char *small_get(void) {
+    void *block = small_pool;
+    if (block != NULL) {
+        small_pool = *(void **)block;
+        small_pool_count--;
+        return block;
+    }
+    return malloc(LINE_BUFFER_SMALL);
+}
+
+static void small_put(unsigned char *block) {
+    if (small_pool_count >= SMALL_POOL_MAX) {
+        free(block);
+        return;
+    }
+    *(void **)block = small_pool;
+    small_pool = block;
+    small_pool_count++;
+}
+
+static void release(unsigned char *data, size_t capacity) {
+    if (capacity == LINE_BUFFER_SMALL) {
+        small_put(data);
+    } else {
+        free(data);
+    }
+    stats_add(STAT_SESSION_MEMORY_FREED, capacity);
+}
+
+size_t line_buffer_limit(int port) {
+    long limit = config_get_long("MAX_LINE", port, LINE_BUFFER_DEFAULT_LIMIT);
+    if (limit < LINE_BUFFER_MIN_LIMIT) {
+        fprintf(stderr, "TELNET_MAX_LINE raised to the minimum of %d bytes\n", LINE_BUFFER_MIN_LIMIT);
+        limit = LINE_BUFFER_MIN_LIMIT;
+    }
+    return (size_t)limit;
+}
+
+void line_buffer_init(line_buffer_t *buffer, size_t limit) {
+    buffer->data = NULL;
+    buffer->len = 0;
+    buffer->capacity = 0;
+    buffer->limit = limit;
+}
+
+void line_buffer_free(line_buffer_t *buffer) {
+    if (buffer->data != NULL) {
+        release(buffer->data, buffer->capacity);
+    }
+    buffer->data = NULL;
+    buffer->len = 0;
+    buffer->capacity = 0;
+}
+
+int line_buffer_reserve(line_buffer_t *buffer, size_t capacity) {
+    if (capacity <= buffer->capacity) {
+        return 0;
+    }
+
+    // Small pooled block, then doubling, then whole chunks
+    size_t rounded = LINE_BUFFER_SMALL;
+    while (rounded < capacity && rounded < LINE_BUFFER_CHUNK) {
+        rounded *= 2;
+    }
+    if (rounded < capacity) {
+        rounded = (capacity + LINE_BUFFER_CHUNK - 1) / LINE_BUFFER_CHUNK * LINE_BUFFER_CHUNK;
+    }
+
+    unsigned char *data;
+    if (rounded == LINE_BUFFER_SMALL) {
+        data = small_get();
+    } else if (buffer->capacity == LINE_BUFFER_SMALL) {
+        data = malloc(rounded);
+        if (data != NULL) {
+            memcpy(data, buffer->data, buffer->len);
+            small_put(buffer->data);
+        }
+    } else {
+        data = realloc(buffer->data, rounded);
+    }
+    if (data == NULL) {
+        return -1;
+    }
+    stats_add(STAT_SESSION_MEMORY_ALLOCATED, rounded - buffer->capacity);
+    buffer->data = data;
+    buffer->capacity = rounded;
+    return 0;
+}
+
+size_t line_buffer_append(line_buffer_t *buffer, const void *data, size_t len) {
+    size_t room = buffer->limit - buffer->len;
+    if (len > room) {
+        len = room;
+    }
+    if (len == 0 || line_buffer_reserve(buffer, buffer->len + len) == -1) {
+        return 0;
+    }
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+    return len;
+}
+
+void line_buffer_consume(line_buffer_t *buffer, size_t count) {
+    if (count >= buffer->len) {
+        buffer->len = 0;
+        line_buffer_trim(buffer);
+        return;
+    }
+    memmove(buffer->data, buffer->data + count, buffer->len - count);
+    buffer->len -= count;
+}
+
+void line_buffer_trim(line_buffer_t *buffer) {
+    if (buffer->len == 0 && buffer->data != NULL) {
+        line_buffer_free(buffer);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef LINE_BUFFER_H
+#define LINE_BUFFER_H
+
+#include <stddef.h>
+
+// Growable byte buffer for line assembly, carried-over protocol bytes,
+// queued output and echo scratch space.
+//
+// Storage is one contiguous block, so UTF-8 validation, transcoding and
+// line-ending searches keep working on plain pointers. An empty buffer
+// holds no memory at all: the first bytes get a LINE_BUFFER_SMALL block
+// from a per-thread pool (most leftovers are a few bytes of a partial line
+// or telnet command), larger contents grow by doubling up to
+// LINE_BUFFER_CHUNK and by whole chunks after that. Appends stop at the
+// buffer's limit (TELNET_MAX_LINE for lines); the caller then streams the
+// buffered part out and continues. line_buffer_trim() gives everything
+// back once the buffer is empty, so an idle session costs nothing here.
+//
+// Capacity changes are counted in the session memory counters.
+
+#define LINE_BUFFER_SMALL 128
+#define LINE_BUFFER_CHUNK 4096
+#define LINE_BUFFER_DEFAULT_LIMIT (64 * 1024)
+#define LINE_BUFFER_MIN_LIMIT 256
+#define LINE_BUFFER_UNLIMITED ((size_t)-1)
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t capacity;
+    size_t limit;              // Maximum len accepted by line_buffer_append()
+} line_buffer_t;
+
+// Maximum line length for a port (TELNET_MAX_LINE[_<port>])
+size_t line_buffer_limit(int port);
+
+// Start empty, without allocating
+void line_buffer_init(line_buffer_t *buffer, size_t limit);
+
+void line_buffer_free(line_buffer_t *buffer);
+
+// Make room for at least capacity bytes, ignoring the limit (scratch use).
+// Returns 0, or -1 when out of memory (the buffer is left unchanged).
+int line_buffer_reserve(line_buffer_t *buffer, size_t capacity);
+
+// Append up to the limit. Returns the number of bytes appended, which is
+// less than len when the limit is reached or memory runs out.
+size_t line_buffer_append(line_buffer_t *buffer, const void *data, size_t len);
+
+// Drop the first count bytes
+void line_buffer_consume(line_buffer_t *buffer, size_t count);
+
+// Give the memory back once the buffer is empty
+void line_buffer_trim(line_buffer_t *buffer);
+
+#endif
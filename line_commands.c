@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "line_commands.h"
+#include "line_session.h"
+
+#define PRIMES_MAX 200000000UL
+#define SEQ_MAX 1000000UL
+
+static int rooms = 0;          // Room mode: /help lists /join
+
+void line_commands_configure(int room_mode) {
+    rooms = room_mode;
+}
+
+// Match cmd against name, followed by the end of the line or a space.
+// Returns the argument text (possibly empty), or NULL when it is not name.
+static const char *command_match(const char *cmd, const char *name) {
+    size_t len = strlen(name);
+    if (strncmp(cmd, name, len) != 0 || (cmd[len] != '\0' && cmd[len] != ' ')) {
+        return NULL;
+    }
+    cmd += len;
+    while (*cmd == ' ') {
+        cmd++;
+    }
+    return cmd;
+}
+
+// Count the primes up to limit with an odd-only bit sieve.
+// Returns -1 when out of memory.
+static long count_primes(unsigned long limit) {
+    if (limit < 2) {
+        return 0;
+    }
+    // Bit i stands for the odd number 2i + 1
+    unsigned long odd_count = (limit + 1) / 2;
+    unsigned char *composite = calloc((odd_count + 7) / 8, 1);
+    if (composite == NULL) {
+        return -1;
+    }
+    long count = 1;   // 2
+    for (unsigned long i = 1; i < odd_count; i++) {
+        if (composite[i >> 3] & (1u << (i & 7))) {
+            continue;
+        }
+        count++;
+        unsigned long p = 2 * i + 1;
+        for (unsigned long j = (p * p) / 2; j < odd_count; j += p) {
+            composite[j >> 3] |= (unsigned char)(1u << (j & 7));
+        }
+    }
+    free(composite);
+    return count;
+}
+
+uint32_t line_command_process(const char *cmd, char *buf, uint32_t buflen, uint32_t *pvar) {
+    const char *arg;
+    int len;
+
+    if (command_match(cmd, "/help") != NULL) {
+        len = snprintf(buf, buflen,
+                       "Commands:\r\n"
+                       "%s"
+                       "  /primes N   count the primes up to N\r\n"
+                       "  /seq N      print the numbers 1 to N\r\n"
+                       "  /bye        disconnect\r\n",
+                       rooms ? "  /join <room> switch to another room\r\n" : "");
+        return (uint32_t)len;
+    }
+
+    if ((arg = command_match(cmd, "/primes")) != NULL) {
+        unsigned long limit = strtoul(arg, NULL, 10);
+        if (limit > PRIMES_MAX) {
+            len = snprintf(buf, buflen, "ERROR: N must be at most %lu.\r\n", PRIMES_MAX);
+            return (uint32_t)len;
+        }
+        long count = count_primes(limit);
+        if (count < 0) {
+            len = snprintf(buf, buflen, "ERROR: Out of memory.\r\n");
+        } else {
+            len = snprintf(buf, buflen, "%ld primes up to %lu\r\n", count, limit);
+        }
+        return (uint32_t)len;
+    }
+
+    if ((arg = command_match(cmd, "/seq")) != NULL) {
+        unsigned long last = strtoul(arg, NULL, 10);
+        if (last > SEQ_MAX) {
+            len = snprintf(buf, buflen, "ERROR: N must be at most %lu.\r\n", SEQ_MAX);
+            return (uint32_t)len;
+        }
+        // *pvar is the last number already written
+        uint32_t used = 0;
+        while (*pvar < last) {
+            char line[24];
+            int n = snprintf(line, sizeof(line), "%lu\r\n", (unsigned long)*pvar + 1);
+            if (used + (uint32_t)n > buflen) {
+                return used | LINE_COMMAND_REPEAT;
+            }
+            memcpy(buf + used, line, n);
+            used += (uint32_t)n;
+            (*pvar)++;
+        }
+        return used;
+    }
+
+    if (command_match(cmd, "/bye") != NULL) {
+        len = snprintf(buf, buflen, "Disconnecting\r\n");
+        return (uint32_t)len | LINE_COMMAND_CLOSE;
+    }
+
+    len = snprintf(buf, buflen, "ERROR: Unknown command '%.64s'. Type /help.\r\n", cmd);
+    return (uint32_t)len;
+}
@@ -0,0 +1,22 @@
+#ifndef LINE_COMMANDS_H
+#define LINE_COMMANDS_H
+
+#include <stdint.h>
+
+// Built-in commands for the line mode servers (TELNET_COMMANDS=1), written
+// as a telnet_server_process() style hook (see line_session.h):
+//
+//   /help          list the commands
+//   /primes N      count the primes up to N (CPU-bound, N <= 200000000)
+//   /seq N         print 1..N, one number per line (large reply, N <= 1000000)
+//   /bye           say goodbye and disconnect
+//
+// Unknown commands get an error line. In room mode /help also lists
+// "/join <room>", which the line session handles itself.
+
+// List the room commands in /help; call before the first fork()
+void line_commands_configure(int rooms);
+
+uint32_t line_command_process(const char *cmd, char *buf, uint32_t buflen, uint32_t *pvar);
+
+#endif
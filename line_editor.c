@@ -0,0 +1,719 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "char_width.h"
+#include "line_editor.h"
+#include "server_stats.h"
+#include "telnet_proto.h"
+
+// Control characters
+#define CTRL_A 1
+#define CTRL_B 2
+#define CTRL_E 5
+#define CTRL_F 6
+#define BACKSPACE 8
+#define CTRL_K 11
+#define CTRL_L 12
+#define CTRL_N 14
+#define CTRL_P 16
+#define CTRL_U 21
+#define CTRL_W 23
+#define ESC 27
+#define DEL 127
+
+// Escape sequence parser states
+#define ESCAPE_NONE 0
+#define ESCAPE_START 1                 // After ESC
+#define ESCAPE_CSI 2                   // After ESC [, reading the first parameter
+#define ESCAPE_CSI_MORE 3              // Further CSI parameters (ignored)
+#define ESCAPE_SS3 4                   // After ESC O
+
+#define EDITOR_MAX_PARAM 1000
+#define EDITOR_HISTORY_LINE_MAX LINE_BUFFER_CHUNK   // Longer lines are not kept
+
+static void editor_put(line_buffer_t *out, const void *data, size_t len) {
+    line_buffer_append(out, data, len);
+}
+
+// CSI <n> <final>, with the parameter left out when it is 1
+static void editor_csi(line_buffer_t *out, int n, char final) {
+    char seq[16];
+    int len = n == 1 ? snprintf(seq, sizeof(seq), "\x1b[%c", final)
+                     : snprintf(seq, sizeof(seq), "\x1b[%d%c", n, final);
+    editor_put(out, seq, (size_t)len);
+}
+
+// Columns the line may use: the last one stays empty so that a full row
+// never wraps
+static int editor_view(const line_editor_t *editor) {
+    int view = editor->cols - 1 - editor->margin;
+    return view < LINE_EDITOR_MIN_COLS - 1 ? LINE_EDITOR_MIN_COLS - 1 : view;
+}
+
+// Byte at offset pos of the line; the text after the cursor sits at the end
+// of the block
+static unsigned char *editor_at(const line_editor_t *editor, size_t pos) {
+    size_t gap = editor->text.capacity - editor->text.len;
+    return editor->text.data + (pos < editor->cursor ? pos : pos + gap);
+}
+
+// Length and width of the character at pos (characters never straddle the gap)
+static size_t editor_char(const line_editor_t *editor, size_t pos, int *width) {
+    size_t end = pos < editor->cursor ? editor->cursor : editor->text.len;
+    return char_width_next(editor_at(editor, pos), end - pos, width);
+}
+
+// End of the character at pos together with the marks that combine with it
+static size_t editor_next(const line_editor_t *editor, size_t pos, int *width) {
+    pos += editor_char(editor, pos, width);
+    while (pos < editor->text.len) {
+        int mark;
+        size_t len = editor_char(editor, pos, &mark);
+        if (mark != 0) {
+            break;
+        }
+        pos += len;
+    }
+    return pos;
+}
+
+// Start of the character that ends at pos
+static size_t editor_back(const line_editor_t *editor, size_t pos) {
+    size_t floor = pos > editor->cursor ? editor->cursor : 0;
+    size_t start = pos - 1;
+    while (start > floor && pos - start < 4 && (*editor_at(editor, start) & 0xC0) == 0x80) {
+        start--;
+    }
+    int width;
+    if (editor_char(editor, start, &width) != pos - start) {
+        start = pos - 1;
+    }
+    return start;
+}
+
+// Start of the character before pos, stepping back over its marks
+static size_t editor_prev(const line_editor_t *editor, size_t pos, int *width) {
+    do {
+        pos = editor_back(editor, pos);
+        editor_char(editor, pos, width);
+    } while (*width == 0 && pos > 0);
+    return pos;
+}
+
+// Display width of the line from from to to
+static int editor_width(const line_editor_t *editor, size_t from, size_t to) {
+    size_t width = 0;
+    if (from < editor->cursor) {
+        size_t end = to < editor->cursor ? to : editor->cursor;
+        width += char_width_utf8(editor->text.data + from, end - from);
+    }
+    if (to > editor->cursor) {
+        size_t start = from > editor->cursor ? from : editor->cursor;
+        width += char_width_utf8(editor_at(editor, start), to - start);
+    }
+    return (int)width;
+}
+
+static void editor_emit(const line_editor_t *editor, size_t from, size_t to, line_buffer_t *out) {
+    if (from < editor->cursor) {
+        size_t end = to < editor->cursor ? to : editor->cursor;
+        editor_put(out, editor->text.data + from, end - from);
+    }
+    if (to > editor->cursor) {
+        size_t start = from > editor->cursor ? from : editor->cursor;
+        editor_put(out, editor_at(editor, start), to - start);
+    }
+}
+
+// Whether the cursor, at column col, and the character under it are on the row
+static int editor_fits(const line_editor_t *editor, int col) {
+    int width = 0;
+    if (editor->cursor < editor->text.len) {
+        editor_next(editor, editor->cursor, &width);
+    }
+    return col + width <= editor_view(editor);
+}
+
+// Move the terminal cursor to column col of the row
+static void editor_move(line_editor_t *editor, int col, line_buffer_t *out) {
+    if (col < editor->col) {
+        int n = editor->col - col;
+        if (col == 0 && editor->margin == 0) {
+            editor_put(out, "\r", 1);
+        } else if (n <= 3) {
+            editor_put(out, "\b\b\b", (size_t)n);
+        } else {
+            editor_csi(out, n, 'D');
+        }
+    } else if (col > editor->col) {
+        editor_csi(out, col - editor->col, 'C');
+    }
+    editor->col = col;
+}
+
+// Paint the row from pos (on the row) to the right edge, clear what is left
+// of the previous paint and put the cursor back
+static void editor_paint(line_editor_t *editor, size_t pos, line_buffer_t *out) {
+    int view = editor_view(editor);
+    int col = editor_width(editor, editor->scroll, pos);
+    editor_move(editor, col, out);
+
+    size_t end = pos;
+    while (end < editor->text.len) {
+        int width;
+        size_t next = editor_next(editor, end, &width);
+        if (col + width > view) {
+            break;
+        }
+        col += width;
+        end = next;
+    }
+    editor_emit(editor, pos, end, out);
+    editor->col = col;
+    if (col < editor->shown) {
+        editor_put(out, "\x1b[K", 3);
+    }
+    editor->shown = col;
+    editor->clipped = end < editor->text.len;
+    editor_move(editor, editor_width(editor, editor->scroll, editor->cursor), out);
+    stats_inc(STAT_EDIT_REPAINTS);
+}
+
+// Scroll so that the cursor is on the row with half a row of text before
+// it, or not at all when the line up to the cursor fits. Walks back from
+// the cursor by at most a row, however long the line is.
+static void editor_scroll(line_editor_t *editor) {
+    int view = editor_view(editor);
+    int width = 0;
+    if (editor->cursor < editor->text.len) {
+        editor_next(editor, editor->cursor, &width);
+    }
+    size_t pos = editor->cursor;
+    size_t half = pos;
+    while (pos > 0) {
+        int step;
+        size_t prev = editor_prev(editor, pos, &step);
+        if (width + step > view) {
+            editor->scroll = half;
+            return;
+        }
+        width += step;
+        pos = prev;
+        if (width <= view / 2) {
+            half = pos;
+        }
+    }
+    editor->scroll = 0;
+}
+
+// Scroll to the cursor and paint the whole row
+static void editor_repaint(line_editor_t *editor, line_buffer_t *out) {
+    editor_scroll(editor);
+    editor_paint(editor, editor->scroll, out);
+}
+
+// Move the gap to pos
+static void editor_seek(line_editor_t *editor, size_t pos) {
+    size_t gap = editor->text.capacity - editor->text.len;
+    unsigned char *data = editor->text.data;
+    if (pos < editor->cursor) {
+        memmove(data + pos + gap, data + pos, editor->cursor - pos);
+    } else if (pos > editor->cursor) {
+        memmove(data + editor->cursor, data + editor->cursor + gap, pos - editor->cursor);
+    }
+    editor->cursor = pos;
+}
+
+// Insert bytes at the cursor. Returns 0, or -1 over the limit or out of memory.
+static int editor_insert_bytes(line_editor_t *editor, const unsigned char *bytes, size_t len) {
+    line_buffer_t *text = &editor->text;
+    if (len == 0) {
+        return 0;
+    }
+    if (len > text->limit - text->len) {
+        return -1;
+    }
+    if (text->capacity - text->len < len) {
+        // Grow with the text in one piece, then move the tail back to the end
+        size_t tail = text->len - editor->cursor;
+        size_t old_capacity = text->capacity;
+        if (tail > 0) {
+            memmove(text->data + editor->cursor, text->data + old_capacity - tail, tail);
+        }
+        if (line_buffer_reserve(text, text->len + len) == -1) {
+            if (tail > 0) {
+                memmove(text->data + old_capacity - tail, text->data + editor->cursor, tail);
+            }
+            return -1;
+        }
+        if (tail > 0) {
+            memmove(text->data + text->capacity - tail, text->data + editor->cursor, tail);
+        }
+    }
+    memcpy(text->data + editor->cursor, bytes, len);
+    editor->cursor += len;
+    text->len += len;
+    return 0;
+}
+
+// Remove from..to, which has the cursor at one end; the cursor ends at from
+static void editor_remove(line_editor_t *editor, size_t from, size_t to) {
+    if (to == editor->cursor) {
+        editor->cursor = from;
+    } else {
+        editor_seek(editor, from);
+    }
+    editor->text.len -= to - from;
+}
+
+// Insert one character at the cursor and show it
+static int editor_insert(line_editor_t *editor, const unsigned char *ch, size_t len, line_buffer_t *out) {
+    if (editor_insert_bytes(editor, ch, len) == -1) {
+        return LINE_EDITOR_FULL;
+    }
+    stats_inc(STAT_CHARS_ECHOED);
+    int width = (int)char_width_utf8(ch, len);
+    int col = editor->col + width;
+    if (!editor_fits(editor, col)) {
+        editor_repaint(editor, out);
+    } else if (editor->cursor == editor->text.len || width == 0) {
+        // At the end the character is all there is to send; a mark
+        // combines with the character before it on the terminal as well
+        editor_put(out, ch, len);
+        editor->col = col;
+        if (editor->cursor == editor->text.len) {
+            editor->shown = col;
+        }
+    } else if (!editor->clipped && editor->shown + width <= editor_view(editor)) {
+        // Open room for it, the rest of the row shifts right
+        editor_csi(out, width, '@');
+        editor_put(out, ch, len);
+        editor->col = col;
+        editor->shown += width;
+    } else {
+        // The rest of the row would be pushed over the edge
+        editor_put(out, ch, len);
+        editor->col = col;
+        editor_paint(editor, editor->cursor, out);
+    }
+    return LINE_EDITOR_OK;
+}
+
+// Delete from..cursor and update the row
+static void editor_delete_back(line_editor_t *editor, size_t from, line_buffer_t *out) {
+    if (from == editor->cursor) {
+        return;
+    }
+    int width = editor_width(editor, from, editor->cursor);
+    int at_end = editor->cursor == editor->text.len;
+    editor_remove(editor, from, editor->cursor);
+    if (from < editor->scroll) {
+        editor_repaint(editor, out);
+    } else if (width == 0) {
+        // Only marks: the character they were drawn on is painted again
+        editor_paint(editor, editor->scroll, out);
+    } else if (at_end && width == 1) {
+        editor_put(out, "\b \b", 3);
+        editor->col--;
+        editor->shown = editor->col;
+    } else {
+        editor_move(editor, editor->col - width, out);
+        if (at_end) {
+            editor_put(out, "\x1b[K", 3);
+            editor->shown = editor->col;
+        } else if (editor->clipped) {
+            editor_paint(editor, editor->cursor, out);
+        } else {
+            editor_csi(out, width, 'P');
+            editor->shown -= width;
+        }
+    }
+}
+
+static void editor_backspace(line_editor_t *editor, line_buffer_t *out) {
+    if (editor->cursor > 0) {
+        int width;
+        editor_delete_back(editor, editor_prev(editor, editor->cursor, &width), out);
+    }
+}
+
+// Ctrl+W: the spaces before the cursor and the word before them
+static void editor_delete_word(line_editor_t *editor, line_buffer_t *out) {
+    size_t from = editor->cursor;
+    while (from > 0 && editor->text.data[from - 1] == ' ') {
+        from--;
+    }
+    while (from > 0 && editor->text.data[from - 1] != ' ') {
+        from--;
+    }
+    editor_delete_back(editor, from, out);
+}
+
+// Delete (ESC [ 3 ~): the character under the cursor
+static void editor_delete(line_editor_t *editor, line_buffer_t *out) {
+    if (editor->cursor == editor->text.len) {
+        return;
+    }
+    int width;
+    size_t to = editor_next(editor, editor->cursor, &width);
+    editor_remove(editor, editor->cursor, to);
+    if (editor->clipped || width == 0) {
+        editor_paint(editor, editor->cursor, out);
+    } else {
+        editor_csi(out, width, 'P');
+        editor->shown -= width;
+    }
+}
+
+// Ctrl+K: everything after the cursor
+static void editor_kill_end(line_editor_t *editor, line_buffer_t *out) {
+    editor->text.len = editor->cursor;
+    if (editor->shown > editor->col) {
+        editor_put(out, "\x1b[K", 3);
+    }
+    editor->shown = editor->col;
+    editor->clipped = 0;
+}
+
+static void editor_left(line_editor_t *editor, line_buffer_t *out) {
+    if (editor->cursor == 0) {
+        return;
+    }
+    int width;
+    editor_seek(editor, editor_prev(editor, editor->cursor, &width));
+    if (editor->cursor < editor->scroll) {
+        editor_repaint(editor, out);
+    } else {
+        editor_move(editor, editor->col - width, out);
+    }
+}
+
+static void editor_right(line_editor_t *editor, line_buffer_t *out) {
+    if (editor->cursor == editor->text.len) {
+        return;
+    }
+    int width;
+    size_t from = editor->cursor;
+    editor_seek(editor, editor_next(editor, from, &width));
+    if (!editor_fits(editor, editor->col + width)) {
+        editor_repaint(editor, out);
+    } else if (width > 0 && editor->cursor - from <= 4) {
+        // Writing the character again is shorter than CUF
+        editor_put(out, editor->text.data + from, editor->cursor - from);
+        editor->col += width;
+    } else {
+        editor_move(editor, editor->col + width, out);
+    }
+}
+
+static void editor_home(line_editor_t *editor, line_buffer_t *out) {
+    editor_seek(editor, 0);
+    if (editor->scroll > 0) {
+        editor_repaint(editor, out);
+    } else {
+        editor_move(editor, 0, out);
+    }
+}
+
+static void editor_end(line_editor_t *editor, line_buffer_t *out) {
+    int width = editor_width(editor, editor->cursor, editor->text.len);
+    editor_seek(editor, editor->text.len);
+    if (editor->clipped) {
+        editor_repaint(editor, out);
+    } else {
+        editor_move(editor, editor->col + width, out);
+    }
+}
+
+// Replace the line (closed with line_editor_line()) with data, cursor at
+// the end, painting only what follows the common prefix on the row
+static void editor_replace(line_editor_t *editor, const unsigned char *data, size_t len, line_buffer_t *out) {
+    size_t same = 0;
+    while (same < len && same < editor->text.len && editor->text.data[same] == data[same]) {
+        same++;
+    }
+
+    // Last character boundary of the row inside the common prefix where
+    // the new line does not continue the character before it
+    int keep_ok = editor->scroll <= same;
+    size_t keep = keep_ok ? editor->scroll : 0;
+    size_t pos = keep;
+    while (keep_ok && pos < editor->text.len) {
+        int width;
+        size_t next = editor_next(editor, pos, &width);
+        if (next > same) {
+            break;
+        }
+        pos = next;
+        if (pos < len) {
+            char_width_next(data + pos, len - pos, &width);
+            if (width == 0 || (data[pos] & 0xC0) == 0x80) {
+                continue;
+            }
+        }
+        keep = pos;
+    }
+
+    editor->text.len = keep;
+    editor->cursor = keep;
+    if (editor_insert_bytes(editor, data + keep, len - keep) == -1) {
+        editor->text.len = keep;
+        editor->cursor = keep;
+    }
+    if (keep_ok && editor_fits(editor, editor_width(editor, editor->scroll, editor->cursor))) {
+        editor_paint(editor, keep, out);
+    } else {
+        editor_repaint(editor, out);
+    }
+}
+
+// Up (back > 0) or down the history
+static void editor_recall(line_editor_t *editor, int back, line_buffer_t *out) {
+    int pos = editor->history_pos + back;
+    if (pos < 0 || pos > editor->history_count) {
+        return;
+    }
+    size_t len;
+    const unsigned char *line = line_editor_line(editor, &len);
+    if (editor->history_pos == 0) {
+        line_buffer_consume(&editor->saved, editor->saved.len);
+        if (line_buffer_append(&editor->saved, line, len) != len) {
+            return;
+        }
+    }
+    const line_buffer_t *entry = &editor->saved;
+    if (pos > 0) {
+        entry = &editor->history[(editor->history_next - pos + LINE_EDITOR_HISTORY) % LINE_EDITOR_HISTORY];
+    }
+    editor_replace(editor, entry->data, entry->len, out);
+    editor->history_pos = pos;
+    if (pos == 0) {
+        line_buffer_consume(&editor->saved, editor->saved.len);
+    }
+}
+
+static void editor_history_add(line_editor_t *editor, const unsigned char *line, size_t len) {
+    if (len == 0 || len > EDITOR_HISTORY_LINE_MAX) {
+        return;
+    }
+    if (editor->history == NULL) {
+        editor->history = calloc(LINE_EDITOR_HISTORY, sizeof(line_buffer_t));
+        if (editor->history == NULL) {
+            return;
+        }
+        stats_add(STAT_SESSION_MEMORY_ALLOCATED, LINE_EDITOR_HISTORY * sizeof(line_buffer_t));
+        for (int i = 0; i < LINE_EDITOR_HISTORY; i++) {
+            line_buffer_init(&editor->history[i], EDITOR_HISTORY_LINE_MAX);
+        }
+    }
+
+    // A repeat of the last line is not kept twice
+    const line_buffer_t *last = &editor->history[(editor->history_next + LINE_EDITOR_HISTORY - 1) % LINE_EDITOR_HISTORY];
+    if (editor->history_count > 0 && last->len == len && memcmp(last->data, line, len) == 0) {
+        return;
+    }
+    line_buffer_t *slot = &editor->history[editor->history_next];
+    line_buffer_consume(slot, slot->len);
+    if (line_buffer_append(slot, line, len) != len) {
+        line_buffer_consume(slot, slot->len);
+        return;
+    }
+    editor->history_next = (editor->history_next + 1) % LINE_EDITOR_HISTORY;
+    if (editor->history_count < LINE_EDITOR_HISTORY) {
+        editor->history_count++;
+    }
+}
+
+// Empty line at column 0 of a new row
+static void editor_reset(line_editor_t *editor) {
+    editor->text.len = 0;
+    editor->cursor = 0;
+    line_buffer_trim(&editor->text);
+    editor->scroll = 0;
+    editor->col = 0;
+    editor->shown = 0;
+    editor->clipped = 0;
+    editor->escape = ESCAPE_NONE;
+    editor->pending_need = 0;
+    editor->history_pos = 0;
+    line_buffer_consume(&editor->saved, editor->saved.len);
+}
+
+// Final byte of an escape sequence: the key it stands for
+static void editor_escape_key(line_editor_t *editor, unsigned char ch, line_buffer_t *out) {
+    stats_inc(STAT_EDIT_KEYS);
+    switch (ch) {
+    case 'A': editor_recall(editor, 1, out); break;
+    case 'B': editor_recall(editor, -1, out); break;
+    case 'C': editor_right(editor, out); break;
+    case 'D': editor_left(editor, out); break;
+    case 'H': editor_home(editor, out); break;
+    case 'F': editor_end(editor, out); break;
+    case '~':
+        if (editor->param == 1 || editor->param == 7) {
+            editor_home(editor, out);
+        } else if (editor->param == 4 || editor->param == 8) {
+            editor_end(editor, out);
+        } else if (editor->param == 3) {
+            editor_delete(editor, out);
+        }
+        break;
+    }
+}
+
+static void editor_escape(line_editor_t *editor, unsigned char ch, line_buffer_t *out) {
+    switch (editor->escape) {
+    case ESCAPE_START:
+        editor->escape = ch == '[' ? ESCAPE_CSI : ch == 'O' ? ESCAPE_SS3 : ESCAPE_NONE;
+        editor->param = 0;
+        return;
+    case ESCAPE_CSI:
+    case ESCAPE_CSI_MORE:
+        if (ch >= '0' && ch <= '9') {
+            if (editor->escape == ESCAPE_CSI && editor->param < EDITOR_MAX_PARAM) {
+                editor->param = editor->param * 10 + (ch - '0');
+            }
+            return;
+        }
+        if (ch < 0x40 || ch > 0x7E) {
+            if (ch == ';') {
+                editor->escape = ESCAPE_CSI_MORE;
+            }
+            return;
+        }
+        break;
+    }
+    editor->escape = ESCAPE_NONE;
+    editor_escape_key(editor, ch, out);
+}
+
+void line_editor_init(line_editor_t *editor, size_t limit) {
+    memset(editor, 0, sizeof(*editor));
+    line_buffer_init(&editor->text, limit);
+    line_buffer_init(&editor->saved, limit);
+    editor->cols = LINE_EDITOR_DEFAULT_COLS;
+}
+
+void line_editor_free(line_editor_t *editor) {
+    line_buffer_free(&editor->text);
+    line_buffer_free(&editor->saved);
+    if (editor->history != NULL) {
+        for (int i = 0; i < LINE_EDITOR_HISTORY; i++) {
+            line_buffer_free(&editor->history[i]);
+        }
+        free(editor->history);
+        stats_add(STAT_SESSION_MEMORY_FREED, LINE_EDITOR_HISTORY * sizeof(line_buffer_t));
+        editor->history = NULL;
+    }
+}
+
+int line_editor_key(line_editor_t *editor, unsigned char ch, line_buffer_t *out) {
+    if (editor->escape != ESCAPE_NONE) {
+        editor_escape(editor, ch, out);
+        return LINE_EDITOR_OK;
+    }
+
+    int result = LINE_EDITOR_OK;
+    if (editor->pending_need > 0) {
+        if ((ch & 0xC0) == 0x80) {
+            editor->pending[editor->pending_len++] = ch;
+            if (editor->pending_len < editor->pending_need) {
+                return LINE_EDITOR_OK;
+            }
+            editor->pending_need = 0;
+            return editor_insert(editor, editor->pending, (size_t)editor->pending_len, out);
+        }
+        // Cut short: the bytes typed so far go in as they are
+        editor->pending_need = 0;
+        for (int i = 0; i < editor->pending_len; i++) {
+            if (editor_insert(editor, &editor->pending[i], 1, out) != LINE_EDITOR_OK) {
+                result = LINE_EDITOR_FULL;
+            }
+        }
+    }
+
+    if (ch >= 0x80) {
+        int need = utf8_sequence_length(ch);
+        if (need > 1) {
+            editor->pending[0] = ch;
+            editor->pending_len = 1;
+            editor->pending_need = need;
+            return result;
+        }
+        return editor_insert(editor, &ch, 1, out) != LINE_EDITOR_OK ? LINE_EDITOR_FULL : result;
+    }
+    if (ch >= 32 && ch != DEL) {
+        return editor_insert(editor, &ch, 1, out) != LINE_EDITOR_OK ? LINE_EDITOR_FULL : result;
+    }
+
+    switch (ch) {
+    case BACKSPACE:
+    case DEL: editor_backspace(editor, out); break;
+    case CTRL_W: editor_delete_word(editor, out); break;
+    case CTRL_U: editor_delete_back(editor, 0, out); break;
+    case CTRL_K: editor_kill_end(editor, out); break;
+    case CTRL_A: editor_home(editor, out); break;
+    case CTRL_E: editor_end(editor, out); break;
+    case CTRL_B: editor_left(editor, out); break;
+    case CTRL_F: editor_right(editor, out); break;
+    case CTRL_P: editor_recall(editor, 1, out); break;
+    case CTRL_N: editor_recall(editor, -1, out); break;
+    case CTRL_L:
+        editor_put(out, "\x1b[H\x1b[2J", 7);
+        line_editor_redraw(editor, out);
+        break;
+    case ESC:
+        editor->escape = ESCAPE_START;
+        return result;
+    default:
+        // Other control characters are ignored
+        return result;
+    }
+    stats_inc(STAT_EDIT_KEYS);
+    return result;
+}
+
+const unsigned char *line_editor_line(line_editor_t *editor, size_t *len) {
+    editor_seek(editor, editor->text.len);
+    *len = editor->text.len;
+    return editor->text.data;
+}
+
+void line_editor_commit(line_editor_t *editor) {
+    size_t len;
+    const unsigned char *line = line_editor_line(editor, &len);
+    editor_history_add(editor, line, len);
+    editor_reset(editor);
+}
+
+void line_editor_clear(line_editor_t *editor) {
+    editor_reset(editor);
+}
+
+void line_editor_redraw(line_editor_t *editor, line_buffer_t *out) {
+    editor->col = 0;
+    editor->shown = 0;
+    if (editor->text.len > 0) {
+        editor_repaint(editor, out);
+    }
+}
+
+void line_editor_set_margin(line_editor_t *editor, int margin) {
+    editor->margin = margin > 0 ? margin : 0;
+}
+
+void line_editor_resize(line_editor_t *editor, int cols, line_buffer_t *out) {
+    if (cols == 0) {
+        cols = LINE_EDITOR_DEFAULT_COLS;
+    } else if (cols < LINE_EDITOR_MIN_COLS) {
+        cols = LINE_EDITOR_MIN_COLS;
+    }
+    if (cols == editor->cols) {
+        return;
+    }
+    editor->cols = cols;
+    if (editor->text.len > 0) {
+        editor_repaint(editor, out);
+    }
+}
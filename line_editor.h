@@ -0,0 +1,94 @@
+#ifndef LINE_EDITOR_H
+#define LINE_EDITOR_H
+
+#include <stddef.h>
+
+#include "line_buffer.h"
+
+// Server-side line editing for character mode sessions.
+//
+// The line is a gap buffer in UTF-8: the text before the cursor sits at the
+// start of a line_buffer_t block and the text after it at the end, so
+// typing, deleting and moving the cursor by a few characters never copy
+// more than those characters. Every key produces the terminal output that
+// updates the client's screen, and the editor keeps the screen state
+// (scroll offset, cursor column, painted width) to make that output the
+// smallest sequence that does the job: a typed character is echoed alone,
+// an insertion in the middle is ICH plus the character, a deletion is
+// backspaces plus DCH, a cursor move is backspaces or CUF. Only scrolling,
+// a tail cut off at the right edge and history recall past the common
+// prefix paint the rest of the row again.
+//
+// The line is kept on one row of the client's width (NAWS, 80 columns until
+// the client reports one) and scrolls sideways when it is longer. Widths
+// come from char_width.h, so Hangul, CJK and fullwidth characters take two
+// columns and combining marks none; a base character and its marks are
+// edited as one.
+//
+// Keys: printable characters insert, Backspace/DEL and Ctrl+W delete a
+// character or a word before the cursor, Delete (ESC [ 3 ~) the character
+// under it, Ctrl+K and Ctrl+U delete to the end and to the start. Left,
+// Right, Ctrl+B and Ctrl+F move by a character, Home, End, Ctrl+A and
+// Ctrl+E to the ends. Up, Down, Ctrl+P and Ctrl+N walk the history of the
+// last LINE_EDITOR_HISTORY lines, Ctrl+L clears the screen. Enter, Ctrl+C
+// and Ctrl+D are left to the session.
+
+#define LINE_EDITOR_HISTORY 16
+#define LINE_EDITOR_DEFAULT_COLS 80
+#define LINE_EDITOR_MIN_COLS 8
+
+// Results of line_editor_key()
+#define LINE_EDITOR_OK 0
+#define LINE_EDITOR_FULL -1            // The line is at its limit; the character was dropped
+
+typedef struct {
+    line_buffer_t text;        // len = bytes in the line, the gap sits at cursor
+    size_t cursor;             // Byte offset of the cursor
+    size_t scroll;             // Byte offset of the first character on the row
+    int cols;                  // Client width; the row uses cols - 1 columns
+    int margin;                // Columns left of the row taken by a prompt
+    int col;                   // Screen column of the terminal cursor
+    int shown;                 // Columns painted on the row
+    int clipped;               // Text continues past the right edge
+    int escape;                // Escape sequence parser state
+    int param;                 // Numeric parameter of a CSI sequence
+    unsigned char pending[4];  // UTF-8 character being typed
+    int pending_len;
+    int pending_need;
+    line_buffer_t *history;    // Ring of past lines, allocated on first use
+    int history_count;
+    int history_next;          // Slot the next line goes to
+    int history_pos;           // Lines back from the one being typed, 0 = that line
+    line_buffer_t saved;       // Line being typed while browsing the history
+} line_editor_t;
+
+// Start an empty line of at most limit bytes, without allocating
+void line_editor_init(line_editor_t *editor, size_t limit);
+
+void line_editor_free(line_editor_t *editor);
+
+// Handle one byte typed by the client, appending the screen update to out.
+// Returns LINE_EDITOR_OK or LINE_EDITOR_FULL.
+int line_editor_key(line_editor_t *editor, unsigned char ch, line_buffer_t *out);
+
+// The line as one contiguous block (closes the gap); *len gets its length
+const unsigned char *line_editor_line(line_editor_t *editor, size_t *len);
+
+// Enter: keep the line in the history and start an empty one on a new row
+void line_editor_commit(line_editor_t *editor);
+
+// Ctrl+C: drop the line and start an empty one on a new row
+void line_editor_clear(line_editor_t *editor);
+
+// Paint the line again on an empty row, after the session wrote its own
+// output (notices, timestamps) below it
+void line_editor_redraw(line_editor_t *editor, line_buffer_t *out);
+
+// A prompt of margin columns sits left of the row from now on (the row
+// starts after it and never moves the cursor over it)
+void line_editor_set_margin(line_editor_t *editor, int margin);
+
+// The client reported its width; repaints the row when the line needs it
+void line_editor_resize(line_editor_t *editor, int cols, line_buffer_t *out);
+
+#endif
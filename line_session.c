@@ -0,0 +1,752 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "latency_hist.h"
+#include "line_buffer.h"
+#include "line_session.h"
+#include "room.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "session_capture.h"
+#include "telnet_proto.h"
+#include "trace_probes.h"
+
+#ifndef DEBUG
+#define DEBUG 0
+#endif
+
+// LINEMODE suboption (RFC 1184)
+#define LM_MODE 1
+#define LM_FORWARDMASK 2
+#define LM_SLC 3
+
+// LINEMODE MODE bits (RFC 1184)
+#define MODE_EDIT 0x01      // Local line editing
+#define MODE_TRAPSIG 0x02   // Signal trapping
+#define MODE_ACK 0x04       // Mode change acknowledgment
+
+// Largest input handed to the telnet parser: a carried-over command plus
+// one receive segment
+#define LINE_SESSION_INPUT_MAX (LINE_SESSION_PENDING_MAX + REACTOR_RECV_SIZE)
+
+// iovecs per sendmsg() call when echoing
+#define ECHO_IOV_MAX 256
+
+static line_session_config_t config = {
+    .max_line = LINE_BUFFER_DEFAULT_LIMIT,
+    .utf8_policy = UTF8_POLICY_PASS
+};
+
+// Telnet negotiation tracking
+typedef struct {
+    int binary_acked;
+    int linemode_acked;
+    int echo_acked;
+    int sga_acked;
+    int ready_sent;
+} telnet_negotiation_t;
+
+// Everything a session keeps between receive segments
+typedef struct {
+    telnet_negotiation_t negotiation;
+    charset_state_t charset;
+    line_buffer_t line;        // Unfinished line
+    line_buffer_t pending;     // Telnet command split across segments
+    line_buffer_t held;        // Decoded input waiting for a command's reply
+    int streaming;             // The current line outgrew the buffer
+    int quit;
+    session_capture_t *capture;
+    room_member_t member;      // Room mode only
+} line_session_t;
+
+// Echo output collected from one receive segment. The iovecs point into the
+// line buffer, the scratch buffers below and static strings, all of which
+// stay put until echo_flush() sends the batch with a single sendmsg().
+typedef struct {
+    session_t *session;
+    charset_state_t *charset;
+    latency_clock_t *clock;
+    line_buffer_t repaired;    // UTF-8 policy output, appended per line
+    line_buffer_t encoded;     // Text in a non-UTF-8 client charset, appended per line
+    struct iovec iov[ECHO_IOV_MAX];
+    int iov_count;
+} echo_context_t;
+
+// Scratch space shared by all sessions of a worker thread
+static __thread echo_context_t echo;
+static __thread unsigned char data_buffer[LINE_SESSION_INPUT_MAX];
+static __thread unsigned char decoded_buffer[CHARSET_DECODE_MAX(LINE_SESSION_INPUT_MAX)];
+
+void line_session_configure(const line_session_config_t *settings) {
+    config = *settings;
+}
+
+static void send_telnet_option(session_t *session, unsigned char command, unsigned char option) {
+    unsigned char buf[3];
+    int len = telnet_option_frame(buf, command, option);
+    session_send(session, buf, len);
+}
+
+static void setup_linemode(session_t *session, telnet_negotiation_t *negotiation) {
+    // Step 1: Enable BINARY mode for 8-bit transparency (UTF-8 support)
+    if (config.binary) {
+        send_telnet_option(session, DO, BINARY);
+        send_telnet_option(session, WILL, BINARY);
+    }
+    // Most clients accept BINARY silently, and without it there is nothing to wait for
+    negotiation->binary_acked = 1;
+
+    // Step 2: Request LINEMODE from client
+    send_telnet_option(session, DO, LINEMODE);
+
+    // Step 3: For true line mode, client should do local echo
+    // So server should NOT echo (WONT ECHO instead of WILL ECHO)
+    send_telnet_option(session, WONT, ECHO);
+    // Many telnet clients don't respond to WONT, so mark as acked immediately
+    negotiation->echo_acked = 1;
+
+    // Step 4: Suppress Go-Ahead for efficiency
+    send_telnet_option(session, WILL, SUPPRESS_GO_AHEAD);
+    send_telnet_option(session, DO, SUPPRESS_GO_AHEAD);
+
+    // Step 5: Send LINEMODE MODE subnegotiation with EDIT bit enabled
+    // Format: IAC SB LINEMODE LM_MODE MODE_VALUE IAC SE
+    // MODE_VALUE = MODE_EDIT (0x01) for line editing
+    // Or MODE_EDIT | MODE_TRAPSIG (0x03) for line editing + signal trapping
+    unsigned char linemode_cmd[] = {
+        IAC, SB, LINEMODE,
+        LM_MODE,              // MODE command
+        MODE_EDIT,            // Enable EDIT bit (0x01) for true line mode
+        IAC, SE
+    };
+    session_send(session, linemode_cmd, sizeof(linemode_cmd));
+
+    // Step 6: Offer TTYPE and CHARSET so the client can select its charset
+    unsigned char offer[6];
+    int offer_len = charset_offer(offer, sizeof(offer));
+    if (offer_len > 0) {
+        session_send(session, offer, offer_len);
+    }
+
+    if (DEBUG) {
+        char ts[32];
+        get_timestamp(ts, sizeof(ts));
+        printf("%s[DEBUG] Negotiation sent: %sLINEMODE, WONT ECHO, MODE=0x%02x (EDIT enabled).\n",
+               ts, config.binary ? "BINARY, " : "DO ", MODE_EDIT);
+    }
+}
+
+// Answer a DO/DONT/WILL/WONT from the client (telnet_extract_data callback)
+static void handle_telnet_option(void *arg, unsigned char cmd, unsigned char opt) {
+    session_t *session = arg;
+    line_session_t *state = session->state;
+    telnet_negotiation_t *negotiation = &state->negotiation;
+    int binary = config.binary && opt == BINARY;
+
+    // TTYPE and CHARSET are answered by the charset module
+    unsigned char reply[128];
+    int reply_len = charset_handle_option(cmd, opt, reply, sizeof(reply));
+    if (reply_len >= 0) {
+        if (reply_len > 0) {
+            session_send(session, reply, reply_len);
+        }
+        return;
+    }
+
+    // Respond to client's option requests
+    if (cmd == DO) {
+        // Client asks us to enable an option
+        if (binary) {
+            send_telnet_option(session, WILL, opt);
+            negotiation->binary_acked = 1;
+        } else if (opt == SUPPRESS_GO_AHEAD) {
+            send_telnet_option(session, WILL, opt);
+            negotiation->sga_acked = 1;
+        } else if (opt == ECHO) {
+            send_telnet_option(session, WONT, opt);
+            negotiation->echo_acked = 1;
+        } else {
+            send_telnet_option(session, WONT, opt);
+        }
+    } else if (cmd == DONT) {
+        send_telnet_option(session, WONT, opt);
+        if (opt == ECHO) {
+            negotiation->echo_acked = 1;
+        } else if (binary) {
+            negotiation->binary_acked = 1;
+        }
+    } else if (cmd == WILL) {
+        // Client agrees to enable an option
+        if (binary) {
+            send_telnet_option(session, DO, opt);
+            negotiation->binary_acked = 1;
+        } else if (opt == LINEMODE) {
+            send_telnet_option(session, DO, opt);
+            negotiation->linemode_acked = 1;
+        } else if (opt == SUPPRESS_GO_AHEAD) {
+            send_telnet_option(session, DO, opt);
+            negotiation->sga_acked = 1;
+        } else if (opt == ECHO) {
+            send_telnet_option(session, DO, opt);
+            negotiation->echo_acked = 1;
+        } else {
+            send_telnet_option(session, DONT, opt);
+        }
+    } else if (cmd == WONT) {
+        send_telnet_option(session, DONT, opt);
+        if (opt == LINEMODE) {
+            negotiation->linemode_acked = 1;
+        } else if (binary) {
+            negotiation->binary_acked = 1;
+        }
+    }
+
+    // Check if negotiation is complete and send "ready!" message
+    if (!negotiation->ready_sent &&
+        negotiation->binary_acked &&
+        negotiation->linemode_acked &&
+        negotiation->echo_acked &&
+        negotiation->sga_acked) {
+
+        const char *ready_msg = config.binary ? "\r\n*** READY! (BINARY mode active) ***\r\n\r\n"
+                                              : "\r\n*** READY! ***\r\n\r\n";
+        session_send(session, ready_msg, strlen(ready_msg));
+        negotiation->ready_sent = 1;
+        stats_inc(STAT_NEGOTIATIONS_COMPLETE);
+        TRACE_PROBE1(negotiation_complete, session->fd);
+        if (DEBUG) {
+            char ts[32];
+            get_timestamp(ts, sizeof(ts));
+            printf("%s[DEBUG] Negotiation complete for client %s:%d.\n",
+                   ts, session->peer_ip, session->peer_port);
+        }
+    }
+}
+
+// Handle a TTYPE or CHARSET subnegotiation (telnet_extract_data callback)
+static void handle_telnet_subnegotiation(void *arg, const unsigned char *data, int len) {
+    session_t *session = arg;
+    line_session_t *state = session->state;
+    const charset_t *previous = state->charset.charset;
+    unsigned char reply[80];
+    int reply_len = charset_handle_subnegotiation(&state->charset, data, len, reply, sizeof(reply));
+    if (reply_len > 0) {
+        session_send(session, reply, reply_len);
+    }
+    if (state->charset.charset != previous) {
+        char ts[32];
+        get_timestamp(ts, sizeof(ts));
+        printf("%s[INFO] Session charset for %s:%d: %s.\n",
+               ts, session->peer_ip, session->peer_port, charset_name(state->charset.charset));
+    }
+}
+
+// Send the pending batch in one gathering send and reset the scratch space
+static void echo_flush(echo_context_t *echo) {
+    if (echo->iov_count > 0) {
+        session_sendv(echo->session, echo->iov, echo->iov_count);
+        stats_inc(STAT_ECHO_SENDS);
+        latency_mark(echo->clock, LAT_SEND);
+        echo->iov_count = 0;
+    }
+    echo->repaired.len = 0;
+    echo->encoded.len = 0;
+    // Scratch for an exceptionally long line is not kept around
+    line_buffer_trim(&echo->repaired);
+    line_buffer_trim(&echo->encoded);
+}
+
+static void echo_queue(echo_context_t *echo, const void *data, size_t len) {
+    if (echo->iov_count == ECHO_IOV_MAX) {
+        echo_flush(echo);
+    }
+    echo->iov[echo->iov_count].iov_base = (void *)data;
+    echo->iov[echo->iov_count].iov_len = len;
+    echo->iov_count++;
+}
+
+// Room for need more bytes at the end of a scratch buffer. Growing the
+// buffer may move it, so the batch pointing into it is sent first.
+// Returns NULL when out of memory.
+static unsigned char *echo_scratch(echo_context_t *echo, line_buffer_t *scratch, size_t need) {
+    if (scratch->len + need > scratch->capacity) {
+        echo_flush(echo);
+        if (line_buffer_reserve(scratch, need) == -1) {
+            return NULL;
+        }
+    }
+    return scratch->data + scratch->len;
+}
+
+// Queue text for the client after the UTF-8 policy and charset conversion,
+// preceded by "ECHO: " when prefix is set and followed by CRLF when suffix
+// is set. Returns 0, or -1 when the text was dropped (the client is told why).
+//
+// Well-formed UTF-8 is queued as a view into text, which must stay valid
+// until echo_flush(). A 0xFF in the text (binary data) is doubled to
+// IAC IAC by the iovecs.
+static int echo_text(echo_context_t *echo, const unsigned char *text, size_t len, int prefix, int suffix) {
+    static const char echo_prefix[] = "ECHO: ";
+    static const char crlf[] = "\r\n";
+    static const char invalid_error[] = "ERROR: Invalid UTF-8 input, line dropped.\r\n";
+    static const char memory_error[] = "ERROR: Out of memory, line dropped.\r\n";
+    size_t text_len = len;
+    const unsigned char *valid = text;
+
+    // Scratch space is only needed when the policy rewrites the line
+    if (!utf8_validate(text, len)) {
+        unsigned char *scratch = echo_scratch(echo, &echo->repaired, UTF8_REPAIR_MAX(len));
+        if (scratch == NULL) {
+            echo_queue(echo, memory_error, sizeof(memory_error) - 1);
+            stats_inc(STAT_LINES_DROPPED);
+            return -1;
+        }
+        valid = utf8_apply_policy(config.utf8_policy, text, len, scratch, &text_len);
+        if (valid == NULL) {
+            echo_queue(echo, invalid_error, sizeof(invalid_error) - 1);
+            return -1;
+        }
+        if (valid == scratch) {
+            echo->repaired.len += text_len;
+        }
+    }
+    latency_mark(echo->clock, LAT_UTF8);
+
+    if (!charset_is_utf8(echo->charset->charset)) {
+        size_t encoded_max = CHARSET_ENCODE_MAX(text_len);
+        unsigned char *encoded = echo_scratch(echo, &echo->encoded, encoded_max);
+        if (encoded == NULL) {
+            echo_queue(echo, memory_error, sizeof(memory_error) - 1);
+            stats_inc(STAT_LINES_DROPPED);
+            return -1;
+        }
+        text_len = charset_encode(echo->charset->charset, valid, text_len, encoded, encoded_max);
+        echo->encoded.len += text_len;
+        valid = encoded;
+        latency_mark(echo->clock, LAT_CHARSET);
+    }
+
+    if (prefix) {
+        echo_queue(echo, echo_prefix, sizeof(echo_prefix) - 1);
+    }
+    size_t done = 0;
+    while (done < text_len) {
+        if (echo->iov_count > ECHO_IOV_MAX - 2) {
+            echo_flush(echo);
+        }
+        size_t consumed;
+        echo->iov_count += telnet_escape_iov(valid + done, text_len - done, echo->iov + echo->iov_count,
+                                             ECHO_IOV_MAX - echo->iov_count, &consumed);
+        done += consumed;
+    }
+    if (suffix) {
+        echo_queue(echo, crlf, sizeof(crlf) - 1);
+    }
+    return 0;
+}
+
+// Room mode: "/join <room>" or a line for the room. Returns 0 when the
+// line was handled, -1 when it is left to the command hook.
+static int room_line(echo_context_t *echo, line_session_t *state, const unsigned char *text, size_t len) {
+    static const char memory_error[] = "ERROR: Out of memory, line dropped.\r\n";
+    static const char invalid_error[] = "ERROR: Invalid UTF-8 input, line dropped.\r\n";
+    char notice[ROOM_NAME_MAX + 64];
+
+    if (len > 6 && memcmp(text, "/join ", 6) == 0) {
+        if (room_join(&state->member, (const char *)text + 6, len - 6) == 0) {
+            snprintf(notice, sizeof(notice), "*** Joined room %s ***\r\n", room_name(&state->member));
+        } else {
+            snprintf(notice, sizeof(notice), "ERROR: Room names are 1-%d letters, digits or -_.#\r\n",
+                     ROOM_NAME_MAX);
+        }
+        echo_flush(echo);
+        session_send(echo->session, notice, strlen(notice));
+        return 0;
+    }
+    if (config.command != NULL && text[0] == '/') {
+        return -1;
+    }
+
+    // Rooms carry valid UTF-8 only, which never holds a 0xFF (IAC) for the
+    // shared message to escape: the pass policy repairs room lines too
+    const unsigned char *valid = text;
+    size_t valid_len = len;
+    if (!utf8_validate(text, len)) {
+        unsigned char *scratch = echo_scratch(echo, &echo->repaired, UTF8_REPAIR_MAX(len));
+        if (scratch == NULL) {
+            echo_queue(echo, memory_error, sizeof(memory_error) - 1);
+            stats_inc(STAT_LINES_DROPPED);
+            return 0;
+        }
+        utf8_policy_t policy = config.utf8_policy == UTF8_POLICY_REJECT ? UTF8_POLICY_REJECT : UTF8_POLICY_REPLACE;
+        valid = utf8_apply_policy(policy, text, len, scratch, &valid_len);
+        if (valid == NULL) {
+            echo_queue(echo, invalid_error, sizeof(invalid_error) - 1);
+            return 0;
+        }
+    }
+    if (room_post(&state->member, valid, valid_len) == -1) {
+        echo_queue(echo, memory_error, sizeof(memory_error) - 1);
+        stats_inc(STAT_LINES_DROPPED);
+    }
+    return 0;
+}
+
+// A command line on its way through the pool
+typedef struct {
+    session_job_t job;
+    size_t size;               // Allocation size, for the memory counters
+    line_buffer_t reply;
+    int close;
+    char cmd[];
+} command_job_t;
+
+static void echo_lines(session_t *session, line_session_t *state, const unsigned char *input, size_t data_len);
+
+// Pool thread: collect the whole reply from the command hook
+static void command_run(session_job_t *job) {
+    command_job_t *command = (command_job_t *)job;
+    char chunk[LINE_COMMAND_CHUNK];
+    uint32_t var = 0;
+    uint32_t result;
+    do {
+        result = config.command(command->cmd, chunk, sizeof(chunk), &var);
+        uint32_t len = LINE_COMMAND_LENGTH(result);
+        if (len > sizeof(chunk)) {
+            len = sizeof(chunk);
+        }
+        if (line_buffer_append(&command->reply, chunk, len) < len) {
+            break;   // Out of memory: the reply is cut short
+        }
+    } while (result & LINE_COMMAND_REPEAT);
+    command->close = (result & LINE_COMMAND_CLOSE) != 0;
+}
+
+// Session worker: send the reply, then carry on with the held input
+static void command_done(session_t *session, session_job_t *job) {
+    command_job_t *command = (command_job_t *)job;
+    line_session_t *state = session->state;
+
+    if (!job->cancelled && state != NULL && !session->failed) {
+        echo.session = session;
+        echo.charset = &state->charset;
+        echo.clock = session_clock(session);
+        latency_begin(echo.clock, 0);
+        if (command->reply.len > 0) {
+            echo_text(&echo, command->reply.data, command->reply.len, 0, 0);
+        }
+        echo_flush(&echo);
+
+        if (command->close) {
+            state->quit = 1;
+            session_close(session);
+        } else {
+            line_buffer_t held = state->held;
+            line_buffer_init(&state->held, LINE_BUFFER_UNLIMITED);
+            echo_lines(session, state, held.data, held.len);
+            line_buffer_free(&held);
+        }
+    }
+
+    line_buffer_free(&command->reply);
+    session_free(command, command->size);
+}
+
+// Hand a command line to the pool. Returns -1 when out of memory.
+static int command_submit(session_t *session, const unsigned char *text, size_t len) {
+    size_t size = sizeof(command_job_t) + len + 1;
+    command_job_t *command = session_alloc(size);
+    if (command == NULL) {
+        return -1;
+    }
+    command->size = size;
+    line_buffer_init(&command->reply, LINE_BUFFER_UNLIMITED);
+    memcpy(command->cmd, text, len);
+    command->cmd[len] = '\0';
+    command->job.run = command_run;
+    command->job.done = command_done;
+    session_submit(session, &command->job);
+    return 0;
+}
+
+// Feed decoded input through the line buffer and queue the echo of every
+// complete line; the whole batch goes out in one send per segment. When a
+// line outgrows the limit, the buffered part is echoed right away
+// (streaming) and the rest of the input is taken in afterwards. A command
+// line stops the processing: what follows it is held for command_done().
+static void echo_lines(session_t *session, line_session_t *state, const unsigned char *input, size_t data_len) {
+    line_buffer_t *line = &state->line;
+    latency_clock_t *clock = echo.clock;
+    char ts[32];
+
+    size_t taken = 0;
+    do {
+        size_t appended = line_buffer_append(line, input + taken, data_len - taken);
+        if (appended == 0 && taken < data_len && line->len < line->limit) {
+            // Could not grow the buffer: drop the line rather than spin
+            const char *error = "ERROR: Out of memory, line dropped.\r\n";
+            echo_flush(&echo);
+            session_send(session, error, strlen(error));
+            stats_inc(STAT_LINES_DROPPED);
+            line_buffer_consume(line, line->len);
+            break;
+        }
+        taken += appended;
+        latency_mark(clock, LAT_LINE);
+
+        // Lines are consumed together after the flush, so the queued
+        // echoes can point into the buffer
+        size_t start = 0;
+
+        // Check for incomplete UTF-8 sequence at end of buffer
+        int incomplete_bytes = check_incomplete_utf8(line->data, line->len);
+        latency_mark(clock, LAT_UTF8);
+        int process_len = line->len - incomplete_bytes;
+
+        // Look for line endings in the processable portion
+        int line_end_pos = find_line_ending(line->data, process_len);
+
+        while (line_end_pos > 0) {
+            const unsigned char *text = line->data + start;
+            session_charge_lines(session, 1);
+
+            // Extract the line content (without line ending). Only the
+            // ending itself is removed; NUL bytes in the line are data.
+            int line_content_len = line_end_pos - 1;
+            if (line_content_len > 0 && text[line_content_len - 1] == '\r' &&
+                (text[line_content_len] == '\n' || text[line_content_len] == '\0')) {
+                line_content_len--;
+            }
+
+            if (state->streaming) {
+                // Last part of a streamed line
+                echo_text(&echo, text, line_content_len, 0, 1);
+                state->streaming = 0;
+                stats_inc(STAT_LINES_ECHOED);
+                TRACE_PROBE2(line_echoed, session->fd, line_content_len);
+            } else if (line_content_len > 0) {
+                // Check for quit command
+                if (line_content_len == 4 && memcmp(text, "quit", 4) == 0) {
+                    echo_queue(&echo, "Goodbye!\r\n", 10);
+                    echo_flush(&echo);
+                    if (DEBUG) {
+                        get_timestamp(ts, sizeof(ts));
+                        printf("%s[DEBUG] Client quit: %s:%d.\n", ts, session->peer_ip, session->peer_port);
+                    }
+                    state->quit = 1;
+                    session_close(session);
+                    return;
+                }
+
+                if (config.rooms && room_line(&echo, state, text, line_content_len) == 0) {
+                    // Posted to the room (or a room command)
+                } else if (config.command != NULL && text[0] == '/') {
+                    // Commands go to the pool; the rest of the input waits for the reply
+                    if (command_submit(session, text, line_content_len) == 0) {
+                        echo_flush(&echo);
+                        line_buffer_consume(line, start + line_end_pos);
+                        line_buffer_append(&state->held, input + taken, data_len - taken);
+                        return;
+                    }
+                    echo_queue(&echo, "ERROR: Out of memory, command dropped.\r\n", 40);
+                    stats_inc(STAT_LINES_DROPPED);
+                } else if (echo_text(&echo, text, line_content_len, 1, 1) == 0) {
+                    // Echo back the line
+                    stats_inc(STAT_LINES_ECHOED);
+                    TRACE_PROBE2(line_echoed, session->fd, line_content_len);
+                    if (DEBUG) {
+                        get_timestamp(ts, sizeof(ts));
+                        printf("%s[DEBUG] Echoed to %s:%d: %.*s.\n",
+                               ts, session->peer_ip, session->peer_port,
+                               line_content_len, (const char *)text);
+                    }
+                } else if (DEBUG) {
+                    get_timestamp(ts, sizeof(ts));
+                    printf("%s[DEBUG] Dropped line from %s:%d.\n",
+                           ts, session->peer_ip, session->peer_port);
+                }
+            }
+
+            start += line_end_pos;
+            latency_mark(clock, LAT_LINE);
+
+            // Recalculate incomplete UTF-8 bytes
+            incomplete_bytes = check_incomplete_utf8(line->data + start, line->len - start);
+            latency_mark(clock, LAT_UTF8);
+            process_len = line->len - start - incomplete_bytes;
+
+            // Check for another line ending
+            line_end_pos = find_line_ending(line->data + start, process_len);
+        }
+
+        // A full buffer without a line ending: echo what arrived so far.
+        // A trailing CR or partial UTF-8 sequence waits for the next bytes.
+        if (start == 0 && line->len >= line->limit) {
+            size_t part = line->len - check_incomplete_utf8(line->data, line->len);
+            if (part > 0 && line->data[part - 1] == '\r') {
+                part--;
+            }
+            if (!state->streaming) {
+                stats_inc(STAT_LINES_STREAMED);
+                get_timestamp(ts, sizeof(ts));
+                printf("%s[INFO] Line from %s:%d exceeds %zu bytes, streaming the echo.\n",
+                       ts, session->peer_ip, session->peer_port, line->limit);
+            }
+            echo_text(&echo, line->data, part, !state->streaming, 0);
+            state->streaming = 1;
+            start = part;
+        }
+
+        echo_flush(&echo);
+        line_buffer_consume(line, start);
+    } while (taken < data_len);
+    latency_mark(clock, LAT_LINE);
+
+    // An idle session keeps no line memory
+    line_buffer_trim(line);
+}
+
+static void line_session_input(session_t *session, const unsigned char *segment, size_t len) {
+    line_session_t *state = session->state;
+    if (state == NULL || state->quit) {
+        return;
+    }
+    latency_clock_t *clock = session_clock(session);
+    capture_record(state->capture, segment, len);
+
+    // A telnet command cut off by the previous segment is completed first
+    const unsigned char *in = segment;
+    size_t in_len = len;
+    if (state->pending.len > 0) {
+        line_buffer_append(&state->pending, segment, len);
+        in = state->pending.data;
+        in_len = state->pending.len;
+    }
+
+    // Extract data bytes from telnet protocol stream
+    int consumed;
+    int data_len = telnet_extract_data(in, (int)in_len, data_buffer, handle_telnet_option,
+                                       handle_telnet_subnegotiation, session, &consumed);
+    if (in == state->pending.data) {
+        line_buffer_consume(&state->pending, consumed);
+    } else if ((size_t)consumed < in_len) {
+        line_buffer_append(&state->pending, in + consumed, in_len - consumed);
+    }
+    if (state->pending.len > LINE_SESSION_PENDING_MAX) {
+        // Not a telnet command any client sends: drop it
+        line_buffer_consume(&state->pending, state->pending.len);
+    }
+    line_buffer_trim(&state->pending);
+    latency_mark(clock, LAT_IAC);
+
+    // Transcode the client charset to UTF-8
+    const unsigned char *input = data_buffer;
+    if (!charset_is_utf8(state->charset.charset)) {
+        data_len = (int)charset_decode(&state->charset, data_buffer, data_len, decoded_buffer);
+        input = decoded_buffer;
+        latency_mark(clock, LAT_CHARSET);
+    }
+
+    echo.session = session;
+    echo.charset = &state->charset;
+    echo.clock = clock;
+    echo_lines(session, state, input, (size_t)data_len);
+}
+
+static void line_session_open(session_t *session) {
+    char ts[32];
+    get_timestamp(ts, sizeof(ts));
+    printf("%s[INFO] Client connected: %s:%d.\n", ts, session->peer_ip, session->peer_port);
+
+    line_session_t *state = session_alloc(sizeof(line_session_t));
+    if (state == NULL) {
+        perror("Failed to allocate session");
+        session_close(session);
+        return;
+    }
+    session->state = state;
+    charset_session_init(&state->charset, config.default_charset);
+    line_buffer_init(&state->line, config.max_line);
+    line_buffer_init(&state->pending, LINE_BUFFER_UNLIMITED);
+    line_buffer_init(&state->held, LINE_BUFFER_UNLIMITED);
+
+    // Setup line mode
+    setup_linemode(session, &state->negotiation);
+
+    // Send welcome message
+    session_send(session, config.banner, strlen(config.banner));
+
+    if (config.rooms) {
+        state->member.session = session;
+        state->member.charset = &state->charset;
+        if (room_join(&state->member, ROOM_DEFAULT, strlen(ROOM_DEFAULT)) == 0) {
+            static const char joined[] = "*** Room mode: joined room " ROOM_DEFAULT
+                                         " (/join <room> to switch) ***\r\n";
+            session_send(session, joined, sizeof(joined) - 1);
+        }
+    }
+
+    // Record the inbound byte stream when capture is enabled
+    state->capture = capture_open(config.port);
+}
+
+// Push the periodic timestamp
+static void line_session_tick(session_t *session) {
+    time_t now = time(NULL);
+    struct tm tm_info;
+    char timestamp_msg[128];
+    localtime_r(&now, &tm_info);
+    snprintf(timestamp_msg, sizeof(timestamp_msg),
+             "\r\n[TIMESTAMP] %04d-%02d-%02d %02d:%02d:%02d\r\n",
+             tm_info.tm_year + 1900, tm_info.tm_mon + 1, tm_info.tm_mday,
+             tm_info.tm_hour, tm_info.tm_min, tm_info.tm_sec);
+
+    session_send(session, timestamp_msg, strlen(timestamp_msg));
+    if (session->failed) {
+        return;
+    }
+    stats_inc(STAT_TIMESTAMPS_SENT);
+    TRACE_PROBE1(timestamp_sent, session->fd);
+
+    char ts[32];
+    get_timestamp(ts, sizeof(ts));
+    printf("%s[INFO] Sent timestamp to client (fd=%d).\n", ts, session->fd);
+}
+
+// Take the room membership along when the session moves to another worker
+static void line_session_migrate(session_t *session, int arriving) {
+    line_session_t *state = session->state;
+    if (config.rooms && state != NULL) {
+        room_migrate(&state->member, arriving);
+    }
+}
+
+static void line_session_close(session_t *session) {
+    line_session_t *state = session->state;
+    if (state == NULL) {
+        return;
+    }
+    if (!state->quit) {
+        char ts[32];
+        get_timestamp(ts, sizeof(ts));
+        printf("%s[INFO] Client disconnected: %s:%d.\n", ts, session->peer_ip, session->peer_port);
+    }
+    room_leave(&state->member);
+    line_buffer_free(&state->line);
+    line_buffer_free(&state->pending);
+    line_buffer_free(&state->held);
+    capture_close(state->capture);
+    session_free(state, sizeof(line_session_t));
+    session->state = NULL;
+}
+
+const session_ops_t line_session_ops = {
+    .open = line_session_open,
+    .input = line_session_input,
+    .tick = line_session_tick,
+    .close = line_session_close,
+    .migrate = line_session_migrate,
+    .tick_seconds = LINE_SESSION_TICK_SECONDS
+};
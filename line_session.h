@@ -0,0 +1,64 @@
+#ifndef LINE_SESSION_H
+#define LINE_SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "charset.h"
+#include "reactor.h"
+#include "utf8_validate.h"
+
+// Line mode echo protocol shared by line_mode_server and
+// line_mode_binary_server, running as reactor sessions.
+//
+// A session negotiates LINEMODE (and BINARY for the binary server), echoes
+// every complete line back as "ECHO: <line>", streams lines longer than
+// max_line, pushes a timestamp every 10 seconds and ends on "quit".
+//
+// In room mode (room.h) complete lines are posted to the session's room
+// instead of being echoed; "/join <room>" moves to another room. Streamed
+// parts of over-long lines are still only echoed.
+//
+// Lines starting with '/' go to the command hook, when one is configured.
+// Commands run on the reactor's pool, so a slow one stalls neither the
+// worker's other sessions nor the timestamps; input that arrives with or
+// after a command is held back until its reply has been sent.
+//
+// Per-session memory is the negotiation and charset state plus two lazily
+// allocated buffers: the unfinished line and the bytes of a telnet command
+// split across receive segments. Decoding and echo scratch space is shared
+// by all sessions of a worker thread.
+
+#define LINE_SESSION_TICK_SECONDS 10
+#define LINE_SESSION_PENDING_MAX 4096   // Longest telnet command carried over
+
+// Command hook in the style of telnet_server_process(): handle the
+// NUL-terminated command line, write up to buflen reply bytes into buf and
+// return their count, or'ed with LINE_COMMAND_REPEAT to be called again for
+// more of the reply (*pvar starts at 0 and is kept between those calls) and
+// LINE_COMMAND_CLOSE to end the session after the reply. Called on a pool
+// thread, possibly for several sessions at once.
+typedef uint32_t (*line_command_t)(const char *cmd, char *buf, uint32_t buflen, uint32_t *pvar);
+
+#define LINE_COMMAND_CLOSE (1u << 30)
+#define LINE_COMMAND_REPEAT (1u << 31)
+#define LINE_COMMAND_LENGTH(result) ((result) & (LINE_COMMAND_CLOSE - 1))
+#define LINE_COMMAND_CHUNK 4096         // buflen passed to the hook
+
+typedef struct {
+    int port;
+    int binary;                        // Negotiate BINARY as well
+    const char *banner;                // Sent after the negotiation commands
+    const charset_t *default_charset;
+    size_t max_line;
+    utf8_policy_t utf8_policy;
+    line_command_t command;            // NULL: '/' lines are echoed like any other
+    int rooms;                         // Post lines to rooms instead of echoing them
+} line_session_config_t;
+
+// Settings used by every line session in this process (set before serving)
+void line_session_configure(const line_session_config_t *config);
+
+extern const session_ops_t line_session_ops;
+
+#endif
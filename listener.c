@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "listener.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "trace_probes.h"
+
+typedef struct {
+    int fd;
+    int port;
+    int backlog;
+    int budget;
+    int reuseport;
+} listener_t;
+
+static listener_t listeners[LISTENER_MAX];
+static int listener_count = 0;
+
+// Descriptor given up when accept() runs into EMFILE
+static int spare_fd = -1;
+static pthread_mutex_t spare_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static listener_t *listener_find(int listen_fd) {
+    for (int i = 0; i < listener_count; i++) {
+        if (listeners[i].fd == listen_fd) {
+            return &listeners[i];
+        }
+    }
+    return NULL;
+}
+
+// Read the TcpExt counter called name from /proc/net/netstat (-1 if absent)
+static long long netstat_counter(const char *name) {
+    FILE *file = fopen("/proc/net/netstat", "r");
+    if (file == NULL) {
+        return -1;
+    }
+    // Each group is a line of names followed by a line of values
+    static char names[4096];
+    static char values[4096];
+    long long result = -1;
+    while (result == -1 && fgets(names, sizeof(names), file) != NULL &&
+           fgets(values, sizeof(values), file) != NULL) {
+        if (strncmp(names, "TcpExt:", 7) != 0) {
+            continue;
+        }
+        char *name_save, *value_save;
+        char *n = strtok_r(names + 7, " \n", &name_save);
+        char *v = strtok_r(values + 7, " \n", &value_save);
+        while (n != NULL && v != NULL) {
+            if (strcmp(n, name) == 0) {
+                result = atoll(v);
+                break;
+            }
+            n = strtok_r(NULL, " \n", &name_save);
+            v = strtok_r(NULL, " \n", &value_save);
+        }
+    }
+    fclose(file);
+    return result;
+}
+
+static size_t listener_metrics_handler(const char *args, char *buf, size_t size) {
+    size_t len = 0;
+    (void)args;
+
+    len = stats_appendf(buf, size, len,
+                        "# HELP telnet_listen_queue_length Connections waiting in the accept queue.\n"
+                        "# TYPE telnet_listen_queue_length gauge\n");
+    for (int i = 0; i < listener_count; i++) {
+        struct tcp_info info;
+        socklen_t info_len = sizeof(info);
+        if (getsockopt(listeners[i].fd, IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0) {
+            // On a listening socket unacked is the queue length and sacked the backlog
+            len = stats_appendf(buf, size, len, "telnet_listen_queue_length{port=\"%d\"} %u\n",
+                                listeners[i].port, info.tcpi_unacked);
+        }
+    }
+    len = stats_appendf(buf, size, len,
+                        "# HELP telnet_listen_backlog Accept queue limit in effect (after somaxconn).\n"
+                        "# TYPE telnet_listen_backlog gauge\n");
+    for (int i = 0; i < listener_count; i++) {
+        struct tcp_info info;
+        socklen_t info_len = sizeof(info);
+        if (getsockopt(listeners[i].fd, IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0) {
+            len = stats_appendf(buf, size, len, "telnet_listen_backlog{port=\"%d\"} %u\n",
+                                listeners[i].port, info.tcpi_sacked);
+        }
+    }
+
+    // Kernel counters, shared by every listener in the network namespace
+    long long overflows = netstat_counter("ListenOverflows");
+    long long drops = netstat_counter("ListenDrops");
+    if (overflows >= 0) {
+        len = stats_appendf(buf, size, len,
+                            "# HELP telnet_listen_overflows_total Connections refused on a full accept queue (host-wide).\n"
+                            "# TYPE telnet_listen_overflows_total counter\n"
+                            "telnet_listen_overflows_total %lld\n", overflows);
+    }
+    if (drops >= 0) {
+        len = stats_appendf(buf, size, len,
+                            "# HELP telnet_listen_drops_total SYNs and handshakes dropped by listeners (host-wide).\n"
+                            "# TYPE telnet_listen_drops_total counter\n"
+                            "telnet_listen_drops_total %lld\n", drops);
+    }
+    return len;
+}
+
+// Allow as many descriptors as the hard limit permits, so a surge is
+// limited by the backlog rather than by EMFILE
+static void raise_fd_limit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+int listener_open(int port) {
+    struct sockaddr_in server_addr;
+    int opt = 1;
+    int backlog = (int)config_get_long("BACKLOG", port, LISTENER_DEFAULT_BACKLOG);
+    int budget = (int)config_get_long("ACCEPT_BUDGET", port, LISTENER_DEFAULT_BUDGET);
+    if (backlog < 1) {
+        backlog = LISTENER_DEFAULT_BACKLOG;
+    }
+    if (budget < 1) {
+        budget = 1;
+    }
+    int reuseport = config_get_long("REUSEPORT", port, 0) != 0;
+
+    // Create socket
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket creation failed");
+        return -1;
+    }
+
+    // Set socket options
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
+        perror("setsockopt failed");
+        close(fd);
+        return -1;
+    }
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+        perror("setsockopt SO_REUSEPORT failed");
+        close(fd);
+        return -1;
+    }
+
+    // Setup server address
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+
+    // Bind socket
+    if (bind(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
+        perror("bind failed");
+        close(fd);
+        return -1;
+    }
+
+    // Listen for connections
+    if (listen(fd, backlog) == -1) {
+        perror("listen failed");
+        close(fd);
+        return -1;
+    }
+
+    raise_fd_limit();
+    if (spare_fd == -1) {
+        spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    if (listener_count == 0) {
+        stats_admin_register_metrics(listener_metrics_handler);
+    }
+    if (listener_count < LISTENER_MAX) {
+        listeners[listener_count].fd = fd;
+        listeners[listener_count].port = port;
+        listeners[listener_count].backlog = backlog;
+        listeners[listener_count].budget = budget;
+        listeners[listener_count].reuseport = reuseport;
+        listener_count++;
+    }
+    return fd;
+}
+
+int listener_budget(int listen_fd) {
+    listener_t *listener = listener_find(listen_fd);
+    return listener != NULL ? listener->budget : LISTENER_DEFAULT_BUDGET;
+}
+
+int listener_backlog(int listen_fd) {
+    listener_t *listener = listener_find(listen_fd);
+    return listener != NULL ? listener->backlog : LISTENER_DEFAULT_BACKLOG;
+}
+
+int listener_reuseport(int listen_fd) {
+    listener_t *listener = listener_find(listen_fd);
+    return listener != NULL && listener->reuseport;
+}
+
+// Out of descriptors: free the spare, take the oldest connection and close
+// it right away, then reserve the spare again
+static void listener_shed(int listen_fd) {
+    pthread_mutex_lock(&spare_lock);
+    if (spare_fd != -1) {
+        close(spare_fd);
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd != -1) {
+            close(fd);
+            stats_inc(STAT_ACCEPTS);
+            stats_inc(STAT_REJECTS);
+        }
+        spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    pthread_mutex_unlock(&spare_lock);
+}
+
+int listener_accept(int listen_fd, struct sockaddr_in *peer) {
+    while (1) {
+        socklen_t peer_len = sizeof(*peer);
+        int fd = accept4(listen_fd, (struct sockaddr *)peer, &peer_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd != -1) {
+            stats_inc(STAT_ACCEPTS);
+            TRACE_PROBE2(session_accept, fd, ntohs(peer->sin_port));
+            return fd;
+        }
+        if (errno == EINTR || errno == ECONNABORTED) {
+            continue;
+        }
+        if (errno == EMFILE || errno == ENFILE) {
+            listener_shed(listen_fd);
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("accept failed");
+        }
+        return -1;
+    }
+}
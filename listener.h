@@ -0,0 +1,48 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <netinet/in.h>
+
+// Listening sockets shared by the servers, sized for connection surges.
+//
+// A reconnect storm (every client of a network segment coming back at
+// once) arrives faster than one accept per wakeup can take it. Listeners
+// are therefore opened with a large backlog (TELNET_BACKLOG[_<port>],
+// clamped by the kernel to net.core.somaxconn) and in non-blocking mode,
+// and each wakeup drains up to TELNET_ACCEPT_BUDGET[_<port>] connections
+// with accept4() before going back to the other descriptors.
+// TELNET_REUSEPORT[_<port>]=1 sets SO_REUSEPORT, so worker processes can
+// open listeners of their own on the port.
+//
+// When the process runs out of descriptors, a spare one is given up to
+// accept and close the connection at the head of the queue, so the
+// listener does not stay readable forever; such connections are counted
+// as rejects.
+//
+// The admin port reports the accept queue of every listener (TCP_INFO)
+// and the kernel's listen overflow and drop counters.
+
+#define LISTENER_DEFAULT_BACKLOG 4096
+#define LISTENER_DEFAULT_BUDGET 64     // Connections taken per wakeup
+#define LISTENER_MAX 8
+
+// Bind INADDR_ANY:port and listen with the configured backlog. The fd is
+// non-blocking. Returns the fd, or -1 after printing the error.
+int listener_open(int port);
+
+// Accept budget of a listener opened by listener_open()
+int listener_budget(int listen_fd);
+
+// Backlog requested for a listener opened by listener_open()
+int listener_backlog(int listen_fd);
+
+// Whether the listener was opened with SO_REUSEPORT (TELNET_REUSEPORT[_<port>]=1),
+// so more listeners on the same port can be opened next to it
+int listener_reuseport(int listen_fd);
+
+// Take one connection as a non-blocking, close-on-exec socket and count it.
+// Returns the fd, or -1 once the queue is empty (or on an error, which is
+// printed).
+int listener_accept(int listen_fd, struct sockaddr_in *peer);
+
+#endif
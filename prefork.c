@@ -0,0 +1,170 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "listener.h"
+#include "prefork.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "server_tls.h"
+
+typedef struct {
+    pid_t pid;                     // 0 while the worker is not running
+    time_t started;
+} prefork_worker_t;
+
+struct prefork {
+    prefork_config_t config;
+    volatile sig_atomic_t *running;
+    prefork_worker_t *workers;
+};
+
+// Worker process: serve sessions on a one-thread reactor until told to stop
+static void prefork_worker_main(prefork_t *prefork, int index) {
+    const prefork_config_t *config = &prefork->config;
+    // Workers share the log; write it a whole line at a time
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    for (int i = 0; i < config->close_count; i++) {
+        if (config->close_fds[i] != -1) {
+            close(config->close_fds[i]);
+        }
+    }
+    stats_admin_close_clients();
+
+    int listen_fd = config->listen_fd;
+    int tls_fd = config->tls_fd;
+    if (index > 0 && listener_reuseport(listen_fd)) {
+        // A listener of its own in the port's SO_REUSEPORT group
+        listen_fd = listener_open(config->port);
+        if (listen_fd == -1) {
+            exit(EXIT_FAILURE);
+        }
+        close(config->listen_fd);
+    }
+    if (index > 0 && tls_fd != -1 && listener_reuseport(tls_fd)) {
+        tls_server_t *tls = tls_listener(config->tls_fd);
+        tls_fd = listener_open(tls_server_port(tls));
+        if (tls_fd == -1) {
+            exit(EXIT_FAILURE);
+        }
+        tls_listener_add(tls_fd, tls);
+        close(config->tls_fd);
+    }
+
+    reactor_t *reactor = reactor_create(1);
+    if (reactor == NULL || reactor_listen(reactor, listen_fd, config->ops) == -1 ||
+        (tls_fd != -1 && reactor_listen(reactor, tls_fd, config->ops) == -1) ||
+        reactor_start(reactor) == -1) {
+        fprintf(stderr, "Failed to start worker %d\n", index);
+        exit(EXIT_FAILURE);
+    }
+    while (*prefork->running) {
+        sleep(1);
+    }
+    reactor_stop(reactor);
+    close(listen_fd);
+    if (tls_fd != -1) {
+        close(tls_fd);
+    }
+    exit(EXIT_SUCCESS);
+}
+
+static int prefork_spawn(prefork_t *prefork, int index) {
+    prefork->workers[index].started = time(NULL);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        prefork_worker_main(prefork, index);
+    }
+    if (pid == -1) {
+        perror("fork failed");
+        return -1;
+    }
+    prefork->workers[index].pid = pid;
+    return 0;
+}
+
+prefork_t *prefork_start(const prefork_config_t *config, volatile sig_atomic_t *running) {
+    prefork_t *prefork = calloc(1, sizeof(prefork_t));
+    if (prefork == NULL) {
+        return NULL;
+    }
+    prefork->workers = calloc(config->workers, sizeof(prefork_worker_t));
+    if (prefork->workers == NULL) {
+        free(prefork);
+        return NULL;
+    }
+    prefork->config = *config;
+    prefork->running = running;
+
+    int started = 0;
+    for (int i = 0; i < config->workers; i++) {
+        if (prefork_spawn(prefork, i) == 0) {
+            started++;
+        }
+    }
+    if (started == 0) {
+        free(prefork->workers);
+        free(prefork);
+        return NULL;
+    }
+    return prefork;
+}
+
+void prefork_check(prefork_t *prefork) {
+    time_t now = time(NULL);
+    char ts[32];
+
+    for (int i = 0; i < prefork->config.workers; i++) {
+        prefork_worker_t *worker = &prefork->workers[i];
+        int status;
+        if (worker->pid != 0 && waitpid(worker->pid, &status, WNOHANG) == worker->pid) {
+            get_timestamp(ts, sizeof(ts));
+            if (WIFSIGNALED(status)) {
+                printf("%s[ERROR] Worker %d (pid %d) killed by signal %d.\n",
+                       ts, i, (int)worker->pid, WTERMSIG(status));
+            } else {
+                printf("%s[ERROR] Worker %d (pid %d) exited with status %d.\n",
+                       ts, i, (int)worker->pid, WEXITSTATUS(status));
+            }
+            stats_reap_worker(worker->pid);
+            if (prefork->config.reap != NULL) {
+                prefork->config.reap(worker->pid);
+            }
+            worker->pid = 0;
+        }
+
+        // A worker that keeps failing is restarted at most once a second
+        if (worker->pid == 0 && *prefork->running && now - worker->started >= PREFORK_RESPAWN_DELAY) {
+            if (prefork_spawn(prefork, i) == 0) {
+                stats_inc(STAT_WORKER_RESPAWNS);
+                get_timestamp(ts, sizeof(ts));
+                printf("%s[INFO] Restarted worker %d as pid %d.\n", ts, i, (int)worker->pid);
+            }
+        }
+    }
+}
+
+void prefork_stop(prefork_t *prefork) {
+    for (int i = 0; i < prefork->config.workers; i++) {
+        if (prefork->workers[i].pid != 0) {
+            kill(prefork->workers[i].pid, SIGTERM);
+        }
+    }
+    for (int i = 0; i < prefork->config.workers; i++) {
+        if (prefork->workers[i].pid != 0) {
+            while (waitpid(prefork->workers[i].pid, NULL, 0) == -1 && errno == EINTR) {
+            }
+            stats_reap_worker(prefork->workers[i].pid);
+            if (prefork->config.reap != NULL) {
+                prefork->config.reap(prefork->workers[i].pid);
+            }
+        }
+    }
+    free(prefork->workers);
+    free(prefork);
+}
@@ -0,0 +1,51 @@
+#ifndef PREFORK_H
+#define PREFORK_H
+
+#include <signal.h>
+#include <sys/types.h>
+
+#include "reactor.h"
+
+// Pre-forked worker processes (TELNET_MODEL=prefork).
+//
+// The listener process forks TELNET_WORKERS worker processes at startup.
+// Each runs a one-thread reactor that accepts and serves many sessions, so
+// a connection costs an accept and a session control block rather than a
+// fork(), while a crash only takes down the sessions of one worker. The
+// listener reaps workers that exit and starts replacements.
+//
+// Workers share the listener's socket (EPOLLEXCLUSIVE wakes one of them).
+// With TELNET_REUSEPORT=1 the first worker keeps using it and every other
+// worker opens its own SO_REUSEPORT listener, so the kernel spreads new
+// connections over per-worker accept queues; the TLS port is handled the
+// same way. Connections still queued on a worker's socket when that worker
+// dies are reset.
+
+#define PREFORK_MAX_CLOSE_FDS 4
+#define PREFORK_RESPAWN_DELAY 1        // Seconds between restarts of one worker
+
+typedef struct prefork prefork_t;
+
+typedef struct {
+    int port;
+    int listen_fd;
+    int tls_fd;                    // TLS listener on its own port, -1 for none
+    const session_ops_t *ops;
+    void (*reap)(pid_t pid);       // Frees what an exited worker held (may be NULL)
+    int workers;
+    int close_fds[PREFORK_MAX_CLOSE_FDS];  // Listener-only descriptors (admin port)
+    int close_count;
+} prefork_config_t;
+
+// Fork the workers, which run until *running drops to 0 (set by the
+// signal handler they inherit) or they are stopped. Returns NULL when none
+// could be started.
+prefork_t *prefork_start(const prefork_config_t *config, volatile sig_atomic_t *running);
+
+// Reap workers that exited and restart them (call from the listener's loop)
+void prefork_check(prefork_t *prefork);
+
+// Stop the workers, wait for them and free the pool
+void prefork_stop(prefork_t *prefork);
+
+#endif
@@ -0,0 +1,128 @@
+#!/bin/bash
+#
+# Profiling workload for the telnet echo servers.
+#
+# Starts all three servers (build them first with 'make profile'), drives
+# each with parallel clients sending ASCII, Korean UTF-8, CR NUL terminated
+# and IAC-escaped lines, records the servers and their forked children with
+# perf, and renders one flamegraph per server.
+#
+# Usage: ./profile_workload.sh [clients_per_server] [seconds]
+#
+# Requirements: perf, and Brendan Gregg's FlameGraph scripts
+# (stackcollapse-perf.pl, flamegraph.pl) in $FLAMEGRAPH_DIR or on PATH.
+# Without perf the workload still runs, which is useful together with the
+# USDT probes or the admin port (/latency).
+#
+# Output: perf-<server>.data, perf-<server>.folded, flamegraph-<server>.svg
+
+CLIENTS=${1:-8}
+DURATION=${2:-20}
+FLAMEGRAPH_DIR=${FLAMEGRAPH_DIR:-}
+SERVERS="line_mode_server:9091 char_mode_server:9092 line_mode_binary_server:9093"
+
+cd "$(dirname "$0")" || exit 1
+
+find_tool() {
+    if [ -n "$FLAMEGRAPH_DIR" ] && [ -x "$FLAMEGRAPH_DIR/$1" ]; then
+        echo "$FLAMEGRAPH_DIR/$1"
+    else
+        command -v "$1"
+    fi
+}
+
+# One client: keep a connection busy for DURATION seconds
+drive_client() {
+    local port=$1
+    local end=$((SECONDS + DURATION))
+
+    exec 3<>"/dev/tcp/127.0.0.1/$port" || return
+    cat <&3 >/dev/null &
+    local reader=$!
+
+    while [ $SECONDS -lt $end ]; do
+        for _ in $(seq 1 50); do
+            printf 'hello world, the quick brown fox jumps over the lazy dog\r\n'
+            printf '\xec\x95\x88\xeb\x85\x95\xed\x95\x98\xec\x84\xb8\xec\x9a\x94 \xec\x84\xb8\xea\xb3\x84\r\n'
+            printf 'carriage return nul terminated line\r\0'
+            printf 'binary \xff\xff escaped byte\r\n'
+        done >&3 2>/dev/null || break
+    done
+
+    printf 'quit\r\n' >&3 2>/dev/null
+    exec 3>&-
+    kill $reader 2>/dev/null
+    wait $reader 2>/dev/null
+}
+
+PIDS=()
+for entry in $SERVERS; do
+    binary=${entry%%:*}
+    if [ ! -x "./$binary" ]; then
+        echo "Missing ./$binary - run 'make profile' first" >&2
+        exit 1
+    fi
+    "./$binary" >"profile-$binary.log" 2>&1 &
+    PIDS+=($!)
+done
+sleep 1
+
+PERF=$(command -v perf)
+PERF_PIDS=()
+if [ -n "$PERF" ]; then
+    i=0
+    for entry in $SERVERS; do
+        binary=${entry%%:*}
+        # -p follows the children each server forks for its clients
+        "$PERF" record -F 999 -g --call-graph fp -o "perf-$binary.data" \
+            -p "${PIDS[$i]}" >/dev/null 2>&1 &
+        PERF_PIDS+=($!)
+        i=$((i + 1))
+    done
+    sleep 1
+else
+    echo "perf not found: running the workload without recording" >&2
+fi
+
+echo "Driving $CLIENTS clients per server for $DURATION seconds..."
+CLIENT_PIDS=()
+for entry in $SERVERS; do
+    port=${entry##*:}
+    for _ in $(seq 1 "$CLIENTS"); do
+        drive_client "$port" &
+        CLIENT_PIDS+=($!)
+    done
+done
+wait "${CLIENT_PIDS[@]}"
+
+for pid in "${PERF_PIDS[@]}"; do
+    kill -INT "$pid" 2>/dev/null
+done
+for pid in "${PERF_PIDS[@]}"; do
+    wait "$pid" 2>/dev/null
+done
+for pid in "${PIDS[@]}"; do
+    kill -USR1 "$pid" 2>/dev/null   # latency table into profile-<server>.log
+done
+sleep 1
+for pid in "${PIDS[@]}"; do
+    kill -INT "$pid" 2>/dev/null
+done
+wait "${PIDS[@]}" 2>/dev/null
+
+if [ -z "$PERF" ]; then
+    exit 0
+fi
+
+STACKCOLLAPSE=$(find_tool stackcollapse-perf.pl)
+FLAMEGRAPH=$(find_tool flamegraph.pl)
+for entry in $SERVERS; do
+    binary=${entry%%:*}
+    if [ -z "$STACKCOLLAPSE" ] || [ -z "$FLAMEGRAPH" ]; then
+        echo "FlameGraph scripts not found: keeping perf-$binary.data only"
+        continue
+    fi
+    "$PERF" script -i "perf-$binary.data" 2>/dev/null | "$STACKCOLLAPSE" >"perf-$binary.folded"
+    "$FLAMEGRAPH" --title "$binary" "perf-$binary.folded" >"flamegraph-$binary.svg"
+    echo "Wrote flamegraph-$binary.svg"
+done
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "rate_limit.h"
+#include "server_config.h"
+
+rate_config_t rate_config;
+rate_port_t *rate_port = NULL;
+
+#define NSEC_PER_SEC 1000000000ull
+
+static int rate_configure(rate_limit_t *limit, const char *name, int port) {
+    char burst_name[64];
+    snprintf(burst_name, sizeof(burst_name), "%s_BURST", name);
+    long rate = config_get_long(name, port, 0);
+    if (rate <= 0) {
+        limit->interval = 0;
+        limit->tolerance = 0;
+        return 0;
+    }
+    long burst = config_get_long(burst_name, port, rate);
+    if (burst < 1) {
+        burst = 1;
+    }
+    // Faster than one unit per nanosecond is no limit at all
+    limit->interval = NSEC_PER_SEC / (uint64_t)rate;
+    if (limit->interval == 0) {
+        limit->tolerance = 0;
+        return 0;
+    }
+    limit->tolerance = limit->interval * (uint64_t)burst;
+    return 1;
+}
+
+int rate_init(int port) {
+    int session_in = rate_configure(&rate_config.in_bytes, "RATE_IN_BYTES", port) |
+                     rate_configure(&rate_config.in_lines, "RATE_IN_LINES", port);
+    int session_out = rate_configure(&rate_config.out_bytes, "RATE_OUT_BYTES", port);
+    int port_in = rate_configure(&rate_config.port_in_bytes, "PORT_RATE_IN_BYTES", port) |
+                  rate_configure(&rate_config.port_in_lines, "PORT_RATE_IN_LINES", port);
+    int port_out = rate_configure(&rate_config.port_out_bytes, "PORT_RATE_OUT_BYTES", port);
+
+    if (port_in || port_out) {
+        void *region = mmap(NULL, sizeof(rate_port_t), PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) {
+            perror("rate limit mmap failed");
+            port_in = port_out = 0;
+            rate_config.port_in_bytes.interval = 0;
+            rate_config.port_in_lines.interval = 0;
+            rate_config.port_out_bytes.interval = 0;
+        } else {
+            rate_port = region;
+        }
+    }
+    rate_config.input = session_in || port_in;
+    rate_config.output = session_out || port_out;
+    return rate_config.input || rate_config.output;
+}
+
+uint64_t rate_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t rate_available(const rate_limit_t *limit, uint64_t tat, uint64_t now) {
+    if (limit->interval == 0) {
+        return UINT64_MAX;
+    }
+    uint64_t ahead = tat > now ? tat - now : 0;
+    if (ahead >= limit->tolerance) {
+        return 0;
+    }
+    return (limit->tolerance - ahead) / limit->interval;
+}
+
+uint64_t rate_ready(const rate_limit_t *limit, uint64_t tat, uint64_t units, uint64_t now) {
+    if (limit->interval == 0) {
+        return now;
+    }
+    uint64_t cost = units * limit->interval;
+    if (cost > limit->tolerance) {
+        cost = limit->tolerance;
+    }
+    // Full at tat, so cost worth of units is there tolerance - cost before
+    uint64_t ready = tat + cost > limit->tolerance ? tat + cost - limit->tolerance : 0;
+    return ready > now ? ready : now;
+}
+
+void rate_take(const rate_limit_t *limit, uint64_t *tat, uint64_t units, uint64_t now) {
+    if (limit->interval != 0) {
+        *tat = (*tat > now ? *tat : now) + units * limit->interval;
+    }
+}
+
+void rate_take_shared(const rate_limit_t *limit, uint64_t *tat, uint64_t units, uint64_t now) {
+    if (limit->interval == 0) {
+        return;
+    }
+    uint64_t old = __atomic_load_n(tat, __ATOMIC_RELAXED);
+    uint64_t next;
+    do {
+        next = (old > now ? old : now) + units * limit->interval;
+    } while (!__atomic_compare_exchange_n(tat, &old, next, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
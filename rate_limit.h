@@ -0,0 +1,75 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <stdint.h>
+
+// Token bucket rate limits on session input and output.
+//
+// Every session has a bucket for the bytes it sends us, one for the lines
+// it sends us and one for the bytes we send it; optional per-port buckets
+// are shared by all sessions of the server (every process, through shared
+// memory created before the first fork()). A bucket refills at its rate
+// (units per second) up to its burst.
+//
+// A bucket is kept in GCRA form, as one 64-bit value: the time at which
+// it would be full again (its "theoretical arrival time"). Taking units
+// pushes that time forward by their emission interval, and the bucket is
+// empty while the time is more than the burst ahead of now. One value
+// means the shared buckets need no lock, only a compare-and-swap.
+//
+// Units are taken after the fact (the lines of a receive segment are only
+// known once it is read), so a bucket can go into debt; its session then
+// waits until the debt is paid. The reactor enforces the limits: a session
+// with an empty input bucket is not read, so TCP flow control pushes back
+// on the client, and output beyond the output bucket stays queued.
+//
+// Settings (TELNET_<NAME>[_<server port>], units per second, 0 = no limit;
+// each has a <NAME>_BURST, by default one second's worth):
+//   RATE_IN_BYTES, RATE_IN_LINES, RATE_OUT_BYTES                per session
+//   PORT_RATE_IN_BYTES, PORT_RATE_IN_LINES, PORT_RATE_OUT_BYTES all sessions
+
+typedef struct {
+    uint64_t interval;             // Nanoseconds per unit, 0 = no limit
+    uint64_t tolerance;            // Burst size times interval
+} rate_limit_t;
+
+typedef struct {
+    rate_limit_t in_bytes;
+    rate_limit_t in_lines;
+    rate_limit_t out_bytes;
+    rate_limit_t port_in_bytes;
+    rate_limit_t port_in_lines;
+    rate_limit_t port_out_bytes;
+    int input;                     // Some input limit is set
+    int output;                    // Some output limit is set
+} rate_config_t;
+
+// Per-port bucket states, in shared memory
+typedef struct {
+    uint64_t in_bytes;
+    uint64_t in_lines;
+    uint64_t out_bytes;
+} rate_port_t;
+
+extern rate_config_t rate_config;
+extern rate_port_t *rate_port;
+
+// Read the limits for the server on port and create the shared per-port
+// buckets (call once in the listener, before the first fork()). Returns 1
+// when any limit is set.
+int rate_init(int port);
+
+// Bucket clock: CLOCK_MONOTONIC in nanoseconds
+uint64_t rate_now(void);
+
+// Units the bucket holds at now (UINT64_MAX without a limit)
+uint64_t rate_available(const rate_limit_t *limit, uint64_t tat, uint64_t now);
+
+// Time at which the bucket will hold units (at most its burst)
+uint64_t rate_ready(const rate_limit_t *limit, uint64_t tat, uint64_t units, uint64_t now);
+
+// Take units from a bucket owned by the caller, or from a shared one
+void rate_take(const rate_limit_t *limit, uint64_t *tat, uint64_t units, uint64_t now);
+void rate_take_shared(const rate_limit_t *limit, uint64_t *tat, uint64_t units, uint64_t now);
+
+#endif
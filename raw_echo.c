@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "raw_echo.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "supervisor.h"
+#include "telnet_proto.h"
+
+void raw_echo_configure(raw_echo_config_t *config, int port, int default_raw_port) {
+    config->port = (int)config_get_long("RAW_PORT", port, default_raw_port);
+    config->splice = config_get_long("RAW_SPLICE", port, 1) != 0;
+    config->escape = config_get_long("RAW_ESCAPE", port, 0) != 0;
+}
+
+// Number of leading bytes that can be echoed before an IAC IP or a trailing
+// lone IAC. Sets *escape when the scan stopped at IAC IP.
+static size_t raw_scan(const unsigned char *data, size_t len, int *escape) {
+    *escape = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] != IAC) {
+            continue;
+        }
+        if (i + 1 == len) {
+            return i;
+        }
+        if (data[i + 1] == IP) {
+            *escape = 1;
+            return i;
+        }
+        i++;   // IAC IAC and other commands are echoed like data
+    }
+    return len;
+}
+
+// Move up to max bytes socket -> pipe -> socket.
+// Returns the byte count, 0 when the client closed, -1 on error.
+static ssize_t raw_splice_chunk(int client_fd, int pipe_fd[2], size_t max) {
+    ssize_t in;
+    do {
+        in = splice(client_fd, NULL, pipe_fd[1], NULL, max, SPLICE_F_MOVE | SPLICE_F_MORE);
+    } while (in == -1 && errno == EINTR);
+    if (in <= 0) {
+        return in;
+    }
+
+    size_t left = (size_t)in;
+    while (left > 0) {
+        ssize_t out = splice(pipe_fd[0], NULL, client_fd, NULL, left, SPLICE_F_MOVE);
+        if (out == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            stats_inc(STAT_SEND_ERRORS);
+            return -1;
+        }
+        left -= (size_t)out;
+    }
+    stats_add(STAT_BYTES_OUT, (uint64_t)in);
+    return in;
+}
+
+// Same contract as raw_splice_chunk() through a user-space buffer
+static ssize_t raw_copy_chunk(int client_fd, unsigned char *buffer, size_t max, transcript_session_t *transcript) {
+    ssize_t in;
+    do {
+        in = recv(client_fd, buffer, max, 0);
+    } while (in == -1 && errno == EINTR);
+    if (in <= 0) {
+        return in;
+    }
+    transcript_record(transcript, TRANSCRIPT_IN, buffer, (size_t)in);
+    transcript_record(transcript, TRANSCRIPT_OUT, buffer, (size_t)in);
+
+    size_t sent = 0;
+    while (sent < (size_t)in) {
+        ssize_t out = stats_send(client_fd, buffer + sent, (size_t)in - sent, 0);
+        if (out == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        sent += (size_t)out;
+    }
+    return in;
+}
+
+int raw_echo_session(int client_fd, const raw_echo_config_t *config, transcript_session_t *transcript) {
+    int pipe_fd[2] = { -1, -1 };
+    int use_splice = config->splice && transcript->id == 0 && pipe2(pipe_fd, O_CLOEXEC) == 0;
+    if (use_splice) {
+        fcntl(pipe_fd[1], F_SETPIPE_SZ, RAW_ECHO_CHUNK);
+    }
+
+    // Copy loop buffer, or the peek buffer for the escape scan
+    unsigned char *buffer = malloc(RAW_ECHO_CHUNK);
+    if (buffer == NULL) {
+        if (use_splice) {
+            close(pipe_fd[0]);
+            close(pipe_fd[1]);
+        }
+        return -1;
+    }
+
+    int result = 0;
+    while (1) {
+        size_t chunk = RAW_ECHO_CHUNK;
+
+        if (config->escape) {
+            ssize_t peeked = recv(client_fd, buffer, RAW_ECHO_CHUNK, MSG_PEEK);
+            if (peeked == 1 && buffer[0] == IAC) {
+                // A lone IAC: wait for the byte that says what it is
+                peeked = recv(client_fd, buffer, 2, MSG_PEEK | MSG_WAITALL);
+                if (peeked == 1) {
+                    break;
+                }
+            }
+            if (peeked <= 0) {
+                if (peeked == -1 && errno == EINTR) {
+                    continue;
+                }
+                result = peeked == 0 ? 0 : -1;
+                break;
+            }
+
+            int escape;
+            chunk = raw_scan(buffer, (size_t)peeked, &escape);
+            if (chunk == 0 && escape) {
+                // Drop the IAC IP itself and end the session
+                recv(client_fd, buffer, 2, MSG_WAITALL);
+                transcript_record(transcript, TRANSCRIPT_IN, buffer, 2);
+                stats_add(STAT_BYTES_IN, 2);
+                result = 1;
+                break;
+            }
+        }
+
+        ssize_t moved = use_splice ? raw_splice_chunk(client_fd, pipe_fd, chunk)
+                                   : raw_copy_chunk(client_fd, buffer, chunk, transcript);
+        if (moved == -1 && use_splice && errno == EINVAL) {
+            // The socket type does not support splice(): copy instead
+            close(pipe_fd[0]);
+            close(pipe_fd[1]);
+            use_splice = 0;
+            continue;
+        }
+        if (moved <= 0) {
+            result = moved == 0 ? 0 : -1;
+            break;
+        }
+        stats_add(STAT_BYTES_IN, (uint64_t)moved);
+        stats_add(STAT_RAW_BYTES, (uint64_t)moved);
+        supervisor_note_in((size_t)moved);
+        supervisor_note_out((size_t)moved);
+    }
+
+    free(buffer);
+    if (use_splice) {
+        close(pipe_fd[0]);
+        close(pipe_fd[1]);
+    }
+    return result;
+}
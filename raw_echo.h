@@ -0,0 +1,39 @@
+#ifndef RAW_ECHO_H
+#define RAW_ECHO_H
+
+#include "transcript.h"
+
+// Raw transparent echo sessions: no telnet negotiation, no line handling,
+// every received byte goes straight back to the client.
+//
+// With splice enabled the bytes move socket -> pipe -> socket inside the
+// kernel and never enter user space. The escape mode keeps a minimal IAC
+// scan (on a MSG_PEEK copy, the echo itself is still spliced) so a client
+// can end the session with IAC IP; IAC IAC is ordinary data.
+//
+// A session with a transcript (transcript.h) always takes the copy loop:
+// spliced bytes never pass through user space to be recorded.
+//
+// Settings (TELNET_<NAME>[_<server port>]):
+//   RAW_PORT    listener port, 0 disables raw mode
+//   RAW_SPLICE  1 = splice() (default), 0 = recv()/send() copy loop
+//   RAW_ESCAPE  1 = end the session on IAC IP, 0 = fully transparent (default)
+
+#define RAW_ECHO_CHUNK (64 * 1024)
+
+typedef struct {
+    int port;
+    int splice;
+    int escape;
+} raw_echo_config_t;
+
+// Read the raw mode settings for the server on port
+void raw_echo_configure(raw_echo_config_t *config, int port, int default_raw_port);
+
+// Echo until the client closes, an error occurs or (with escape) IAC IP
+// arrives, recording the bytes in transcript. Falls back to the copy loop
+// when splice() is unsupported. Returns 1 when ended by the escape
+// sequence, 0 on close, -1 on error.
+int raw_echo_session(int client_fd, const raw_echo_config_t *config, transcript_session_t *transcript);
+
+#endif
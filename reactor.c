@@ -0,0 +1,1587 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "listener.h"
+#include "rate_limit.h"
+#include "reactor.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "supervisor.h"
+#include "trace_probes.h"
+
+#define REACTOR_MAX_LISTENERS 4
+#define REACTOR_MAX_EVENTS 64
+#define REACTOR_OUT_IOV 64             // iovecs per send of a queue with shared output
+
+// session_t.throttled bits
+#define THROTTLE_IN 1                  // Not read until the input buckets refill
+#define THROTTLE_OUT 2                 // Queued output waits for the output buckets
+
+// Every epoll entry points at a struct whose first member is one of these
+enum {
+    KIND_SESSION,
+    KIND_LISTENER,
+    KIND_WAKE
+};
+
+// One entry of a session's output queue: a shared buffer, or a run of the
+// next len bytes of the session's own out buffer
+struct session_out {
+    session_out_t *next;
+    session_shared_t *shared;      // NULL for a run of out
+    size_t offset;                 // Bytes of shared already sent
+    size_t len;                    // Bytes still to send
+};
+
+// Sessions waiting for a turn with input they have received
+struct session_queue {
+    session_t *head;
+    session_t *tail;
+    int count;
+};
+
+// Worker run queues, served in this order
+enum {
+    RUN_SMALL,                     // At most one turn of input waiting (SLO mode)
+    RUN_BULK,
+    RUN_QUEUES
+};
+
+// Load a worker publishes for the others and for the admin port, one slot
+// per shared counter slot (shared across fork() for the prefork workers)
+typedef struct {
+    _Alignas(STATS_CACHE_LINE) pid_t owner;    // Process of the worker, 0 when free
+    int sessions;
+    uint64_t load;                 // Bytes per second, smoothed
+    uint64_t migrated_in;
+    uint64_t migrated_out;
+} worker_load_t;
+
+typedef struct {
+    int kind;
+    int fd;
+    int budget;                    // Connections taken per wakeup
+    const session_ops_t *ops;
+    tls_server_t *tls;             // NULL for a plain listener
+} reactor_listener_t;
+
+struct reactor_worker {
+    reactor_t *reactor;            // NULL for a fork-model worker
+    volatile sig_atomic_t *running;
+    int epoll_fd;
+    int wake_fd;
+    int wake_kind;
+    pthread_t thread;
+    session_t *sessions;
+    int session_count;
+    time_t next_tick_scan;
+    session_job_t *completed;      // Finished jobs, pushed by pool threads (newest first)
+    worker_task_t *tasks;          // Tasks posted by other threads (newest first)
+    session_t *throttled;          // Sessions held back by a rate limit
+    uint64_t throttle_wake;        // Earliest resume_at among them
+    session_queue_t run[RUN_QUEUES];
+    worker_load_t load;            // Read by the other workers when they balance
+    worker_load_t *load_slot;      // Copy in worker_loads for the admin port (NULL: none)
+    latency_clock_t clock;
+    unsigned char recv_buf[REACTOR_RECV_SIZE];
+};
+
+struct reactor {
+    int worker_count;
+    reactor_worker_t *workers;
+    reactor_listener_t listeners[REACTOR_MAX_LISTENERS];
+    int listener_count;
+    volatile sig_atomic_t running;
+};
+
+// Command pool shared by the process, started by the first job
+static int pool_threads = 0;
+static work_pool_t *job_pool = NULL;
+static int job_pool_closed = 0;
+static pthread_mutex_t job_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Fair turns (reactor_configure)
+static size_t fair_bytes = 0;
+static unsigned int fair_lines = 0;
+static int fair_slo = 0;
+
+// Load balancing between reactor threads (reactor_configure)
+static int balance_skew = 0;
+static uint64_t balance_min = REACTOR_BALANCE_MIN;
+static worker_load_t *worker_loads = NULL;
+
+static size_t reactor_metrics_handler(const char *args, char *buf, size_t size) {
+    static const struct {
+        const char *name;
+        const char *type;
+        const char *help;
+    } metrics[] = {
+        { "telnet_worker_sessions", "gauge", "Sessions served by the worker." },
+        { "telnet_worker_load_bytes_per_second", "gauge", "Bytes in and out per second on the worker, smoothed." },
+        { "telnet_worker_migrations_in_total", "counter", "Sessions moved to the worker from a busier one." },
+        { "telnet_worker_migrations_out_total", "counter", "Sessions the worker moved to a less loaded one." }
+    };
+    size_t len = 0;
+    (void)args;
+    for (size_t m = 0; m < sizeof(metrics) / sizeof(metrics[0]); m++) {
+        len = stats_appendf(buf, size, len, "# HELP %s %s\n# TYPE %s %s\n",
+                            metrics[m].name, metrics[m].help, metrics[m].name, metrics[m].type);
+        for (int w = 0; w < STATS_MAX_WORKERS; w++) {
+            const worker_load_t *slot = &worker_loads[w];
+            pid_t owner = __atomic_load_n(&slot->owner, __ATOMIC_ACQUIRE);
+            // A prefork worker that died leaves its slot behind
+            if (owner == 0 || (owner != getpid() && kill(owner, 0) == -1)) {
+                continue;
+            }
+            uint64_t values[] = {
+                (uint64_t)__atomic_load_n(&slot->sessions, __ATOMIC_RELAXED),
+                __atomic_load_n(&slot->load, __ATOMIC_RELAXED),
+                __atomic_load_n(&slot->migrated_in, __ATOMIC_RELAXED),
+                __atomic_load_n(&slot->migrated_out, __ATOMIC_RELAXED)
+            };
+            len = stats_appendf(buf, size, len, "%s{worker=\"%d\"} %llu\n",
+                                metrics[m].name, w, (unsigned long long)values[m]);
+        }
+    }
+    return len;
+}
+
+void reactor_configure(reactor_config_t *config, int port) {
+    const char *model = config_get_str("MODEL", port, "fork");
+    config->model = REACTOR_MODEL_FORK;
+    if (strcasecmp(model, "reactor") == 0 || strcasecmp(model, "threads") == 0) {
+        config->model = REACTOR_MODEL_THREADS;
+    } else if (strcasecmp(model, "prefork") == 0) {
+        config->model = REACTOR_MODEL_PREFORK;
+    } else if (strcasecmp(model, "fork") != 0) {
+        fprintf(stderr, "Unknown TELNET_MODEL '%s', using fork\n", model);
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long workers = config_get_long("WORKERS", port, cpus > 0 ? cpus : 1);
+    // Slots are needed for the listener, the overflow and every worker
+    if (workers < 1) {
+        workers = 1;
+    } else if (workers > STATS_MAX_WORKERS - 2) {
+        workers = STATS_MAX_WORKERS - 2;
+    }
+    config->workers = (int)workers;
+
+    // A forked worker serves one session, so one pool thread is plenty
+    // there; pre-forked workers split the CPUs between them
+    long default_threads = 1;
+    if (config->model == REACTOR_MODEL_THREADS) {
+        default_threads = cpus > 0 ? cpus : 1;
+    } else if (config->model == REACTOR_MODEL_PREFORK && cpus > workers) {
+        default_threads = cpus / workers;
+    }
+    long threads = config_get_long("POOL_THREADS", port, default_threads);
+    if (threads < 0) {
+        threads = 0;
+    } else if (threads > STATS_MAX_WORKERS / 4) {
+        threads = STATS_MAX_WORKERS / 4;
+    }
+    config->pool_threads = (int)threads;
+    pool_threads = config->pool_threads;
+
+    // A forked worker has a single session, with nobody to take turns with
+    long bytes = config_get_long("FAIR_BYTES", port,
+                                 config->model == REACTOR_MODEL_FORK ? 0 : REACTOR_FAIR_BYTES);
+    if (bytes < 0 || bytes >= REACTOR_RECV_SIZE) {
+        bytes = 0;
+    }
+    long lines = config_get_long("FAIR_LINES", port, 0);
+    if (lines < 0) {
+        lines = 0;
+    }
+    const char *mode = config_get_str("FAIR_MODE", port, "rr");
+    config->fair_slo = 0;
+    if (strcasecmp(mode, "slo") == 0) {
+        config->fair_slo = 1;
+    } else if (strcasecmp(mode, "rr") != 0) {
+        fprintf(stderr, "Unknown TELNET_FAIR_MODE '%s', using rr\n", mode);
+    }
+    config->fair_bytes = (size_t)bytes;
+    config->fair_lines = (unsigned int)lines;
+    fair_bytes = config->fair_bytes;
+    fair_lines = config->fair_lines;
+    fair_slo = config->fair_slo;
+
+    // Sessions only move between the threads of one process
+    long skew = config_get_long("BALANCE_SKEW", port,
+                                config->model == REACTOR_MODEL_THREADS ? REACTOR_BALANCE_SKEW : 0);
+    long min = config_get_long("BALANCE_MIN", port, REACTOR_BALANCE_MIN);
+    config->balance_skew = skew > 0 && config->model == REACTOR_MODEL_THREADS && config->workers > 1 ? (int)skew : 0;
+    config->balance_min = min > 0 ? min : 0;
+    balance_skew = config->balance_skew;
+    balance_min = (uint64_t)config->balance_min;
+
+    // Every worker's load is exported, the prefork workers' too
+    if (config->model != REACTOR_MODEL_FORK && worker_loads == NULL) {
+        void *region = mmap(NULL, sizeof(worker_load_t) * STATS_MAX_WORKERS, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) {
+            perror("worker load mmap failed");
+        } else {
+            worker_loads = region;
+            stats_admin_register_metrics(reactor_metrics_handler);
+        }
+    }
+}
+
+// The process-wide pool, or NULL to run jobs inline
+static work_pool_t *reactor_pool(void) {
+    work_pool_t *pool = __atomic_load_n(&job_pool, __ATOMIC_ACQUIRE);
+    if (pool == NULL && pool_threads > 0) {
+        pthread_mutex_lock(&job_pool_lock);
+        if (job_pool == NULL && !job_pool_closed) {
+            __atomic_store_n(&job_pool, work_pool_create(pool_threads), __ATOMIC_RELEASE);
+        }
+        pool = job_pool;
+        pthread_mutex_unlock(&job_pool_lock);
+    }
+    return pool;
+}
+
+// Run the jobs still in the pool and stop it; later jobs run inline
+static void reactor_pool_shutdown(void) {
+    pthread_mutex_lock(&job_pool_lock);
+    work_pool_t *pool = job_pool;
+    job_pool = NULL;
+    job_pool_closed = 1;
+    pthread_mutex_unlock(&job_pool_lock);
+    if (pool != NULL) {
+        work_pool_destroy(pool);
+    }
+}
+
+void *session_alloc(size_t size) {
+    void *state = calloc(1, size);
+    if (state != NULL) {
+        stats_add(STAT_SESSION_MEMORY_ALLOCATED, size);
+    }
+    return state;
+}
+
+void session_free(void *state, size_t size) {
+    if (state != NULL) {
+        free(state);
+        stats_add(STAT_SESSION_MEMORY_FREED, size);
+    }
+}
+
+latency_clock_t *session_clock(session_t *session) {
+    return &session->worker->clock;
+}
+
+size_t session_queued(const session_t *session) {
+    return session->out.len + session->shared_len;
+}
+
+session_shared_t *session_shared_create(const void *data, size_t len) {
+    session_shared_t *shared = session_alloc(sizeof(session_shared_t) + len);
+    if (shared != NULL) {
+        shared->refs = 1;
+        shared->len = len;
+        if (data != NULL) {
+            memcpy(shared->data, data, len);
+        }
+    }
+    return shared;
+}
+
+void session_shared_release(session_shared_t *shared) {
+    if (__atomic_sub_fetch(&shared->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        session_free(shared, sizeof(session_shared_t) + shared->len);
+    }
+}
+
+static session_out_t *session_out_push(session_t *session, session_shared_t *shared, size_t offset, size_t len) {
+    session_out_t *entry = session_alloc(sizeof(session_out_t));
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->shared = shared;
+    entry->offset = offset;
+    entry->len = len;
+    if (session->queue_tail != NULL) {
+        session->queue_tail->next = entry;
+    } else {
+        session->queue = entry;
+    }
+    session->queue_tail = entry;
+    return entry;
+}
+
+static void session_out_pop(session_t *session) {
+    session_out_t *entry = session->queue;
+    session->queue = entry->next;
+    if (session->queue == NULL) {
+        session->queue_tail = NULL;
+    }
+    if (entry->shared != NULL) {
+        session->shared_len -= entry->len;
+        session_shared_release(entry->shared);
+    }
+    session_free(entry, sizeof(session_out_t));
+}
+
+// Whether the protocol may be handed input now
+static int session_takes_input(const session_t *session) {
+    return !session->handshake && !session->closing && session->jobs == NULL &&
+           !(session->throttled & THROTTLE_IN) && session_queued(session) < REACTOR_OUT_HIGH;
+}
+
+// Put the session at the back of a run queue for its next turn
+static void session_enqueue(session_t *session) {
+    size_t turn = fair_bytes != 0 ? fair_bytes : REACTOR_RECV_SIZE;
+    session_queue_t *queue = &session->worker->run[fair_slo && session->pending.len <= turn ? RUN_SMALL : RUN_BULK];
+    session->run_next = NULL;
+    if (queue->tail != NULL) {
+        queue->tail->run_next = session;
+    } else {
+        queue->head = session;
+    }
+    queue->tail = session;
+    queue->count++;
+    session->run_queue = queue;
+}
+
+static session_t *session_queue_pop(session_queue_t *queue) {
+    session_t *session = queue->head;
+    queue->head = session->run_next;
+    if (queue->head == NULL) {
+        queue->tail = NULL;
+    }
+    queue->count--;
+    session->run_next = NULL;
+    session->run_queue = NULL;
+    return session;
+}
+
+// Keep the epoll interest in line with the session's state: stop reading
+// while closing, while too much output is queued or while input it has
+// received waits for its turn (the session is then on a run queue)
+static void session_update_events(session_t *session) {
+    if (session->detached || session->parked) {
+        return;
+    }
+    unsigned int events = 0;
+    if (session->handshake) {
+        events = tls_conn_wants_write(session->tls) ? EPOLLOUT : EPOLLIN;
+    } else if (session_takes_input(session)) {
+        if (session->pending.len == 0) {
+            events |= EPOLLIN;
+        } else if (session->run_queue == NULL) {
+            session_enqueue(session);
+        }
+    }
+    if (!session->handshake && !(session->throttled & THROTTLE_OUT) &&
+        (session_queued(session) > 0 || session->notify_writable)) {
+        events |= EPOLLOUT;
+    }
+    if (events != session->events) {
+        struct epoll_event event = { .events = events, .data.ptr = session };
+        epoll_ctl(session->worker->epoll_fd, EPOLL_CTL_MOD, session->fd, &event);
+        session->events = events;
+    }
+}
+
+static void session_fail(session_t *session) {
+    session->failed = 1;
+    session->closing = 1;
+    session->out.len = 0;
+    session->pending.len = 0;
+    while (session->queue != NULL) {
+        session_out_pop(session);
+    }
+}
+
+// Hold the session back until until (rate_now() clock)
+static void session_throttle(session_t *session, int what, uint64_t until) {
+    reactor_worker_t *worker = session->worker;
+    if (session->throttled == 0) {
+        session->throttle_next = worker->throttled;
+        worker->throttled = session;
+        session->resume_at = until;
+    } else if (until < session->resume_at) {
+        session->resume_at = until;
+    }
+    session->throttled |= what;
+    if (worker->throttle_wake == 0 || session->resume_at < worker->throttle_wake) {
+        worker->throttle_wake = session->resume_at;
+    }
+    session_update_events(session);
+}
+
+// Bytes the input limits let the session read now. While a bucket is
+// empty the session is not read (returns 0) until it holds a full receive
+// again, or one line.
+static size_t session_input_budget(session_t *session) {
+    uint64_t now = rate_now();
+    uint64_t budget = rate_available(&rate_config.in_bytes, session->rate_in, now);
+    uint64_t until = 0;
+    if (budget == 0) {
+        until = rate_ready(&rate_config.in_bytes, session->rate_in, REACTOR_RECV_SIZE, now);
+        stats_inc(STAT_THROTTLE_IN_BYTES);
+    }
+    if (rate_available(&rate_config.in_lines, session->rate_lines, now) == 0) {
+        uint64_t ready = rate_ready(&rate_config.in_lines, session->rate_lines, 1, now);
+        until = ready > until ? ready : until;
+        stats_inc(STAT_THROTTLE_IN_LINES);
+    }
+    if (rate_port != NULL) {
+        uint64_t port_bytes = __atomic_load_n(&rate_port->in_bytes, __ATOMIC_RELAXED);
+        uint64_t port_lines = __atomic_load_n(&rate_port->in_lines, __ATOMIC_RELAXED);
+        uint64_t shared = rate_available(&rate_config.port_in_bytes, port_bytes, now);
+        budget = shared < budget ? shared : budget;
+        if (shared == 0) {
+            uint64_t ready = rate_ready(&rate_config.port_in_bytes, port_bytes, REACTOR_RECV_SIZE, now);
+            until = ready > until ? ready : until;
+            stats_inc(STAT_THROTTLE_PORT);
+        }
+        if (rate_available(&rate_config.port_in_lines, port_lines, now) == 0) {
+            uint64_t ready = rate_ready(&rate_config.port_in_lines, port_lines, 1, now);
+            until = ready > until ? ready : until;
+            stats_inc(STAT_THROTTLE_PORT);
+        }
+    }
+    if (until != 0) {
+        session_throttle(session, THROTTLE_IN, until);
+        return 0;
+    }
+    return budget < REACTOR_RECV_SIZE ? (size_t)budget : REACTOR_RECV_SIZE;
+}
+
+// Bytes the output limits let the session send now
+static size_t session_output_budget(session_t *session, uint64_t now) {
+    uint64_t budget = rate_available(&rate_config.out_bytes, session->rate_out, now);
+    if (rate_port != NULL) {
+        uint64_t shared = rate_available(&rate_config.port_out_bytes,
+                                         __atomic_load_n(&rate_port->out_bytes, __ATOMIC_RELAXED), now);
+        budget = shared < budget ? shared : budget;
+    }
+    return budget < SIZE_MAX ? (size_t)budget : SIZE_MAX;
+}
+
+// Queued output waits while an output bucket is empty, until it holds
+// everything queued (or its burst)
+static void session_throttle_output(session_t *session) {
+    uint64_t now = rate_now();
+    uint64_t queued = session_queued(session);
+    uint64_t until = 0;
+    if (rate_available(&rate_config.out_bytes, session->rate_out, now) == 0) {
+        until = rate_ready(&rate_config.out_bytes, session->rate_out, queued, now);
+        stats_inc(STAT_THROTTLE_OUT_BYTES);
+    }
+    if (rate_port != NULL) {
+        uint64_t port_bytes = __atomic_load_n(&rate_port->out_bytes, __ATOMIC_RELAXED);
+        if (rate_available(&rate_config.port_out_bytes, port_bytes, now) == 0) {
+            uint64_t ready = rate_ready(&rate_config.port_out_bytes, port_bytes, queued, now);
+            until = ready > until ? ready : until;
+            stats_inc(STAT_THROTTLE_PORT);
+        }
+    }
+    if (until != 0) {
+        session_throttle(session, THROTTLE_OUT, until);
+    }
+}
+
+// Whether all of iov may go out right away
+static int session_output_fits(session_t *session, const struct iovec *iov, int iovcnt) {
+    if (!rate_config.output) {
+        return 1;
+    }
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    return len <= session_output_budget(session, rate_now());
+}
+
+// Account bytes the socket took
+static void session_note_out(session_t *session, size_t n) {
+    stats_add(STAT_BYTES_OUT, (uint64_t)n);
+    session->load_bytes += n;
+    supervisor_note_out(n);
+    if (rate_config.output) {
+        uint64_t now = rate_now();
+        rate_take(&rate_config.out_bytes, &session->rate_out, n, now);
+        if (rate_port != NULL) {
+            rate_take_shared(&rate_config.port_out_bytes, &rate_port->out_bytes, n, now);
+        }
+    }
+}
+
+void session_charge_lines(session_t *session, unsigned int lines) {
+    if (rate_config.input) {
+        uint64_t now = rate_now();
+        rate_take(&rate_config.in_lines, &session->rate_lines, lines, now);
+        if (rate_port != NULL) {
+            rate_take_shared(&rate_config.port_in_lines, &rate_port->in_lines, lines, now);
+        }
+    }
+}
+
+// Advance the TLS handshake; the session is opened once it is complete
+static void session_handshake(session_t *session) {
+    int result = tls_conn_handshake(session->tls);
+    if (result == 1) {
+        session->handshake = 0;
+        session->ops->open(session);
+    } else if (result == -1) {
+        session_fail(session);
+    }
+}
+
+// Take the session off its worker's session list and run queue
+static void session_unlink(session_t *session) {
+    reactor_worker_t *worker = session->worker;
+    if (session->prev != NULL) {
+        session->prev->next = session->next;
+    } else {
+        worker->sessions = session->next;
+    }
+    if (session->next != NULL) {
+        session->next->prev = session->prev;
+    }
+    session->prev = session->next = NULL;
+    worker->session_count--;
+
+    if (session->run_queue != NULL) {
+        session_queue_t *queue = session->run_queue;
+        session_t **link = &queue->head;
+        session_t *prev = NULL;
+        while (*link != session) {
+            prev = *link;
+            link = &prev->run_next;
+        }
+        *link = session->run_next;
+        if (queue->tail == session) {
+            queue->tail = prev;
+        }
+        queue->count--;
+        session->run_queue = NULL;
+        session->run_next = NULL;
+    }
+}
+
+// Put the session at the head of its worker's session list
+static void session_link(session_t *session) {
+    reactor_worker_t *worker = session->worker;
+    session->prev = NULL;
+    session->next = worker->sessions;
+    if (worker->sessions != NULL) {
+        worker->sessions->prev = session;
+    }
+    worker->sessions = session;
+    worker->session_count++;
+}
+
+static session_t *session_create(reactor_worker_t *worker, int fd, const struct sockaddr_in *peer,
+                                 const session_ops_t *ops, tls_server_t *tls) {
+    session_t *session = session_alloc(sizeof(session_t));
+    tls_conn_t *conn = NULL;
+    if (session == NULL || (tls != NULL && (conn = tls_conn_new(tls, fd)) == NULL)) {
+        stats_inc(STAT_REJECTS);
+        close(fd);
+        if (session != NULL) {
+            session_free(session, sizeof(session_t));
+        }
+        return NULL;
+    }
+    session->kind = KIND_SESSION;
+    session->fd = fd;
+    session->worker = worker;
+    session->ops = ops;
+    session->tls = conn;
+    session->handshake = conn != NULL;
+    line_buffer_init(&session->out, LINE_BUFFER_UNLIMITED);
+    line_buffer_init(&session->pending, LINE_BUFFER_UNLIMITED);
+    inet_ntop(AF_INET, &peer->sin_addr, session->peer_ip, sizeof(session->peer_ip));
+    session->peer_port = ntohs(peer->sin_port);
+    if (ops->tick != NULL) {
+        session->next_tick = time(NULL) + ops->tick_seconds;
+    }
+
+    session->events = EPOLLIN;
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = session };
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        perror("epoll_ctl failed");
+        stats_inc(STAT_REJECTS);
+        if (conn != NULL) {
+            tls_conn_free(conn);
+        }
+        close(fd);
+        session_free(session, sizeof(session_t));
+        return NULL;
+    }
+
+    transcript_open(&session->transcript, session->peer_ip, session->peer_port);
+    session_link(session);
+    stats_inc(STAT_CONNECTIONS_OPENED);
+
+    // The ClientHello has usually arrived with the connection
+    if (session->handshake) {
+        session_handshake(session);
+    } else {
+        ops->open(session);
+    }
+    session_update_events(session);
+    return session;
+}
+
+static void session_destroy(session_t *session) {
+    reactor_worker_t *worker = session->worker;
+
+    // Only jobs that never started can be left here
+    while (session->jobs != NULL) {
+        session_job_t *job = session->jobs;
+        session->jobs = job->next;
+        job->cancelled = 1;
+        job->done(session, job);
+    }
+    if (!session->handshake) {
+        session->ops->close(session);
+    }
+
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+    if (session->tls != NULL) {
+        tls_conn_free(session->tls);
+    }
+    close(session->fd);
+    transcript_close(&session->transcript);
+    TRACE_PROBE1(session_close, session->fd);
+    stats_inc(STAT_CONNECTIONS_CLOSED);
+
+    session_unlink(session);
+    if (session->throttled) {
+        session_t **link = &worker->throttled;
+        while (*link != session) {
+            link = &(*link)->throttle_next;
+        }
+        *link = session->throttle_next;
+    }
+    while (session->queue != NULL) {
+        session_out_pop(session);
+    }
+    line_buffer_free(&session->out);
+    line_buffer_free(&session->pending);
+    session_free(session, sizeof(session_t));
+}
+
+// sendmsg() of the session's plaintext. Without kTLS a TLS session goes
+// through OpenSSL one iovec at a time, stopping at the first short write.
+static ssize_t session_write(session_t *session, const struct iovec *iov, int iovcnt) {
+    ssize_t n;
+    if (session->tls == NULL || tls_conn_ktls_send(session->tls)) {
+        struct msghdr msg = {
+            .msg_iov = (struct iovec *)iov,
+            .msg_iovlen = iovcnt
+        };
+        do {
+            n = sendmsg(session->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        } while (n == -1 && errno == EINTR);
+        return n;
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        n = tls_conn_send(session->tls, iov[i].iov_base, iov[i].iov_len);
+        if (n == -1) {
+            return total > 0 ? (ssize_t)total : -1;
+        }
+        total += (size_t)n;
+        if ((size_t)n < iov[i].iov_len) {
+            break;
+        }
+    }
+    return (ssize_t)total;
+}
+
+void session_sendv(session_t *session, const struct iovec *iov, int iovcnt) {
+    if (session->failed) {
+        return;
+    }
+    transcript_recordv(&session->transcript, TRANSCRIPT_OUT, iov, iovcnt);
+
+    // Send directly unless older output is still waiting
+    size_t sent = 0;
+    if (session_queued(session) == 0 && !session->handshake && session_output_fits(session, iov, iovcnt)) {
+        ssize_t n = session_write(session, iov, iovcnt);
+        if (n >= 0) {
+            session_note_out(session, (size_t)n);
+            sent = (size_t)n;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            stats_inc(STAT_SEND_ERRORS);
+            session_fail(session);
+            return;
+        }
+    }
+
+    // Queue whatever the socket did not take
+    for (int i = 0; i < iovcnt; i++) {
+        if (sent >= iov[i].iov_len) {
+            sent -= iov[i].iov_len;
+            continue;
+        }
+        size_t left = iov[i].iov_len - sent;
+        if (line_buffer_append(&session->out, (const char *)iov[i].iov_base + sent, left) < left) {
+            session_fail(session);
+            return;
+        }
+        // Behind shared output the new bytes are a run of their own
+        if (session->queue_tail != NULL) {
+            if (session->queue_tail->shared == NULL) {
+                session->queue_tail->len += left;
+            } else if (session_out_push(session, NULL, 0, left) == NULL) {
+                session_fail(session);
+                return;
+            }
+        }
+        sent = 0;
+    }
+    if (rate_config.output && !(session->throttled & THROTTLE_OUT) && session_queued(session) > 0) {
+        session_throttle_output(session);
+    }
+    session_update_events(session);
+}
+
+void session_send_shared(session_t *session, session_shared_t *shared) {
+    if (session->failed) {
+        return;
+    }
+    transcript_record(&session->transcript, TRANSCRIPT_OUT, shared->data, shared->len);
+
+    size_t sent = 0;
+    struct iovec iov = { .iov_base = shared->data, .iov_len = shared->len };
+    if (session_queued(session) == 0 && !session->handshake && session_output_fits(session, &iov, 1)) {
+        ssize_t n = session_write(session, &iov, 1);
+        if (n >= 0) {
+            session_note_out(session, (size_t)n);
+            sent = (size_t)n;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            stats_inc(STAT_SEND_ERRORS);
+            session_fail(session);
+            return;
+        }
+        if (sent == shared->len) {
+            return;
+        }
+    }
+
+    // Queue a reference, after a run for whatever out already holds
+    if (session->queue == NULL && session->out.len > 0 &&
+        session_out_push(session, NULL, 0, session->out.len) == NULL) {
+        session_fail(session);
+        return;
+    }
+    if (session_out_push(session, shared, sent, shared->len - sent) == NULL) {
+        session_fail(session);
+        return;
+    }
+    __atomic_add_fetch(&shared->refs, 1, __ATOMIC_RELAXED);
+    session->shared_len += shared->len - sent;
+    if (rate_config.output && !(session->throttled & THROTTLE_OUT)) {
+        session_throttle_output(session);
+    }
+    session_update_events(session);
+}
+
+void session_send(session_t *session, const void *data, size_t len) {
+    struct iovec iov = { .iov_base = (void *)data, .iov_len = len };
+    session_sendv(session, &iov, 1);
+}
+
+void session_notify_writable(session_t *session) {
+    if (session->ops->writable != NULL) {
+        session->notify_writable = 1;
+        session_update_events(session);
+    }
+}
+
+void session_close(session_t *session) {
+    session->closing = 1;
+}
+
+static void session_job_run(work_job_t *work) {
+    session_job_t *job = (session_job_t *)work;
+    job->run(job);
+}
+
+// Hand a finished job back to its session's worker (any thread)
+static void session_job_finish(work_job_t *work) {
+    session_job_t *job = (session_job_t *)work;
+    reactor_worker_t *worker = job->session->worker;
+    session_job_t *head = __atomic_load_n(&worker->completed, __ATOMIC_RELAXED);
+    do {
+        job->done_next = head;
+    } while (!__atomic_compare_exchange_n(&worker->completed, &head, job, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    // Only the push onto an empty queue needs to wake the worker
+    if (head == NULL) {
+        uint64_t one = 1;
+        ssize_t ignored = write(worker->wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+static void session_job_dispatch(session_job_t *job) {
+    stats_inc(STAT_POOL_JOBS);
+    work_pool_t *pool = reactor_pool();
+    if (pool != NULL) {
+        work_pool_submit(pool, &job->work);
+    } else {
+        // Still delivered through the completion queue, never re-entrantly
+        session_job_run(&job->work);
+        session_job_finish(&job->work);
+    }
+}
+
+void session_submit(session_t *session, session_job_t *job) {
+    job->session = session;
+    job->cancelled = 0;
+    job->next = NULL;
+    job->work.run = session_job_run;
+    job->work.finish = session_job_finish;
+    if (session->jobs_tail != NULL) {
+        session->jobs_tail->next = job;
+        session->jobs_tail = job;
+    } else {
+        session->jobs = session->jobs_tail = job;
+        session_job_dispatch(job);
+    }
+    // Input waits until the job's result has been delivered
+    session_update_events(session);
+}
+
+// Send a queue holding shared output: gather its entries, then retire
+// what the socket took, at most *budget bytes. Returns 0 once the queue is
+// empty or the budget spent, -1 to wait.
+static int session_writable_queue(session_t *session, size_t *budget) {
+    while (session->queue != NULL && *budget > 0) {
+        struct iovec iov[REACTOR_OUT_IOV];
+        int count = 0;
+        size_t run_offset = 0;
+        size_t room = *budget;
+        for (session_out_t *entry = session->queue; entry != NULL && count < REACTOR_OUT_IOV && room > 0;
+             entry = entry->next) {
+            if (entry->shared != NULL) {
+                iov[count].iov_base = entry->shared->data + entry->offset;
+            } else {
+                iov[count].iov_base = session->out.data + run_offset;
+                run_offset += entry->len;
+            }
+            iov[count].iov_len = entry->len < room ? entry->len : room;
+            room -= iov[count].iov_len;
+            count++;
+        }
+
+        ssize_t n = session_write(session, iov, count);
+        if (n == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                stats_inc(STAT_SEND_ERRORS);
+                session_fail(session);
+            }
+            return -1;
+        }
+        session_note_out(session, (size_t)n);
+        *budget -= (size_t)n;
+
+        size_t left = (size_t)n;
+        while (left > 0) {
+            session_out_t *entry = session->queue;
+            size_t take = left < entry->len ? left : entry->len;
+            if (entry->shared != NULL) {
+                entry->offset += take;
+                session->shared_len -= take;
+            } else {
+                line_buffer_consume(&session->out, take);
+            }
+            entry->len -= take;
+            left -= take;
+            if (entry->len == 0) {
+                session_out_pop(session);
+            }
+        }
+    }
+    return 0;
+}
+
+// Send queued output (EPOLLOUT), as much as the output limits allow
+static void session_writable(session_t *session) {
+    size_t budget = rate_config.output ? session_output_budget(session, rate_now()) : SIZE_MAX;
+    if (session->queue != NULL && session_writable_queue(session, &budget) == -1) {
+        return;
+    }
+    while (session->out.len > 0 && budget > 0) {
+        size_t len = session->out.len < budget ? session->out.len : budget;
+        struct iovec iov = { .iov_base = session->out.data, .iov_len = len };
+        ssize_t n = session_write(session, &iov, 1);
+        if (n > 0) {
+            session_note_out(session, (size_t)n);
+            budget -= (size_t)n;
+            line_buffer_consume(&session->out, (size_t)n);
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            stats_inc(STAT_SEND_ERRORS);
+            session_fail(session);
+            break;
+        }
+    }
+    if (budget == 0 && session_queued(session) > 0) {
+        session_throttle_output(session);
+    }
+    if (session->notify_writable && session_queued(session) == 0 && !session->closing) {
+        session->notify_writable = 0;
+        session->ops->writable(session);
+    }
+}
+
+// Length of the turn at the start of data: at most fair_bytes, ending
+// with the fair_lines-th line (LF or CR NUL)
+static size_t session_turn_len(const unsigned char *data, size_t len) {
+    size_t take = fair_bytes != 0 && fair_bytes < len ? fair_bytes : len;
+    if (fair_lines != 0) {
+        unsigned int lines = 0;
+        for (size_t i = 0; i < take; i++) {
+            if ((data[i] == '\n' || (data[i] == '\0' && i > 0 && data[i - 1] == '\r')) && ++lines == fair_lines) {
+                return i + 1;
+            }
+        }
+    }
+    return take;
+}
+
+// Hand the protocol one turn of input, keeping the rest for later turns.
+// Returns the bytes handed over.
+static size_t session_turn(session_t *session, const unsigned char *data, size_t len) {
+    size_t take = fair_bytes != 0 || fair_lines != 0 ? session_turn_len(data, len) : len;
+    session->ops->input(session, data, take);
+    // Stop reading now rather than at the next readable event
+    if (rate_config.input && !(session->throttled & THROTTLE_IN)) {
+        session_input_budget(session);
+    }
+    return take;
+}
+
+// Keep received input that has to wait for a later turn
+static void session_defer(session_t *session, const unsigned char *data, size_t len) {
+    if (line_buffer_append(&session->pending, data, len) < len) {
+        session_fail(session);
+        return;
+    }
+    stats_inc(STAT_FAIR_DEFERRED);
+}
+
+// Read one segment into the worker's buffer and hand it to the protocol
+static void session_readable(session_t *session) {
+    reactor_worker_t *worker = session->worker;
+    size_t len = REACTOR_RECV_SIZE;
+    if (session->pending.len > 0) {
+        // A hangup is reported while earlier input waits for its turn
+        return;
+    }
+    if (rate_config.input) {
+        size_t budget = session_input_budget(session);
+        if (budget == 0) {
+            return;
+        }
+        // A TLS record has to be read whole (below), so it may overdraw
+        if (session->tls == NULL) {
+            len = budget;
+        }
+    }
+    latency_begin(&worker->clock, latency_should_sample());
+
+    // The buffer holds a whole TLS record, so OpenSSL keeps nothing back
+    // that epoll would not report
+    ssize_t n = session->tls != NULL ? tls_conn_recv(session->tls, worker->recv_buf, REACTOR_RECV_SIZE)
+                                     : recv(session->fd, worker->recv_buf, len, 0);
+    if (n > 0) {
+        stats_add(STAT_BYTES_IN, (uint64_t)n);
+        supervisor_note_in((size_t)n);
+        session->load_bytes += (uint64_t)n;
+        transcript_record(&session->transcript, TRANSCRIPT_IN, worker->recv_buf, (size_t)n);
+        if (rate_config.input) {
+            uint64_t now = rate_now();
+            rate_take(&rate_config.in_bytes, &session->rate_in, (uint64_t)n, now);
+            if (rate_port != NULL) {
+                rate_take_shared(&rate_config.port_in_bytes, &rate_port->in_bytes, (uint64_t)n, now);
+            }
+        }
+        latency_mark(&worker->clock, LAT_RECV);
+        size_t taken = 0;
+        // A receive of more than one turn waits behind the small ones in
+        // SLO mode
+        if (!fair_slo || (size_t)n <= (fair_bytes != 0 ? fair_bytes : REACTOR_RECV_SIZE)) {
+            taken = session_turn(session, worker->recv_buf, (size_t)n);
+        }
+        latency_end(&worker->clock);
+        if (taken < (size_t)n && !session->failed) {
+            session_defer(session, worker->recv_buf + taken, (size_t)n - taken);
+        }
+    } else if (n == 0) {
+        // Client closed its side: finish sending, then close
+        session->closing = 1;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        session_fail(session);
+    }
+}
+
+// Destroy the session when it is done, otherwise refresh its interest.
+// A session with a job out stays until the job is back. Returns 1 when the
+// session is gone.
+static int session_settle(session_t *session) {
+    if (session->failed || (session->closing && session_queued(session) == 0)) {
+        if (session->jobs == NULL) {
+            session_destroy(session);
+            return 1;
+        }
+        if (session->failed && !session->detached) {
+            // Nothing more will be sent: stop watching the socket
+            epoll_ctl(session->worker->epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+            session->detached = 1;
+        }
+        return 0;
+    }
+    session_update_events(session);
+    return 0;
+}
+
+// Deliver the jobs pool threads have finished, oldest first
+static void worker_complete(reactor_worker_t *worker) {
+    session_job_t *list = __atomic_exchange_n(&worker->completed, NULL, __ATOMIC_ACQUIRE);
+    session_job_t *ordered = NULL;
+    while (list != NULL) {
+        session_job_t *next = list->done_next;
+        list->done_next = ordered;
+        ordered = list;
+        list = next;
+    }
+
+    while (ordered != NULL) {
+        session_job_t *job = ordered;
+        ordered = job->done_next;
+        session_t *session = job->session;
+
+        // The finished job is the head of its session's queue
+        session->jobs = job->next;
+        if (session->jobs == NULL) {
+            session->jobs_tail = NULL;
+        } else {
+            session_job_dispatch(session->jobs);
+        }
+        stats_inc(STAT_POOL_JOBS_DONE);
+        job->done(session, job);
+        session_settle(session);
+    }
+}
+
+// Push a task onto the worker's inbox (any thread); only the push onto an
+// empty inbox needs to wake it
+static void worker_post(reactor_worker_t *worker, worker_task_t *task) {
+    worker_task_t *head = __atomic_load_n(&worker->tasks, __ATOMIC_RELAXED);
+    do {
+        task->next = head;
+    } while (!__atomic_compare_exchange_n(&worker->tasks, &head, task, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    if (head == NULL) {
+        uint64_t one = 1;
+        ssize_t ignored = write(worker->wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+// Run the tasks other threads have posted, oldest first
+static void worker_run_tasks(reactor_worker_t *worker) {
+    worker_task_t *list = __atomic_exchange_n(&worker->tasks, NULL, __ATOMIC_ACQUIRE);
+    worker_task_t *ordered = NULL;
+    while (list != NULL) {
+        worker_task_t *next = list->next;
+        list->next = ordered;
+        ordered = list;
+        list = next;
+    }
+    while (ordered != NULL) {
+        worker_task_t *task = ordered;
+        ordered = task->next;
+        task->run(task);
+    }
+}
+
+static void worker_accept(reactor_worker_t *worker, reactor_listener_t *listener) {
+    for (int i = 0; i < listener->budget; i++) {
+        struct sockaddr_in peer;
+        int fd = listener_accept(listener->fd, &peer);
+        if (fd == -1) {
+            return;
+        }
+        session_t *session = session_create(worker, fd, &peer, listener->ops, listener->tls);
+        if (session != NULL) {
+            session_settle(session);
+        }
+    }
+    // More may be queued: the listener is still readable, so the next
+    // epoll_wait() comes back to it after the sessions that are ready
+    stats_inc(STAT_ACCEPT_BUDGET_EXHAUSTED);
+}
+
+// Task on the new worker: take over a session another worker let go of
+static void session_arrive(worker_task_t *task) {
+    session_t *session = (session_t *)((char *)task - offsetof(session_t, migrate_task));
+    reactor_worker_t *worker = session->worker;
+    session_link(session);
+    __atomic_add_fetch(&worker->load.migrated_in, 1, __ATOMIC_RELAXED);
+
+    // Added without interest, which session_settle() sets from its state
+    struct epoll_event event = { .events = 0, .data.ptr = session };
+    session->events = 0;
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, session->fd, &event) == -1) {
+        perror("epoll_ctl failed");
+        session_fail(session);
+    } else if (session->ops->migrate != NULL) {
+        session->ops->migrate(session, 1);
+    }
+    session_settle(session);
+}
+
+// Whether the session can move to another worker now
+static int session_movable(const session_t *session, time_t now) {
+    return !session->handshake && !session->closing && !session->failed && session->jobs == NULL &&
+           !session->throttled && now - session->migrated_at >= REACTOR_MIGRATE_HOLD;
+}
+
+// Hand the session to target: it leaves this worker here, and target's
+// thread takes it over from its inbox. Queued output and pending input go
+// with the session, so nothing is sent out of order.
+static void session_migrate(session_t *session, reactor_worker_t *target, time_t now) {
+    reactor_worker_t *worker = session->worker;
+    if (session->ops->migrate != NULL) {
+        session->ops->migrate(session, 0);
+    }
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+    session_unlink(session);
+    session->migrated_at = now;
+    session->worker = target;
+    session->migrate_task.run = session_arrive;
+    __atomic_add_fetch(&worker->load.migrated_out, 1, __ATOMIC_RELAXED);
+    stats_inc(STAT_SESSION_MIGRATIONS);
+    TRACE_PROBE1(session_migrate, session->fd);
+    worker_post(target, &session->migrate_task);
+}
+
+// Move sessions to the least loaded worker when this one carries more than
+// balance_skew percent over it: sessions whose load fits into half the
+// difference, so the two workers end up closer without trading places
+static void worker_balance(reactor_worker_t *worker, uint64_t load, time_t now) {
+    reactor_t *reactor = worker->reactor;
+    reactor_worker_t *target = NULL;
+    uint64_t target_load = 0;
+    for (int w = 0; w < reactor->worker_count; w++) {
+        reactor_worker_t *other = &reactor->workers[w];
+        uint64_t other_load = __atomic_load_n(&other->load.load, __ATOMIC_RELAXED);
+        if (other != worker && (target == NULL || other_load < target_load)) {
+            target = other;
+            target_load = other_load;
+        }
+    }
+    if (target == NULL || load < balance_min || load * 100 <= target_load * (uint64_t)(100 + balance_skew)) {
+        return;
+    }
+
+    uint64_t budget = (load - target_load) / 2;
+    uint64_t moved = 0;
+    int count = 0;
+    session_t *next;
+    for (session_t *session = worker->sessions; session != NULL && count < REACTOR_MIGRATE_MAX; session = next) {
+        next = session->next;
+        if (session->load == 0 || session->load > budget - moved || !session_movable(session, now)) {
+            continue;
+        }
+        moved += session->load;
+        count++;
+        session_migrate(session, target, now);
+    }
+    // Until they next measure, the others see the load where it went
+    if (moved > 0) {
+        __atomic_store_n(&worker->load.load, load - moved, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&target->load.load, moved, __ATOMIC_RELAXED);
+    }
+}
+
+// Copy the worker's load to its slot for the admin port
+static void worker_publish(reactor_worker_t *worker) {
+    worker_load_t *slot = worker->load_slot;
+    if (slot != NULL) {
+        __atomic_store_n(&slot->sessions, worker->session_count, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->load, __atomic_load_n(&worker->load.load, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->migrated_in, __atomic_load_n(&worker->load.migrated_in, __ATOMIC_RELAXED),
+                         __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->migrated_out, __atomic_load_n(&worker->load.migrated_out, __ATOMIC_RELAXED),
+                         __ATOMIC_RELAXED);
+    }
+}
+
+// Once a second: tick the sessions that are due, measure the load and
+// balance it with the other workers
+static void worker_ticks(reactor_worker_t *worker) {
+    time_t now = time(NULL);
+    if (now < worker->next_tick_scan) {
+        return;
+    }
+    worker->next_tick_scan = now + 1;
+
+    uint64_t load = 0;
+    session_t *next;
+    for (session_t *session = worker->sessions; session != NULL; session = next) {
+        next = session->next;
+        // Bytes per second, halving the weight of the past every second
+        session->load = (session->load + session->load_bytes) / 2;
+        session->load_bytes = 0;
+        load += session->load;
+        if (session->ops->tick != NULL && !session->closing && !session->handshake && now >= session->next_tick) {
+            session->next_tick = now + session->ops->tick_seconds;
+            session->ops->tick(session);
+            session_settle(session);
+        }
+    }
+    __atomic_store_n(&worker->load.load, load, __ATOMIC_RELAXED);
+    if (balance_skew != 0 && worker->reactor != NULL && worker->reactor->worker_count > 1) {
+        worker_balance(worker, load, now);
+    }
+    worker_publish(worker);
+}
+
+// A hangup cannot be left out of the epoll interest, and it is reported
+// on every epoll_wait() while the socket is not read. A session throttled
+// on input leaves the epoll set until its buckets refill, and its input
+// and the hangup are read then.
+static void session_park(session_t *session) {
+    epoll_ctl(session->worker->epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+    session->parked = 1;
+    session->events = 0;
+}
+
+static void session_unpark(session_t *session) {
+    struct epoll_event event = { .events = 0, .data.ptr = session };
+    session->parked = 0;
+    if (epoll_ctl(session->worker->epoll_fd, EPOLL_CTL_ADD, session->fd, &event) == -1) {
+        session_fail(session);
+    }
+}
+
+// Let the sessions whose buckets have refilled be read and written again
+static void worker_resume(reactor_worker_t *worker) {
+    uint64_t now = rate_now();
+    if (now < worker->throttle_wake) {
+        return;
+    }
+    uint64_t wake = 0;
+    session_t **link = &worker->throttled;
+    while (*link != NULL) {
+        session_t *session = *link;
+        if (session->resume_at <= now) {
+            *link = session->throttle_next;
+            session->throttled = 0;
+            if (session->parked) {
+                session_unpark(session);
+            }
+            session_settle(session);
+        } else {
+            if (wake == 0 || session->resume_at < wake) {
+                wake = session->resume_at;
+            }
+            link = &session->throttle_next;
+        }
+    }
+    worker->throttle_wake = wake;
+}
+
+// Give every session waiting on the run queues one turn of its input.
+// Sessions with input left go to the back of a queue and wait for the next
+// round, after the sockets have been polled again.
+static void worker_run_turns(reactor_worker_t *worker) {
+    for (int q = 0; q < RUN_QUEUES; q++) {
+        session_queue_t *queue = &worker->run[q];
+        for (int round = queue->count; round > 0 && queue->head != NULL; round--) {
+            session_t *session = session_queue_pop(queue);
+            if (session_takes_input(session) && session->pending.len > 0) {
+                latency_begin(&worker->clock, latency_should_sample());
+                latency_mark(&worker->clock, LAT_RECV);
+                size_t taken = session_turn(session, session->pending.data, session->pending.len);
+                latency_end(&worker->clock);
+                line_buffer_consume(&session->pending, taken);
+                line_buffer_trim(&session->pending);
+                stats_inc(STAT_FAIR_TURNS);
+            }
+            session_settle(session);
+        }
+    }
+}
+
+static int worker_has_turns(const reactor_worker_t *worker) {
+    for (int q = 0; q < RUN_QUEUES; q++) {
+        if (worker->run[q].head != NULL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// epoll_wait() timeout: ticks run every second, throttled sessions may
+// resume sooner, and sessions waiting for a turn only let other sockets
+// be polled
+static int worker_timeout(reactor_worker_t *worker) {
+    if (worker_has_turns(worker)) {
+        return 0;
+    }
+    if (worker->throttled == NULL) {
+        return 1000;
+    }
+    uint64_t now = rate_now();
+    if (worker->throttle_wake <= now) {
+        return 0;
+    }
+    uint64_t ms = (worker->throttle_wake - now + 999999) / 1000000;
+    return ms < 1000 ? (int)ms : 1000;
+}
+
+static void worker_loop(reactor_worker_t *worker) {
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    while (*worker->running && (worker->reactor != NULL || worker->session_count > 0)) {
+        int count = epoll_wait(worker->epoll_fd, events, REACTOR_MAX_EVENTS, worker_timeout(worker));
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            int kind = *(int *)events[i].data.ptr;
+            if (kind == KIND_WAKE) {
+                uint64_t value;
+                ssize_t ignored = read(worker->wake_fd, &value, sizeof(value));
+                (void)ignored;
+                worker_complete(worker);
+                worker_run_tasks(worker);
+                continue;
+            }
+            if (kind == KIND_LISTENER) {
+                worker_accept(worker, events[i].data.ptr);
+                continue;
+            }
+
+            session_t *session = events[i].data.ptr;
+            // A hangup while a job is out cannot be read: the session is over
+            if ((events[i].events & EPOLLERR) || ((events[i].events & EPOLLHUP) && session->jobs != NULL)) {
+                session_fail(session);
+            } else if ((events[i].events & EPOLLHUP) && (session->throttled & THROTTLE_IN) && !session->handshake) {
+                session_park(session);
+                continue;
+            }
+            if (session->handshake) {
+                if (!session->failed) {
+                    session_handshake(session);
+                }
+            } else {
+                if (events[i].events & EPOLLOUT) {
+                    session_writable(session);
+                }
+                if ((events[i].events & (EPOLLIN | EPOLLHUP)) && !session->closing && session->jobs == NULL) {
+                    session_readable(session);
+                }
+            }
+            session_settle(session);
+        }
+
+        worker_run_turns(worker);
+        if (worker->throttled != NULL) {
+            worker_resume(worker);
+        }
+        worker_ticks(worker);
+    }
+}
+
+static int worker_init(reactor_worker_t *worker, reactor_t *reactor, volatile sig_atomic_t *running) {
+    worker->reactor = reactor;
+    worker->running = running;
+    worker->sessions = NULL;
+    worker->session_count = 0;
+    worker->next_tick_scan = 0;
+    worker->completed = NULL;
+    worker->tasks = NULL;
+    worker->throttled = NULL;
+    worker->throttle_wake = 0;
+    memset(worker->run, 0, sizeof(worker->run));
+    memset(&worker->load, 0, sizeof(worker->load));
+    worker->load_slot = NULL;
+    worker->wake_kind = KIND_WAKE;
+    worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    worker->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (worker->epoll_fd == -1 || worker->wake_fd == -1) {
+        perror("worker setup failed");
+        return -1;
+    }
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = &worker->wake_kind };
+    return epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wake_fd, &event);
+}
+
+// Call after the pool has been shut down, so every job is back
+static void worker_cleanup(reactor_worker_t *worker) {
+    while (__atomic_load_n(&worker->completed, __ATOMIC_ACQUIRE) != NULL) {
+        worker_complete(worker);
+    }
+    worker_run_tasks(worker);
+    while (worker->sessions != NULL) {
+        session_destroy(worker->sessions);
+    }
+    close(worker->epoll_fd);
+    close(worker->wake_fd);
+}
+
+static void *worker_thread(void *arg) {
+    reactor_worker_t *worker = arg;
+    stats_attach_worker();
+    // The load slot goes with the counter slot
+    int index = stats_worker_index();
+    if (worker_loads != NULL && index >= 0) {
+        worker->load_slot = &worker_loads[index];
+        worker->load_slot->owner = getpid();
+        worker_publish(worker);
+    }
+    worker_loop(worker);
+    if (worker->load_slot != NULL) {
+        __atomic_store_n(&worker->load_slot->owner, 0, __ATOMIC_RELEASE);
+        worker->load_slot = NULL;
+    }
+    transcript_detach();
+    stats_detach_worker();
+    return NULL;
+}
+
+reactor_t *reactor_create(int workers) {
+    reactor_t *reactor = calloc(1, sizeof(reactor_t));
+    if (reactor == NULL) {
+        return NULL;
+    }
+    reactor->workers = calloc(workers, sizeof(reactor_worker_t));
+    if (reactor->workers == NULL) {
+        free(reactor);
+        return NULL;
+    }
+    reactor->worker_count = workers;
+    reactor->running = 1;
+    for (int w = 0; w < workers; w++) {
+        if (worker_init(&reactor->workers[w], reactor, &reactor->running) == -1) {
+            reactor->worker_count = w;
+            reactor_stop(reactor);
+            return NULL;
+        }
+    }
+    return reactor;
+}
+
+int reactor_listen(reactor_t *reactor, int listen_fd, const session_ops_t *ops) {
+    if (reactor->listener_count == REACTOR_MAX_LISTENERS) {
+        return -1;
+    }
+    reactor_listener_t *listener = &reactor->listeners[reactor->listener_count++];
+    listener->kind = KIND_LISTENER;
+    listener->fd = listen_fd;
+    listener->budget = listener_budget(listen_fd);
+    listener->ops = ops;
+    listener->tls = tls_listener(listen_fd);
+
+    // Every worker waits on the listener; EPOLLEXCLUSIVE wakes only one
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+    for (int w = 0; w < reactor->worker_count; w++) {
+        struct epoll_event event = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = listener };
+        if (epoll_ctl(reactor->workers[w].epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) == -1) {
+            perror("epoll_ctl listener failed");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int reactor_start(reactor_t *reactor) {
+    for (int w = 0; w < reactor->worker_count; w++) {
+        if (pthread_create(&reactor->workers[w].thread, NULL, worker_thread, &reactor->workers[w]) != 0) {
+            perror("Failed to create worker thread");
+            reactor->worker_count = w;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void reactor_stop(reactor_t *reactor) {
+    reactor->running = 0;
+    for (int w = 0; w < reactor->worker_count; w++) {
+        uint64_t one = 1;
+        ssize_t ignored = write(reactor->workers[w].wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+    for (int w = 0; w < reactor->worker_count; w++) {
+        if (reactor->workers[w].thread != 0) {
+            pthread_join(reactor->workers[w].thread, NULL);
+        }
+    }
+    reactor_pool_shutdown();
+    for (int w = 0; w < reactor->worker_count; w++) {
+        worker_cleanup(&reactor->workers[w]);
+    }
+    transcript_detach();
+    free(reactor->workers);
+    free(reactor);
+}
+
+int session_workers(const session_t *session) {
+    reactor_t *reactor = session->worker->reactor;
+    return reactor != NULL ? reactor->worker_count : 1;
+}
+
+void session_post(const session_t *session, int index, worker_task_t *task) {
+    reactor_t *reactor = session->worker->reactor;
+    worker_post(reactor != NULL ? &reactor->workers[index] : session->worker, task);
+}
+
+void reactor_serve_one(const session_ops_t *ops, int fd, const struct sockaddr_in *peer,
+                       tls_server_t *tls, volatile sig_atomic_t *running) {
+    // One worker per process in the fork model; static to keep the receive
+    // buffer off the stack
+    static reactor_worker_t worker;
+    if (worker_init(&worker, NULL, running) == -1) {
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    supervisor_set_state(SUPERVISOR_ACTIVE);
+    session_t *session = session_create(&worker, fd, peer, ops, tls);
+    if (session != NULL && !session_settle(session)) {
+        worker_loop(&worker);
+    }
+    supervisor_set_state(SUPERVISOR_CLOSING);
+    reactor_pool_shutdown();
+    worker_cleanup(&worker);
+    transcript_detach();
+}
@@ -0,0 +1,259 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <signal.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+
+#include "latency_hist.h"
+#include "line_buffer.h"
+#include "server_tls.h"
+#include "transcript.h"
+#include "work_pool.h"
+
+// Event-driven session core shared by the servers.
+//
+// A worker is one epoll loop on one thread. A session is a small control
+// block owned by a worker, and a protocol module drives it through
+// session_ops_t callbacks that never block. Receive buffers belong to the
+// worker: a readable socket is read into the worker's scratch buffer and
+// handed to the protocol, which keeps only what it has to carry over (a
+// partial line or telnet command) in small per-session allocations. An
+// idle session therefore costs its control block and protocol state only.
+//
+// Output goes straight to the socket; whatever the socket does not take is
+// queued in the session and the session stops being read while more than
+// REACTOR_OUT_HIGH bytes are queued, so TCP flow control pushes back on a
+// client that does not read.
+//
+// A session accepted on a TLS listener (server_tls.h) is opened once its
+// handshake is done. Its output takes the same path as plaintext when the
+// kernel encrypts for it (kTLS) and goes through OpenSSL otherwise.
+//
+// Output meant for many sessions (a room message) is created once as a
+// reference-counted session_shared_t; a session whose socket does not take
+// it right away queues a reference rather than a copy.
+//
+// Rate limits (rate_limit.h) are enforced here too: a session whose input
+// buckets are empty is not read until they refill, and output beyond its
+// output bucket stays queued, which stops reading it at REACTOR_OUT_HIGH.
+//
+// Sessions on a worker take turns: a readable session is handed at most
+// TELNET_FAIR_BYTES of input (and TELNET_FAIR_LINES lines) per loop
+// iteration, and what is left of its receive waits in the session, which
+// goes to the back of the worker's run queue and is not read again until
+// it has been handed everything. A session flooding input thus gets one
+// turn per iteration like everybody else instead of running the loop for
+// a whole receive. TELNET_FAIR_MODE=slo serves the sessions with at most
+// one turn of input waiting before the others, so interactive sessions
+// keep their latency next to bulk transfers.
+//
+// With transcripts enabled (transcript.h) the worker records what it reads
+// and everything the protocol sends, so every protocol module is covered.
+//
+// Code running on one worker reaches the others by posting a task, which
+// the target worker runs on its own thread (lock-free inbox, eventfd wake).
+//
+// Reactor threads keep their load even: every second each worker smooths
+// the bytes its sessions moved into a load figure and publishes it. A
+// worker carrying more than TELNET_BALANCE_SKEW percent over the least
+// loaded one (and at least TELNET_BALANCE_MIN bytes per second) hands
+// sessions to it, lightest first and no more than half the difference, so
+// the two end up closer and one heavy session is never bounced between
+// them. The session leaves its worker's epoll set and lists and travels as
+// a task through the target's inbox, output queue, pending input and
+// protocol state included; nothing is sent in between, so output keeps its
+// order. Sessions in a TLS handshake, with a job out, throttled or moved in
+// the last REACTOR_MIGRATE_HOLD seconds stay put, and a protocol with state
+// of its own on the worker (room membership) moves it in ops->migrate.
+//
+// Process models (TELNET_MODEL[_<port>]):
+//   fork     one process per connection, running a single-session worker
+//   reactor  TELNET_WORKERS threads in the listener process, each taking
+//            connections from the shared listener (EPOLLEXCLUSIVE)
+//   prefork  TELNET_WORKERS processes started up front, each running a
+//            one-thread reactor (prefork.h)
+//
+// Work too slow for a network loop (a command that computes or formats a
+// large reply) is submitted as a session job. Jobs run on a work-stealing
+// pool shared by the process (TELNET_POOL_THREADS, started on first use)
+// and come back through a lock-free completion queue of the session's
+// worker, which calls their done callback. A session runs one job at a
+// time, delivers results in submission order and is not read while a job
+// is outstanding, so input after a command is handled after its reply.
+
+#define REACTOR_RECV_SIZE (16 * 1024)
+#define REACTOR_OUT_HIGH (256 * 1024)
+#define REACTOR_FAIR_BYTES (4 * 1024)
+#define REACTOR_BALANCE_SKEW 50        // Percent over the least loaded worker
+#define REACTOR_BALANCE_MIN (64 * 1024)    // Bytes per second before a worker sheds sessions
+#define REACTOR_MIGRATE_MAX 16         // Sessions a worker hands off per second
+#define REACTOR_MIGRATE_HOLD 10        // Seconds a moved session stays on its new worker
+
+typedef enum {
+    REACTOR_MODEL_FORK,
+    REACTOR_MODEL_THREADS,
+    REACTOR_MODEL_PREFORK
+} reactor_model_t;
+
+typedef struct {
+    reactor_model_t model;
+    int workers;
+    int pool_threads;              // 0 runs jobs on the network loop
+    size_t fair_bytes;             // Input per session turn, 0 = a whole receive
+    unsigned int fair_lines;       // Lines per session turn, 0 = no line budget
+    int fair_slo;                  // Sessions with little input waiting go first
+    int balance_skew;              // Load skew in percent that moves sessions, 0 = never
+    long balance_min;              // Least load (bytes per second) a worker sheds sessions at
+} reactor_config_t;
+
+typedef struct reactor reactor_t;
+typedef struct reactor_worker reactor_worker_t;
+typedef struct session session_t;
+typedef struct session_job session_job_t;
+typedef struct session_out session_out_t;
+typedef struct session_queue session_queue_t;
+typedef struct worker_task worker_task_t;
+
+// Immutable output shared by reference, freed with its last reference
+typedef struct {
+    unsigned int refs;
+    size_t len;
+    unsigned char data[];
+} session_shared_t;
+
+struct worker_task {
+    worker_task_t *next;
+    void (*run)(worker_task_t *task);  // Called on the target worker's thread
+};
+
+// Protocol callbacks, all called on the session's worker thread
+typedef struct {
+    void (*open)(session_t *session);
+    void (*input)(session_t *session, const unsigned char *data, size_t len);
+    void (*tick)(session_t *session);              // Every tick_seconds (may be NULL)
+    void (*close)(session_t *session);
+    void (*writable)(session_t *session);          // After session_notify_writable() (may be NULL)
+    // Moving to another worker: called on the old worker with arriving 0,
+    // then on the new one with arriving 1 (may be NULL)
+    void (*migrate)(session_t *session, int arriving);
+    int tick_seconds;
+} session_ops_t;
+
+struct session_job {
+    work_job_t work;               // Pool linkage (first member)
+    session_t *session;
+    void (*run)(session_job_t *job);                         // Pool thread: must not touch the session
+    void (*done)(session_t *session, session_job_t *job);    // Session's worker: deliver and free
+    int cancelled;                 // The session ended before run was called
+    session_job_t *next;           // Session's job queue
+    session_job_t *done_next;      // Worker's completion queue
+};
+
+struct session {
+    int kind;                      // Tags epoll entries (first member)
+    int fd;
+    reactor_worker_t *worker;
+    const session_ops_t *ops;
+    void *state;                   // Protocol data, owned by ops
+    tls_conn_t *tls;               // NULL for a plaintext connection
+    int handshake;                 // TLS handshake running: not opened yet
+    line_buffer_t out;             // Output the socket has not taken yet
+    session_out_t *queue;          // Shared output waiting, in order with runs of out (NULL: none)
+    session_out_t *queue_tail;
+    size_t shared_len;             // Bytes of shared output waiting
+    time_t next_tick;
+    unsigned int events;           // Current epoll interest
+    int closing;                   // Close once the output queue is empty
+    int failed;                    // Socket error: output is discarded
+    int detached;                  // Failed and removed from epoll, waiting for its job
+    int parked;                    // Hung up while throttled on input: out of epoll until resumed
+    int notify_writable;           // Call ops->writable once the output is out
+    session_job_t *jobs;           // Running job first, then the queued ones
+    session_job_t *jobs_tail;
+    int peer_port;
+    char peer_ip[INET_ADDRSTRLEN];
+    transcript_session_t transcript;   // Audit transcript (id 0: not recorded)
+    uint64_t rate_in;              // Rate limit buckets (rate_limit.h)
+    uint64_t rate_lines;
+    uint64_t rate_out;
+    int throttled;                 // Held back by a rate limit: THROTTLE_IN / THROTTLE_OUT
+    uint64_t resume_at;            // When to try again (rate_now() clock)
+    session_t *throttle_next;      // Worker's list of throttled sessions
+    line_buffer_t pending;         // Input received but not handed to the protocol yet
+    session_queue_t *run_queue;    // Worker's run queue it waits on (NULL: none)
+    session_t *run_next;
+    uint64_t load_bytes;           // Bytes in and out since the last load update
+    uint64_t load;                 // Bytes per second, smoothed
+    time_t migrated_at;            // Last move to another worker
+    worker_task_t migrate_task;    // Carries the session to its new worker
+    session_t *prev;
+    session_t *next;
+};
+
+// Read TELNET_MODEL, TELNET_WORKERS, TELNET_POOL_THREADS and the
+// TELNET_FAIR_* and TELNET_BALANCE_* settings for the server on port
+void reactor_configure(reactor_config_t *config, int port);
+
+// Threaded model: create the workers, add listeners (TLS ones marked with
+// tls_listener_add() first), then start
+reactor_t *reactor_create(int workers);
+int reactor_listen(reactor_t *reactor, int listen_fd, const session_ops_t *ops);
+int reactor_start(reactor_t *reactor);
+
+// Stop the workers, closing their sessions, and free the reactor
+void reactor_stop(reactor_t *reactor);
+
+// Fork model: serve one accepted connection on the calling thread until it
+// closes or *running drops to 0. tls is the listener's TLS context (NULL
+// for a plain listener).
+void reactor_serve_one(const session_ops_t *ops, int fd, const struct sockaddr_in *peer,
+                       tls_server_t *tls, volatile sig_atomic_t *running);
+
+// Count lines the protocol took from the session's input against the
+// input line limits
+void session_charge_lines(session_t *session, unsigned int lines);
+
+// Queue output for the client, sending as much as the socket takes now
+void session_send(session_t *session, const void *data, size_t len);
+void session_sendv(session_t *session, const struct iovec *iov, int iovcnt);
+
+// Bytes queued for the client
+size_t session_queued(const session_t *session);
+
+// Call ops->writable once everything queued has been sent and the socket
+// takes more, for a protocol that produces output in pieces (a long reply)
+// and wants to make the next one only when the client keeps up
+void session_notify_writable(session_t *session);
+
+// Shared output: create with one reference held by the caller, queue on any
+// number of sessions (each keeps its own reference until sent) and release
+// the caller's reference. create copies data (or leaves the bytes to be
+// filled in when data is NULL) and returns NULL when out of memory.
+session_shared_t *session_shared_create(const void *data, size_t len);
+void session_shared_release(session_shared_t *shared);
+void session_send_shared(session_t *session, session_shared_t *shared);
+
+// Close the session once its queued output has been sent
+void session_close(session_t *session);
+
+// Workers of the session's reactor (1 in the fork model), and running
+// task->run on one of them (index < session_workers()); any thread may post
+int session_workers(const session_t *session);
+void session_post(const session_t *session, int index, worker_task_t *task);
+
+// Run job->run on the pool and job->done on the session's worker, after
+// every job submitted before it. The caller sets run and done; done is
+// called exactly once, with cancelled set if the session ended first.
+void session_submit(session_t *session, session_job_t *job);
+
+// Timing of the receive segment being processed on the session's worker
+latency_clock_t *session_clock(session_t *session);
+
+// Account protocol state allocated for a session in the memory counters
+void *session_alloc(size_t size);
+void session_free(void *state, size_t size);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef RL_NET_H
+#define RL_NET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Telnet server callback API of the rl_net embedded network stack, served
+// by libtelnetd (rl_session.h) so that applications written against it run
+// on the event-driven core unchanged.
+//
+// The application defines the callbacks it needs; the library has a
+// default for each one it leaves out (accept every client, no user
+// database, no commands, the default messages below). They are called on
+// the thread serving the session, one session at a time per thread.
+
+// Request flags in the return value of telnet_server_process()
+#define TELNET_REPEAT (1u << 31)       // Call again with the same cmd and *pvar
+#define TELNET_DISCONNECT (1u << 30)   // Close the session after this reply
+
+// Messages requested with telnet_server_message()
+typedef enum {
+    telnetServerWelcome,               // Initial welcome message
+    telnetServerPrompt,                // Prompt message
+    telnetServerLogin,                 // Login welcome message, if authentication is enabled
+    telnetServerUsername,              // Username request login message
+    telnetServerPassword,              // Password request login message
+    telnetServerLoginFailed,           // Incorrect login error message
+    telnetServerLoginTimeout,          // Login timeout error message
+    telnetServerUnsolicitedMessage     // Unsolicited message (ie. from basic interpreter)
+} telnetServerMessage;
+
+// Callbacks
+
+// Accept or deny a connection from a remote client (ip_addr: 4 bytes,
+// network order). Without it every client is accepted.
+bool telnet_accept_client (const uint8_t *ip_addr, uint16_t port);
+
+// User database, with authentication enabled (TELNET_AUTH=1): the ID of an
+// account (1..255, 0: unknown user) and whether its password is right.
+// The built-in account (TELNET_USERNAME / TELNET_PASSWORD, when a password
+// is set) is user 0 and is checked first.
+uint8_t telnet_check_username (const char *username);
+bool telnet_check_password (uint8_t user_id, const char *password);
+
+// Write message msg into buf (at most len bytes) and return its length.
+// Returning 0 sends the library's default text for the message (none for
+// telnetServerUnsolicitedMessage).
+uint32_t telnet_server_message (telnetServerMessage msg, char *buf, uint32_t len);
+
+// Whether an unsolicited message is ready for the session (asked every
+// second); if so telnet_server_message(telnetServerUnsolicitedMessage) is
+// sent to it.
+bool telnet_server_message_poll (int32_t session);
+
+// Process the command line cmd, writing the reply into buf (at most buflen
+// bytes). *pvar is 0 for a new command and kept across repeated calls.
+// Returns the reply length, ORed with TELNET_REPEAT to be called again
+// once the reply has been sent (after telnet_set_delay() if it was
+// called) and with TELNET_DISCONNECT to close the session.
+uint32_t telnet_server_process (const char *cmd, char *buf, uint32_t buflen, uint32_t *pvar);
+
+// Library functions for use inside the callbacks
+
+// Whether the first word of cmd is user_cmd (case-insensitive)
+bool telnet_check_command (const char *cmd, const char *user_cmd);
+
+// The session being served: its number (1.., the lowest one free when it
+// started), its user ID (0 for the built-in account or without
+// authentication) and its client's address (ip_addr: 4 bytes)
+int32_t telnet_get_session (void);
+uint8_t telnet_get_user_id (void);
+bool telnet_get_client (uint8_t *ip_addr, uint16_t *port);
+
+// Delay the next repeated call of telnet_server_process() by delay ticks of
+// 100 ms (rounded up to whole seconds)
+void telnet_set_delay (uint32_t delay);
+
+#endif
@@ -0,0 +1,630 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+
+#include "char_width.h"
+#include "line_buffer.h"
+#include "line_editor.h"
+#include "rl_net.h"
+#include "rl_session.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "telnet_proto.h"
+
+#ifndef DEBUG
+#define DEBUG 0
+#endif
+
+// Control characters
+#define CTRL_C 3
+
+// What the typed bytes are for
+enum {
+    RL_USERNAME,
+    RL_PASSWORD,
+    RL_COMMAND,
+    RL_REPEAT                  // A repeated command is running
+};
+
+static rl_session_config_t config = {
+    .login_timeout = 30,
+    .max_line = LINE_BUFFER_DEFAULT_LIMIT
+};
+
+// Session numbers in use, shared by the server's processes: the pid of
+// the process holding each one, 0 when free
+static pid_t *session_slots = NULL;
+
+// Everything a session keeps across suspensions
+typedef struct {
+    coro_t co;                 // First member: the state is the coroutine
+    line_editor_t editor;      // Command line being typed
+    line_buffer_t sb;          // Subnegotiation being received
+    line_buffer_t cmd;         // Command being processed, NUL-terminated
+    int phase;
+    int last_cr;               // The previous byte was CR (a following LF or NUL is part of Enter)
+    int attempts;              // Failed logins
+    time_t login_deadline;
+    time_t repeat_at;          // Next call of a delayed repeat, 0 when none
+    uint32_t pvar;             // telnet_server_process() state of the command
+    uint32_t delay;            // telnet_set_delay() of the current call
+    int32_t number;            // Session number, 0 until one is taken
+    uint8_t user_id;
+    uint8_t ip[4];
+    char field[RL_SESSION_FIELD_MAX + 1];     // Username or password being typed
+    size_t field_len;
+    char username[RL_SESSION_FIELD_MAX + 1];
+    unsigned char ch;          // Byte being handled
+    unsigned char command;     // Telnet command after IAC
+} rl_session_t;
+
+// Session whose callbacks are running on this thread
+static __thread rl_session_t *current = NULL;
+
+// Reply and message buffer of the callbacks
+static __thread char reply[RL_SESSION_BUF_SIZE];
+
+// Screen update of the key being handled
+static __thread line_buffer_t edit_output = { .limit = LINE_BUFFER_UNLIMITED };
+
+// Texts sent when telnet_server_message() leaves a message empty
+static const char *const default_messages[] = {
+    [telnetServerWelcome] = "\r\n\r\nTelnet Server ready\r\n",
+    [telnetServerPrompt] = "\r\nCmd> ",
+    [telnetServerLogin] = "\r\nEmbedded Telnet Server\r\n\r\nPlease login...",
+    [telnetServerUsername] = "\r\nUsername: ",
+    [telnetServerPassword] = "\r\nPassword: ",
+    [telnetServerLoginFailed] = "\r\nLogin incorrect",
+    [telnetServerLoginTimeout] = "\r\nLogin timeout\r\n",
+    [telnetServerUnsolicitedMessage] = NULL
+};
+
+// Defaults for the callbacks the application leaves out
+
+__attribute__((weak)) bool telnet_accept_client(const uint8_t *ip_addr, uint16_t port) {
+    (void)ip_addr;
+    (void)port;
+    return true;
+}
+
+__attribute__((weak)) uint8_t telnet_check_username(const char *username) {
+    (void)username;
+    return 0;
+}
+
+__attribute__((weak)) bool telnet_check_password(uint8_t user_id, const char *password) {
+    (void)user_id;
+    (void)password;
+    return false;
+}
+
+__attribute__((weak)) uint32_t telnet_server_message(telnetServerMessage msg, char *buf, uint32_t len) {
+    (void)msg;
+    (void)buf;
+    (void)len;
+    return 0;
+}
+
+__attribute__((weak)) bool telnet_server_message_poll(int32_t session) {
+    (void)session;
+    return false;
+}
+
+__attribute__((weak)) uint32_t telnet_server_process(const char *cmd, char *buf, uint32_t buflen, uint32_t *pvar) {
+    (void)cmd;
+    (void)buf;
+    (void)buflen;
+    (void)pvar;
+    return 0;
+}
+
+// Library functions
+
+bool telnet_check_command(const char *cmd, const char *user_cmd) {
+    while (*cmd == ' ' || *cmd == '\t') {
+        cmd++;
+    }
+    size_t len = strlen(user_cmd);
+    if (strncasecmp(cmd, user_cmd, len) != 0) {
+        return false;
+    }
+    return cmd[len] == '\0' || cmd[len] == ' ' || cmd[len] == '\t';
+}
+
+int32_t telnet_get_session(void) {
+    return current != NULL ? current->number : 0;
+}
+
+uint8_t telnet_get_user_id(void) {
+    return current != NULL ? current->user_id : 0;
+}
+
+bool telnet_get_client(uint8_t *ip_addr, uint16_t *port) {
+    if (current == NULL) {
+        return false;
+    }
+    if (ip_addr != NULL) {
+        memcpy(ip_addr, current->ip, sizeof(current->ip));
+    }
+    if (port != NULL) {
+        *port = (uint16_t)current->co.session->peer_port;
+    }
+    return true;
+}
+
+void telnet_set_delay(uint32_t delay) {
+    if (current != NULL) {
+        current->delay = delay;
+    }
+}
+
+int rl_session_configure(const rl_session_config_t *settings) {
+    config = *settings;
+    if (session_slots == NULL) {
+        void *region = mmap(NULL, RL_SESSION_MAX * sizeof(pid_t), PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) {
+            perror("session number mmap failed");
+            return -1;
+        }
+        session_slots = region;
+    }
+    return 0;
+}
+
+// Take the lowest free session number; 0 when all are in use
+static int32_t rl_number_take(void) {
+    pid_t self = getpid();
+    for (int i = 0; i < RL_SESSION_MAX; i++) {
+        pid_t expected = 0;
+        if (__atomic_load_n(&session_slots[i], __ATOMIC_RELAXED) == 0 &&
+            __atomic_compare_exchange_n(&session_slots[i], &expected, self, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static void rl_number_release(int32_t number) {
+    if (number > 0) {
+        __atomic_store_n(&session_slots[number - 1], 0, __ATOMIC_RELEASE);
+    }
+}
+
+void rl_session_reap(pid_t pid) {
+    if (session_slots == NULL || pid <= 0) {
+        return;
+    }
+    for (int i = 0; i < RL_SESSION_MAX; i++) {
+        pid_t expected = pid;
+        if (__atomic_load_n(&session_slots[i], __ATOMIC_RELAXED) == pid) {
+            __atomic_compare_exchange_n(&session_slots[i], &expected, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void send_telnet_option(coro_t *co, unsigned char command, unsigned char option) {
+    unsigned char buf[3];
+    int len = telnet_option_frame(buf, command, option);
+    coro_send(co, buf, len);
+}
+
+// Answer a DO/DONT/WILL/WONT from the client: echo and SGA are ours, NAWS
+// and SGA theirs, everything else is refused
+static void handle_telnet_option(coro_t *co, unsigned char cmd, unsigned char opt) {
+    if (cmd == DO) {
+        if (opt != ECHO && opt != SUPPRESS_GO_AHEAD) {
+            send_telnet_option(co, WONT, opt);
+        }
+    } else if (cmd == WILL) {
+        if (opt != NAWS && opt != SUPPRESS_GO_AHEAD) {
+            send_telnet_option(co, DONT, opt);
+        }
+    }
+}
+
+// NAWS: width and height as 16-bit numbers, with IAC doubled
+static void handle_naws(rl_session_t *state, const unsigned char *data, size_t len) {
+    unsigned char size[4];
+    int count = 0;
+    for (size_t i = 1; i < len && count < 4; i++) {
+        size[count++] = data[i];
+        if (data[i] == IAC && i + 1 < len && data[i + 1] == IAC) {
+            i++;
+        }
+    }
+    if (count == 4 && state->phase != RL_REPEAT) {
+        line_editor_resize(&state->editor, size[0] << 8 | size[1], &edit_output);
+    }
+}
+
+// Send the editor's screen update
+static void send_edit_output(rl_session_t *state) {
+    if (edit_output.len > 0) {
+        coro_send_escaped(&state->co, edit_output.data, edit_output.len);
+        edit_output.len = 0;
+    }
+    line_buffer_trim(&edit_output);
+}
+
+// Send message msg of the application, or the default text when it has none
+static void send_message(rl_session_t *state, telnetServerMessage msg) {
+    uint32_t len = telnet_server_message(msg, reply, sizeof(reply));
+    if (len > sizeof(reply)) {
+        len = sizeof(reply);
+    }
+    if (len > 0) {
+        coro_send_escaped(&state->co, (const unsigned char *)reply, len);
+    } else if (default_messages[msg] != NULL) {
+        coro_send(&state->co, default_messages[msg], strlen(default_messages[msg]));
+    }
+}
+
+// Send the prompt; the line is edited to the right of its last row
+static void send_prompt(rl_session_t *state) {
+    uint32_t len = telnet_server_message(telnetServerPrompt, reply, sizeof(reply));
+    if (len > sizeof(reply)) {
+        len = sizeof(reply);
+    }
+    const char *prompt = reply;
+    if (len == 0) {
+        prompt = default_messages[telnetServerPrompt];
+        len = (uint32_t)strlen(prompt);
+    }
+    coro_send_escaped(&state->co, (const unsigned char *)prompt, len);
+
+    uint32_t row = len;
+    while (row > 0 && prompt[row - 1] != '\r' && prompt[row - 1] != '\n') {
+        row--;
+    }
+    line_editor_set_margin(&state->editor, (int)char_width_utf8((const unsigned char *)prompt + row, len - row));
+}
+
+// Logged in (or no login): welcome the user and take commands
+static void start_commands(rl_session_t *state) {
+    state->phase = RL_COMMAND;
+    state->login_deadline = 0;
+    send_message(state, telnetServerWelcome);
+    send_prompt(state);
+}
+
+// Call telnet_server_process() for the command until it is done, stopping
+// after a batch of output (continued once it has been sent) or for a delay
+// (continued by the tick). Returns 1 when the session ends.
+static int run_command(rl_session_t *state) {
+    coro_t *co = &state->co;
+    size_t produced = 0;
+    while (1) {
+        state->delay = 0;
+        uint32_t result = telnet_server_process((const char *)state->cmd.data, reply, sizeof(reply), &state->pvar);
+        uint32_t len = result & ~(TELNET_REPEAT | TELNET_DISCONNECT);
+        if (len > sizeof(reply)) {
+            len = sizeof(reply);
+        }
+        coro_send_escaped(co, (const unsigned char *)reply, len);
+        produced += len;
+
+        if (result & TELNET_DISCONNECT) {
+            return 1;
+        }
+        if (!(result & TELNET_REPEAT)) {
+            state->phase = RL_COMMAND;
+            send_prompt(state);
+            return 0;
+        }
+        state->phase = RL_REPEAT;
+        stats_inc(STAT_RL_REPEATS);
+        if (state->delay > 0) {
+            state->repeat_at = time(NULL) + (state->delay + 9) / 10;
+            return 0;
+        }
+        if (produced >= RL_SESSION_REPEAT_BATCH) {
+            session_notify_writable(co->session);
+            return 0;
+        }
+    }
+}
+
+// Enter on a command line: hand it to the application
+static int end_of_line(rl_session_t *state) {
+    size_t len;
+    const unsigned char *line = line_editor_line(&state->editor, &len);
+    session_charge_lines(state->co.session, 1);
+
+    state->cmd.len = 0;
+    int stored = len > 0 && line_buffer_append(&state->cmd, line, len) == len &&
+                 line_buffer_append(&state->cmd, "", 1) == 1;
+    if (DEBUG && len > 0) {
+        char ts[32];
+        get_timestamp(ts, sizeof(ts));
+        printf("%s[DEBUG] Command from session %d: %.*s.\n", ts, state->number, (int)len, (const char *)line);
+    }
+    line_editor_commit(&state->editor);
+
+    if (!stored) {
+        if (len > 0) {
+            stats_inc(STAT_LINES_DROPPED);
+        }
+        send_prompt(state);
+        return 0;
+    }
+    stats_inc(STAT_RL_COMMANDS);
+    state->pvar = 0;
+    return run_command(state);
+}
+
+// Enter after a username or password
+static int end_of_field(rl_session_t *state) {
+    session_t *session = state->co.session;
+    state->field[state->field_len] = '\0';
+    state->field_len = 0;
+    if (state->phase == RL_USERNAME) {
+        memcpy(state->username, state->field, sizeof(state->username));
+        state->phase = RL_PASSWORD;
+        send_message(state, telnetServerPassword);
+        return 0;
+    }
+
+    // The built-in account first, then the application's user database
+    int accepted = 0;
+    uint8_t user_id = 0;
+    if (config.password != NULL && config.password[0] != '\0' &&
+        strcmp(state->username, config.username) == 0 && strcmp(state->field, config.password) == 0) {
+        accepted = 1;
+    } else {
+        user_id = telnet_check_username(state->username);
+        accepted = user_id != 0 && telnet_check_password(user_id, state->field);
+    }
+    memset(state->field, 0, sizeof(state->field));
+
+    char ts[32];
+    get_timestamp(ts, sizeof(ts));
+    if (accepted) {
+        state->user_id = user_id;
+        printf("%s[INFO] Session %d logged in as %s (user %d): %s:%d.\n",
+               ts, state->number, state->username, user_id, session->peer_ip, session->peer_port);
+        start_commands(state);
+        return 0;
+    }
+    stats_inc(STAT_RL_LOGIN_FAILURES);
+    printf("%s[INFO] Login failed for %s: %s:%d.\n", ts, state->username, session->peer_ip, session->peer_port);
+    send_message(state, telnetServerLoginFailed);
+    if (++state->attempts >= RL_SESSION_LOGIN_ATTEMPTS) {
+        coro_send(&state->co, "\r\n", 2);
+        return 1;
+    }
+    state->phase = RL_USERNAME;
+    send_message(state, telnetServerUsername);
+    return 0;
+}
+
+// Handle one data byte typed by the client. Returns 1 to end the session.
+static int handle_key(rl_session_t *state, unsigned char ch) {
+    coro_t *co = &state->co;
+
+    // CR LF and CR NUL are one Enter
+    if (state->last_cr) {
+        state->last_cr = 0;
+        if (ch == '\n' || ch == '\0') {
+            return 0;
+        }
+    }
+    state->last_cr = ch == '\r';
+
+    if (state->phase == RL_REPEAT) {
+        // Only Ctrl+C is taken while a command repeats
+        if (ch == CTRL_C) {
+            state->repeat_at = 0;
+            state->phase = RL_COMMAND;
+            coro_send(co, "^C", 2);
+            send_prompt(state);
+        }
+        return 0;
+    }
+
+    if (state->phase == RL_USERNAME || state->phase == RL_PASSWORD) {
+        // Login fields: the username is echoed, the password is not
+        int echo = state->phase == RL_USERNAME;
+        if (ch == '\r' || ch == '\n') {
+            return end_of_field(state);
+        } else if (ch == '\b' || ch == 0x7f) {
+            if (state->field_len > 0) {
+                state->field_len--;
+                if (echo) {
+                    coro_send(co, "\b \b", 3);
+                }
+            }
+        } else if (ch >= 0x20 && state->field_len < RL_SESSION_FIELD_MAX) {
+            state->field[state->field_len++] = (char)ch;
+            if (echo) {
+                coro_send_escaped(co, &ch, 1);
+            }
+        }
+        return 0;
+    }
+
+    if (ch == '\r' || ch == '\n') {
+        return end_of_line(state);
+    } else if (ch == CTRL_C) {
+        coro_send(co, "^C", 2);
+        line_editor_clear(&state->editor);
+        send_prompt(state);
+        return 0;
+    }
+    if (line_editor_key(&state->editor, ch, &edit_output) == LINE_EDITOR_FULL) {
+        coro_send(co, "\a", 1);
+    }
+    send_edit_output(state);
+    return 0;
+}
+
+// The session, from the access check to the end
+static int rl_session_body(coro_t *co) {
+    rl_session_t *state = (rl_session_t *)co;
+    session_t *session = co->session;
+    char ts[32];
+
+    CORO_BEGIN(co);
+
+    get_timestamp(ts, sizeof(ts));
+    inet_pton(AF_INET, session->peer_ip, state->ip);
+    if (!telnet_accept_client(state->ip, (uint16_t)session->peer_port)) {
+        printf("%s[INFO] Client denied: %s:%d.\n", ts, session->peer_ip, session->peer_port);
+        CORO_EXIT(co);
+    }
+    state->number = rl_number_take();
+    if (state->number == 0) {
+        printf("%s[INFO] No free session number for %s:%d.\n", ts, session->peer_ip, session->peer_port);
+        CORO_EXIT(co);
+    }
+    printf("%s[INFO] Client connected: %s:%d (session %d).\n",
+           ts, session->peer_ip, session->peer_port, state->number);
+
+    line_editor_init(&state->editor, config.max_line);
+    line_buffer_init(&state->sb, RL_SESSION_SB_MAX);
+    line_buffer_init(&state->cmd, config.max_line + 1);
+
+    // The server echoes, in character mode, and learns the client's width
+    send_telnet_option(co, WILL, ECHO);
+    send_telnet_option(co, WILL, SUPPRESS_GO_AHEAD);
+    send_telnet_option(co, DO, SUPPRESS_GO_AHEAD);
+    send_telnet_option(co, DO, NAWS);
+
+    if (config.auth) {
+        state->phase = RL_USERNAME;
+        state->login_deadline = time(NULL) + config.login_timeout;
+        send_message(state, telnetServerLogin);
+        send_message(state, telnetServerUsername);
+    } else {
+        start_commands(state);
+    }
+
+    co->capture = capture_open(config.port);
+
+    while (1) {
+        CORO_GETC(co, state->ch);
+
+        // Handle telnet protocol commands
+        if (state->ch == IAC) {
+            CORO_GETC(co, state->command);
+            if (state->command != IAC) {
+                stats_count_iac(state->command);
+            }
+            if (state->command == DO || state->command == DONT ||
+                state->command == WILL || state->command == WONT) {
+                CORO_GETC(co, state->ch);
+                handle_telnet_option(co, state->command, state->ch);
+                continue;
+            } else if (state->command == SB) {
+                // Subnegotiation: collect everything up to IAC SE
+                do {
+                    CORO_GETC(co, state->ch);
+                    if (state->ch != IAC) {
+                        line_buffer_append(&state->sb, &state->ch, 1);
+                        continue;
+                    }
+                    CORO_GETC(co, state->command);
+                    if (state->command != SE) {
+                        line_buffer_append(&state->sb, &state->ch, 1);
+                        line_buffer_append(&state->sb, &state->command, 1);
+                    }
+                } while (state->ch != IAC || state->command != SE);
+                if (state->sb.len > 0 && state->sb.data[0] == NAWS) {
+                    handle_naws(state, state->sb.data, state->sb.len);
+                    send_edit_output(state);
+                }
+                line_buffer_consume(&state->sb, state->sb.len);
+                continue;
+            } else if (state->command != IAC) {
+                continue;
+            }
+            // Escaped IAC (255), treat as regular character
+        }
+
+        if (handle_key(state, state->ch)) {
+            CORO_EXIT(co);
+        }
+    }
+
+    CORO_END(co);
+}
+
+// The callbacks see the session through telnet_get_session() and friends
+static int rl_session_run(coro_t *co) {
+    current = (rl_session_t *)co;
+    int result = rl_session_body(co);
+    current = NULL;
+    return result;
+}
+
+// Login timeout, delayed repeats and unsolicited messages
+static void rl_session_tick(coro_t *co) {
+    rl_session_t *state = (rl_session_t *)co;
+    session_t *session = co->session;
+    if (session->failed || session->closing || state->number == 0) {
+        return;
+    }
+    current = state;
+    time_t now = time(NULL);
+    if (state->login_deadline != 0 && now >= state->login_deadline) {
+        char ts[32];
+        get_timestamp(ts, sizeof(ts));
+        printf("%s[INFO] Login timeout: %s:%d.\n", ts, session->peer_ip, session->peer_port);
+        send_message(state, telnetServerLoginTimeout);
+        session_close(session);
+    } else if (state->phase == RL_REPEAT && state->repeat_at != 0 && now >= state->repeat_at) {
+        state->repeat_at = 0;
+        if (run_command(state)) {
+            session_close(session);
+        }
+    } else if (state->phase == RL_COMMAND && telnet_server_message_poll(state->number)) {
+        // The message goes above a fresh prompt with the line being typed
+        send_message(state, telnetServerUnsolicitedMessage);
+        send_prompt(state);
+        line_editor_redraw(&state->editor, &edit_output);
+        send_edit_output(state);
+    }
+    current = NULL;
+}
+
+// The previous batch of a repeated command has been sent
+static void rl_session_writable(coro_t *co) {
+    rl_session_t *state = (rl_session_t *)co;
+    if (state->phase != RL_REPEAT || state->repeat_at != 0) {
+        return;
+    }
+    current = state;
+    if (run_command(state)) {
+        session_close(co->session);
+    }
+    current = NULL;
+}
+
+static void rl_session_close(coro_t *co) {
+    rl_session_t *state = (rl_session_t *)co;
+    if (state->number != 0) {
+        if (!co->done) {
+            char ts[32];
+            get_timestamp(ts, sizeof(ts));
+            printf("%s[INFO] Client disconnected: %s:%d (session %d).\n",
+                   ts, co->session->peer_ip, co->session->peer_port, state->number);
+        }
+        rl_number_release(state->number);
+    }
+    line_editor_free(&state->editor);
+    line_buffer_free(&state->sb);
+    line_buffer_free(&state->cmd);
+}
+
+const coro_protocol_t rl_session_protocol = {
+    .ops = CORO_SESSION_OPS(1),
+    .state_size = sizeof(rl_session_t),
+    .run = rl_session_run,
+    .tick = rl_session_tick,
+    .close = rl_session_close,
+    .writable = rl_session_writable
+};
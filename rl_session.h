@@ -0,0 +1,56 @@
+#ifndef RL_SESSION_H
+#define RL_SESSION_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "coro_session.h"
+
+// rl_net Telnet server sessions (rl_net.h) as a coroutine session
+// (coro_session.h), so that applications written against the rl_net
+// callbacks run on the reactor core.
+//
+// A session asks telnet_accept_client(), negotiates server-side echo and
+// SGA, logs the user in when authentication is enabled (the built-in
+// account, then telnet_check_username() / telnet_check_password(), within
+// the login timeout) and sends the welcome message and the prompt. Lines
+// are edited as they are typed with the line editor (line_editor.h) and
+// handed to telnet_server_process() on Enter. A repeated command is called
+// again once its reply has left, a batch of replies at a time, so a long
+// listing never queues more than RL_SESSION_REPEAT_BATCH bytes, or after
+// its telnet_set_delay() delay; Ctrl+C stops it. Unsolicited messages are
+// polled every second.
+//
+// Session numbers are the lowest ones free in a table shared by every
+// process of the server, so they are the same in all process models. Each
+// number records the process holding it, so the numbers of a process that
+// died in the middle of its sessions are given back when it is reaped.
+
+#define RL_SESSION_BUF_SIZE 1460       // Reply buffer of telnet_server_process() (one segment)
+#define RL_SESSION_REPEAT_BATCH (16 * 1024)
+#define RL_SESSION_MAX 4096            // Session numbers
+#define RL_SESSION_FIELD_MAX 64        // Longest username or password
+#define RL_SESSION_LOGIN_ATTEMPTS 3
+#define RL_SESSION_SB_MAX 64           // Longest subnegotiation kept (NAWS)
+
+typedef struct {
+    int port;
+    int auth;                          // Log users in (TELNET_AUTH)
+    const char *username;              // Built-in account, user 0 (TELNET_USERNAME)
+    const char *password;              // (TELNET_PASSWORD)
+    int login_timeout;                 // Seconds to log in (TELNET_LOGIN_TIMEOUT)
+    size_t max_line;
+} rl_session_config_t;
+
+// Settings used by every rl_net session of the server, and the shared
+// session number table; call before the first fork(). Returns 0, or -1
+// when the table cannot be created.
+int rl_session_configure(const rl_session_config_t *config);
+
+// Free the session numbers still held by process pid, which has exited
+// (the telnetd_app_t reap hook)
+void rl_session_reap(pid_t pid);
+
+extern const coro_protocol_t rl_session_protocol;
+
+#endif
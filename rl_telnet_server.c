@@ -0,0 +1,58 @@
+#include <stdio.h>
+
+#include "line_buffer.h"
+#include "rl_session.h"
+#include "server_config.h"
+#include "telnetd.h"
+
+// Command server for applications written against the rl_net Telnet
+// server callbacks (rl_net.h): link them in (Telnet_Server_*.c here) and
+// they are served by libtelnetd.
+
+#define PORT 9095
+#define ADMIN_PORT 19095  // Loopback-only metrics port
+#define TLS_PORT 9995     // TLS port, served when TELNET_TLS_CERT is set
+
+static rl_session_config_t session_config;
+
+static int rl_telnet_setup(telnetd_t *server) {
+    (void)server;
+    rl_session_config_t settings = {
+        .port = PORT,
+        .auth = config_get_long("AUTH", PORT, 0) != 0,
+        .username = config_get_str("USERNAME", PORT, "admin"),
+        .password = config_get_str("PASSWORD", PORT, ""),
+        .login_timeout = (int)config_get_long("LOGIN_TIMEOUT", PORT, 30),
+        .max_line = line_buffer_limit(PORT)
+    };
+    session_config = settings;
+    return rl_session_configure(&session_config);
+}
+
+static void rl_telnet_describe(const telnetd_t *server, const char *ts) {
+    (void)server;
+    if (!session_config.auth) {
+        printf("%s[INFO] Login: off (TELNET_AUTH=1 enables it).\n", ts);
+    } else if (session_config.password[0] != '\0') {
+        printf("%s[INFO] Login: built-in account '%s' and the user database, %d second timeout.\n",
+               ts, session_config.username, session_config.login_timeout);
+    } else {
+        printf("%s[INFO] Login: user database only (no TELNET_PASSWORD), %d second timeout.\n",
+               ts, session_config.login_timeout);
+    }
+}
+
+int main() {
+    const telnetd_app_t app = {
+        .name = "rl_telnet",
+        .title = "rl_net Telnet Command Server",
+        .port = PORT,
+        .admin_port = ADMIN_PORT,
+        .tls_port = TLS_PORT,
+        .ops = &rl_session_protocol.ops,
+        .setup = rl_telnet_setup,
+        .describe = rl_telnet_describe,
+        .reap = rl_session_reap
+    };
+    return telnetd_main(&app);
+}
@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "line_buffer.h"
+#include "room.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "telnet_proto.h"
+
+#define ROOM_IOV_MAX 64
+
+struct room {
+    char name[ROOM_NAME_MAX + 1];
+    room_t **bucket;                   // Chain in the owning worker's table
+    room_t *next;
+    room_member_t *members;
+    int count;
+};
+
+// One post on its way to one worker
+typedef struct room_post room_post_t;
+typedef struct {
+    worker_task_t task;
+    room_post_t *post;
+} room_delivery_t;
+
+struct room_post {
+    session_shared_t *shared;          // "[room] peer: text\r\n"
+    unsigned int pending;              // Workers that have not delivered it yet
+    size_t size;
+    char room[ROOM_NAME_MAX + 1];
+    room_delivery_t deliveries[];
+};
+
+// Rooms of the calling worker thread. The table outlives the thread, so a
+// session closed by reactor_stop() after its worker ended can still leave.
+static __thread room_t **room_table = NULL;
+
+// Charset conversion scratch for non-UTF-8 members
+static __thread line_buffer_t room_encoded;
+
+int room_enabled(int port) {
+    return config_get_long("ROOMS", port, 0) != 0;
+}
+
+static unsigned int room_hash(const char *name) {
+    unsigned int hash = 2166136261u;   // FNV-1a
+    for (; *name != '\0'; name++) {
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    }
+    return hash % ROOM_BUCKETS;
+}
+
+static room_t *room_find(const char *name) {
+    if (room_table == NULL) {
+        return NULL;
+    }
+    for (room_t *room = room_table[room_hash(name)]; room != NULL; room = room->next) {
+        if (strcmp(room->name, name) == 0) {
+            return room;
+        }
+    }
+    return NULL;
+}
+
+static int room_name_valid(const char *name, size_t len) {
+    if (len == 0 || len > ROOM_NAME_MAX) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+              c == '-' || c == '_' || c == '.' || c == '#')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int room_join(room_member_t *member, const char *name, size_t len) {
+    char key[ROOM_NAME_MAX + 1];
+    if (!room_name_valid(name, len)) {
+        return -1;
+    }
+    memcpy(key, name, len);
+    key[len] = '\0';
+    if (member->room != NULL && strcmp(member->room->name, key) == 0) {
+        return 0;
+    }
+
+    if (room_table == NULL) {
+        room_table = calloc(ROOM_BUCKETS, sizeof(room_t *));
+        if (room_table == NULL) {
+            return -1;
+        }
+    }
+    room_t *room = room_find(key);
+    if (room == NULL) {
+        room = session_alloc(sizeof(room_t));
+        if (room == NULL) {
+            return -1;
+        }
+        memcpy(room->name, key, len + 1);
+        room->bucket = &room_table[room_hash(key)];
+        room->next = *room->bucket;
+        *room->bucket = room;
+    }
+
+    room_leave(member);
+    member->room = room;
+    member->prev = NULL;
+    member->next = room->members;
+    if (room->members != NULL) {
+        room->members->prev = member;
+    }
+    room->members = member;
+    room->count++;
+    return 0;
+}
+
+void room_leave(room_member_t *member) {
+    room_t *room = member->room;
+    if (room == NULL) {
+        return;
+    }
+    if (member->prev != NULL) {
+        member->prev->next = member->next;
+    } else {
+        room->members = member->next;
+    }
+    if (member->next != NULL) {
+        member->next->prev = member->prev;
+    }
+    member->room = NULL;
+
+    // The last member out removes the room
+    if (--room->count == 0) {
+        room_t **link = room->bucket;
+        while (*link != room) {
+            link = &(*link)->next;
+        }
+        *link = room->next;
+        session_free(room, sizeof(room_t));
+    }
+}
+
+void room_migrate(room_member_t *member, int arriving) {
+    if (!arriving) {
+        snprintf(member->moving, sizeof(member->moving), "%s", room_name(member));
+        room_leave(member);
+    } else if (member->moving[0] != '\0') {
+        room_join(member, member->moving, strlen(member->moving));
+        member->moving[0] = '\0';
+    }
+}
+
+const char *room_name(const room_member_t *member) {
+    return member->room != NULL ? member->room->name : "";
+}
+
+// Convert the message for a member with another charset and send the copy
+static void room_send_converted(room_member_t *member, const session_shared_t *shared) {
+    if (line_buffer_reserve(&room_encoded, CHARSET_ENCODE_MAX(shared->len)) == -1) {
+        return;
+    }
+    size_t len = charset_encode(member->charset->charset, shared->data, shared->len,
+                                room_encoded.data, room_encoded.capacity);
+
+    // Doubled IACs, as for every byte of text sent to a client
+    struct iovec iov[ROOM_IOV_MAX];
+    size_t done = 0;
+    while (done < len) {
+        size_t consumed;
+        int count = telnet_escape_iov(room_encoded.data + done, len - done, iov, ROOM_IOV_MAX, &consumed);
+        session_sendv(member->session, iov, count);
+        done += consumed;
+    }
+    line_buffer_trim(&room_encoded);
+}
+
+// Worker task: queue the post on this worker's members of the room
+static void room_deliver(worker_task_t *task) {
+    room_post_t *post = ((room_delivery_t *)task)->post;
+    room_t *room = room_find(post->room);
+    uint64_t delivered = 0, dropped = 0;
+
+    if (room != NULL) {
+        for (room_member_t *member = room->members; member != NULL; member = member->next) {
+            session_t *session = member->session;
+            if (session->failed || session->closing) {
+                continue;
+            }
+            if (session_queued(session) > ROOM_QUEUE_MAX) {
+                dropped++;
+                continue;
+            }
+            if (charset_is_utf8(member->charset->charset)) {
+                session_send_shared(session, post->shared);
+            } else {
+                room_send_converted(member, post->shared);
+            }
+            delivered++;
+        }
+    }
+    stats_add(STAT_ROOM_DELIVERIES, delivered);
+    stats_add(STAT_ROOM_DROPS, dropped);
+
+    if (__atomic_sub_fetch(&post->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        session_shared_release(post->shared);
+        session_free(post, post->size);
+    }
+}
+
+int room_post(room_member_t *member, const unsigned char *text, size_t len) {
+    session_t *session = member->session;
+    if (member->room == NULL) {
+        return -1;
+    }
+
+    // The text is valid UTF-8 (the line session repairs or rejects
+    // anything else, whatever its UTF-8 policy), which never contains
+    // 0xFF, so the message needs no IAC escaping
+    char prefix[ROOM_NAME_MAX + INET_ADDRSTRLEN + 16];
+    int prefix_len = snprintf(prefix, sizeof(prefix), "[%s] %s:%d: ",
+                              member->room->name, session->peer_ip, session->peer_port);
+    session_shared_t *shared = session_shared_create(NULL, (size_t)prefix_len + len + 2);
+    if (shared == NULL) {
+        return -1;
+    }
+    memcpy(shared->data, prefix, prefix_len);
+    memcpy(shared->data + prefix_len, text, len);
+    memcpy(shared->data + prefix_len + len, "\r\n", 2);
+
+    int workers = session_workers(session);
+    size_t size = sizeof(room_post_t) + sizeof(room_delivery_t) * workers;
+    room_post_t *post = session_alloc(size);
+    if (post == NULL) {
+        session_shared_release(shared);
+        return -1;
+    }
+    post->shared = shared;
+    post->pending = (unsigned int)workers;
+    post->size = size;
+    memcpy(post->room, member->room->name, sizeof(post->room));
+    for (int w = 0; w < workers; w++) {
+        post->deliveries[w].task.run = room_deliver;
+        post->deliveries[w].post = post;
+    }
+    stats_inc(STAT_ROOM_MESSAGES);
+
+    // The post may be freed by the last delivery: touch nothing after this
+    for (int w = 0; w < workers; w++) {
+        session_post(session, w, &post->deliveries[w].task);
+    }
+    return 0;
+}
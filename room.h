@@ -0,0 +1,69 @@
+#ifndef ROOM_H
+#define ROOM_H
+
+#include <stddef.h>
+
+#include "charset.h"
+#include "reactor.h"
+
+// Chat rooms for line sessions (TELNET_ROOMS[_<port>]=1).
+//
+// A line posted by a member goes to every member of its room, the sender
+// included. Membership is kept per worker thread: each worker has its own
+// table of the rooms its sessions are in, touched only by that thread, so
+// joining and leaving take no lock. A post is formatted once into a
+// session_shared_t and handed to every worker as a task; each worker then
+// queues that one buffer on its local members by reference.
+//
+// Members are never waited for. A member with more than ROOM_QUEUE_MAX
+// bytes of unsent output misses the message (telnet_room_drops_total), so
+// a slow reader neither holds up the others nor grows without bound.
+// Members using a non-UTF-8 charset get a converted copy.
+//
+// Rooms connect the sessions of one process: every session in the reactor
+// model, the sessions of one worker process in the prefork model. A member
+// whose session moves to another worker thread (room_migrate()) leaves the
+// room on the old worker and joins it again on the new one, so it misses
+// what is posted while it is on the way.
+
+#define ROOM_NAME_MAX 32
+#define ROOM_DEFAULT "lobby"
+#define ROOM_QUEUE_MAX (64 * 1024)
+#define ROOM_BUCKETS 256               // Rooms hash table size, per worker
+
+typedef struct room room_t;
+
+typedef struct room_member {
+    session_t *session;
+    charset_state_t *charset;          // Charset the member's text is sent in
+    room_t *room;                      // NULL when in no room
+    char moving[ROOM_NAME_MAX + 1];    // Room to join again after a move, "" when none
+    struct room_member *prev;
+    struct room_member *next;
+} room_member_t;
+
+// Whether room mode is on for the server on port
+int room_enabled(int port);
+
+// Move the member into the named room (letters, digits, '-', '_', '.', '#').
+// Call on the session's worker. Returns 0, or -1 for a bad name or when
+// out of memory (the member then stays where it was).
+int room_join(room_member_t *member, const char *name, size_t len);
+
+// Leave the current room, if any
+void room_leave(room_member_t *member);
+
+// Session migration hook (session_ops_t.migrate): leave the room on the
+// old worker and join it again on the new one
+void room_migrate(room_member_t *member, int arriving);
+
+// Name of the member's room, "" when in none
+const char *room_name(const room_member_t *member);
+
+// Send a line of valid UTF-8 to everyone in the member's room. The line
+// goes out unescaped, so it must be valid whatever the session's UTF-8
+// policy: a 0xFF in it would reach every member as a telnet command.
+// Returns 0, or -1 when out of memory or not in a room.
+int room_post(room_member_t *member, const unsigned char *text, size_t len);
+
+#endif
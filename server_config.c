@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "server_config.h"
+
+// Look up TELNET_<NAME>_<PORT>, then TELNET_<NAME>
+static const char *config_lookup(const char *name, int port) {
+    char key[128];
+    const char *value;
+
+    if (port > 0) {
+        snprintf(key, sizeof(key), "TELNET_%s_%d", name, port);
+        value = getenv(key);
+        if (value != NULL && value[0] != '\0') {
+            return value;
+        }
+    }
+
+    snprintf(key, sizeof(key), "TELNET_%s", name);
+    value = getenv(key);
+    if (value != NULL && value[0] != '\0') {
+        return value;
+    }
+    return NULL;
+}
+
+long config_get_long(const char *name, int port, long default_value) {
+    const char *value = config_lookup(name, port);
+    if (value == NULL) {
+        return default_value;
+    }
+
+    char *end;
+    errno = 0;
+    long result = strtol(value, &end, 0);
+    if (errno != 0 || *end != '\0') {
+        fprintf(stderr, "Ignoring invalid value for TELNET_%s: '%s'\n", name, value);
+        return default_value;
+    }
+    return result;
+}
+
+const char *config_get_str(const char *name, int port, const char *default_value) {
+    const char *value = config_lookup(name, port);
+    return value != NULL ? value : default_value;
+}
+
+void get_timestamp(char *buffer, size_t size) {
+    time_t now = time(NULL);
+    struct tm tm_info;
+    localtime_r(&now, &tm_info);
+    snprintf(buffer, size, "[%04d-%02d-%02d %02d:%02d:%02d]",
+             tm_info.tm_year + 1900, tm_info.tm_mon + 1, tm_info.tm_mday,
+             tm_info.tm_hour, tm_info.tm_min, tm_info.tm_sec);
+}
@@ -0,0 +1,19 @@
+#ifndef SERVER_CONFIG_H
+#define SERVER_CONFIG_H
+
+#include <stddef.h>
+
+// Runtime configuration lookup shared by all servers.
+//
+// Every setting is read from the environment. A per-port value
+// (TELNET_<NAME>_<PORT>, e.g. TELNET_ADMIN_PORT_9093) takes precedence
+// over the global value (TELNET_<NAME>), which takes precedence over the
+// compiled-in default passed by the caller.
+
+long config_get_long(const char *name, int port, long default_value);
+const char *config_get_str(const char *name, int port, const char *default_value);
+
+// Current local time as "[YYYY-MM-DD HH:MM:SS]" for log lines (thread-safe)
+void get_timestamp(char *buffer, size_t size);
+
+#endif
@@ -0,0 +1,597 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "server_stats.h"
+
+// Slot 0 belongs to the listener, the last slot is shared by workers that
+// find no free slot of their own (counting there is a locked add, so
+// sharing is safe).
+#define STATS_LISTENER_SLOT 0
+#define STATS_OVERFLOW_SLOT (STATS_MAX_WORKERS - 1)
+
+#define ADMIN_REQUEST_SIZE 1024
+#define ADMIN_HEADER_SIZE 160
+#define ADMIN_RESPONSE_SIZE (256 * 1024)
+#define ADMIN_MAX_HANDLERS 16
+#define ADMIN_MAX_CLIENTS 8
+#define ADMIN_IDLE_MS 200              // A client that sends nothing gets /metrics after this
+#define ADMIN_TIMEOUT_MS 5000          // A client not served by then is dropped
+
+// Threads that count before they attach all write here
+static stats_worker_t stats_dummy = { .shared = 1 };
+__thread stats_worker_t *stats_self = &stats_dummy;
+
+static stats_worker_t *stats_slots = NULL;
+static const char *stats_server_name = "telnet";
+
+typedef struct {
+    const char *path;
+    stats_admin_handler_t handler;
+} admin_route_t;
+
+// An admin connection, served a step at a time from the listener's loop
+typedef struct {
+    int fd;                            // -1 when the slot is free
+    uint64_t started;                  // admin_now_ms() at accept
+    char request[ADMIN_REQUEST_SIZE];
+    size_t request_len;
+    int eof;                           // The client closed its side
+    char *buffer;                      // Answer being sent, NULL while reading
+    char *response;                    // Start of the answer within buffer
+    size_t response_len;
+    size_t sent;
+} admin_client_t;
+
+static int admin_listen_fd = -1;
+static int admin_epoll_fd = -1;        // Watches the admin listener and clients
+static int admin_accepting = 0;        // The listener is in admin_epoll_fd
+static admin_client_t admin_clients[ADMIN_MAX_CLIENTS];
+
+static admin_route_t admin_routes[ADMIN_MAX_HANDLERS];
+static int admin_route_count = 0;
+static stats_admin_handler_t admin_metric_handlers[ADMIN_MAX_HANDLERS];
+static int admin_metric_count = 0;
+
+#define STATS_NAME_ENTRY(id, name, help) name,
+static const char *stat_names[STAT_COUNTER_COUNT] = {
+    STATS_COUNTERS(STATS_NAME_ENTRY)
+};
+#undef STATS_NAME_ENTRY
+
+#define STATS_HELP_ENTRY(id, name, help) help,
+static const char *stat_help[STAT_COUNTER_COUNT] = {
+    STATS_COUNTERS(STATS_HELP_ENTRY)
+};
+#undef STATS_HELP_ENTRY
+
+int stats_init(const char *server_name) {
+    size_t size = sizeof(stats_worker_t) * STATS_MAX_WORKERS;
+    void *region = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        perror("stats mmap failed");
+        return -1;
+    }
+
+    stats_slots = (stats_worker_t *)region;
+    stats_slots[STATS_OVERFLOW_SLOT].shared = 1;
+    stats_server_name = server_name;
+    stats_slots[STATS_LISTENER_SLOT].owner = getpid();
+    stats_self = &stats_slots[STATS_LISTENER_SLOT];
+    return 0;
+}
+
+void stats_attach_worker(void) {
+    if (stats_slots == NULL) {
+        return;
+    }
+
+    pid_t self = getpid();
+
+    // First pass: free slots. Second pass: slots left behind by workers
+    // that died without detaching.
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = STATS_LISTENER_SLOT + 1; i < STATS_OVERFLOW_SLOT; i++) {
+            pid_t owner = stats_slots[i].owner;
+            if (pass == 1) {
+                if (owner == 0 || kill(owner, 0) == 0 || errno != ESRCH) {
+                    continue;
+                }
+            } else if (owner != 0) {
+                continue;
+            }
+            if (__atomic_compare_exchange_n(&stats_slots[i].owner, &owner, self, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                stats_self = &stats_slots[i];
+                return;
+            }
+        }
+    }
+
+    stats_self = &stats_slots[STATS_OVERFLOW_SLOT];
+}
+
+void stats_detach_worker(void) {
+    if (stats_slots == NULL || stats_self == &stats_slots[STATS_OVERFLOW_SLOT] ||
+        stats_self == &stats_slots[STATS_LISTENER_SLOT]) {
+        return;
+    }
+    __atomic_store_n(&stats_self->owner, 0, __ATOMIC_RELEASE);
+    stats_self = &stats_dummy;
+}
+
+void stats_reap_worker(pid_t pid) {
+    // Counter pairs whose difference is a gauge. A process may start an
+    // item in one of its slots and finish it in another, so the pairs are
+    // settled over all of its slots together.
+    static const stat_counter_t pairs[][2] = {
+        { STAT_CONNECTIONS_OPENED, STAT_CONNECTIONS_CLOSED },
+        { STAT_SESSION_MEMORY_ALLOCATED, STAT_SESSION_MEMORY_FREED },
+        { STAT_POOL_JOBS, STAT_POOL_JOBS_DONE },
+    };
+    uint64_t open[sizeof(pairs) / sizeof(pairs[0])] = { 0 };
+    stats_worker_t *last = NULL;
+    if (stats_slots == NULL) {
+        return;
+    }
+    for (int i = STATS_LISTENER_SLOT + 1; i < STATS_OVERFLOW_SLOT; i++) {
+        stats_worker_t *slot = &stats_slots[i];
+        if (__atomic_load_n(&slot->owner, __ATOMIC_ACQUIRE) != pid) {
+            continue;
+        }
+        for (size_t p = 0; p < sizeof(pairs) / sizeof(pairs[0]); p++) {
+            open[p] += slot->counters[pairs[p][0]] - slot->counters[pairs[p][1]];
+        }
+        last = slot;
+    }
+    if (last == NULL) {
+        return;
+    }
+    for (size_t p = 0; p < sizeof(pairs) / sizeof(pairs[0]); p++) {
+        __atomic_fetch_add(&last->counters[pairs[p][1]], open[p], __ATOMIC_RELAXED);
+    }
+    for (int i = STATS_LISTENER_SLOT + 1; i < STATS_OVERFLOW_SLOT; i++) {
+        if (__atomic_load_n(&stats_slots[i].owner, __ATOMIC_ACQUIRE) == pid) {
+            __atomic_store_n(&stats_slots[i].owner, 0, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+int stats_worker_index(void) {
+    if (stats_slots == NULL || stats_self == &stats_dummy ||
+        stats_self == &stats_slots[STATS_OVERFLOW_SLOT]) {
+        return -1;
+    }
+    return (int)(stats_self - stats_slots);
+}
+
+void stats_snapshot(uint64_t *totals) {
+    memset(totals, 0, sizeof(uint64_t) * STAT_COUNTER_COUNT);
+    if (stats_slots == NULL) {
+        return;
+    }
+    for (int i = 0; i < STATS_MAX_WORKERS; i++) {
+        for (int c = 0; c < STAT_COUNTER_COUNT; c++) {
+            totals[c] += __atomic_load_n(&stats_slots[i].counters[c], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+size_t stats_appendf(char *buf, size_t size, size_t len, const char *fmt, ...) {
+    if (len + 1 >= size) {
+        return len;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + len, size - len, fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        return len;
+    }
+    return (len + (size_t)n >= size) ? size - 1 : len + (size_t)n;
+}
+
+size_t stats_render(char *buf, size_t size) {
+    uint64_t totals[STAT_COUNTER_COUNT];
+    size_t len = 0;
+
+    stats_snapshot(totals);
+
+    for (int c = 0; c < STAT_COUNTER_COUNT; c++) {
+        len = stats_appendf(buf, size, len, "# HELP %s %s\n# TYPE %s counter\n%s{server=\"%s\"} %llu\n",
+                     stat_names[c], stat_help[c], stat_names[c], stat_names[c],
+                     stats_server_name, (unsigned long long)totals[c]);
+    }
+
+    // Derived gauges
+    uint64_t active = totals[STAT_CONNECTIONS_OPENED] - totals[STAT_CONNECTIONS_CLOSED];
+    len = stats_appendf(buf, size, len,
+                 "# HELP telnet_connections_active Client sessions currently open.\n"
+                 "# TYPE telnet_connections_active gauge\n"
+                 "telnet_connections_active{server=\"%s\"} %llu\n",
+                 stats_server_name, (unsigned long long)active);
+
+    // Memory held by open sessions (control blocks plus retained buffers)
+    uint64_t session_memory = totals[STAT_SESSION_MEMORY_ALLOCATED] - totals[STAT_SESSION_MEMORY_FREED];
+    len = stats_appendf(buf, size, len,
+                 "# HELP telnet_session_memory_bytes Memory held by open sessions.\n"
+                 "# TYPE telnet_session_memory_bytes gauge\n"
+                 "telnet_session_memory_bytes{server=\"%s\"} %llu\n"
+                 "# HELP telnet_session_memory_bytes_per_session Session memory divided by open sessions.\n"
+                 "# TYPE telnet_session_memory_bytes_per_session gauge\n"
+                 "telnet_session_memory_bytes_per_session{server=\"%s\"} %.1f\n",
+                 stats_server_name, (unsigned long long)session_memory,
+                 stats_server_name, active > 0 ? (double)session_memory / (double)active : 0.0);
+
+    // Command jobs queued or running in the worker pool
+    len = stats_appendf(buf, size, len,
+                 "# HELP telnet_pool_queue_depth Command jobs submitted and not yet delivered.\n"
+                 "# TYPE telnet_pool_queue_depth gauge\n"
+                 "telnet_pool_queue_depth{server=\"%s\"} %llu\n",
+                 stats_server_name, (unsigned long long)(totals[STAT_POOL_JOBS] - totals[STAT_POOL_JOBS_DONE]));
+
+    // Line-mode batching: how many echoed lines each send carried
+    double lines_per_send = totals[STAT_ECHO_SENDS] > 0
+        ? (double)totals[STAT_LINES_ECHOED] / (double)totals[STAT_ECHO_SENDS] : 0.0;
+    len = stats_appendf(buf, size, len,
+                 "# HELP telnet_echo_lines_per_send Echoed lines per gathering send (line mode).\n"
+                 "# TYPE telnet_echo_lines_per_send gauge\n"
+                 "telnet_echo_lines_per_send{server=\"%s\"} %.3f\n",
+                 stats_server_name, lines_per_send);
+
+    int workers = 0;
+    if (stats_slots != NULL) {
+        for (int i = STATS_LISTENER_SLOT + 1; i < STATS_OVERFLOW_SLOT; i++) {
+            if (__atomic_load_n(&stats_slots[i].owner, __ATOMIC_RELAXED) != 0) {
+                workers++;
+            }
+        }
+    }
+    len = stats_appendf(buf, size, len,
+                 "# HELP telnet_workers_active Worker slots currently claimed.\n"
+                 "# TYPE telnet_workers_active gauge\n"
+                 "telnet_workers_active{server=\"%s\"} %d\n",
+                 stats_server_name, workers);
+
+    for (int i = 0; i < admin_metric_count; i++) {
+        len += admin_metric_handlers[i]("", buf + len, size - len);
+    }
+
+    return len;
+}
+
+void stats_admin_register(const char *path, stats_admin_handler_t handler) {
+    if (admin_route_count < ADMIN_MAX_HANDLERS) {
+        admin_routes[admin_route_count].path = path;
+        admin_routes[admin_route_count].handler = handler;
+        admin_route_count++;
+    }
+}
+
+void stats_admin_register_metrics(stats_admin_handler_t handler) {
+    if (admin_metric_count < ADMIN_MAX_HANDLERS) {
+        admin_metric_handlers[admin_metric_count++] = handler;
+    }
+}
+
+static size_t admin_metrics_handler(const char *args, char *buf, size_t size) {
+    (void)args;
+    return stats_render(buf, size);
+}
+
+// Split "GET /path?args HTTP/1.0" or a raw "path args" line into its parts.
+// Returns the handler for the path (metrics when the path is unknown or empty).
+static stats_admin_handler_t admin_route(char *request, int is_http, const char **args) {
+    char *path = is_http ? request + 4 : request;
+    while (*path == '/' || *path == ' ') {
+        path++;
+    }
+
+    char *end = path + strcspn(path, " ?\r\n");
+    *args = "";
+    if (*end == '?' || (*end == ' ' && !is_http)) {
+        char *arg_start = end + 1;
+        arg_start[strcspn(arg_start, " \r\n")] = '\0';
+        *args = arg_start;
+    }
+    *end = '\0';
+
+    for (int i = 0; i < admin_route_count; i++) {
+        const char *route = admin_routes[i].path;
+        while (*route == '/') {
+            route++;
+        }
+        if (strcmp(path, route) == 0) {
+            return admin_routes[i].handler;
+        }
+    }
+    return admin_metrics_handler;
+}
+
+int stats_admin_listen(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("admin socket creation failed");
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    // Loopback only: the admin port must never be reachable from outside
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror("admin bind failed");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, 16) == -1) {
+        perror("admin listen failed");
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    // Admin connections are accepted long after startup and can get any
+    // descriptor number, so they are watched here rather than in the
+    // listener's select() set, which only gets this epoll fd
+    admin_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (admin_epoll_fd == -1 || epoll_ctl(admin_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror("admin epoll failed");
+        if (admin_epoll_fd != -1) {
+            close(admin_epoll_fd);
+            admin_epoll_fd = -1;
+        }
+        close(fd);
+        return -1;
+    }
+    admin_accepting = 1;
+    for (int i = 0; i < ADMIN_MAX_CLIENTS; i++) {
+        admin_clients[i].fd = -1;
+    }
+    admin_listen_fd = fd;
+    return fd;
+}
+
+// Take new clients only while a client slot is free; the others wait in
+// the backlog
+static void admin_accept_interest(int on) {
+    if (on != admin_accepting) {
+        struct epoll_event ev = { .events = on ? EPOLLIN : 0, .data.ptr = NULL };
+        epoll_ctl(admin_epoll_fd, EPOLL_CTL_MOD, admin_listen_fd, &ev);
+        admin_accepting = on;
+    }
+}
+
+static void admin_client_close(admin_client_t *client) {
+    // Removed by hand: a forked child may still hold a copy of the socket
+    epoll_ctl(admin_epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    client->fd = -1;
+    free(client->buffer);
+    client->buffer = NULL;
+    admin_accept_interest(1);
+}
+
+// Whether the request has arrived: the first line for a raw client, the
+// whole header for HTTP (so nothing is left unread when the socket closes)
+static int admin_request_done(const admin_client_t *client) {
+    const char *request = client->request;
+    if (client->request_len == sizeof(client->request) - 1) {
+        return 1;
+    }
+    if (strncmp(request, "GET ", 4) == 0) {
+        return strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL;
+    }
+    return strchr(request, '\n') != NULL;
+}
+
+// Render the answer into the client's buffer, body first and the HTTP
+// header just in front of it
+static int admin_respond(admin_client_t *client) {
+    client->buffer = malloc(ADMIN_HEADER_SIZE + ADMIN_RESPONSE_SIZE);
+    if (client->buffer == NULL) {
+        return -1;
+    }
+    int is_http = strncmp(client->request, "GET ", 4) == 0;
+    const char *args;
+    stats_admin_handler_t handler = admin_route(client->request, is_http, &args);
+    char *body = client->buffer + ADMIN_HEADER_SIZE;
+    size_t body_len = handler(args, body, ADMIN_RESPONSE_SIZE);
+
+    // Speak just enough HTTP for a Prometheus scraper; raw clients such as
+    // nc get the bare text.
+    client->response = body;
+    client->response_len = body_len;
+    if (is_http) {
+        char header[ADMIN_HEADER_SIZE];
+        int header_len = snprintf(header, sizeof(header),
+                                  "HTTP/1.0 200 OK\r\n"
+                                  "Content-Type: text/plain; version=0.0.4\r\n"
+                                  "Content-Length: %zu\r\n\r\n", body_len);
+        client->response -= header_len;
+        client->response_len += (size_t)header_len;
+        memcpy(client->response, header, (size_t)header_len);
+    }
+    client->sent = 0;
+    return 0;
+}
+
+// Read what the client sent; answer once the request is complete, the
+// client has closed its side or has stayed silent for ADMIN_IDLE_MS
+static void admin_client_read(admin_client_t *client, uint64_t now) {
+    for (;;) {
+        size_t room = sizeof(client->request) - 1 - client->request_len;
+        if (room == 0) {
+            break;
+        }
+        ssize_t n = recv(client->fd, client->request + client->request_len, room, 0);
+        if (n > 0) {
+            client->request_len += (size_t)n;
+            client->request[client->request_len] = '\0';
+            continue;
+        }
+        if (n == 0) {
+            client->eof = 1;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            admin_client_close(client);
+            return;
+        }
+        break;
+    }
+    if (client->eof || admin_request_done(client) || now - client->started >= ADMIN_IDLE_MS) {
+        if (admin_respond(client) == -1) {
+            admin_client_close(client);
+        }
+    }
+}
+
+// Send as much of the answer as the socket takes
+static void admin_client_write(admin_client_t *client) {
+    while (client->sent < client->response_len) {
+        ssize_t n = send(client->fd, client->response + client->sent,
+                         client->response_len - client->sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            client->sent += (size_t)n;
+            continue;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return;
+        }
+        break;
+    }
+    admin_client_close(client);
+}
+
+static uint64_t admin_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+int stats_admin_fds(fd_set *readfds, int max_fd) {
+    if (admin_epoll_fd == -1) {
+        return max_fd;
+    }
+    FD_SET(admin_epoll_fd, readfds);
+    return admin_epoll_fd > max_fd ? admin_epoll_fd : max_fd;
+}
+
+// Read and answer a client, and wait for the socket to take the rest of
+// the answer when it did not take all of it
+static void admin_client_serve(admin_client_t *client, uint64_t now) {
+    if (client->buffer == NULL) {
+        admin_client_read(client, now);
+        if (client->fd == -1 || client->buffer == NULL) {
+            return;
+        }
+        admin_client_write(client);
+        if (client->fd != -1) {
+            struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = client };
+            epoll_ctl(admin_epoll_fd, EPOLL_CTL_MOD, client->fd, &ev);
+        }
+    } else {
+        admin_client_write(client);
+    }
+}
+
+static void admin_accept(uint64_t now) {
+    for (int i = 0; i < ADMIN_MAX_CLIENTS; i++) {
+        admin_client_t *client = &admin_clients[i];
+        if (client->fd != -1) {
+            continue;
+        }
+        int fd = accept4(admin_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            return;
+        }
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = client };
+        if (epoll_ctl(admin_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        client->started = now;
+        client->request_len = 0;
+        client->request[0] = '\0';
+        client->eof = 0;
+        client->buffer = NULL;
+    }
+    admin_accept_interest(0);
+}
+
+void stats_admin_poll(const fd_set *readfds) {
+    if (admin_epoll_fd == -1) {
+        return;
+    }
+    uint64_t now = admin_now_ms();
+    if (readfds != NULL && FD_ISSET(admin_epoll_fd, readfds)) {
+        struct epoll_event events[ADMIN_MAX_CLIENTS + 1];
+        int count = epoll_wait(admin_epoll_fd, events, ADMIN_MAX_CLIENTS + 1, 0);
+        int accepting = 0;
+        for (int i = 0; i < count; i++) {
+            admin_client_t *client = events[i].data.ptr;
+            if (client == NULL) {
+                accepting = 1;
+            } else if (client->fd != -1) {
+                admin_client_serve(client, now);
+            }
+        }
+        // After the clients, so a slot freed above takes a waiting client
+        if (accepting) {
+            admin_accept(now);
+        }
+    }
+
+    // Answer silent clients and drop the ones that take too long
+    for (int i = 0; i < ADMIN_MAX_CLIENTS; i++) {
+        admin_client_t *client = &admin_clients[i];
+        if (client->fd == -1) {
+            continue;
+        }
+        if (now - client->started >= ADMIN_TIMEOUT_MS) {
+            admin_client_close(client);
+        } else if (client->buffer == NULL && now - client->started >= ADMIN_IDLE_MS) {
+            admin_client_serve(client, now);
+        }
+    }
+}
+
+void stats_admin_close_clients(void) {
+    if (admin_epoll_fd == -1) {
+        return;
+    }
+    // The epoll instance is shared with the listener: close the copies
+    // without taking anything out of it
+    for (int i = 0; i < ADMIN_MAX_CLIENTS; i++) {
+        admin_client_t *client = &admin_clients[i];
+        if (client->fd != -1) {
+            close(client->fd);
+            client->fd = -1;
+            free(client->buffer);
+            client->buffer = NULL;
+        }
+    }
+    close(admin_epoll_fd);
+    admin_epoll_fd = -1;
+    admin_listen_fd = -1;
+}
@@ -0,0 +1,227 @@
+#ifndef SERVER_STATS_H
+#define SERVER_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/select.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// Live counters shared by the listener and all client workers.
+//
+// Counters live in an anonymous MAP_SHARED region created before the first
+// fork(), so every worker process writes into the same mapping. Each worker
+// owns one cache-line aligned slot and only ever adds to it; a reader sums
+// all slots with plain loads, so taking a snapshot never blocks a worker.
+//
+// In the threaded model every worker thread claims a slot of its own
+// (stats_self is thread-local), so the single-writer rule still holds.
+//
+// Counters are cumulative per slot and are never reset when a slot changes
+// owner, which keeps every exported counter monotonic. Gauges such as the
+// number of active connections are derived from counter pairs at read time.
+
+#define STATS_MAX_WORKERS 256
+#define STATS_CACHE_LINE 64
+
+// X(enum suffix, metric name, help text)
+#define STATS_COUNTERS(X) \
+    X(CONNECTIONS_OPENED, "telnet_connections_opened_total", "Client sessions started.") \
+    X(CONNECTIONS_CLOSED, "telnet_connections_closed_total", "Client sessions finished.") \
+    X(ACCEPTS, "telnet_accepts_total", "Connections accepted by the listener.") \
+    X(REJECTS, "telnet_rejects_total", "Accepted connections that could not be served.") \
+    X(ACCEPT_BUDGET_EXHAUSTED, "telnet_accept_budget_exhausted_total", "Listener wakeups that used the whole accept budget.") \
+    X(WORKER_RESPAWNS, "telnet_worker_respawns_total", "Pre-forked worker processes restarted after exiting.") \
+    X(CHILDREN_REAPED, "telnet_children_reaped_total", "Forked session processes reaped after exiting.") \
+    X(CHILD_LIMIT_REJECTS, "telnet_child_limit_rejects_total", "Connections turned away at the child process limit.") \
+    X(BYTES_IN, "telnet_bytes_in_total", "Bytes received from clients.") \
+    X(BYTES_OUT, "telnet_bytes_out_total", "Bytes sent to clients.") \
+    X(LINES_ECHOED, "telnet_lines_echoed_total", "Lines echoed back to clients.") \
+    X(ECHO_SENDS, "telnet_echo_sends_total", "Gathering sends that carried echoed lines (one per receive segment).") \
+    X(RAW_SESSIONS, "telnet_raw_sessions_total", "Sessions accepted on the raw echo port.") \
+    X(RAW_BYTES, "telnet_raw_bytes_total", "Bytes echoed by raw sessions (spliced or copied).") \
+    X(TLS_HANDSHAKES, "telnet_tls_handshakes_total", "TLS handshakes completed.") \
+    X(TLS_HANDSHAKE_FAILURES, "telnet_tls_handshake_failures_total", "TLS handshakes that failed.") \
+    X(TLS_RESUMED, "telnet_tls_resumed_total", "TLS handshakes that resumed a session from a ticket.") \
+    X(TLS_KTLS_SEND, "telnet_tls_ktls_send_total", "TLS sessions whose sending was offloaded to the kernel.") \
+    X(TLS_KTLS_RECV, "telnet_tls_ktls_recv_total", "TLS sessions whose receiving was offloaded to the kernel.") \
+    X(ROOM_MESSAGES, "telnet_room_messages_total", "Lines posted to rooms.") \
+    X(ROOM_DELIVERIES, "telnet_room_deliveries_total", "Room messages queued for a member.") \
+    X(ROOM_DROPS, "telnet_room_drops_total", "Room messages skipped for members with too much unsent output.") \
+    X(THROTTLE_IN_BYTES, "telnet_throttle_in_bytes_total", "Sessions stopped from being read by their input byte limit.") \
+    X(THROTTLE_IN_LINES, "telnet_throttle_in_lines_total", "Sessions stopped from being read by their input line limit.") \
+    X(THROTTLE_OUT_BYTES, "telnet_throttle_out_bytes_total", "Sessions whose output was held back by their output byte limit.") \
+    X(THROTTLE_PORT, "telnet_throttle_port_total", "Sessions throttled by a per-port limit shared by all sessions.") \
+    X(FAIR_DEFERRED, "telnet_fair_deferred_total", "Receives split into several turns by the fair scheduling budget.") \
+    X(FAIR_TURNS, "telnet_fair_turns_total", "Turns given to sessions from input that waited on a run queue.") \
+    X(SESSION_MIGRATIONS, "telnet_session_migrations_total", "Sessions moved to a less loaded worker thread.") \
+    X(LINES_STREAMED, "telnet_lines_streamed_total", "Lines longer than the line limit, echoed in parts as they arrived.") \
+    X(LINES_DROPPED, "telnet_lines_dropped_total", "Lines dropped or cut short (out of memory, or over the character-mode line limit).") \
+    X(CHARS_ECHOED, "telnet_chars_echoed_total", "Characters echoed immediately in character mode.") \
+    X(EDIT_KEYS, "telnet_edit_keys_total", "Line editing keys handled in character mode (cursor movement, deletion, history).") \
+    X(EDIT_REPAINTS, "telnet_edit_repaints_total", "Character-mode edits that painted part of the row again instead of a minimal update.") \
+    X(IAC_DO, "telnet_iac_do_total", "IAC DO commands received.") \
+    X(IAC_DONT, "telnet_iac_dont_total", "IAC DONT commands received.") \
+    X(IAC_WILL, "telnet_iac_will_total", "IAC WILL commands received.") \
+    X(IAC_WONT, "telnet_iac_wont_total", "IAC WONT commands received.") \
+    X(IAC_SB, "telnet_iac_sb_total", "IAC SB subnegotiations received.") \
+    X(IAC_OTHER, "telnet_iac_other_total", "Other IAC commands received.") \
+    X(NEGOTIATIONS_COMPLETE, "telnet_negotiations_complete_total", "Sessions that completed option negotiation.") \
+    X(TIMESTAMPS_SENT, "telnet_timestamps_sent_total", "Periodic timestamp messages pushed to clients.") \
+    X(SEND_ERRORS, "telnet_send_errors_total", "Failed send() calls.") \
+    X(UTF8_INVALID_LINES, "telnet_utf8_invalid_lines_total", "Lines that were not well-formed UTF-8.") \
+    X(UTF8_REPLACEMENTS, "telnet_utf8_replacements_total", "Ill-formed UTF-8 subsequences replaced with U+FFFD.") \
+    X(UTF8_REJECTED_LINES, "telnet_utf8_rejected_lines_total", "Lines dropped by the reject UTF-8 policy.") \
+    X(CHARSET_SWITCHES, "telnet_charset_switches_total", "Sessions switched to a legacy charset by TTYPE or CHARSET.") \
+    X(CHARSET_UNMAPPED, "telnet_charset_unmapped_total", "Characters that could not be transcoded.") \
+    X(SESSION_MEMORY_ALLOCATED, "telnet_session_memory_allocated_bytes_total", "Bytes allocated for session control blocks and buffers.") \
+    X(SESSION_MEMORY_FREED, "telnet_session_memory_freed_bytes_total", "Bytes of session control blocks and buffers given back.") \
+    X(TRANSCRIPT_RECORDS, "telnet_transcript_records_total", "Records appended to session transcripts.") \
+    X(TRANSCRIPT_BYTES, "telnet_transcript_bytes_total", "Session bytes recorded in transcripts.") \
+    X(TRANSCRIPT_SEGMENTS, "telnet_transcript_segments_total", "Transcript segment files opened.") \
+    X(TRANSCRIPT_DROPS, "telnet_transcript_drops_total", "Transcript records lost because no segment could be opened.") \
+    X(POOL_JOBS, "telnet_pool_jobs_total", "Command jobs handed to the worker pool.") \
+    X(POOL_JOBS_DONE, "telnet_pool_jobs_done_total", "Pool jobs whose results reached their session.") \
+    X(POOL_STEALS, "telnet_pool_steals_total", "Pool jobs taken from another pool thread's deque.") \
+    X(RL_COMMANDS, "telnet_rl_commands_total", "Command lines handed to telnet_server_process().") \
+    X(RL_REPEATS, "telnet_rl_repeats_total", "Repeated telnet_server_process() calls requested with TELNET_REPEAT.") \
+    X(RL_LOGIN_FAILURES, "telnet_rl_login_failures_total", "Logins refused for a wrong username or password.")
+
+#define STATS_ENUM_ENTRY(id, name, help) STAT_##id,
+typedef enum {
+    STATS_COUNTERS(STATS_ENUM_ENTRY)
+    STAT_COUNTER_COUNT
+} stat_counter_t;
+#undef STATS_ENUM_ENTRY
+
+// One slot per worker, padded so two workers never share a cache line
+typedef struct {
+    _Alignas(STATS_CACHE_LINE) volatile pid_t owner;
+    int shared;                        // Written by several threads (the overflow slot)
+    uint64_t counters[STAT_COUNTER_COUNT];
+} stats_worker_t;
+
+// Slot written by the current thread. Points at a private dummy slot until
+// stats_init() or stats_attach_worker() runs, so counting is always safe
+// and branch-free.
+extern __thread stats_worker_t *stats_self;
+
+// A slot of its own has one writer, so a plain load and store is enough
+// (relaxed atomics only keep the admin port's reads whole); the shared
+// slot needs the locked add.
+static inline void stats_add(stat_counter_t counter, uint64_t value) {
+    stats_worker_t *slot = stats_self;
+    uint64_t *field = &slot->counters[counter];
+    if (__builtin_expect(slot->shared, 0)) {
+        __atomic_fetch_add(field, value, __ATOMIC_RELAXED);
+    } else {
+        __atomic_store_n(field, __atomic_load_n(field, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+    }
+}
+
+static inline void stats_inc(stat_counter_t counter) {
+    stats_add(counter, 1);
+}
+
+// Count a received IAC command by type (escaped IAC IAC is data, not a command)
+static inline void stats_count_iac(unsigned char command) {
+    switch (command) {
+    case 253: stats_inc(STAT_IAC_DO); break;    // DO
+    case 254: stats_inc(STAT_IAC_DONT); break;  // DONT
+    case 251: stats_inc(STAT_IAC_WILL); break;  // WILL
+    case 252: stats_inc(STAT_IAC_WONT); break;  // WONT
+    case 250: stats_inc(STAT_IAC_SB); break;    // SB
+    default: stats_inc(STAT_IAC_OTHER); break;
+    }
+}
+
+// send() that accounts for bytes out and send errors
+static inline ssize_t stats_send(int fd, const void *buf, size_t len, int flags) {
+    ssize_t sent = send(fd, buf, len, flags);
+    if (sent >= 0) {
+        stats_add(STAT_BYTES_OUT, (uint64_t)sent);
+    } else {
+        stats_inc(STAT_SEND_ERRORS);
+    }
+    return sent;
+}
+
+// Gathering send of iovcnt buffers with the same accounting as stats_send()
+static inline ssize_t stats_sendv(int fd, const struct iovec *iov, int iovcnt, int flags) {
+    struct msghdr msg = {
+        .msg_iov = (struct iovec *)iov,
+        .msg_iovlen = iovcnt
+    };
+    ssize_t sent = sendmsg(fd, &msg, flags);
+    if (sent >= 0) {
+        stats_add(STAT_BYTES_OUT, (uint64_t)sent);
+    } else {
+        stats_inc(STAT_SEND_ERRORS);
+    }
+    return sent;
+}
+
+// Create the shared counter region. Call once in the listener before fork().
+// The calling process becomes the owner of the listener slot.
+int stats_init(const char *server_name);
+
+// Claim a worker slot for the calling process or thread (call in the
+// forked child or at the start of a worker thread)
+void stats_attach_worker(void);
+
+// Give the worker slot back (call before the child exits)
+void stats_detach_worker(void);
+
+// Sum all slots into totals[STAT_COUNTER_COUNT] without locking
+void stats_snapshot(uint64_t *totals);
+
+// Render a snapshot in Prometheus text exposition format.
+// Returns the number of bytes written (truncated to size - 1).
+size_t stats_render(char *buf, size_t size);
+
+// Release the slots of a worker process that died, counting its open
+// sessions, session memory and pending jobs as finished so the derived
+// gauges stay right. Call after waitpid() has reaped it.
+void stats_reap_worker(pid_t pid);
+
+// Index of the slot owned by the calling process (per-worker side tables
+// such as the latency histograms are laid out in the same order), or -1
+// when the process has no slot of its own.
+int stats_worker_index(void);
+
+// snprintf() that appends at buf + len and never overruns size.
+// Returns the new length (at most size - 1).
+size_t stats_appendf(char *buf, size_t size, size_t len, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+// Admin request handler. args points at the text after '?' in the request
+// path (empty when there is none). Returns the number of bytes written.
+typedef size_t (*stats_admin_handler_t)(const char *args, char *buf, size_t size);
+
+// Serve an additional admin path such as "/latency". Register before the
+// first request; "/metrics" (also the default) is always available.
+void stats_admin_register(const char *path, stats_admin_handler_t handler);
+
+// Metrics appended to "/metrics" after the built-in counters
+void stats_admin_register_metrics(stats_admin_handler_t handler);
+
+// Open the loopback-only admin listener. Returns the fd or -1.
+int stats_admin_listen(int port);
+
+// The admin port is served from the listener's select() loop without ever
+// blocking it. Its connections are watched by an epoll instance of their
+// own, so the only descriptor in the select() set is that one, opened at
+// startup, however many sessions the listener holds: add it with
+// stats_admin_fds() (returns the new max_fd), then let stats_admin_poll()
+// accept, read and answer whatever is ready. Call stats_admin_poll() after
+// every select(), with NULL when select() reported nothing, so slow
+// clients are answered or dropped.
+int stats_admin_fds(fd_set *readfds, int max_fd);
+void stats_admin_poll(const fd_set *readfds);
+
+// Close this process's copies of the admin connections and their epoll
+// instance (a forked child, or the listener at shutdown)
+void stats_admin_close_clients(void);
+
+#endif
@@ -0,0 +1,294 @@
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "listener.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "server_tls.h"
+#include "supervisor.h"
+
+#define TLS_CHUNK (16 * 1024)          // One full record of plaintext
+
+struct tls_server {
+    SSL_CTX *ctx;
+    int port;
+    int ktls;                      // Offload requested (the kernel may still refuse)
+};
+
+struct tls_conn {
+    SSL *ssl;
+    int fd;
+    int want_write;
+    int established;
+    int ktls_send;                 // Offload state, settled by the handshake
+    int ktls_recv;
+    int failed;                    // Fatal error: no close_notify
+};
+
+typedef struct {
+    int fd;
+    tls_server_t *server;
+} tls_listener_t;
+
+static tls_listener_t tls_listeners[LISTENER_MAX];
+static int tls_listener_count = 0;
+
+// Ciphers the kernel can take over (AES-GCM first, ChaCha20 on newer kernels)
+static const char tls_ciphersuites[] =
+    "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256";
+static const char tls_cipher_list[] = "ECDHE+AESGCM:ECDHE+CHACHA20";
+
+// Print the OpenSSL error queue after what
+static void tls_print_errors(const char *what) {
+    char ts[32];
+    char reason[256];
+    get_timestamp(ts, sizeof(ts));
+    unsigned long error = ERR_get_error();
+    ERR_error_string_n(error, reason, sizeof(reason));
+    fprintf(stderr, "%s[ERROR] %s: %s\n", ts, what, error != 0 ? reason : "unknown error");
+    ERR_clear_error();
+}
+
+tls_server_t *tls_server_init(int port, int default_tls_port) {
+    const char *cert = config_get_str("TLS_CERT", port, NULL);
+    int tls_port = (int)config_get_long("TLS_PORT", port, default_tls_port);
+    if (cert == NULL || tls_port == 0) {
+        return NULL;
+    }
+    const char *key = config_get_str("TLS_KEY", port, cert);
+    const char *max_version = config_get_str("TLS_MAX_VERSION", port, "1.3");
+
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (ctx == NULL) {
+        tls_print_errors("TLS context");
+        return NULL;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_max_proto_version(ctx, strcmp(max_version, "1.2") == 0 ? TLS1_2_VERSION : TLS1_3_VERSION);
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1) {
+        tls_print_errors(cert);
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    SSL_CTX_set_ciphersuites(ctx, tls_ciphersuites);
+    SSL_CTX_set_cipher_list(ctx, tls_cipher_list);
+
+    // Writes may stop at a record boundary and resume from a queue that
+    // has moved; idle sessions give their record buffers back
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                          SSL_MODE_RELEASE_BUFFERS);
+    SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF | SSL_OP_NO_RENEGOTIATION);
+    int ktls = config_get_long("TLS_KTLS", port, 1) != 0;
+    if (ktls) {
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    }
+
+    // Stateless tickets only: no per-process session cache to miss after
+    // a reconnect lands on another worker
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    if (config_get_long("TLS_TICKETS", port, 1) != 0) {
+        SSL_CTX_set_num_tickets(ctx, 1);
+    } else {
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+        SSL_CTX_set_num_tickets(ctx, 0);
+    }
+
+    tls_server_t *server = malloc(sizeof(tls_server_t));
+    if (server == NULL) {
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    server->ctx = ctx;
+    server->port = tls_port;
+    server->ktls = ktls;
+
+    // OpenSSL writes with write(), which raises SIGPIPE on a reset connection
+    signal(SIGPIPE, SIG_IGN);
+    return server;
+}
+
+int tls_server_port(const tls_server_t *server) {
+    return server->port;
+}
+
+int tls_server_ktls(const tls_server_t *server) {
+    return server->ktls;
+}
+
+void tls_listener_add(int listen_fd, tls_server_t *server) {
+    if (tls_listener_count < LISTENER_MAX) {
+        tls_listeners[tls_listener_count].fd = listen_fd;
+        tls_listeners[tls_listener_count].server = server;
+        tls_listener_count++;
+    }
+}
+
+tls_server_t *tls_listener(int listen_fd) {
+    for (int i = 0; i < tls_listener_count; i++) {
+        if (tls_listeners[i].fd == listen_fd) {
+            return tls_listeners[i].server;
+        }
+    }
+    return NULL;
+}
+
+tls_conn_t *tls_conn_new(tls_server_t *server, int fd) {
+    tls_conn_t *conn = calloc(1, sizeof(tls_conn_t));
+    if (conn == NULL) {
+        return NULL;
+    }
+    conn->ssl = SSL_new(server->ctx);
+    if (conn->ssl == NULL || SSL_set_fd(conn->ssl, fd) != 1) {
+        ERR_clear_error();
+        SSL_free(conn->ssl);
+        free(conn);
+        return NULL;
+    }
+    conn->fd = fd;
+
+    // Handshake flights and records go out whole already; Nagle would only
+    // hold the last segment of each back for the peer's delayed ACK
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return conn;
+}
+
+int tls_conn_handshake(tls_conn_t *conn) {
+    int result = SSL_accept(conn->ssl);
+    if (result == 1) {
+        conn->established = 1;
+        conn->ktls_send = BIO_get_ktls_send(SSL_get_wbio(conn->ssl));
+        conn->ktls_recv = BIO_get_ktls_recv(SSL_get_rbio(conn->ssl));
+        stats_inc(STAT_TLS_HANDSHAKES);
+        if (SSL_session_reused(conn->ssl)) {
+            stats_inc(STAT_TLS_RESUMED);
+        }
+        if (conn->ktls_send) {
+            stats_inc(STAT_TLS_KTLS_SEND);
+        }
+        if (conn->ktls_recv) {
+            stats_inc(STAT_TLS_KTLS_RECV);
+        }
+        return 1;
+    }
+
+    int error = SSL_get_error(conn->ssl, result);
+    if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+        conn->want_write = error == SSL_ERROR_WANT_WRITE;
+        return 0;
+    }
+    conn->failed = 1;
+    stats_inc(STAT_TLS_HANDSHAKE_FAILURES);
+    ERR_clear_error();
+    return -1;
+}
+
+int tls_conn_wants_write(const tls_conn_t *conn) {
+    return conn->want_write;
+}
+
+int tls_conn_ktls_send(const tls_conn_t *conn) {
+    return conn->ktls_send;
+}
+
+int tls_conn_ktls_recv(const tls_conn_t *conn) {
+    return conn->ktls_recv;
+}
+
+// Map a failed SSL_read()/SSL_write() to the recv()/send() contract
+static ssize_t tls_conn_error(tls_conn_t *conn, int result) {
+    int saved = errno;
+    int error = SSL_get_error(conn->ssl, result);
+    ERR_clear_error();
+    switch (error) {
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        conn->want_write = error == SSL_ERROR_WANT_WRITE;
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_SYSCALL:
+        conn->failed = 1;
+        errno = saved != 0 ? saved : ECONNRESET;
+        return -1;
+    default:
+        conn->failed = 1;
+        errno = EPROTO;
+        return -1;
+    }
+}
+
+ssize_t tls_conn_recv(tls_conn_t *conn, void *buf, size_t len) {
+    int result = SSL_read(conn->ssl, buf, len > INT_MAX ? INT_MAX : (int)len);
+    return result > 0 ? result : tls_conn_error(conn, result);
+}
+
+ssize_t tls_conn_send(tls_conn_t *conn, const void *buf, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    int result = SSL_write(conn->ssl, buf, len > INT_MAX ? INT_MAX : (int)len);
+    return result > 0 ? result : tls_conn_error(conn, result);
+}
+
+void tls_conn_free(tls_conn_t *conn) {
+    if (conn->established && !conn->failed) {
+        SSL_shutdown(conn->ssl);
+    }
+    ERR_clear_error();
+    SSL_free(conn->ssl);
+    free(conn);
+}
+
+int tls_raw_echo(tls_conn_t *conn, const raw_echo_config_t *config, transcript_session_t *transcript) {
+    if (tls_conn_handshake(conn) != 1) {
+        return -1;
+    }
+    if (conn->ktls_send && conn->ktls_recv) {
+        return raw_echo_session(conn->fd, config, transcript);
+    }
+
+    // No kernel offload: decrypt, copy and encrypt in user space (the IAC
+    // IP escape is only looked for by raw_echo_session())
+    unsigned char buffer[TLS_CHUNK];
+    while (1) {
+        ssize_t in = tls_conn_recv(conn, buffer, sizeof(buffer));
+        if (in == -1 && errno == EINTR) {
+            continue;
+        }
+        if (in <= 0) {
+            return in == 0 ? 0 : -1;
+        }
+        transcript_record(transcript, TRANSCRIPT_IN, buffer, (size_t)in);
+        transcript_record(transcript, TRANSCRIPT_OUT, buffer, (size_t)in);
+        size_t sent = 0;
+        while (sent < (size_t)in) {
+            ssize_t out = tls_conn_send(conn, buffer + sent, (size_t)in - sent);
+            if (out == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                stats_inc(STAT_SEND_ERRORS);
+                return -1;
+            }
+            sent += (size_t)out;
+        }
+        stats_add(STAT_BYTES_IN, (uint64_t)in);
+        stats_add(STAT_BYTES_OUT, (uint64_t)in);
+        stats_add(STAT_RAW_BYTES, (uint64_t)in);
+        supervisor_note_in((size_t)in);
+        supervisor_note_out((size_t)in);
+    }
+}
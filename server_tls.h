@@ -0,0 +1,78 @@
+#ifndef SERVER_TLS_H
+#define SERVER_TLS_H
+
+#include <sys/types.h>
+
+#include "raw_echo.h"
+
+// TLS listeners ("telnets") next to the plain ports, terminated with OpenSSL.
+//
+// TLS is on when a certificate is configured. After the handshake the
+// session's keys are handed to the kernel (kTLS) where the kernel and
+// OpenSSL support it: with kTLS for sending the reactor keeps writing
+// plaintext to the socket with its gathering sendmsg() and shared output,
+// and with kTLS in both directions the raw echo port keeps splicing. A
+// connection without kTLS is encrypted in user space by OpenSSL instead.
+//
+// Resumption uses stateless session tickets. Ticket keys belong to the
+// context, which is created before any fork(), so a ticket issued by one
+// worker process or forked child resumes on every other.
+//
+// Settings (TELNET_<NAME>[_<server port>]):
+//   TLS_CERT         PEM certificate chain; unset disables TLS
+//   TLS_KEY          PEM private key (default: the TLS_CERT file)
+//   TLS_PORT         TLS listener port, 0 disables
+//   TLS_KTLS         1 = kernel TLS offload when available (default), 0 = off
+//   TLS_TICKETS      1 = session tickets (default), 0 = full handshakes only
+//   TLS_MAX_VERSION  "1.3" (default) or "1.2"
+
+typedef struct tls_server tls_server_t;
+typedef struct tls_conn tls_conn_t;
+
+// Create the server context from the settings of the server on port
+// (before any fork()). Returns NULL when TLS is off or the setup failed
+// (after printing why).
+tls_server_t *tls_server_init(int port, int default_tls_port);
+
+// TLS port of a context from tls_server_init(), and whether kTLS is
+// requested for its connections
+int tls_server_port(const tls_server_t *server);
+int tls_server_ktls(const tls_server_t *server);
+
+// Mark listen_fd as accepting TLS connections for server
+void tls_listener_add(int listen_fd, tls_server_t *server);
+
+// Context of a listener marked with tls_listener_add(), NULL for plain ones
+tls_server_t *tls_listener(int listen_fd);
+
+// Start the server side of a connection on fd (the fd stays the caller's).
+// Returns NULL when out of memory.
+tls_conn_t *tls_conn_new(tls_server_t *server, int fd);
+
+// Continue the handshake. Returns 1 once it is complete (kTLS is enabled
+// at that point), 0 to call again when the socket is ready in the
+// direction tls_conn_wants_write() names, -1 when it failed.
+int tls_conn_handshake(tls_conn_t *conn);
+int tls_conn_wants_write(const tls_conn_t *conn);
+
+// Whether the kernel encrypts what is written to / decrypts what is read
+// from the socket (known once the handshake is complete)
+int tls_conn_ktls_send(const tls_conn_t *conn);
+int tls_conn_ktls_recv(const tls_conn_t *conn);
+
+// recv()/send() of plaintext: a byte count, 0 when the peer closed (recv),
+// or -1 with errno set (EAGAIN when the socket is not ready)
+ssize_t tls_conn_recv(tls_conn_t *conn, void *buf, size_t len);
+ssize_t tls_conn_send(tls_conn_t *conn, const void *buf, size_t len);
+
+// Send close_notify (without waiting for the peer's) and free the
+// connection; the fd is not closed
+void tls_conn_free(tls_conn_t *conn);
+
+// Raw echo over a blocking TLS connection: handshake, then echo until the
+// client closes. With kTLS in both directions the echo is spliced by
+// raw_echo_session(); otherwise it is copied through OpenSSL. Returns as
+// raw_echo_session() does.
+int tls_raw_echo(tls_conn_t *conn, const raw_echo_config_t *config, transcript_session_t *transcript);
+
+#endif
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "server_config.h"
+#include "session_capture.h"
+
+#define CAPTURE_BUFFER_SIZE (64 * 1024)
+
+struct session_capture {
+    FILE *fp;
+    uint64_t last_usec;
+    char buffer[CAPTURE_BUFFER_SIZE];
+};
+
+static const char *capture_dir = NULL;
+
+static uint64_t monotonic_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void put_le(unsigned char *p, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        p[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static int put_varint(unsigned char *p, uint64_t value) {
+    int n = 0;
+    while (value >= 0x80) {
+        p[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    p[n++] = (unsigned char)value;
+    return n;
+}
+
+const char *capture_init(int port) {
+    capture_dir = config_get_str("CAPTURE_DIR", port, NULL);
+    if (capture_dir != NULL && mkdir(capture_dir, 0755) == -1 && errno != EEXIST) {
+        perror("capture directory");
+        capture_dir = NULL;
+    }
+    return capture_dir;
+}
+
+session_capture_t *capture_open(int port) {
+    if (capture_dir == NULL) {
+        return NULL;
+    }
+
+    // Sessions after the first in a process (threaded workers) get a
+    // sequence number so their files do not collide
+    static unsigned int sequence = 0;
+    unsigned int seq = __atomic_fetch_add(&sequence, 1, __ATOMIC_RELAXED);
+
+    char suffix[16] = "";
+    if (seq > 0) {
+        snprintf(suffix, sizeof(suffix), "-%u", seq);
+    }
+
+    time_t now = time(NULL);
+    struct tm tm_info;
+    localtime_r(&now, &tm_info);
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%d-%04d%02d%02d-%02d%02d%02d-%d%s.tcap",
+             capture_dir, port,
+             tm_info.tm_year + 1900, tm_info.tm_mon + 1, tm_info.tm_mday,
+             tm_info.tm_hour, tm_info.tm_min, tm_info.tm_sec, (int)getpid(), suffix);
+
+    session_capture_t *capture = malloc(sizeof(*capture));
+    if (capture == NULL) {
+        return NULL;
+    }
+    capture->fp = fopen(path, "wb");
+    if (capture->fp == NULL) {
+        perror("capture file");
+        free(capture);
+        return NULL;
+    }
+    setvbuf(capture->fp, capture->buffer, _IOFBF, sizeof(capture->buffer));
+
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    unsigned char header[CAPTURE_HEADER_SIZE];
+    memcpy(header, CAPTURE_MAGIC, 4);
+    header[4] = CAPTURE_VERSION;
+    header[5] = 0;
+    put_le(header + 6, (uint64_t)port, 2);
+    put_le(header + 8, (uint64_t)wall.tv_sec * 1000000ull + (uint64_t)wall.tv_nsec / 1000, 8);
+    fwrite(header, 1, sizeof(header), capture->fp);
+
+    capture->last_usec = monotonic_usec();
+    return capture;
+}
+
+void capture_record(session_capture_t *capture, const void *data, size_t len) {
+    if (capture == NULL) {
+        return;
+    }
+    uint64_t now = monotonic_usec();
+    unsigned char prefix[20];
+    int n = put_varint(prefix, now - capture->last_usec);
+    n += put_varint(prefix + n, len);
+    capture->last_usec = now;
+
+    fwrite(prefix, 1, n, capture->fp);
+    fwrite(data, 1, len, capture->fp);
+}
+
+void capture_close(session_capture_t *capture) {
+    if (capture == NULL) {
+        return;
+    }
+    fclose(capture->fp);
+    free(capture);
+}
@@ -0,0 +1,40 @@
+#ifndef SESSION_CAPTURE_H
+#define SESSION_CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Session capture: records the raw inbound byte stream of each client
+// session, with relative timing, for later replay by telnet_replay.
+//
+// Enabled by setting TELNET_CAPTURE_DIR (or TELNET_CAPTURE_DIR_<port>).
+// Each session writes <dir>/<port>-<YYYYmmdd-HHMMSS>-<pid>.tcap.
+//
+// File format (all integers little endian):
+//   header   "TCAP" | u8 version (1) | u8 flags (0) | u16 server port |
+//            u64 session start, microseconds since the epoch
+//   record   varint microseconds since the previous record |
+//            varint byte count | bytes exactly as returned by recv()
+// The file simply ends after the last record.
+
+#define CAPTURE_MAGIC "TCAP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 16
+
+typedef struct session_capture session_capture_t;
+
+// Read the capture configuration (call once in the listener).
+// Returns the capture directory, or NULL when capture is disabled.
+const char *capture_init(int port);
+
+// Start capturing a session. Returns NULL when capture is disabled or the
+// file cannot be created; all other calls accept NULL.
+session_capture_t *capture_open(int port);
+
+// Append one received segment
+void capture_record(session_capture_t *capture, const void *data, size_t len);
+
+// Flush and close the capture file
+void capture_close(session_capture_t *capture);
+
+#endif
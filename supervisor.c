@@ -0,0 +1,260 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "server_config.h"
+#include "supervisor.h"
+
+supervisor_entry_t *supervisor_self = NULL;
+
+static supervisor_entry_t *registry = NULL;
+static int registry_size = 0;
+static int registry_high = 0;      // One past the highest entry in use
+static int next_free = 0;          // Where the search for a free entry starts
+static int children = 0;
+static int signal_fd = -1;
+static int stopping = 0;           // Set once supervisor_shutdown() started killing
+static sigset_t chld_mask;
+static void (*reap_hook)(pid_t pid) = NULL;
+
+static const char busy_message[] = "Server busy: too many connections, please try again later.\r\n";
+static const char *state_names[] = { "free", "starting", "active", "closing" };
+
+static int supervisor_find(pid_t pid) {
+    for (int i = 0; i < registry_high; i++) {
+        if (registry[i].pid == pid) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// "/children": one line per running child
+static size_t supervisor_admin_handler(const char *args, char *buf, size_t size) {
+    time_t now = time(NULL);
+    size_t len = 0;
+    (void)args;
+
+    len = stats_appendf(buf, size, len, "children: %d of %d\n", children, registry_size);
+    len = stats_appendf(buf, size, len, "%-8s %-8s %-21s %12s %12s %8s %8s\n",
+                        "pid", "state", "peer", "bytes_in", "bytes_out", "age_s", "idle_s");
+    for (int i = 0; i < registry_high; i++) {
+        supervisor_entry_t *entry = &registry[i];
+        pid_t pid = entry->pid;
+        if (pid <= 0) {
+            continue;
+        }
+        int state = __atomic_load_n(&entry->state, __ATOMIC_RELAXED);
+        char peer[INET_ADDRSTRLEN + 8];
+        snprintf(peer, sizeof(peer), "%s:%d", entry->peer_ip, entry->peer_port);
+        len = stats_appendf(buf, size, len, "%-8d %-8s %-21s %12llu %12llu %8lld %8lld\n",
+                            (int)pid, state_names[state], peer,
+                            (unsigned long long)__atomic_load_n(&entry->bytes_in, __ATOMIC_RELAXED),
+                            (unsigned long long)__atomic_load_n(&entry->bytes_out, __ATOMIC_RELAXED),
+                            (long long)(now - entry->started),
+                            (long long)(now - __atomic_load_n(&entry->last_activity, __ATOMIC_RELAXED)));
+    }
+    return len;
+}
+
+static size_t supervisor_metrics_handler(const char *args, char *buf, size_t size) {
+    (void)args;
+    return stats_appendf(buf, size, 0,
+                         "# HELP telnet_children_active Forked session processes running.\n"
+                         "# TYPE telnet_children_active gauge\n"
+                         "telnet_children_active %d\n"
+                         "# HELP telnet_children_limit Forked session processes allowed at once.\n"
+                         "# TYPE telnet_children_limit gauge\n"
+                         "telnet_children_limit %d\n",
+                         children, registry_size);
+}
+
+int supervisor_init(int port, void (*reap)(pid_t pid)) {
+    reap_hook = reap;
+    long max_children = config_get_long("MAX_CHILDREN", port, SUPERVISOR_DEFAULT_MAX_CHILDREN);
+    if (max_children < 1) {
+        max_children = SUPERVISOR_DEFAULT_MAX_CHILDREN;
+    }
+
+    size_t size = sizeof(supervisor_entry_t) * (size_t)max_children;
+    void *region = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        perror("supervisor mmap failed");
+        return -1;
+    }
+
+    // SIGCHLD only arrives through the signalfd
+    sigemptyset(&chld_mask);
+    sigaddset(&chld_mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld_mask, NULL);
+    signal_fd = signalfd(-1, &chld_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1) {
+        perror("signalfd failed");
+        sigprocmask(SIG_UNBLOCK, &chld_mask, NULL);
+        munmap(region, size);
+        return -1;
+    }
+
+    registry = region;
+    registry_size = (int)max_children;
+    stats_admin_register("/children", supervisor_admin_handler);
+    stats_admin_register_metrics(supervisor_metrics_handler);
+    return signal_fd;
+}
+
+pid_t supervisor_fork(int client_fd, const struct sockaddr_in *peer) {
+    if (children >= registry_size) {
+        ssize_t ignored = send(client_fd, busy_message, sizeof(busy_message) - 1,
+                               MSG_NOSIGNAL | MSG_DONTWAIT);
+        (void)ignored;
+        stats_inc(STAT_CHILD_LIMIT_REJECTS);
+        stats_inc(STAT_REJECTS);
+        return -1;
+    }
+
+    int slot = next_free;
+    while (registry[slot].state != SUPERVISOR_FREE) {
+        slot = (slot + 1) % registry_size;
+    }
+    supervisor_entry_t *entry = &registry[slot];
+    entry->state = SUPERVISOR_STARTING;
+    inet_ntop(AF_INET, &peer->sin_addr, entry->peer_ip, sizeof(entry->peer_ip));
+    entry->peer_port = ntohs(peer->sin_port);
+    entry->bytes_in = 0;
+    entry->bytes_out = 0;
+    entry->started = time(NULL);
+    entry->last_activity = entry->started;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        supervisor_self = entry;
+        close(signal_fd);
+        signal_fd = -1;
+        sigprocmask(SIG_UNBLOCK, &chld_mask, NULL);
+        return 0;
+    }
+    if (pid == -1) {
+        perror("fork failed");
+        entry->state = SUPERVISOR_FREE;
+        stats_inc(STAT_REJECTS);
+        return -1;
+    }
+
+    entry->pid = pid;
+    children++;
+    next_free = (slot + 1) % registry_size;
+    if (slot >= registry_high) {
+        registry_high = slot + 1;
+    }
+    return pid;
+}
+
+static void supervisor_release(int slot, int status) {
+    supervisor_entry_t *entry = &registry[slot];
+    if (WIFSIGNALED(status) && !stopping && WTERMSIG(status) != SIGTERM && WTERMSIG(status) != SIGINT) {
+        char ts[32];
+        get_timestamp(ts, sizeof(ts));
+        printf("%s[ERROR] Client process %d (%s:%d) killed by signal %d.\n",
+               ts, (int)entry->pid, entry->peer_ip, entry->peer_port, WTERMSIG(status));
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        // Did not get to close its session and give its stats slot back
+        stats_reap_worker(entry->pid);
+        if (reap_hook != NULL) {
+            reap_hook(entry->pid);
+        }
+    }
+    stats_inc(STAT_CHILDREN_REAPED);
+
+    entry->pid = 0;
+    entry->state = SUPERVISOR_FREE;
+    children--;
+    while (registry_high > 0 && registry[registry_high - 1].state == SUPERVISOR_FREE) {
+        registry_high--;
+    }
+}
+
+// Try every registered child: the slow path for when another part of the
+// listener (the pre-forked workers) has an exited child of its own queued
+static void supervisor_reap_scan(void) {
+    for (int i = 0; i < registry_high; i++) {
+        int status;
+        pid_t pid = registry[i].pid;
+        if (pid > 0 && waitpid(pid, &status, WNOHANG) == pid) {
+            supervisor_release(i, status);
+        }
+    }
+}
+
+void supervisor_reap(void) {
+    struct signalfd_siginfo info;
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+    }
+
+    // Signals coalesce: look at every child that can be waited for
+    while (children > 0) {
+        siginfo_t exited;
+        exited.si_pid = 0;
+        if (waitid(P_ALL, 0, &exited, WEXITED | WNOHANG | WNOWAIT) == -1 || exited.si_pid == 0) {
+            break;
+        }
+        int slot = supervisor_find(exited.si_pid);
+        if (slot == -1) {
+            supervisor_reap_scan();
+            break;
+        }
+        int status;
+        waitpid(exited.si_pid, &status, 0);
+        supervisor_release(slot, status);
+    }
+}
+
+int supervisor_children(void) {
+    return children;
+}
+
+int supervisor_limit(void) {
+    return registry_size;
+}
+
+void supervisor_shutdown(void) {
+    if (registry == NULL || children == 0) {
+        return;
+    }
+    char ts[32];
+    get_timestamp(ts, sizeof(ts));
+    printf("%s[INFO] Stopping %d client process(es).\n", ts, children);
+
+    for (int i = 0; i < registry_high; i++) {
+        if (registry[i].pid > 0) {
+            kill(registry[i].pid, SIGTERM);
+        }
+    }
+    stopping = 1;
+    time_t deadline = time(NULL) + SUPERVISOR_SHUTDOWN_GRACE;
+    while (children > 0 && time(NULL) < deadline) {
+        supervisor_reap_scan();
+        usleep(50000);
+    }
+
+    for (int i = 0; i < registry_high; i++) {
+        pid_t pid = registry[i].pid;
+        if (pid > 0) {
+            int status;
+            kill(pid, SIGKILL);
+            while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+            }
+            supervisor_release(i, status);
+        }
+    }
+}
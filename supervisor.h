@@ -0,0 +1,96 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "server_stats.h"
+
+// Supervision of the forked session processes (fork model, raw port).
+//
+// SIGCHLD is blocked in the listener and delivered through a signalfd
+// that the listener's select loop watches, so exited children are reaped
+// as soon as they exit instead of piling up as zombies. At most
+// TELNET_MAX_CHILDREN[_<port>] children run at once; a connection beyond
+// that gets a short "busy" line and is closed.
+//
+// Every child owns one entry of a MAP_SHARED registry, created before the
+// first fork(). The child is the only writer of its entry (peer, state,
+// byte counts, last activity); the listener reads the entries without
+// locking to serve "/children" on the admin port and to stop every child
+// at shutdown.
+
+#define SUPERVISOR_DEFAULT_MAX_CHILDREN 1024
+#define SUPERVISOR_SHUTDOWN_GRACE 3    // Seconds before remaining children get SIGKILL
+
+typedef enum {
+    SUPERVISOR_FREE,
+    SUPERVISOR_STARTING,           // Forked, session not set up yet
+    SUPERVISOR_ACTIVE,
+    SUPERVISOR_CLOSING
+} supervisor_state_t;
+
+// One registry entry, padded so two children never share a cache line
+typedef struct {
+    _Alignas(STATS_CACHE_LINE) volatile pid_t pid;
+    volatile int state;
+    char peer_ip[INET_ADDRSTRLEN];
+    int peer_port;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    time_t started;
+    time_t last_activity;
+} supervisor_entry_t;
+
+// Entry of the calling child, NULL in the listener and in threaded workers
+extern supervisor_entry_t *supervisor_self;
+
+static inline void supervisor_set_state(supervisor_state_t state) {
+    if (supervisor_self != NULL) {
+        __atomic_store_n(&supervisor_self->state, state, __ATOMIC_RELAXED);
+    }
+}
+
+static inline void supervisor_note_in(size_t bytes) {
+    if (supervisor_self != NULL) {
+        __atomic_store_n(&supervisor_self->bytes_in, supervisor_self->bytes_in + bytes, __ATOMIC_RELAXED);
+        __atomic_store_n(&supervisor_self->last_activity, time(NULL), __ATOMIC_RELAXED);
+    }
+}
+
+static inline void supervisor_note_out(size_t bytes) {
+    if (supervisor_self != NULL) {
+        __atomic_store_n(&supervisor_self->bytes_out, supervisor_self->bytes_out + bytes, __ATOMIC_RELAXED);
+    }
+}
+
+// Create the registry, block SIGCHLD and open the signalfd. Call in the
+// listener after stats_init() and before the first fork(). Returns the
+// signalfd to watch, or -1 after printing the error. reap (may be NULL) is
+// called with the pid of each child that did not exit cleanly.
+int supervisor_init(int port, void (*reap)(pid_t pid));
+
+// Fork a child for the connection on client_fd. Returns 0 in the child
+// (which then owns its registry entry), the child's pid in the listener,
+// or -1 when the limit is reached (the client has been told) or fork()
+// failed; the connection is counted as rejected and the caller closes it.
+pid_t supervisor_fork(int client_fd, const struct sockaddr_in *peer);
+
+// Reap the children that exited (call when the signalfd is readable)
+void supervisor_reap(void);
+
+// Children currently running
+int supervisor_children(void);
+
+// Children allowed at once (TELNET_MAX_CHILDREN)
+int supervisor_limit(void);
+
+// Send SIGTERM to every child, wait up to SUPERVISOR_SHUTDOWN_GRACE seconds
+// for them and kill the rest
+void supervisor_shutdown(void);
+
+#endif
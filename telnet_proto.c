@@ -0,0 +1,188 @@
+#include <string.h>
+
+#include "telnet_proto.h"
+#include "server_stats.h"
+
+int utf8_sequence_length(unsigned char lead_byte) {
+    if (lead_byte < 0x80) return 1;        // 0xxxxxxx: ASCII (1 byte)
+    if ((lead_byte & 0xE0) == 0xC0) return 2; // 110xxxxx: 2-byte sequence
+    if ((lead_byte & 0xF0) == 0xE0) return 3; // 1110xxxx: 3-byte sequence (Korean, etc.)
+    if ((lead_byte & 0xF8) == 0xF0) return 4; // 11110xxx: 4-byte sequence
+    return 0; // Invalid lead byte
+}
+
+int check_incomplete_utf8(const unsigned char *buf, int len) {
+    if (len == 0) return 0;
+
+    // Check last 1-3 bytes for incomplete sequences
+    for (int i = 1; i <= 4 && i <= len; i++) {
+        int pos = len - i;
+        unsigned char byte = buf[pos];
+
+        // Check if this is a UTF-8 lead byte
+        int expected_len = utf8_sequence_length(byte);
+        if (expected_len > 0) {
+            // Found a lead byte, check if sequence is complete
+            int actual_len = len - pos;
+            if (actual_len < expected_len) {
+                // Incomplete sequence
+                return actual_len;
+            } else {
+                // Complete sequence
+                return 0;
+            }
+        }
+
+        // Continue if it's a continuation byte (10xxxxxx)
+        if ((byte & 0xC0) != 0x80) {
+            // Not a continuation byte and not a valid lead byte
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+int find_line_ending(const unsigned char *buf, int len) {
+    for (int i = 0; i < len; i++) {
+        if (buf[i] == '\r') {
+            // Check for CRLF or CR NUL
+            if (i + 1 < len) {
+                if (buf[i + 1] == '\n' || buf[i + 1] == '\0') {
+                    return i + 2; // Position after CRLF or CR NUL
+                }
+            }
+            // CR alone at end of buffer, wait for next recv
+            if (i + 1 == len) {
+                return -1;
+            }
+            // CR followed by something else, treat as line ending
+            return i + 1;
+        } else if (buf[i] == '\n') {
+            // LF alone
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+int telnet_escape_iov(const unsigned char *data, size_t len, struct iovec *iov, int max_iov,
+                      size_t *consumed) {
+    size_t start = 0;    // Start of the next segment
+    size_t search = 0;   // Where to look for the next IAC
+    int count = 0;
+    while (start < len && count < max_iov) {
+        const unsigned char *iac = memchr(data + search, IAC, len - search);
+        size_t end = iac != NULL ? (size_t)(iac - data) + 1 : len;
+        iov[count].iov_base = (void *)(data + start);
+        iov[count].iov_len = end - start;
+        count++;
+        if (iac == NULL) {
+            start = len;
+        } else if (count == max_iov) {
+            // Out of iovecs before this IAC's second copy: leave the IAC
+            // for the next call, which escapes it from scratch
+            start = end - 1;
+            if (--iov[count - 1].iov_len == 0) {
+                count--;
+            }
+        } else {
+            start = end - 1;
+            search = end;
+        }
+    }
+    *consumed = start;
+    return count;
+}
+
+int telnet_option_frame(unsigned char *buf, unsigned char command, unsigned char option) {
+    buf[0] = IAC;
+    buf[1] = command;
+    buf[2] = option;
+    return 3;
+}
+
+int telnet_subneg_frame(unsigned char *buf, unsigned char option,
+                        const unsigned char *data, int len) {
+    buf[0] = IAC;
+    buf[1] = SB;
+    buf[2] = option;
+    memcpy(buf + 3, data, len);
+    buf[len + 3] = IAC;
+    buf[len + 4] = SE;
+    return len + 5;
+}
+
+int telnet_extract_data(const unsigned char *in, int len, unsigned char *out,
+                        telnet_option_handler_t handler,
+                        telnet_subneg_handler_t subneg_handler, void *ctx, int *consumed) {
+    int out_len = 0;
+    int i = 0;
+
+    while (i < len) {
+        if (in[i] == IAC) {
+            if (i + 1 < len) {
+                unsigned char cmd = in[i + 1];
+
+                // Handle IAC IAC (escaped 255) - restore to single 0xFF
+                if (cmd == IAC) {
+                    out[out_len++] = IAC;
+                    i += 2;
+                    continue;
+                }
+
+                // Handle DO/DONT/WILL/WONT options
+                if (cmd == DO || cmd == DONT || cmd == WILL || cmd == WONT) {
+                    if (i + 2 < len) {
+                        // Counted once complete: a sequence split across
+                        // segments is parsed again with the next one
+                        stats_count_iac(cmd);
+                        handler(ctx, cmd, in[i + 2]);
+                        i += 3; // Skip IAC, command, option
+                        continue;
+                    } else {
+                        // Incomplete sequence, wait for the rest
+                        break;
+                    }
+                }
+
+                // Handle Subnegotiation Begin (IAC SB ... IAC SE)
+                if (cmd == SB) {
+                    // Find the end of subnegotiation (IAC SE)
+                    int j = i + 2;
+                    while (j < len - 1) {
+                        if (in[j] == IAC && in[j + 1] == SE) {
+                            stats_count_iac(cmd);
+                            if (subneg_handler != NULL && j > i + 2) {
+                                subneg_handler(ctx, in + i + 2, j - (i + 2));
+                            }
+                            i = j + 2;
+                            break;
+                        }
+                        j++;
+                    }
+                    if (j >= len - 1) {
+                        // Incomplete subnegotiation, wait for the rest
+                        break;
+                    }
+                    continue;
+                }
+
+                // Skip other IAC commands
+                stats_count_iac(cmd);
+                i += 2;
+            } else {
+                // IAC at end of buffer
+                break;
+            }
+        } else {
+            // Regular data byte
+            out[out_len++] = in[i++];
+        }
+    }
+
+    if (consumed != NULL) {
+        *consumed = i;
+    }
+    return out_len;
+}
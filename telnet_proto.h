@@ -0,0 +1,86 @@
+#ifndef TELNET_PROTO_H
+#define TELNET_PROTO_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+// Telnet protocol and UTF-8 helpers shared by the servers and bench_proto
+
+// Telnet protocol codes
+#define IAC  255  // Interpret As Command
+#define DONT 254
+#define DO   253
+#define WONT 252
+#define WILL 251
+#define SB   250  // Subnegotiation Begin
+#define IP   244  // Interrupt Process
+#define SE   240  // Subnegotiation End
+
+// Telnet options
+#define BINARY 0
+#define ECHO 1
+#define SUPPRESS_GO_AHEAD 3
+#define TTYPE 24
+#define NAWS 31
+#define LINEMODE 34
+#define CHARSET 42
+
+// TTYPE subnegotiation commands (RFC 1091)
+#define TTYPE_IS 0
+#define TTYPE_SEND 1
+
+// CHARSET subnegotiation commands (RFC 2066)
+#define CHARSET_REQUEST 1
+#define CHARSET_ACCEPTED 2
+#define CHARSET_REJECTED 3
+
+// Called for every complete DO/DONT/WILL/WONT sequence found in the stream
+typedef void (*telnet_option_handler_t)(void *ctx, unsigned char command, unsigned char option);
+
+// Called for every complete subnegotiation with the bytes between IAC SB
+// and IAC SE (option byte first, IAC IAC inside the payload not unescaped)
+typedef void (*telnet_subneg_handler_t)(void *ctx, const unsigned char *data, int len);
+
+// UTF-8 helper functions
+// Returns the expected length of a UTF-8 sequence based on the lead byte
+// Returns 0 if the byte is not a valid UTF-8 lead byte
+int utf8_sequence_length(unsigned char lead_byte);
+
+// Check if the buffer ends with an incomplete UTF-8 sequence
+// Returns the number of bytes at the end that form an incomplete sequence
+int check_incomplete_utf8(const unsigned char *buf, int len);
+
+// Find line ending in buffer, returns position after the line ending
+// Supports CRLF, CR NUL, LF, and CR alone
+// Returns -1 if no line ending found
+int find_line_ending(const unsigned char *buf, int len);
+
+// Write the 3-byte option command IAC <command> <option> into buf
+// Returns the number of bytes written
+int telnet_option_frame(unsigned char *buf, unsigned char command, unsigned char option);
+
+// Write IAC SB <option> <data> IAC SE into buf (len + 5 bytes)
+// Returns the number of bytes written
+int telnet_subneg_frame(unsigned char *buf, unsigned char option,
+                        const unsigned char *data, int len);
+
+// Describe data for output as iovecs pointing into data itself, with every
+// 0xFF sent twice (IAC IAC) by letting the segment after an IAC start on
+// that same byte. Data without 0xFF becomes a single iovec. Fills at most
+// max_iov entries and stores the number of data bytes covered in *consumed
+// (less than len when max_iov ran out). Returns the number of iovecs.
+int telnet_escape_iov(const unsigned char *data, size_t len, struct iovec *iov, int max_iov,
+                      size_t *consumed);
+
+// Extract data bytes from a received telnet protocol stream.
+// IAC IAC is restored to a single 0xFF, option commands are passed to
+// handler, subnegotiations to subneg_handler (may be NULL) and other
+// commands are dropped. An incomplete command at the end of the input ends
+// extraction; *consumed (when not NULL) tells where, so the caller can keep
+// the partial command and retry once more bytes arrive. out must hold at
+// least len bytes. Returns the number of data bytes.
+int telnet_extract_data(const unsigned char *in, int len, unsigned char *out,
+                        telnet_option_handler_t handler,
+                        telnet_subneg_handler_t subneg_handler, void *ctx, int *consumed);
+
+#endif
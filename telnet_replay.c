@@ -0,0 +1,393 @@
+// Replays session captures (.tcap, see session_capture.h) against a server
+//
+// Every connection replays one capture file (files are assigned round
+// robin) with the recorded inter-segment gaps divided by the speed factor.
+// Latency is measured from sending a segment that contains a line ending
+// to the first byte received back on that connection.
+//
+// Usage: telnet_replay [-h host] [-p port] [-s speed] [-c conns] [-n iterations] file...
+//        telnet_replay -D file...
+//   -h HOST   server address (default 127.0.0.1)
+//   -p PORT   server port (default: the port recorded in the capture)
+//   -s SPEED  time acceleration: 1 = real time, 10 = ten times faster,
+//             0 = send as fast as possible (default 1)
+//   -c N      number of parallel connections (default: one per file)
+//   -n N      replay each capture N times per connection (default 1)
+//   -D        print the records of each capture and exit
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "session_capture.h"
+
+#define RECV_BUFFER_SIZE 4096
+#define MAX_EVENTS 256
+#define DRAIN_TIMEOUT_US 2000000   // Wait this long for the last echo
+
+typedef struct {
+    uint64_t delay_us;
+    size_t len;
+    const unsigned char *data;
+} record_t;
+
+typedef struct {
+    const char *path;
+    int port;
+    record_t *records;
+    int record_count;
+    unsigned char *raw;
+} capture_file_t;
+
+typedef struct {
+    int fd;
+    const capture_file_t *capture;
+    int record;                // Next record to send
+    size_t sent;               // Bytes of that record already sent
+    int iteration;
+    uint64_t due_us;           // When the next record may be sent
+    uint64_t pending_us;       // Send time of an unanswered line, 0 if none
+    uint64_t last_send_us;
+    int done;
+} connection_t;
+
+static uint64_t *latencies;
+static size_t latency_count, latency_capacity;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static int get_varint(const unsigned char *p, size_t len, size_t *pos, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && *pos < len; shift += 7) {
+        unsigned char byte = p[(*pos)++];
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int load_capture(const char *path, capture_file_t *capture) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        perror(path);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+    capture->raw = malloc(size > 0 ? size : 1);
+    if (capture->raw == NULL || fread(capture->raw, 1, size, fp) != (size_t)size) {
+        fprintf(stderr, "%s: read failed\n", path);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    if (size < CAPTURE_HEADER_SIZE || memcmp(capture->raw, CAPTURE_MAGIC, 4) != 0 ||
+        capture->raw[4] != CAPTURE_VERSION) {
+        fprintf(stderr, "%s: not a version %d session capture\n", path, CAPTURE_VERSION);
+        return -1;
+    }
+    capture->path = path;
+    capture->port = capture->raw[6] | (capture->raw[7] << 8);
+
+    int capacity = 64;
+    capture->records = malloc(sizeof(record_t) * capacity);
+    capture->record_count = 0;
+    size_t pos = CAPTURE_HEADER_SIZE;
+    while (pos < (size_t)size) {
+        uint64_t delay, len;
+        if (get_varint(capture->raw, size, &pos, &delay) < 0 ||
+            get_varint(capture->raw, size, &pos, &len) < 0 || len > (uint64_t)size - pos) {
+            // A capture cut short by a crash still replays up to this point
+            fprintf(stderr, "%s: truncated record at offset %zu\n", path, pos);
+            break;
+        }
+        if (capture->record_count == capacity) {
+            capacity *= 2;
+            capture->records = realloc(capture->records, sizeof(record_t) * capacity);
+        }
+        record_t *record = &capture->records[capture->record_count++];
+        record->delay_us = delay;
+        record->len = len;
+        record->data = capture->raw + pos;
+        pos += len;
+    }
+    return 0;
+}
+
+static void dump_capture(const capture_file_t *capture) {
+    printf("%s: port %d, %d records\n", capture->path, capture->port, capture->record_count);
+    for (int i = 0; i < capture->record_count; i++) {
+        const record_t *record = &capture->records[i];
+        printf("  +%8llu us %5zu  ", (unsigned long long)record->delay_us, record->len);
+        for (size_t j = 0; j < record->len; j++) {
+            unsigned char c = record->data[j];
+            if (c == '\\') {
+                printf("\\\\");
+            } else if (c >= 0x20 && c < 0x7F) {
+                putchar(c);
+            } else {
+                printf("\\x%02x", c);
+            }
+        }
+        putchar('\n');
+    }
+}
+
+static void add_latency(uint64_t usec) {
+    if (latency_count == latency_capacity) {
+        latency_capacity = latency_capacity ? latency_capacity * 2 : 4096;
+        latencies = realloc(latencies, sizeof(uint64_t) * latency_capacity);
+    }
+    latencies[latency_count++] = usec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_ms(double p) {
+    size_t index = (size_t)(p * (latency_count - 1) + 0.5);
+    return latencies[index] / 1000.0;
+}
+
+static int open_connection(const char *host, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address: %s\n", host);
+        close(fd);
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static int has_line_ending(const record_t *record) {
+    return memchr(record->data, '\n', record->len) != NULL ||
+           memchr(record->data, '\r', record->len) != NULL;
+}
+
+// Send every record of the connection that is due. Returns bytes sent.
+static size_t send_due(connection_t *conn, uint64_t now, double speed, int iterations,
+                       long *records_sent) {
+    size_t total = 0;
+    while (!conn->done && conn->record < conn->capture->record_count && conn->due_us <= now) {
+        const record_t *record = &conn->capture->records[conn->record];
+        ssize_t n = send(conn->fd, record->data + conn->sent, record->len - conn->sent,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                // Give up on the rest; the main loop closes the connection
+                perror("send");
+                conn->record = conn->capture->record_count;
+                conn->pending_us = 0;
+            }
+            break;
+        }
+        total += n;
+        conn->sent += n;
+        if (conn->sent < record->len) {
+            break;
+        }
+
+        (*records_sent)++;
+        conn->last_send_us = now;
+        if (conn->pending_us == 0 && has_line_ending(record)) {
+            conn->pending_us = now;
+        }
+        conn->sent = 0;
+        conn->record++;
+        if (conn->record == conn->capture->record_count && ++conn->iteration < iterations) {
+            conn->record = 0;
+        }
+        if (conn->record < conn->capture->record_count) {
+            uint64_t delay = conn->capture->records[conn->record].delay_us;
+            conn->due_us = speed > 0 ? now + (uint64_t)(delay / speed) : now;
+        }
+    }
+    return total;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-h host] [-p port] [-s speed] [-c conns] [-n iterations] file...\n"
+                    "       %s -D file...\n", prog, prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *host = "127.0.0.1";
+    int port = 0;
+    double speed = 1.0;
+    int conn_count = 0;
+    int iterations = 1;
+    int dump = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:s:c:n:D")) != -1) {
+        switch (opt) {
+            case 'h': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 's': speed = atof(optarg); break;
+            case 'c': conn_count = atoi(optarg); break;
+            case 'n': iterations = atoi(optarg); break;
+            case 'D': dump = 1; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    int file_count = argc - optind;
+    if (file_count <= 0 || speed < 0 || iterations < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    capture_file_t *captures = calloc(file_count, sizeof(capture_file_t));
+    for (int i = 0; i < file_count; i++) {
+        if (load_capture(argv[optind + i], &captures[i]) < 0) {
+            return 1;
+        }
+        if (dump) {
+            dump_capture(&captures[i]);
+        }
+    }
+    if (dump) {
+        return 0;
+    }
+    if (conn_count <= 0) {
+        conn_count = file_count;
+    }
+
+    int epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    connection_t *conns = calloc(conn_count, sizeof(connection_t));
+    uint64_t start = now_us();
+    int active = 0;
+    for (int i = 0; i < conn_count; i++) {
+        connection_t *conn = &conns[i];
+        conn->capture = &captures[i % file_count];
+        conn->fd = open_connection(host, port ? port : conn->capture->port);
+        if (conn->fd < 0) {
+            conn->done = 1;
+            continue;
+        }
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev);
+        if (conn->capture->record_count > 0) {
+            uint64_t delay = conn->capture->records[0].delay_us;
+            conn->due_us = start + (speed > 0 ? (uint64_t)(delay / speed) : 0);
+        }
+        active++;
+    }
+    if (speed > 0) {
+        printf("Replaying %d capture(s) on %d connection(s) at %gx speed\n",
+               file_count, active, speed);
+    } else {
+        printf("Replaying %d capture(s) on %d connection(s) at max speed\n", file_count, active);
+    }
+
+    long records_sent = 0;
+    size_t bytes_sent = 0, bytes_received = 0;
+    unsigned char buffer[RECV_BUFFER_SIZE];
+    struct epoll_event events[MAX_EVENTS];
+
+    while (active > 0) {
+        // Send whatever is due and find the next deadline
+        uint64_t now = now_us();
+        uint64_t next = now + 100000;
+        for (int i = 0; i < conn_count; i++) {
+            connection_t *conn = &conns[i];
+            if (conn->done) {
+                continue;
+            }
+            bytes_sent += send_due(conn, now, speed, iterations, &records_sent);
+            if (conn->record < conn->capture->record_count) {
+                if (conn->due_us < next) {
+                    next = conn->due_us;
+                }
+            } else if (conn->pending_us == 0 || now - conn->last_send_us > DRAIN_TIMEOUT_US) {
+                // Everything sent and the last line answered (or given up on)
+                close(conn->fd);
+                conn->done = 1;
+                active--;
+            }
+        }
+        if (active == 0) {
+            break;
+        }
+
+        int timeout_ms = next > now ? (int)((next - now + 999) / 1000) : 0;
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        now = now_us();
+        for (int i = 0; i < n; i++) {
+            connection_t *conn = events[i].data.ptr;
+            ssize_t received;
+            while ((received = recv(conn->fd, buffer, sizeof(buffer), 0)) > 0) {
+                bytes_received += received;
+                if (conn->pending_us != 0) {
+                    add_latency(now - conn->pending_us);
+                    conn->pending_us = 0;
+                }
+            }
+            if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                if (!conn->done) {
+                    close(conn->fd);
+                    conn->done = 1;
+                    active--;
+                }
+            }
+        }
+    }
+
+    double elapsed = (now_us() - start) / 1e6;
+    printf("Elapsed:     %.3f s\n", elapsed);
+    printf("Sent:        %zu bytes, %ld records (%.0f bytes/s, %.0f records/s)\n",
+           bytes_sent, records_sent, bytes_sent / elapsed, records_sent / elapsed);
+    printf("Received:    %zu bytes (%.0f bytes/s)\n", bytes_received, bytes_received / elapsed);
+    if (latency_count > 0) {
+        qsort(latencies, latency_count, sizeof(uint64_t), compare_u64);
+        printf("Latency:     %zu samples, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+               latency_count, percentile_ms(0.50), percentile_ms(0.90), percentile_ms(0.99),
+               latencies[latency_count - 1] / 1000.0);
+    } else {
+        printf("Latency:     no line was answered\n");
+    }
+    return 0;
+}
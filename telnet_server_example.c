@@ -1,83 +1,54 @@
-#include<stdio.h>    
-#include<stdlib.h> 
-#include<sys/socket.h>    
-#include<sys/types.h>    
-#include<netinet/in.h>    
-#include<error.h>    
-#include<strings.h>    
-#include<unistd.h>    
-#include<arpa/inet.h>    
-
-
-#define ERROR -1    
-#define MAX_CLIENTS 2    
-#define MAX_DATA 1024
-
-
-main(int argc, char **argv)    
-{    
- struct sockaddr_in server;    
- struct sockaddr_in client;    
- int sock;    
- int new;    
- int sockaddr_len = sizeof(struct sockaddr_in);    
- int data_len;    
- char data[MAX_DATA];    
-
-
- if((sock = socket(AF_INET, SOCK_STREAM, 0)) == ERROR)    
- {    
-  perror("server socket: ");    
-  exit(-1);    
- }    
-
- server.sin_family = AF_INET;    
- server.sin_port = htons(atoi(argv[1]));
- server.sin_addr.s_addr = INADDR_ANY;    
- bzero(&server.sin_zero, 8);    
-
- if((bind(sock, (struct sockaddr *)&server, sockaddr_len)) == ERROR)    
- {    
-  perror("bind : ");    
-  exit(-1);    
- }
-
- if((listen(sock, MAX_CLIENTS)) == ERROR)    
- {    
-  perror("listen");    
-  exit(-1);    
- }
-
- while(1) // Better signal handling required    
- {    
-  if((new = accept(sock, (struct sockaddr *)&client, &sockaddr_len)) == ERROR)    
-  {    
-   perror("accept");    
-   exit(-1);    
-  }    
-
-
-  printf("New Client connected from port no %d and IP %s\n", ntohs(client.sin_port), net_ntoa(client.sin_addr));
-
-  data_len = 1;            
-
-  while(data_len)    
-  {    
-   data_len = recv(new, data, MAX_DATA, 0);    
-
-   if(data_len)    
-   {    
-    send(new, data, data_len, 0);    
-    data[data_len] = '\0';    
-    printf("Sent mesg %.*s", data_len, data);
-   }
-  }
-
-  printf("Client disconnected\n");
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "server_config.h"
+#include "telnetd.h"
+
+// Smallest libtelnetd application: echo whatever the client sends. The
+// frame brings the process models, the counters on the admin port (port +
+// 10000), transcripts, rate limits and TLS (TELNET_TLS_PORT); the
+// application only supplies the session callbacks.
+//
+// Usage: ./telnet_server_example <port_number>
+
+static void example_open(session_t *session) {
+    char ts[32];
+    get_timestamp(ts, sizeof(ts));
+    printf("%s[INFO] New client connected from port no %d and IP %s.\n", ts, session->peer_port, session->peer_ip);
+}
 
-  close(new);       
+static void example_input(session_t *session, const unsigned char *data, size_t len) {
+    session_send(session, data, len);
+}
 
- }
+static void example_close(session_t *session) {
+    char ts[32];
+    get_timestamp(ts, sizeof(ts));
+    printf("%s[INFO] Client disconnected: %s:%d.\n", ts, session->peer_ip, session->peer_port);
+}
 
- close(sock);    
+static const session_ops_t example_ops = {
+    .open = example_open,
+    .input = example_input,
+    .close = example_close
+};
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <port_number>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int port = atoi(argv[1]);
+    if (port <= 0 || port > 65535) {
+        fprintf(stderr, "Invalid port: %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    const telnetd_app_t app = {
+        .name = "telnet_server_example",
+        .title = "Telnet Server Example",
+        .port = port,
+        .admin_port = port + 10000 <= 65535 ? port + 10000 : 0,
+        .ops = &example_ops
+    };
+    return telnetd_main(&app);
 }
@@ -0,0 +1,358 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#include "latency_hist.h"
+#include "listener.h"
+#include "prefork.h"
+#include "rate_limit.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "session_capture.h"
+#include "supervisor.h"
+#include "telnetd.h"
+#include "trace_probes.h"
+#include "transcript.h"
+
+typedef struct {
+    int fd;
+    tls_server_t *tls;
+    telnetd_serve_t serve;
+} telnetd_fork_port_t;
+
+struct telnetd {
+    const telnetd_app_t *app;
+    int listen_fd;
+    int tls_fd;
+    int admin_fd;
+    int child_fd;
+    tls_server_t *tls;
+    reactor_config_t model;
+    telnetd_fork_port_t fork_ports[TELNETD_MAX_FORK_PORTS];
+    int fork_port_count;
+};
+
+static volatile sig_atomic_t running = 1;
+static volatile sig_atomic_t dump_latency = 0;
+
+static void telnetd_stop_signal(int signum) {
+    (void)signum;
+    running = 0;
+}
+
+static void telnetd_dump_signal(int signum) {
+    (void)signum;
+    dump_latency = 1;
+}
+
+int telnetd_add_fork_port(telnetd_t *server, int port, tls_server_t *tls, telnetd_serve_t serve) {
+    if (server->fork_port_count == TELNETD_MAX_FORK_PORTS) {
+        fprintf(stderr, "Too many fork ports, %d not served\n", port);
+        return -1;
+    }
+    int fd = listener_open(port);
+    if (fd == -1) {
+        return -1;
+    }
+    telnetd_fork_port_t *fork_port = &server->fork_ports[server->fork_port_count++];
+    fork_port->fd = fd;
+    fork_port->tls = tls;
+    fork_port->serve = serve;
+    return 0;
+}
+
+tls_server_t *telnetd_tls(const telnetd_t *server) {
+    return server->tls;
+}
+
+const reactor_config_t *telnetd_model(const telnetd_t *server) {
+    return &server->model;
+}
+
+// Descriptors only the listener process uses
+static void telnetd_close_listeners(telnetd_t *server) {
+    close(server->listen_fd);
+    if (server->tls_fd != -1) {
+        close(server->tls_fd);
+    }
+    if (server->admin_fd != -1) {
+        close(server->admin_fd);
+        stats_admin_close_clients();
+    }
+    for (int i = 0; i < server->fork_port_count; i++) {
+        close(server->fork_ports[i].fd);
+    }
+}
+
+// Serve an accepted connection in a forked child; never returns
+static void telnetd_serve_child(telnetd_t *server, int listen_fd, int client_fd, struct sockaddr_in *client_addr) {
+    telnetd_fork_port_t *fork_port = NULL;
+    for (int i = 0; i < server->fork_port_count; i++) {
+        if (server->fork_ports[i].fd == listen_fd) {
+            fork_port = &server->fork_ports[i];
+        }
+    }
+    telnetd_close_listeners(server);
+    stats_attach_worker();
+    if (fork_port != NULL) {
+        // A fork port's session blocks (the raw echo loop sits in splice())
+        fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL) & ~O_NONBLOCK);
+        stats_inc(STAT_CONNECTIONS_OPENED);
+        fork_port->serve(client_fd, client_addr, fork_port->tls);
+        stats_inc(STAT_CONNECTIONS_CLOSED);
+        TRACE_PROBE1(session_close, client_fd);
+    } else {
+        reactor_serve_one(server->app->ops, client_fd, client_addr, tls_listener(listen_fd), &running);
+    }
+    stats_detach_worker();
+    exit(EXIT_SUCCESS);
+}
+
+// Take connections from a ready port up to its budget and fork for each
+static void telnetd_accept(telnetd_t *server, int listen_fd) {
+    // Drain the accept queue up to the budget before looking at the other
+    // ports again
+    int budget = listener_budget(listen_fd);
+    for (int burst = 0; burst < budget; burst++) {
+        struct sockaddr_in client_addr;
+        int client_fd = listener_accept(listen_fd, &client_addr);
+        if (client_fd == -1) {
+            break;
+        }
+        if (burst == budget - 1) {
+            stats_inc(STAT_ACCEPT_BUDGET_EXHAUSTED);
+        }
+
+        pid_t pid = supervisor_fork(client_fd, &client_addr);
+        if (pid == 0) {
+            telnetd_serve_child(server, listen_fd, client_fd, &client_addr);
+        }
+        // Parent, or over the child limit (the client was told) or no fork
+        close(client_fd);
+    }
+}
+
+static void telnetd_describe(const telnetd_t *server, const reactor_t *reactor, const prefork_t *prefork,
+                             const char *capture_dir, const char *transcript_dir, int rate_limited,
+                             int admin_port) {
+    const reactor_config_t *model = &server->model;
+    char ts[32];
+    get_timestamp(ts, sizeof(ts));
+    printf("%s[INFO] %s started on port %d.\n", ts, server->app->title, server->app->port);
+    printf("%s[INFO] Listen backlog %d, up to %d accepts per wakeup.\n", ts,
+           listener_backlog(server->listen_fd), listener_budget(server->listen_fd));
+    if (reactor != NULL) {
+        printf("%s[INFO] Reactor model: %d worker threads.\n", ts, model->workers);
+    } else if (prefork != NULL) {
+        printf("%s[INFO] Prefork model: %d worker processes%s.\n", ts, model->workers,
+               listener_reuseport(server->listen_fd) ? " with their own listeners" : "");
+    } else {
+        printf("%s[INFO] Fork model: one process per client, at most %d.\n", ts, supervisor_limit());
+    }
+    if (model->fair_bytes != 0 || model->fair_lines != 0) {
+        printf("%s[INFO] Input turns per session: %zu bytes, %u lines (0: no limit), %s.\n", ts,
+               model->fair_bytes, model->fair_lines, model->fair_slo ? "small input first" : "round-robin");
+    }
+    if (model->balance_skew != 0) {
+        printf("%s[INFO] Load balancing: sessions move off a worker with %d%% more load than another (from %ld bytes/s).\n",
+               ts, model->balance_skew, model->balance_min);
+    }
+    if (server->tls != NULL) {
+        printf("%s[INFO] TLS on port %d (%s).\n", ts, tls_server_port(server->tls),
+               tls_server_ktls(server->tls) ? "kernel TLS offload where supported" : "kernel TLS offload off");
+    }
+    if (server->admin_fd != -1) {
+        printf("%s[INFO] Metrics available on 127.0.0.1:%d.\n", ts, admin_port);
+    }
+    if (capture_dir != NULL) {
+        printf("%s[INFO] Capturing client sessions to %s.\n", ts, capture_dir);
+    }
+    if (transcript_dir != NULL) {
+        printf("%s[INFO] Recording session transcripts to %s.\n", ts, transcript_dir);
+    }
+    if (rate_limited) {
+        printf("%s[INFO] Rate limits: input %s, output %s.\n", ts,
+               rate_config.input ? "limited" : "unlimited", rate_config.output ? "limited" : "unlimited");
+    }
+    if (server->app->describe != NULL) {
+        server->app->describe(server, ts);
+    }
+    printf("Press Ctrl+C to stop the server\n\n");
+}
+
+int telnetd_main(const telnetd_app_t *app) {
+    telnetd_t server = {
+        .app = app,
+        .tls_fd = -1,
+        .admin_fd = -1
+    };
+    int port = app->port;
+    int admin_port = (int)config_get_long("ADMIN_PORT", port, app->admin_port);
+
+    signal(SIGINT, telnetd_stop_signal);
+    signal(SIGTERM, telnetd_stop_signal);
+
+    // SIGUSR1 dumps the latency histograms; SA_RESTART keeps blocking fork
+    // port sessions undisturbed, reactor workers go back to epoll_wait()
+    struct sigaction dump_action;
+    memset(&dump_action, 0, sizeof(dump_action));
+    dump_action.sa_handler = telnetd_dump_signal;
+    dump_action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &dump_action, NULL);
+
+    // Listen with a large backlog; connections are taken in bursts
+    server.listen_fd = listener_open(port);
+    if (server.listen_fd == -1) {
+        return EXIT_FAILURE;
+    }
+
+    // The TLS port serves the same sessions, set up before anything forks
+    server.tls = tls_server_init(port, app->tls_port);
+    if (server.tls != NULL) {
+        server.tls_fd = listener_open(tls_server_port(server.tls));
+        if (server.tls_fd == -1) {
+            close(server.listen_fd);
+            return EXIT_FAILURE;
+        }
+        tls_listener_add(server.tls_fd, server.tls);
+    }
+
+    // Shared counters must exist before the first fork()
+    stats_init(app->name);
+    latency_init(port);
+    if (app->setup != NULL && app->setup(&server) == -1) {
+        telnetd_close_listeners(&server);
+        return EXIT_FAILURE;
+    }
+    const char *capture_dir = capture_init(port);
+    const char *transcript_dir = transcript_init(port);
+    int rate_limited = rate_init(port);
+    server.admin_fd = stats_admin_listen(admin_port);
+
+    // Forked children are reaped through a signalfd and capped
+    server.child_fd = supervisor_init(port, app->reap);
+    if (server.child_fd == -1) {
+        telnetd_close_listeners(&server);
+        return EXIT_FAILURE;
+    }
+
+    // In the reactor and prefork models the workers take telnet connections
+    // themselves; fork port sessions are always forked
+    reactor_t *reactor = NULL;
+    prefork_t *prefork = NULL;
+    reactor_configure(&server.model, port);
+    if (server.model.model == REACTOR_MODEL_THREADS) {
+        reactor = reactor_create(server.model.workers);
+        if (reactor == NULL || reactor_listen(reactor, server.listen_fd, app->ops) == -1 ||
+            (server.tls_fd != -1 && reactor_listen(reactor, server.tls_fd, app->ops) == -1) ||
+            reactor_start(reactor) == -1) {
+            fprintf(stderr, "Failed to start the reactor workers\n");
+            telnetd_close_listeners(&server);
+            return EXIT_FAILURE;
+        }
+    } else if (server.model.model == REACTOR_MODEL_PREFORK) {
+        prefork_config_t prefork_config = {
+            .port = port,
+            .listen_fd = server.listen_fd,
+            .tls_fd = server.tls_fd,
+            .ops = app->ops,
+            .reap = app->reap,
+            .workers = server.model.workers,
+            .close_fds = { server.admin_fd, server.child_fd },
+            .close_count = 2
+        };
+        for (int i = 0; i < server.fork_port_count; i++) {
+            prefork_config.close_fds[prefork_config.close_count++] = server.fork_ports[i].fd;
+        }
+        prefork = prefork_start(&prefork_config, &running);
+        if (prefork == NULL) {
+            fprintf(stderr, "Failed to start the worker processes\n");
+            telnetd_close_listeners(&server);
+            return EXIT_FAILURE;
+        }
+    }
+
+    telnetd_describe(&server, reactor, prefork, capture_dir, transcript_dir, rate_limited, admin_port);
+
+    // Accept and handle clients
+    int forking = server.model.model == REACTOR_MODEL_FORK;
+    while (running) {
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        int max_fd = server.child_fd;
+        FD_SET(server.child_fd, &readfds);
+        if (forking) {
+            FD_SET(server.listen_fd, &readfds);
+            max_fd = server.listen_fd > max_fd ? server.listen_fd : max_fd;
+            if (server.tls_fd != -1) {
+                FD_SET(server.tls_fd, &readfds);
+                max_fd = server.tls_fd > max_fd ? server.tls_fd : max_fd;
+            }
+        }
+        for (int i = 0; i < server.fork_port_count; i++) {
+            FD_SET(server.fork_ports[i].fd, &readfds);
+            max_fd = server.fork_ports[i].fd > max_fd ? server.fork_ports[i].fd : max_fd;
+        }
+        max_fd = stats_admin_fds(&readfds, max_fd);
+
+        struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+        int activity = select(max_fd + 1, &readfds, NULL, NULL, &tv);
+        if (activity < 0 && errno != EINTR) {
+            perror("select error");
+            break;
+        }
+
+        if (activity > 0 && FD_ISSET(server.child_fd, &readfds)) {
+            supervisor_reap();
+        }
+        if (prefork != NULL) {
+            prefork_check(prefork);
+        }
+
+        if (dump_latency) {
+            dump_latency = 0;
+            latency_dump(stdout);
+        }
+
+        // Also runs on a timeout, to answer or drop slow admin clients
+        stats_admin_poll(activity > 0 ? &readfds : NULL);
+        if (activity <= 0) {
+            continue;
+        }
+
+        // All ports go through the same accept and fork path, one per round
+        if (forking && FD_ISSET(server.listen_fd, &readfds)) {
+            telnetd_accept(&server, server.listen_fd);
+            continue;
+        }
+        if (forking && server.tls_fd != -1 && FD_ISSET(server.tls_fd, &readfds)) {
+            telnetd_accept(&server, server.tls_fd);
+            continue;
+        }
+        for (int i = 0; i < server.fork_port_count; i++) {
+            if (FD_ISSET(server.fork_ports[i].fd, &readfds)) {
+                telnetd_accept(&server, server.fork_ports[i].fd);
+                break;
+            }
+        }
+    }
+
+    char ts[32];
+    get_timestamp(ts, sizeof(ts));
+    printf("\n%s[INFO] Shutting down server.\n", ts);
+    if (reactor != NULL) {
+        reactor_stop(reactor);
+    }
+    if (prefork != NULL) {
+        prefork_stop(prefork);
+    }
+    supervisor_shutdown();
+    telnetd_close_listeners(&server);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,61 @@
+#ifndef TELNETD_H
+#define TELNETD_H
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "reactor.h"
+#include "server_tls.h"
+
+// Server frame of libtelnetd, shared by every server built on it.
+//
+// An application describes its telnet port and protocol in a telnetd_app_t
+// and hands it to telnetd_main(), which does everything the servers have in
+// common: the listener and its TLS twin, the shared counters with the
+// admin port, latency histograms, captures, transcripts and rate limits,
+// the child supervisor, the process model (TELNET_MODEL: fork, reactor or
+// prefork) with its accept loop, signals and the shutdown. Settings are
+// read for the telnet port (TELNET_<NAME>_<port>, then TELNET_<NAME>).
+//
+// Ports that do not speak the telnet protocol (the raw echo port) are added
+// by the application's setup hook as fork ports: a connection on one is
+// always served by a forked child running the port's blocking serve
+// function, whatever the model of the telnet port.
+
+#define TELNETD_MAX_FORK_PORTS 2
+
+typedef struct telnetd telnetd_t;
+
+typedef struct {
+    const char *name;              // Counter label ("line_mode")
+    const char *title;             // Log name ("Line Mode Telnet Echo Server")
+    int port;                      // Telnet port
+    int admin_port;                // Loopback metrics port unless TELNET_ADMIN_PORT says otherwise
+    int tls_port;                  // TLS port, served when TELNET_TLS_CERT is set
+    const session_ops_t *ops;      // The telnet protocol
+    // Read the protocol settings and add fork ports, before the first
+    // fork() (may be NULL). Returns 0, or -1 to give up.
+    int (*setup)(telnetd_t *server);
+    // Startup log lines of the application, after the common ones (may be NULL)
+    void (*describe)(const telnetd_t *server, const char *ts);
+    // A forked child or worker process was reaped without having closed
+    // its sessions: free what it held in the memory shared by the server's
+    // processes (may be NULL)
+    void (*reap)(pid_t pid);
+} telnetd_app_t;
+
+// Serve a blocking connection on a fork port, in the forked child
+typedef void (*telnetd_serve_t)(int fd, struct sockaddr_in *peer, tls_server_t *tls);
+
+// Run the server until SIGINT or SIGTERM. Returns the exit status.
+int telnetd_main(const telnetd_app_t *app);
+
+// Open a fork port in setup: listen on port, plain or TLS. Returns 0, or -1
+// when the port cannot be opened.
+int telnetd_add_fork_port(telnetd_t *server, int port, tls_server_t *tls, telnetd_serve_t serve);
+
+// The telnet port's TLS context (NULL without TLS) and process model
+tls_server_t *telnetd_tls(const telnetd_t *server);
+const reactor_config_t *telnetd_model(const telnetd_t *server);
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef TRACE_PROBES_H
+#define TRACE_PROBES_H
+
+// USDT static tracepoints (provider "telnet").
+//
+// Each probe compiles to a single nop plus an ELF note describing where its
+// arguments live, so an unattached probe costs nothing beyond keeping the
+// arguments in registers. perf, bpftrace and SystemTap find the probes
+// through the .note.stapsdt section:
+//
+//   perf probe -x ./line_mode_server sdt_telnet:line_echoed
+//   bpftrace -e 'usdt:./line_mode_server:telnet:line_echoed { @[pid] = count(); }'
+//
+// <sys/sdt.h> from systemtap-sdt-dev is used when it is installed; otherwise
+// an equivalent note is emitted directly on x86-64. Build with
+// -DTELNET_NO_PROBES to compile every probe out.
+//
+// Probes:
+//   session_accept(fd, peer_port)    listener accepted a connection
+//   negotiation_complete(fd)         option negotiation finished
+//   line_echoed(fd, length)          a line was echoed back
+//   timestamp_sent(fd)               a periodic timestamp was pushed
+//   session_close(fd)                the client session ended
+//   session_migrate(fd)              a session moved to another worker thread
+
+#if defined(TELNET_NO_PROBES)
+
+#define TRACE_PROBE0(name) do { } while (0)
+#define TRACE_PROBE1(name, a) do { (void)(a); } while (0)
+#define TRACE_PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+
+#elif defined(__has_include) && __has_include(<sys/sdt.h>)
+
+#include <sys/sdt.h>
+#define TRACE_PROBE0(name) DTRACE_PROBE(telnet, name)
+#define TRACE_PROBE1(name, a) DTRACE_PROBE1(telnet, name, a)
+#define TRACE_PROBE2(name, a, b) DTRACE_PROBE2(telnet, name, a, b)
+
+#elif defined(__x86_64__) && defined(__GNUC__)
+
+// Same note layout as <sys/sdt.h> (version 3); every argument is passed as
+// a signed 64-bit value.
+#define TRACE_PROBE_BASE \
+    ".ifndef _.stapsdt.base\n" \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+    ".weak _.stapsdt.base\n" \
+    ".hidden _.stapsdt.base\n" \
+    "_.stapsdt.base: .space 1\n" \
+    ".size _.stapsdt.base, 1\n" \
+    ".popsection\n" \
+    ".endif\n"
+
+#define TRACE_PROBE_NOTE(name, args, ...) \
+    __asm__ __volatile__ ( \
+        "990: nop\n" \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+        ".balign 4\n" \
+        ".4byte 992f-991f, 994f-993f, 3\n" \
+        "991: .asciz \"stapsdt\"\n" \
+        "992: .balign 4\n" \
+        "993: .8byte 990b\n" \
+        ".8byte _.stapsdt.base\n" \
+        ".8byte 0\n" \
+        ".asciz \"telnet\"\n" \
+        ".asciz \"" #name "\"\n" \
+        ".asciz \"" args "\"\n" \
+        "994: .balign 4\n" \
+        ".popsection\n" \
+        TRACE_PROBE_BASE \
+        : : __VA_ARGS__)
+
+#define TRACE_PROBE0(name) TRACE_PROBE_NOTE(name, "")
+#define TRACE_PROBE1(name, a) \
+    TRACE_PROBE_NOTE(name, "-8@%[a0]", [a0] "nor" ((long)(a)))
+#define TRACE_PROBE2(name, a, b) \
+    TRACE_PROBE_NOTE(name, "-8@%[a0] -8@%[a1]", [a0] "nor" ((long)(a)), [a1] "nor" ((long)(b)))
+
+#else
+
+#define TRACE_PROBE0(name) do { } while (0)
+#define TRACE_PROBE1(name, a) do { (void)(a); } while (0)
+#define TRACE_PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+
+#endif
+
+#endif
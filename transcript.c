@@ -0,0 +1,342 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "server_config.h"
+#include "server_stats.h"
+#include "transcript.h"
+
+typedef struct transcript_writer transcript_writer_t;
+
+// A segment being written by one thread
+struct transcript_writer {
+    transcript_writer_t *next;     // Flusher's list
+    int fd;
+    unsigned char *map;
+    uint32_t sequence;
+    uint32_t used;                 // End of the records
+    uint32_t index_low;            // Start of the index at the end of the mapping
+    uint32_t committed;            // used, published for the flusher
+    uint32_t flushed;              // Writeback started up to here (flusher only)
+};
+
+static const char *transcript_dir = NULL;
+static int transcript_port = 0;
+static uint32_t segment_size = TRANSCRIPT_DEFAULT_SEGMENT;
+static uint32_t max_payload = 0;
+static long flush_ms = TRANSCRIPT_DEFAULT_FLUSH_MS;
+static char run_stamp[16];
+static uint64_t *session_counter = NULL;   // Shared by the processes of the run
+static uint32_t next_sequence = 0;
+
+// Segments open in this process, for the flusher
+static pthread_mutex_t writers_lock = PTHREAD_MUTEX_INITIALIZER;
+static transcript_writer_t *writers = NULL;
+static int flusher_started = 0;
+
+static __thread transcript_writer_t *current = NULL;
+
+static uint64_t wall_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static uint32_t transcript_align(uint32_t size) {
+    return (size + TRANSCRIPT_ALIGN - 1) & ~(uint32_t)(TRANSCRIPT_ALIGN - 1);
+}
+
+static transcript_index_t *transcript_slot(transcript_writer_t *writer, uint32_t slot) {
+    return (transcript_index_t *)(writer->map + segment_size) - slot - 1;
+}
+
+// Start writeback of what changed since the last pass, without waiting
+static void transcript_flush(transcript_writer_t *writer) {
+    uint32_t committed = __atomic_load_n(&writer->committed, __ATOMIC_ACQUIRE);
+    if (committed == writer->flushed) {
+        return;
+    }
+    uint32_t page = (uint32_t)sysconf(_SC_PAGESIZE);
+    uint32_t start = writer->flushed & ~(page - 1);
+    sync_file_range(writer->fd, start, committed - start, SYNC_FILE_RANGE_WRITE);
+
+    // The header page (index count) and the index pages
+    transcript_header_t *header = (transcript_header_t *)writer->map;
+    uint32_t index_bytes = __atomic_load_n(&header->index_count, __ATOMIC_RELAXED) * sizeof(transcript_index_t);
+    uint32_t index_start = (segment_size - index_bytes) & ~(page - 1);
+    sync_file_range(writer->fd, 0, page, SYNC_FILE_RANGE_WRITE);
+    sync_file_range(writer->fd, index_start, segment_size - index_start, SYNC_FILE_RANGE_WRITE);
+    writer->flushed = committed;
+}
+
+static void *transcript_flusher(void *arg) {
+    (void)arg;
+    struct timespec interval = { .tv_sec = flush_ms / 1000, .tv_nsec = (flush_ms % 1000) * 1000000 };
+    while (1) {
+        nanosleep(&interval, NULL);
+        pthread_mutex_lock(&writers_lock);
+        for (transcript_writer_t *writer = writers; writer != NULL; writer = writer->next) {
+            transcript_flush(writer);
+        }
+        pthread_mutex_unlock(&writers_lock);
+    }
+    return NULL;
+}
+
+// A forked child starts without the flusher and without the parent's
+// segments, which stay with the parent
+static void transcript_atfork_prepare(void) {
+    pthread_mutex_lock(&writers_lock);
+}
+
+static void transcript_atfork_parent(void) {
+    pthread_mutex_unlock(&writers_lock);
+}
+
+static void transcript_atfork_child(void) {
+    while (writers != NULL) {
+        transcript_writer_t *writer = writers;
+        writers = writer->next;
+        munmap(writer->map, segment_size);
+        close(writer->fd);
+        free(writer);
+    }
+    current = NULL;
+    flusher_started = 0;
+    pthread_mutex_unlock(&writers_lock);
+}
+
+const char *transcript_init(int port) {
+    transcript_dir = config_get_str("TRANSCRIPT_DIR", port, NULL);
+    if (transcript_dir == NULL) {
+        return NULL;
+    }
+    if (mkdir(transcript_dir, 0750) == -1 && errno != EEXIST) {
+        perror("transcript directory");
+        transcript_dir = NULL;
+        return NULL;
+    }
+
+    long size = config_get_long("TRANSCRIPT_SEGMENT", port, TRANSCRIPT_DEFAULT_SEGMENT);
+    if (size < TRANSCRIPT_MIN_SEGMENT) {
+        size = TRANSCRIPT_MIN_SEGMENT;
+    } else if (size > TRANSCRIPT_MAX_SEGMENT) {
+        size = TRANSCRIPT_MAX_SEGMENT;
+    }
+    long page = sysconf(_SC_PAGESIZE);
+    segment_size = (uint32_t)(size & ~(page - 1));
+    // A record of this size always fits an empty segment with its index entry
+    max_payload = segment_size / 4;
+    flush_ms = config_get_long("TRANSCRIPT_FLUSH_MS", port, TRANSCRIPT_DEFAULT_FLUSH_MS);
+
+    void *region = mmap(NULL, sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        perror("transcript mmap failed");
+        transcript_dir = NULL;
+        return NULL;
+    }
+    session_counter = region;
+
+    time_t now = time(NULL);
+    struct tm tm_info;
+    localtime_r(&now, &tm_info);
+    strftime(run_stamp, sizeof(run_stamp), "%Y%m%d-%H%M%S", &tm_info);
+    transcript_port = port;
+    pthread_atfork(transcript_atfork_prepare, transcript_atfork_parent, transcript_atfork_child);
+    return transcript_dir;
+}
+
+static transcript_writer_t *transcript_writer_open(void) {
+    transcript_writer_t *writer = calloc(1, sizeof(transcript_writer_t));
+    if (writer == NULL) {
+        return NULL;
+    }
+    writer->sequence = __atomic_add_fetch(&next_sequence, 1, __ATOMIC_RELAXED);
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%d-%s-%d-%u.tseg", transcript_dir, transcript_port, run_stamp,
+             (int)getpid(), writer->sequence);
+    writer->fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0640);
+    if (writer->fd == -1) {
+        perror("transcript segment");
+        free(writer);
+        return NULL;
+    }
+    // Allocate the blocks now, so appending never extends the file
+    int err = posix_fallocate(writer->fd, 0, segment_size);
+    if (err == 0) {
+        writer->map = mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, writer->fd, 0);
+    }
+    if (err != 0 || writer->map == MAP_FAILED) {
+        fprintf(stderr, "transcript segment %s: %s\n", path, strerror(err != 0 ? err : errno));
+        close(writer->fd);
+        unlink(path);
+        free(writer);
+        return NULL;
+    }
+
+    transcript_header_t *header = (transcript_header_t *)writer->map;
+    memcpy(header->magic, TRANSCRIPT_MAGIC, 4);
+    header->version = TRANSCRIPT_VERSION;
+    header->port = (uint16_t)transcript_port;
+    header->pid = (uint32_t)getpid();
+    header->sequence = writer->sequence;
+    header->created = wall_usec();
+    header->size = segment_size;
+    writer->used = TRANSCRIPT_HEADER_SIZE;
+    writer->index_low = segment_size;
+    writer->committed = writer->used;
+    stats_inc(STAT_TRANSCRIPT_SEGMENTS);
+
+    pthread_mutex_lock(&writers_lock);
+    writer->next = writers;
+    writers = writer;
+    if (!flusher_started && flush_ms > 0) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, transcript_flusher, NULL) == 0) {
+            pthread_detach(thread);
+            flusher_started = 1;
+        }
+    }
+    pthread_mutex_unlock(&writers_lock);
+    return writer;
+}
+
+// Move the index behind the records and cut the file to what is used
+static void transcript_writer_close(transcript_writer_t *writer) {
+    pthread_mutex_lock(&writers_lock);
+    transcript_writer_t **link = &writers;
+    while (*link != writer) {
+        link = &(*link)->next;
+    }
+    *link = writer->next;
+    pthread_mutex_unlock(&writers_lock);
+
+    transcript_header_t *header = (transcript_header_t *)writer->map;
+    uint32_t index_bytes = segment_size - writer->index_low;
+    memmove(writer->map + writer->used, writer->map + writer->index_low, index_bytes);
+    header->data_end = writer->used;
+    header->index_offset = writer->used;
+    header->size = writer->used + index_bytes;
+    munmap(writer->map, segment_size);
+    if (ftruncate(writer->fd, writer->used + index_bytes) == -1) {
+        perror("transcript truncate");
+    }
+    sync_file_range(writer->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+    close(writer->fd);
+    free(writer);
+}
+
+// Append one record of at most max_payload bytes, taken from *iov at
+// *offset; advances both. Returns -1 when no segment can be opened.
+static int transcript_append(transcript_session_t *session, int type, const struct iovec **iov,
+                             size_t *offset, uint32_t len) {
+    transcript_writer_t *writer = current;
+    uint32_t need = transcript_align(sizeof(transcript_record_t) + len);
+    int new_entry = writer == NULL || session->segment != writer->sequence;
+    if (writer == NULL || writer->used + need + (new_entry ? sizeof(transcript_index_t) : 0) > writer->index_low) {
+        if (writer != NULL) {
+            transcript_writer_close(writer);
+        }
+        current = writer = transcript_writer_open();
+        if (writer == NULL) {
+            return -1;
+        }
+        new_entry = 1;
+    }
+
+    uint32_t position = writer->used;
+    transcript_record_t *record = (transcript_record_t *)(writer->map + position);
+    record->type = (uint32_t)type;
+    record->session = session->id;
+    record->time = wall_usec();
+    unsigned char *dest = (unsigned char *)(record + 1);
+    uint32_t left = len;
+    while (left > 0) {
+        size_t take = (*iov)->iov_len - *offset;
+        if (take > left) {
+            take = left;
+        }
+        memcpy(dest, (const unsigned char *)(*iov)->iov_base + *offset, take);
+        dest += take;
+        left -= (uint32_t)take;
+        *offset += take;
+        if (*offset == (*iov)->iov_len) {
+            (*iov)++;
+            *offset = 0;
+        }
+    }
+
+    if (new_entry) {
+        transcript_header_t *header = (transcript_header_t *)writer->map;
+        writer->index_low -= sizeof(transcript_index_t);
+        session->segment = writer->sequence;
+        session->index_slot = header->index_count;
+        transcript_index_t *entry = transcript_slot(writer, session->index_slot);
+        entry->session = session->id;
+        entry->first = position;
+        entry->last = position;
+        __atomic_store_n(&header->index_count, session->index_slot + 1, __ATOMIC_RELEASE);
+    } else {
+        transcript_slot(writer, session->index_slot)->last = position;
+    }
+
+    // A reader sees the record once its size is set
+    __atomic_store_n(&record->size, (uint32_t)sizeof(transcript_record_t) + len, __ATOMIC_RELEASE);
+    writer->used += need;
+    __atomic_store_n(&writer->committed, writer->used, __ATOMIC_RELEASE);
+    stats_inc(STAT_TRANSCRIPT_RECORDS);
+    stats_add(STAT_TRANSCRIPT_BYTES, len);
+    return 0;
+}
+
+void transcript_writev(transcript_session_t *session, int type, const struct iovec *iov, int iovcnt) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    size_t offset = 0;
+    do {
+        uint32_t len = total < max_payload ? (uint32_t)total : max_payload;
+        if (transcript_append(session, type, &iov, &offset, len) == -1) {
+            stats_inc(STAT_TRANSCRIPT_DROPS);
+            return;
+        }
+        total -= len;
+    } while (total > 0);
+}
+
+void transcript_open(transcript_session_t *session, const char *peer_ip, int peer_port) {
+    session->id = 0;
+    session->segment = 0;
+    if (session_counter == NULL) {
+        return;
+    }
+    session->id = __atomic_add_fetch(session_counter, 1, __ATOMIC_RELAXED);
+
+    char peer[INET_ADDRSTRLEN + 8];
+    int len = snprintf(peer, sizeof(peer), "%s:%d", peer_ip, peer_port);
+    transcript_record(session, TRANSCRIPT_OPEN, peer, (size_t)len);
+}
+
+void transcript_close(transcript_session_t *session) {
+    transcript_record(session, TRANSCRIPT_CLOSE, NULL, 0);
+    session->id = 0;
+}
+
+void transcript_detach(void) {
+    if (current != NULL) {
+        transcript_writer_close(current);
+        current = NULL;
+    }
+}
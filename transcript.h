@@ -0,0 +1,125 @@
+#ifndef TRANSCRIPT_H
+#define TRANSCRIPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+// Session transcripts for audit: every byte a session receives and sends,
+// with the session ID and a timestamp, in memory-mapped segment files.
+//
+// Enabled by setting TELNET_TRANSCRIPT_DIR (or TELNET_TRANSCRIPT_DIR_<port>).
+// Every thread that records (a reactor worker, a forked session process)
+// owns its current segment, <dir>/<port>-<YYYYmmdd-HHMMSS>-<pid>-<seq>.tseg
+// (the time is the server start), so appending a record is a memcpy into
+// the mapping and one release store, without locks or system calls. A
+// segment is allocated at its full size (TELNET_TRANSCRIPT_SEGMENT bytes,
+// default 16 MiB) when it is opened, and its writer moves on to a new one
+// when it is full. A flusher thread per process starts writeback of what
+// has been appended every TELNET_TRANSCRIPT_FLUSH_MS (default 1000, 0
+// leaves it to the kernel); the recording thread never waits for the disk.
+//
+// Session IDs count up from 1 across all processes of a server run (the
+// counter is shared memory created before the first fork()).
+//
+// Segment layout (host byte order, little endian on the supported targets):
+//   header   transcript_header_t, TRANSCRIPT_HEADER_SIZE bytes
+//   records  transcript_record_t followed by the payload, each record
+//            starting on an 8-byte boundary; size 0 marks the end
+//   index    transcript_index_t per session that has records in the
+//            segment: its first and last record
+// While a segment is written its index grows down from the end of the
+// file. Closing the segment moves the index behind the records, sets
+// index_offset and truncates the file, so a finished segment has no
+// unused space. A segment left by a crash keeps the index at its end,
+// and both layouts can be read.
+//
+// transcript_read extracts the transcript of one session from a set of
+// segments, using the indexes to skip segments and records of other
+// sessions.
+
+#define TRANSCRIPT_MAGIC "TSEG"
+#define TRANSCRIPT_VERSION 1
+#define TRANSCRIPT_HEADER_SIZE 64
+#define TRANSCRIPT_ALIGN 8
+#define TRANSCRIPT_DEFAULT_SEGMENT (16 * 1024 * 1024)
+#define TRANSCRIPT_MIN_SEGMENT (1024 * 1024)
+#define TRANSCRIPT_MAX_SEGMENT (1024 * 1024 * 1024)
+#define TRANSCRIPT_DEFAULT_FLUSH_MS 1000
+
+// Record types
+#define TRANSCRIPT_OPEN 1              // Session start; payload is the peer "ip:port"
+#define TRANSCRIPT_IN 2                // Bytes received (after TLS decryption)
+#define TRANSCRIPT_OUT 3               // Bytes handed to the socket for the client
+#define TRANSCRIPT_CLOSE 4             // Session end, no payload
+
+typedef struct {
+    char magic[4];                 // TRANSCRIPT_MAGIC
+    uint8_t version;
+    uint8_t flags;
+    uint16_t port;                 // Server port
+    uint32_t pid;                  // Writing process
+    uint32_t sequence;             // Segment number within the process
+    uint64_t created;              // Microseconds since the epoch
+    uint32_t size;                 // File size
+    uint32_t index_count;          // Index entries
+    uint32_t index_offset;         // Index position once closed, 0 = at the end of size
+    uint32_t data_end;             // End of the records once closed
+    uint8_t reserved[24];
+} transcript_header_t;
+
+typedef struct {
+    uint32_t size;                 // Header and payload, without padding; written last
+    uint32_t type;
+    uint64_t session;
+    uint64_t time;                 // Microseconds since the epoch
+} transcript_record_t;
+
+typedef struct {
+    uint64_t session;
+    uint32_t first;                // Offsets of the session's first and last record
+    uint32_t last;
+} transcript_index_t;
+
+// A session's link to the transcript, embedded in its control block.
+// id 0 means the session is not recorded.
+typedef struct {
+    uint64_t id;
+    uint32_t segment;              // Process-wide number of the segment holding index_slot
+    uint32_t index_slot;
+} transcript_session_t;
+
+// Read the transcript configuration and create the shared session
+// counter (call once in the listener, before the first fork()).
+// Returns the transcript directory, or NULL when transcripts are disabled.
+const char *transcript_init(int port);
+
+// Give the session an ID and record its start. Leaves the ID at 0 when
+// transcripts are disabled.
+void transcript_open(transcript_session_t *session, const char *peer_ip, int peer_port);
+
+// Append a record of the session on the calling thread's segment; longer
+// data is split into several records
+void transcript_writev(transcript_session_t *session, int type, const struct iovec *iov, int iovcnt);
+
+static inline void transcript_record(transcript_session_t *session, int type, const void *data, size_t len) {
+    if (session->id != 0) {
+        struct iovec iov = { .iov_base = (void *)data, .iov_len = len };
+        transcript_writev(session, type, &iov, 1);
+    }
+}
+
+static inline void transcript_recordv(transcript_session_t *session, int type, const struct iovec *iov, int iovcnt) {
+    if (session->id != 0) {
+        transcript_writev(session, type, iov, iovcnt);
+    }
+}
+
+// Record the end of the session
+void transcript_close(transcript_session_t *session);
+
+// Close the calling thread's segment (a worker thread or session process
+// that is about to exit)
+void transcript_detach(void);
+
+#endif
@@ -0,0 +1,308 @@
+// Reads session transcripts (.tseg, see transcript.h)
+//
+// Segments may be given in any order and may still be open or left by a
+// crash. Extracting a session looks it up in the index of every segment,
+// skips the segments it has no records in and walks only the stretch
+// between its first and last record in the others.
+//
+// Usage: transcript_read -l file...
+//        transcript_read -s id [-r in|out] file...
+//   -l        list the sessions: ID, peer, start, bytes in and out
+//   -s ID     print the transcript of session ID, one record per line
+//   -r DIR    with -s: write the raw bytes of one direction (in or out)
+//             to stdout instead, e.g. to replay what a client saw
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "transcript.h"
+
+typedef struct {
+    const char *path;
+    const unsigned char *map;
+    size_t map_size;
+    const transcript_header_t *header;
+    const transcript_index_t *index;
+    uint32_t index_count;
+    uint32_t data_end;             // Records stop here at the latest
+} segment_t;
+
+typedef struct {
+    uint64_t session;
+    uint64_t started;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    int closed;
+    char peer[32];
+} summary_t;
+
+static const char *type_names[] = { "?", "open", "in", "out", "close" };
+
+static int load_segment(const char *path, segment_t *segment) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror(path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < TRANSCRIPT_HEADER_SIZE) {
+        fprintf(stderr, "%s: not a transcript segment\n", path);
+        close(fd);
+        return -1;
+    }
+    // A shared mapping also shows what a running server appends later
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path);
+        return -1;
+    }
+
+    segment->path = path;
+    segment->map = map;
+    segment->map_size = (size_t)st.st_size;
+    segment->header = map;
+    const transcript_header_t *header = segment->header;
+    if (memcmp(header->magic, TRANSCRIPT_MAGIC, 4) != 0 || header->version != TRANSCRIPT_VERSION) {
+        fprintf(stderr, "%s: not a version %d transcript segment\n", path, TRANSCRIPT_VERSION);
+        return -1;
+    }
+
+    // A closed segment has its index behind the records, an open or
+    // abandoned one at the end of the file
+    uint32_t count = __atomic_load_n(&header->index_count, __ATOMIC_ACQUIRE);
+    size_t index_bytes = (size_t)count * sizeof(transcript_index_t);
+    size_t index_offset = header->index_offset != 0 ? header->index_offset : segment->map_size - index_bytes;
+    if (index_bytes > segment->map_size - TRANSCRIPT_HEADER_SIZE || index_offset < TRANSCRIPT_HEADER_SIZE ||
+        index_offset + index_bytes > segment->map_size) {
+        fprintf(stderr, "%s: damaged index, ignored\n", path);
+        count = 0;
+        index_offset = segment->map_size;
+    }
+    segment->index = (const transcript_index_t *)(segment->map + index_offset);
+    segment->index_count = count;
+    segment->data_end = header->data_end != 0 ? header->data_end : (uint32_t)index_offset;
+    return 0;
+}
+
+// The record at offset, or NULL at the end of the records
+static const transcript_record_t *segment_record(const segment_t *segment, uint32_t offset) {
+    if ((size_t)offset + sizeof(transcript_record_t) > segment->data_end) {
+        return NULL;
+    }
+    const transcript_record_t *record = (const transcript_record_t *)(segment->map + offset);
+    uint32_t size = __atomic_load_n(&record->size, __ATOMIC_ACQUIRE);
+    if (size < sizeof(transcript_record_t) || (size_t)offset + size > segment->data_end) {
+        return NULL;
+    }
+    return record;
+}
+
+static uint32_t record_next(const transcript_record_t *record, uint32_t offset) {
+    return offset + ((record->size + TRANSCRIPT_ALIGN - 1) & ~(uint32_t)(TRANSCRIPT_ALIGN - 1));
+}
+
+// Segments in the order they were written: by creation time, then writer
+static int compare_segments(const void *a, const void *b) {
+    const transcript_header_t *x = ((const segment_t *)a)->header;
+    const transcript_header_t *y = ((const segment_t *)b)->header;
+    if (x->created != y->created) {
+        return x->created < y->created ? -1 : 1;
+    }
+    if (x->pid != y->pid) {
+        return x->pid < y->pid ? -1 : 1;
+    }
+    return (x->sequence > y->sequence) - (x->sequence < y->sequence);
+}
+
+static void print_time(uint64_t usec) {
+    time_t seconds = (time_t)(usec / 1000000);
+    struct tm tm_info;
+    localtime_r(&seconds, &tm_info);
+    char text[32];
+    strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &tm_info);
+    printf("%s.%06u", text, (unsigned int)(usec % 1000000));
+}
+
+static void print_escaped(const unsigned char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = data[i];
+        if (c == '\\') {
+            printf("\\\\");
+        } else if (c >= 0x20 && c < 0x7F) {
+            putchar(c);
+        } else {
+            printf("\\x%02x", c);
+        }
+    }
+}
+
+// Write out the records of one session, or only the payload of one
+// direction when raw is set. Returns the number of records found.
+static long extract_session(const segment_t *segments, int count, uint64_t session, int raw) {
+    long found = 0;
+    for (int s = 0; s < count; s++) {
+        const segment_t *segment = &segments[s];
+        const transcript_index_t *entry = NULL;
+        for (uint32_t i = 0; i < segment->index_count; i++) {
+            if (segment->index[i].session == session) {
+                entry = &segment->index[i];
+                break;
+            }
+        }
+        if (entry == NULL) {
+            continue;
+        }
+
+        uint32_t offset = entry->first;
+        const transcript_record_t *record;
+        while (offset <= entry->last && (record = segment_record(segment, offset)) != NULL) {
+            if (record->session == session) {
+                const unsigned char *data = (const unsigned char *)(record + 1);
+                size_t len = record->size - sizeof(transcript_record_t);
+                found++;
+                if (raw != 0) {
+                    if ((int)record->type == raw) {
+                        fwrite(data, 1, len, stdout);
+                    }
+                } else {
+                    print_time(record->time);
+                    printf(" %-5s %6zu  ", record->type <= TRANSCRIPT_CLOSE ? type_names[record->type] : "?", len);
+                    print_escaped(data, len);
+                    putchar('\n');
+                }
+            }
+            offset = record_next(record, offset);
+        }
+    }
+    return found;
+}
+
+// Open addressing on the session ID (IDs start at 1, 0 marks a free slot)
+typedef struct {
+    summary_t *slots;
+    size_t capacity;
+    size_t used;
+} summary_table_t;
+
+static summary_t *summary_find(summary_table_t *table, uint64_t session) {
+    if (table->used * 2 >= table->capacity) {
+        summary_table_t grown = { .capacity = table->capacity ? table->capacity * 2 : 1024 };
+        grown.slots = calloc(grown.capacity, sizeof(summary_t));
+        for (size_t i = 0; i < table->capacity; i++) {
+            if (table->slots[i].session != 0) {
+                *summary_find(&grown, table->slots[i].session) = table->slots[i];
+            }
+        }
+        free(table->slots);
+        *table = grown;
+    }
+    size_t i = (size_t)(session * 0x9E3779B97F4A7C15ull) & (table->capacity - 1);
+    while (table->slots[i].session != session && table->slots[i].session != 0) {
+        i = (i + 1) & (table->capacity - 1);
+    }
+    if (table->slots[i].session == 0) {
+        table->slots[i].session = session;
+        table->used++;
+    }
+    return &table->slots[i];
+}
+
+static int compare_summaries(const void *a, const void *b) {
+    uint64_t x = ((const summary_t *)a)->session, y = ((const summary_t *)b)->session;
+    return (x > y) - (x < y);
+}
+
+static void list_sessions(const segment_t *segments, int count) {
+    summary_table_t table = { 0 };
+    for (int s = 0; s < count; s++) {
+        const segment_t *segment = &segments[s];
+        uint32_t offset = TRANSCRIPT_HEADER_SIZE;
+        const transcript_record_t *record;
+        while ((record = segment_record(segment, offset)) != NULL) {
+            summary_t *summary = summary_find(&table, record->session);
+            size_t len = record->size - sizeof(transcript_record_t);
+            if (record->type == TRANSCRIPT_OPEN) {
+                summary->started = record->time;
+                snprintf(summary->peer, sizeof(summary->peer), "%.*s", (int)len,
+                         (const char *)(record + 1));
+            } else if (record->type == TRANSCRIPT_IN) {
+                summary->bytes_in += len;
+            } else if (record->type == TRANSCRIPT_OUT) {
+                summary->bytes_out += len;
+            } else if (record->type == TRANSCRIPT_CLOSE) {
+                summary->closed = 1;
+            }
+            offset = record_next(record, offset);
+        }
+    }
+
+    // Sorting moves the free slots (session 0) to the front
+    qsort(table.slots, table.capacity, sizeof(summary_t), compare_summaries);
+    printf("%-10s %-21s %-26s %12s %12s %s\n", "session", "peer", "started", "bytes_in", "bytes_out", "state");
+    for (size_t i = table.capacity - table.used; i < table.capacity; i++) {
+        summary_t *summary = &table.slots[i];
+        printf("%-10llu %-21s ", (unsigned long long)summary->session, summary->peer[0] ? summary->peer : "?");
+        if (summary->started != 0) {
+            print_time(summary->started);
+        } else {
+            printf("%-26s", "?");
+        }
+        printf(" %12llu %12llu %s\n", (unsigned long long)summary->bytes_in,
+               (unsigned long long)summary->bytes_out, summary->closed ? "closed" : "open");
+    }
+    free(table.slots);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s -l file...\n"
+                    "       %s -s id [-r in|out] file...\n", prog, prog);
+}
+
+int main(int argc, char *argv[]) {
+    int list = 0;
+    uint64_t session = 0;
+    int raw = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ls:r:")) != -1) {
+        switch (opt) {
+            case 'l': list = 1; break;
+            case 's': session = strtoull(optarg, NULL, 10); break;
+            case 'r':
+                raw = strcmp(optarg, "in") == 0 ? TRANSCRIPT_IN : strcmp(optarg, "out") == 0 ? TRANSCRIPT_OUT : -1;
+                break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    int file_count = argc - optind;
+    if (file_count <= 0 || list == (session != 0) || raw == -1 || (list && raw != 0)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    segment_t *segments = calloc(file_count, sizeof(segment_t));
+    int count = 0;
+    for (int i = 0; i < file_count; i++) {
+        if (load_segment(argv[optind + i], &segments[count]) == 0) {
+            count++;
+        }
+    }
+    qsort(segments, count, sizeof(segment_t), compare_segments);
+
+    if (list) {
+        list_sessions(segments, count);
+        return 0;
+    }
+    if (extract_session(segments, count, session, raw) == 0) {
+        fprintf(stderr, "session %llu: no records\n", (unsigned long long)session);
+        return 1;
+    }
+    return 0;
+}
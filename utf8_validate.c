@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+
+#include "server_config.h"
+#include "server_stats.h"
+#include "utf8_validate.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTF8_HAVE_X86 1
+#endif
+
+// Length of the well-formed sequence at s, or 0 when it is ill-formed; in
+// that case *bad is the length of the maximal ill-formed subpart (Unicode
+// table 3-7), which is what a single U+FFFD replaces.
+static int scalar_sequence(const unsigned char *s, size_t len, int *bad) {
+    unsigned char c = s[0];
+    unsigned char lo = 0x80, hi = 0xBF;
+    int need;
+
+    if (c < 0x80) {
+        return 1;
+    } else if (c >= 0xC2 && c <= 0xDF) {
+        need = 1;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        need = 2;
+        if (c == 0xE0) lo = 0xA0;       // Overlong
+        if (c == 0xED) hi = 0x9F;       // Surrogates
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        need = 3;
+        if (c == 0xF0) lo = 0x90;       // Overlong
+        if (c == 0xF4) hi = 0x8F;       // Above U+10FFFF
+    } else {
+        *bad = 1;
+        return 0;
+    }
+
+    for (int i = 1; i <= need; i++) {
+        if ((size_t)i >= len || s[i] < lo || s[i] > hi) {
+            *bad = i;
+            return 0;
+        }
+        lo = 0x80;
+        hi = 0xBF;
+    }
+    return need + 1;
+}
+
+static int validate_scalar(const unsigned char *buf, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        // Skip ASCII eight bytes at a time
+        if (i + 8 <= len) {
+            uint64_t word;
+            memcpy(&word, buf + i, sizeof(word));
+            if ((word & 0x8080808080808080ull) == 0) {
+                i += 8;
+                continue;
+            }
+        }
+        int bad;
+        int n = scalar_sequence(buf + i, len - i, &bad);
+        if (n == 0) {
+            return 0;
+        }
+        i += n;
+    }
+    return 1;
+}
+
+#ifdef UTF8_HAVE_X86
+
+// Error classes of the lookup-table algorithm. Each table maps a nibble to
+// the set of errors that nibble allows; an error is reported when all three
+// lookups (high and low nibble of the previous byte, high nibble of the
+// current byte) agree on some class.
+#define TOO_SHORT    (1 << 0)  // Lead byte not followed by enough continuations
+#define TOO_LONG     (1 << 1)  // Continuation after ASCII
+#define OVERLONG_3   (1 << 2)  // E0 80..9F
+#define TOO_LARGE    (1 << 3)  // Above U+10FFFF
+#define SURROGATE    (1 << 4)  // ED A0..BF
+#define OVERLONG_2   (1 << 5)  // C0, C1
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4   (1 << 6)  // F0 80..8F
+#define TWO_CONTS    (1 << 7)  // Continuation after continuation
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define BYTE_1_HIGH \
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, \
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS, \
+    TOO_SHORT | OVERLONG_2, \
+    TOO_SHORT, \
+    TOO_SHORT | OVERLONG_3 | SURROGATE, \
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+
+#define BYTE_1_LOW \
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, \
+    CARRY | OVERLONG_2, \
+    CARRY, \
+    CARRY, \
+    CARRY | TOO_LARGE, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000
+
+#define BYTE_2_HIGH \
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, \
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4, \
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE, \
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+
+// A block that ends in the middle of a sequence: the last byte is a lead
+// byte, or the second/third to last byte starts a 3/4-byte sequence
+#define INCOMPLETE_MAX \
+    255, 255, 255, 255, 255, 255, 255, 255, \
+    255, 255, 255, 255, 255, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1
+
+__attribute__((target("ssse3")))
+static __m128i ssse3_block_errors(__m128i input, __m128i prev_input) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i byte_1_high = _mm_setr_epi8(BYTE_1_HIGH);
+    const __m128i byte_1_low = _mm_setr_epi8(BYTE_1_LOW);
+    const __m128i byte_2_high = _mm_setr_epi8(BYTE_2_HIGH);
+
+    __m128i prev1 = _mm_alignr_epi8(input, prev_input, 16 - 1);
+    __m128i special = _mm_and_si128(
+        _mm_and_si128(
+            _mm_shuffle_epi8(byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+            _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble))),
+        _mm_shuffle_epi8(byte_2_high, _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+
+    // Third and fourth bytes of a sequence must be continuations; the
+    // tables only catch the second, so check these separately
+    __m128i prev2 = _mm_alignr_epi8(input, prev_input, 16 - 2);
+    __m128i prev3 = _mm_alignr_epi8(input, prev_input, 16 - 3);
+    __m128i is_third = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80)));
+    __m128i is_fourth = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80)));
+    __m128i must23 = _mm_and_si128(_mm_or_si128(is_third, is_fourth), _mm_set1_epi8((char)0x80));
+    return _mm_xor_si128(must23, special);
+}
+
+__attribute__((target("ssse3")))
+static int validate_ssse3(const unsigned char *buf, size_t len) {
+    const __m128i incomplete_max = _mm_setr_epi8(INCOMPLETE_MAX);
+    __m128i error = _mm_setzero_si128();
+    __m128i prev_input = _mm_setzero_si128();
+    __m128i prev_incomplete = _mm_setzero_si128();
+    unsigned char tail[16];
+    size_t i = 0;
+
+    while (i < len) {
+        __m128i input;
+        if (i + 16 <= len) {
+            input = _mm_loadu_si128((const __m128i *)(buf + i));
+        } else {
+            // Pad the tail with ASCII so a truncated sequence shows as TOO_SHORT
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, buf + i, len - i);
+            input = _mm_loadu_si128((const __m128i *)tail);
+        }
+        i += 16;
+
+        if (_mm_movemask_epi8(input) == 0) {
+            // ASCII block: only a sequence left open by the previous block can fail
+            error = _mm_or_si128(error, prev_incomplete);
+        } else {
+            error = _mm_or_si128(error, ssse3_block_errors(input, prev_input));
+            prev_incomplete = _mm_subs_epu8(input, incomplete_max);
+        }
+        prev_input = input;
+    }
+    error = _mm_or_si128(error, prev_incomplete);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+}
+
+__attribute__((target("avx2")))
+static __m256i avx2_prev(__m256i input, __m256i prev_input, int n) {
+    // Bytes shifted in from the previous 32-byte block
+    __m256i shifted = _mm256_permute2x128_si256(prev_input, input, 0x21);
+    switch (n) {
+    case 1: return _mm256_alignr_epi8(input, shifted, 16 - 1);
+    case 2: return _mm256_alignr_epi8(input, shifted, 16 - 2);
+    default: return _mm256_alignr_epi8(input, shifted, 16 - 3);
+    }
+}
+
+__attribute__((target("avx2")))
+static __m256i avx2_block_errors(__m256i input, __m256i prev_input) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i byte_1_high = _mm256_setr_epi8(BYTE_1_HIGH, BYTE_1_HIGH);
+    const __m256i byte_1_low = _mm256_setr_epi8(BYTE_1_LOW, BYTE_1_LOW);
+    const __m256i byte_2_high = _mm256_setr_epi8(BYTE_2_HIGH, BYTE_2_HIGH);
+
+    __m256i prev1 = avx2_prev(input, prev_input, 1);
+    __m256i special = _mm256_and_si256(
+        _mm256_and_si256(
+            _mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+            _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble))),
+        _mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+
+    __m256i prev2 = avx2_prev(input, prev_input, 2);
+    __m256i prev3 = avx2_prev(input, prev_input, 3);
+    __m256i is_third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+    __m256i is_fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+    __m256i must23 = _mm256_and_si256(_mm256_or_si256(is_third, is_fourth),
+                                      _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(must23, special);
+}
+
+__attribute__((target("avx2")))
+static int validate_avx2(const unsigned char *buf, size_t len) {
+    const __m256i incomplete_max = _mm256_setr_epi8(
+        255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+        INCOMPLETE_MAX);
+    __m256i error = _mm256_setzero_si256();
+    __m256i prev_input = _mm256_setzero_si256();
+    __m256i prev_incomplete = _mm256_setzero_si256();
+    unsigned char tail[32];
+    size_t i = 0;
+
+    while (i < len) {
+        __m256i input;
+        if (i + 32 <= len) {
+            input = _mm256_loadu_si256((const __m256i *)(buf + i));
+        } else {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, buf + i, len - i);
+            input = _mm256_loadu_si256((const __m256i *)tail);
+        }
+        i += 32;
+
+        if (_mm256_movemask_epi8(input) == 0) {
+            error = _mm256_or_si256(error, prev_incomplete);
+        } else {
+            error = _mm256_or_si256(error, avx2_block_errors(input, prev_input));
+            prev_incomplete = _mm256_subs_epu8(input, incomplete_max);
+        }
+        prev_input = input;
+    }
+    error = _mm256_or_si256(error, prev_incomplete);
+    return _mm256_testz_si256(error, error);
+}
+
+#endif
+
+typedef int (*utf8_validator_t)(const unsigned char *buf, size_t len);
+
+static utf8_validator_t validator = NULL;
+static const char *validator_name = "scalar";
+
+static void select_validator(void) {
+    validator = validate_scalar;
+#ifdef UTF8_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        validator = validate_avx2;
+        validator_name = "avx2";
+    } else if (__builtin_cpu_supports("ssse3")) {
+        validator = validate_ssse3;
+        validator_name = "ssse3";
+    }
+#endif
+}
+
+int utf8_validate(const unsigned char *buf, size_t len) {
+    if (validator == NULL) {
+        select_validator();
+    }
+    return validator(buf, len);
+}
+
+const char *utf8_validator_name(void) {
+    if (validator == NULL) {
+        select_validator();
+    }
+    return validator_name;
+}
+
+size_t utf8_repair(const unsigned char *in, size_t len, unsigned char *out, int *replacements) {
+    size_t i = 0, o = 0;
+    int count = 0;
+
+    while (i < len) {
+        int bad;
+        int n = scalar_sequence(in + i, len - i, &bad);
+        if (n > 0) {
+            memcpy(out + o, in + i, n);
+            o += n;
+            i += n;
+        } else {
+            out[o++] = 0xEF;
+            out[o++] = 0xBF;
+            out[o++] = 0xBD;
+            i += bad;
+            count++;
+        }
+    }
+    *replacements = count;
+    return o;
+}
+
+utf8_policy_t utf8_policy_init(int port, utf8_policy_t default_policy) {
+    const char *value = config_get_str("UTF8_POLICY", port, NULL);
+    if (value == NULL) {
+        return default_policy;
+    }
+    if (strcasecmp(value, "pass") == 0) {
+        return UTF8_POLICY_PASS;
+    } else if (strcasecmp(value, "replace") == 0) {
+        return UTF8_POLICY_REPLACE;
+    } else if (strcasecmp(value, "reject") == 0) {
+        return UTF8_POLICY_REJECT;
+    }
+    fprintf(stderr, "Ignoring invalid value for TELNET_UTF8_POLICY: '%s'\n", value);
+    return default_policy;
+}
+
+const unsigned char *utf8_apply_policy(utf8_policy_t policy, const unsigned char *line, size_t len,
+                                       unsigned char *scratch, size_t *out_len) {
+    *out_len = len;
+    if (utf8_validate(line, len)) {
+        return line;
+    }
+    stats_inc(STAT_UTF8_INVALID_LINES);
+
+    switch (policy) {
+    case UTF8_POLICY_REPLACE: {
+        int replacements;
+        *out_len = utf8_repair(line, len, scratch, &replacements);
+        stats_add(STAT_UTF8_REPLACEMENTS, replacements);
+        return scratch;
+    }
+    case UTF8_POLICY_REJECT:
+        stats_inc(STAT_UTF8_REJECTED_LINES);
+        return NULL;
+    default:
+        return line;
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef UTF8_VALIDATE_H
+#define UTF8_VALIDATE_H
+
+#include <stddef.h>
+
+// Full UTF-8 validation for assembled lines.
+//
+// utf8_validate() rejects everything Unicode calls ill-formed: stray
+// continuation bytes, truncated sequences, overlong encodings, surrogates
+// (U+D800..U+DFFF) and code points above U+10FFFF. On x86-64 it uses the
+// lookup-table algorithm (Keiser & Lemire) with AVX2 or SSSE3, chosen at
+// run time, and skips pure ASCII blocks; elsewhere a scalar loop is used.
+
+typedef enum {
+    UTF8_POLICY_PASS,      // Echo lines unchanged (only count invalid input)
+    UTF8_POLICY_REPLACE,   // Replace each ill-formed subsequence with U+FFFD
+    UTF8_POLICY_REJECT     // Drop invalid lines and tell the client
+} utf8_policy_t;
+
+// Worst case growth of utf8_repair(): every input byte becomes U+FFFD
+#define UTF8_REPAIR_MAX(len) ((len) * 3)
+
+// Returns 1 when buf[0..len) is well-formed UTF-8, 0 otherwise
+int utf8_validate(const unsigned char *buf, size_t len);
+
+// Copy in to out, replacing every maximal ill-formed subpart with U+FFFD
+// (EF BF BD), the same substitution browsers and iconv use.
+// out must hold UTF8_REPAIR_MAX(len) bytes. Returns the output length and
+// stores the number of replacements in *replacements.
+size_t utf8_repair(const unsigned char *in, size_t len, unsigned char *out, int *replacements);
+
+// Read TELNET_UTF8_POLICY[_<port>] (pass, replace or reject)
+utf8_policy_t utf8_policy_init(int port, utf8_policy_t default_policy);
+
+// Name of the active validator ("avx2", "ssse3" or "scalar")
+const char *utf8_validator_name(void);
+
+// Validate a line under policy and count invalid input.
+// Returns the bytes to echo with their length in *out_len: line itself, or
+// the repaired copy written to scratch (UTF8_REPAIR_MAX(len) bytes).
+// Returns NULL when the policy rejects the line.
+const unsigned char *utf8_apply_policy(utf8_policy_t policy, const unsigned char *line, size_t len,
+                                       unsigned char *scratch, size_t *out_len);
+
+#endif
@@ -0,0 +1,189 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "server_stats.h"
+#include "work_pool.h"
+
+// One deque per thread, on its own cache line
+typedef struct {
+    _Alignas(STATS_CACHE_LINE) pthread_mutex_t lock;
+    work_job_t *head;              // Oldest job: taken by the owner
+    work_job_t *tail;              // Newest job: taken by thieves
+} work_deque_t;
+
+typedef struct {
+    work_pool_t *pool;
+    int index;
+    pthread_t thread;
+} work_thread_t;
+
+struct work_pool {
+    int thread_count;
+    work_deque_t *deques;
+    work_thread_t *threads;
+    unsigned int next_deque;       // Round-robin submission cursor
+    int pending;                   // Jobs queued and not yet taken
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    int sleepers;
+    int stopping;
+};
+
+static void deque_push_tail(work_deque_t *deque, work_job_t *job) {
+    pthread_mutex_lock(&deque->lock);
+    job->next = NULL;
+    job->prev = deque->tail;
+    if (deque->tail != NULL) {
+        deque->tail->next = job;
+    } else {
+        deque->head = job;
+    }
+    deque->tail = job;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+static work_job_t *deque_pop_head(work_deque_t *deque) {
+    pthread_mutex_lock(&deque->lock);
+    work_job_t *job = deque->head;
+    if (job != NULL) {
+        deque->head = job->next;
+        if (deque->head != NULL) {
+            deque->head->prev = NULL;
+        } else {
+            deque->tail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+static work_job_t *deque_steal_tail(work_deque_t *deque) {
+    pthread_mutex_lock(&deque->lock);
+    work_job_t *job = deque->tail;
+    if (job != NULL) {
+        deque->tail = job->prev;
+        if (deque->tail != NULL) {
+            deque->tail->next = NULL;
+        } else {
+            deque->head = NULL;
+        }
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+// Next job for thread index: its own deque first, then the others
+static work_job_t *work_take(work_pool_t *pool, int index) {
+    work_job_t *job = deque_pop_head(&pool->deques[index]);
+    for (int k = 1; job == NULL && k < pool->thread_count; k++) {
+        job = deque_steal_tail(&pool->deques[(index + k) % pool->thread_count]);
+        if (job != NULL) {
+            stats_inc(STAT_POOL_STEALS);
+        }
+    }
+    if (job != NULL) {
+        __atomic_fetch_sub(&pool->pending, 1, __ATOMIC_ACQ_REL);
+    }
+    return job;
+}
+
+static void *work_thread_main(void *arg) {
+    work_thread_t *self = arg;
+    work_pool_t *pool = self->pool;
+    stats_attach_worker();
+
+    while (1) {
+        work_job_t *job = work_take(pool, self->index);
+        if (job != NULL) {
+            job->run(job);
+            job->finish(job);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->idle_lock);
+        while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) == 0 && !pool->stopping) {
+            pool->sleepers++;
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+            pool->sleepers--;
+        }
+        int done = pool->stopping && __atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) == 0;
+        pthread_mutex_unlock(&pool->idle_lock);
+        if (done) {
+            break;
+        }
+    }
+
+    stats_detach_worker();
+    return NULL;
+}
+
+work_pool_t *work_pool_create(int threads) {
+    work_pool_t *pool = calloc(1, sizeof(work_pool_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->deques = aligned_alloc(STATS_CACHE_LINE, sizeof(work_deque_t) * threads);
+    pool->threads = calloc(threads, sizeof(work_thread_t));
+    if (pool->deques == NULL || pool->threads == NULL) {
+        free(pool->deques);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->idle_lock, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+        pool->deques[i].head = NULL;
+        pool->deques[i].tail = NULL;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        pool->threads[i].pool = pool;
+        pool->threads[i].index = i;
+        if (pthread_create(&pool->threads[i].thread, NULL, work_thread_main, &pool->threads[i]) != 0) {
+            perror("Failed to create pool thread");
+            if (i == 0) {
+                free(pool->deques);
+                free(pool->threads);
+                free(pool);
+                return NULL;
+            }
+            break;
+        }
+        pool->thread_count = i + 1;
+    }
+    return pool;
+}
+
+void work_pool_submit(work_pool_t *pool, work_job_t *job) {
+    unsigned int index = __atomic_fetch_add(&pool->next_deque, 1, __ATOMIC_RELAXED) % pool->thread_count;
+    __atomic_fetch_add(&pool->pending, 1, __ATOMIC_ACQ_REL);
+    deque_push_tail(&pool->deques[index], job);
+
+    pthread_mutex_lock(&pool->idle_lock);
+    if (pool->sleepers > 0) {
+        pthread_cond_signal(&pool->idle_cond);
+    }
+    pthread_mutex_unlock(&pool->idle_lock);
+}
+
+void work_pool_destroy(work_pool_t *pool) {
+    pthread_mutex_lock(&pool->idle_lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i].thread, NULL);
+    }
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+    }
+    pthread_mutex_destroy(&pool->idle_lock);
+    pthread_cond_destroy(&pool->idle_cond);
+    free(pool->deques);
+    free(pool->threads);
+    free(pool);
+}
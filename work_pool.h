@@ -0,0 +1,36 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+// Work-stealing thread pool for jobs too slow for a network loop.
+//
+// Every pool thread owns a deque. Submitted jobs are spread over the deques
+// round robin; a thread takes the oldest job of its own deque and, when
+// that is empty, steals the newest job of another thread's deque, so one
+// long job never holds up the jobs queued behind it while other threads are
+// idle. Threads with nothing to do sleep on a condition variable.
+//
+// A job runs on some pool thread and calls its finish callback right after
+// on the same thread; the caller hands the result back from there (the
+// reactor pushes it onto the session worker's completion queue). The pool
+// itself gives no ordering guarantee between jobs.
+
+typedef struct work_job work_job_t;
+
+struct work_job {
+    void (*run)(work_job_t *job);
+    void (*finish)(work_job_t *job);
+    work_job_t *prev;              // Deque links, owned by the pool
+    work_job_t *next;
+};
+
+typedef struct work_pool work_pool_t;
+
+// Start threads pool threads. Returns NULL on failure.
+work_pool_t *work_pool_create(int threads);
+
+void work_pool_submit(work_pool_t *pool, work_job_t *job);
+
+// Run every job still queued, then stop the threads and free the pool
+void work_pool_destroy(work_pool_t *pool);
+
+#endif